@@ -4,7 +4,13 @@ HELPSTRING="Usage:
   build.sh                           display this help message
   build.sh miscrc [CCOPTS...]        build the MiSCR compiler
   build.sh miscrc-static             build statically-linked miscrc
+  build.sh miscrc-client             build the thin client for miscrc --daemon
+  build.sh runtime [CCOPTS...]       build the runtime libraries
+                                     libmiscr-async.a and libmiscr-alloc.a
+  build.sh alloc-bench               build the allocator benchmark
+  build.sh sort-bench                build the sorting benchmark (needs miscrc)
   build.sh playground                build the playground
+  build.sh fuzzer [libfuzzer]        build the compile-time complexity fuzzer
   build.sh tests [TESTFILE.cpp...]   build unit tests
   build.sh clean                     delete previously built files
 
@@ -39,10 +45,10 @@ printExtraArgumentsMessage () {
 getLLVMConfigArgs () {
   if [ $(which llvm-config-18) ]; then
     echo -e "$BLUE~ Found llvm-config-18$NOCOLOR"
-    LLVM_CONFIG_ARGS=$(llvm-config-18 --cxxflags --ldflags --libs core)
+    LLVM_CONFIG_ARGS=$(llvm-config-18 --cxxflags --ldflags --libs core native object passes bitreader linker)
   elif [ $(which llvm-config) ]; then
     echo -e "$BLUE~ Found llvm-config$NOCOLOR"
-    LLVM_CONFIG_ARGS=$(llvm-config --cxxflags --ldflags --libs core)
+    LLVM_CONFIG_ARGS=$(llvm-config --cxxflags --ldflags --libs core native object passes bitreader linker)
   else
     echo -e "${RED}Could not find llvm-config in PATH. I looked for:"
     echo -e "  llvm-config-18\n  llvm-config$NOCOLOR"
@@ -67,7 +73,13 @@ elif [ $1 = "clean" ]; then
   fi
   if [ -f $DIR/miscrc ]; then parrot rm $DIR/miscrc; fi
   if [ -f $DIR/miscrc-static ]; then parrot rm $DIR/miscrc-static; fi
+  if [ -f $DIR/miscrc-client ]; then parrot rm $DIR/miscrc-client; fi
+  if [ -f $DIR/libmiscr-async.a ]; then parrot rm $DIR/libmiscr-async.a; fi
+  if [ -f $DIR/libmiscr-alloc.a ]; then parrot rm $DIR/libmiscr-alloc.a; fi
+  if [ -f $DIR/alloc-bench ]; then parrot rm $DIR/alloc-bench; fi
+  if [ -f $DIR/sort-bench ]; then parrot rm $DIR/sort-bench; fi
   if [ -f $DIR/playground ]; then parrot rm $DIR/playground; fi
+  if [ -f $DIR/complexity-fuzzer ]; then parrot rm $DIR/complexity-fuzzer; fi
   if [ -f $DIR/tests ]; then parrot rm $DIR/tests; fi
   if [ -f $DIR/src/test/testmain.cpp ]; then
     parrot rm $DIR/src/test/testmain.cpp;
@@ -80,7 +92,7 @@ elif [ $1 = "clean" ]; then
 elif [ $1 = "miscrc" ]; then
   getLLVMConfigArgs
   parrot $CC -o $DIR/miscrc $DIR/src/main/main.cpp -I$DIR/src/main \
-    $LLVM_CONFIG_ARGS ${@:2}
+    $LLVM_CONFIG_ARGS -pthread ${@:2}
 
 
 ########################################
@@ -88,9 +100,58 @@ elif [ $1 = "miscrc" ]; then
 ###
 
 elif [ $1 = "miscrc-static" ]; then
-  LLVM_CONFIG_ARGS=$(llvm-config-18 --cxxflags --ldflags --link-static --libs core)
+  LLVM_CONFIG_ARGS=$(llvm-config-18 --cxxflags --ldflags --link-static --libs core native object passes bitreader linker)
   parrot $CC -static -o $DIR/miscrc-static $DIR/src/main/main.cpp \
-    -I$DIR/src/main $LLVM_CONFIG_ARGS -ltinfo -O1
+    -I$DIR/src/main $LLVM_CONFIG_ARGS -ltinfo -pthread -O1
+
+
+########################################
+### Subcommand: miscrc-client
+###
+elif [ $1 = "miscrc-client" ]; then
+  parrot $CC -o $DIR/miscrc-client $DIR/src/client/main.cpp -I$DIR/src/main \
+    -O2 ${@:2}
+
+
+########################################
+### Subcommand: runtime
+###
+elif [ $1 = "runtime" ]; then
+  parrot cc -c -o $DIR/miscr-async.o $DIR/src/runtime/async.c -O2 ${@:2}
+  parrot ar rcs $DIR/libmiscr-async.a $DIR/miscr-async.o
+  parrot rm $DIR/miscr-async.o
+  parrot cc -c -o $DIR/miscr-alloc.o $DIR/src/runtime/alloc.c -O2 ${@:2}
+  parrot ar rcs $DIR/libmiscr-alloc.a $DIR/miscr-alloc.o
+  parrot rm $DIR/miscr-alloc.o
+
+
+########################################
+### Subcommand: alloc-bench
+###
+elif [ $1 = "alloc-bench" ]; then
+  if [ $# -gt 1 ]; then
+    printExtraArgumentsMessage "build the allocator benchmark" $2
+  fi
+  parrot cc -o $DIR/alloc-bench $DIR/src/runtime/alloc-bench.c \
+    $DIR/src/runtime/alloc.c -O2 -pthread
+
+
+########################################
+### Subcommand: sort-bench
+###
+elif [ $1 = "sort-bench" ]; then
+  if [ $# -gt 1 ]; then
+    printExtraArgumentsMessage "build the sorting benchmark" $2
+  fi
+  if [ ! -f $DIR/miscrc ]; then
+    echo -e "${RED}! Build miscrc first: ./build.sh miscrc$NOCOLOR"
+    exit 1
+  fi
+  parrot $DIR/miscrc --emit-llvm -O2 --libc-alloc $DIR/src/bench/sort.miscr \
+    -o $DIR/sort-bench.ll
+  parrot clang++ -o $DIR/sort-bench $DIR/src/bench/sort-bench.cpp \
+    $DIR/sort-bench.ll -O2
+  parrot rm $DIR/sort-bench.ll
 
 
 ########################################
@@ -105,6 +166,25 @@ elif [ $1 = "playground" ]; then
     $LLVM_CONFIG_ARGS
 
 
+########################################
+### Subcommand: fuzzer
+###
+elif [ $1 = "fuzzer" ]; then
+  getLLVMConfigArgs
+  if [ $# -gt 1 ] && [ $2 = "libfuzzer" ]; then
+    # libFuzzer drives the search; needs clang
+    parrot clang++ -o $DIR/complexity-fuzzer $DIR/src/fuzz/main.cpp \
+      -I$DIR/src/main $LLVM_CONFIG_ARGS -O2 -g -fsanitize=fuzzer \
+      -DMISCR_LIBFUZZER -pthread ${@:3}
+  else
+    if [ $# -gt 1 ]; then
+      printExtraArgumentsMessage "build the fuzzer" $2
+    fi
+    parrot $CC -o $DIR/complexity-fuzzer $DIR/src/fuzz/main.cpp \
+      -I$DIR/src/main $LLVM_CONFIG_ARGS -O2 -pthread
+  fi
+
+
 ########################################
 ### Subcommand: tests
 ###
@@ -0,0 +1,178 @@
+/*
+ * Benchmarks MiSCR's sorting builtins (compiled from sort.miscr) against
+ * qsort and std::sort, and lower_bound against std::lower_bound.
+ *
+ * Every workload sorts the same input with each implementation and checks
+ * the result against std::sort's:
+ *
+ *   random    uniformly random keys
+ *   few       random keys with only 16 distinct values
+ *   sorted    already ascending
+ *   reverse   descending
+ *   organ     ascending then descending
+ *   nearly    ascending with 1% of the elements swapped at random
+ *
+ * Results are in nanoseconds per element. Build with `./build.sh sort-bench`
+ * and run `./sort-bench [N]`.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// The functions of sort.miscr, by the names miscrc gives them in LLVM.
+struct Record { int64_t key, payload; };
+extern "C" {
+void sortI32(int32_t*, size_t) asm("global::SortBench::sortI32");
+void sortI64(int64_t*, size_t) asm("global::SortBench::sortI64");
+void sortF64(double*, size_t) asm("global::SortBench::sortF64");
+void radixSortI32(int32_t*, size_t) asm("global::SortBench::radixSortI32");
+void radixSortI64(int64_t*, size_t) asm("global::SortBench::radixSortI64");
+size_t lowerBoundI64(int64_t*, size_t, int64_t)
+  asm("global::SortBench::lowerBoundI64");
+void sortRecords(Record*, size_t) asm("global::SortBench::sortRecords");
+}
+
+static double now() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename T> static int compare(const void* a, const void* b) {
+  T x = *(const T*)a, y = *(const T*)b;
+  return (y < x) - (x < y);
+}
+
+static int compareRecords(const void* a, const void* b) {
+  return compare<int64_t>(&((const Record*)a)->key, &((const Record*)b)->key);
+}
+
+static bool keyLess(const Record& a, const Record& b) { return a.key < b.key; }
+
+static bool operator==(const Record& a, const Record& b) {
+  return a.key == b.key;
+}
+
+/// Fills @p keys (as 64-bit values) according to the pattern @p pattern.
+static void generate(const char* pattern, std::vector<int64_t>& keys) {
+  std::mt19937_64 rng(42);
+  size_t n = keys.size();
+  for (size_t i = 0; i < n; ++i) {
+    if (!strcmp(pattern, "random")) keys[i] = (int64_t)rng();
+    else if (!strcmp(pattern, "few")) keys[i] = (int64_t)(rng() % 16);
+    else if (!strcmp(pattern, "reverse")) keys[i] = (int64_t)(n - i);
+    else if (!strcmp(pattern, "organ")) keys[i] = i < n / 2 ? i : n - i;
+    else keys[i] = (int64_t)i;
+  }
+  if (!strcmp(pattern, "nearly"))
+    for (size_t i = 0; i < n / 100; ++i)
+      std::swap(keys[rng() % n], keys[rng() % n]);
+}
+
+struct Result { const char* name; double nsPerElem; bool ok; };
+
+/// Times @p sort on a copy of @p input and compares the result to
+/// @p expected.
+template <typename T, typename F>
+static Result run(const char* name, const std::vector<T>& input,
+                  const std::vector<T>& expected, F sort) {
+  std::vector<T> data = input;
+  double start = now();
+  sort(data.data(), data.size());
+  double secs = now() - start;
+  return { name, secs * 1e9 / (double)input.size(), data == expected };
+}
+
+static void report(const char* type, const char* pattern,
+                   std::initializer_list<Result> results) {
+  printf("%-7s %-8s", type, pattern);
+  for (const Result& r : results)
+    printf(" %9.2f%s", r.nsPerElem, r.ok ? " " : "!");
+  printf("\n");
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+  if (n == 0) {
+    fprintf(stderr, "usage: %s [N (at least 1)]\n", argv[0]);
+    return 1;
+  }
+  printf("ns per element for %zu elements (! marks a wrong result)\n", n);
+  printf("%-7s %-8s %10s %10s %10s %10s\n", "type", "pattern", "qsort",
+         "std::sort", "sort", "radix_sort");
+  const char* patterns[] = { "random", "few", "sorted", "reverse", "organ",
+                             "nearly" };
+  std::vector<int64_t> keys(n);
+  for (const char* pattern : patterns) {
+    generate(pattern, keys);
+
+    std::vector<int64_t> expected64 = keys;
+    std::sort(expected64.begin(), expected64.end());
+    report("i64", pattern, {
+      run("qsort", keys, expected64, [](int64_t* a, size_t n) {
+        qsort(a, n, sizeof *a, compare<int64_t>); }),
+      run("std::sort", keys, expected64, [](int64_t* a, size_t n) {
+        std::sort(a, a + n); }),
+      run("sort", keys, expected64, sortI64),
+      run("radix_sort", keys, expected64, radixSortI64) });
+
+    std::vector<int32_t> keys32(keys.begin(), keys.end());
+    std::vector<int32_t> expected32 = keys32;
+    std::sort(expected32.begin(), expected32.end());
+    report("i32", pattern, {
+      run("qsort", keys32, expected32, [](int32_t* a, size_t n) {
+        qsort(a, n, sizeof *a, compare<int32_t>); }),
+      run("std::sort", keys32, expected32, [](int32_t* a, size_t n) {
+        std::sort(a, a + n); }),
+      run("sort", keys32, expected32, sortI32),
+      run("radix_sort", keys32, expected32, radixSortI32) });
+
+    std::vector<double> keysF(keys.begin(), keys.end());
+    std::vector<double> expectedF = keysF;
+    std::sort(expectedF.begin(), expectedF.end());
+    report("f64", pattern, {
+      run("qsort", keysF, expectedF, [](double* a, size_t n) {
+        qsort(a, n, sizeof *a, compare<double>); }),
+      run("std::sort", keysF, expectedF, [](double* a, size_t n) {
+        std::sort(a, a + n); }),
+      run("sort", keysF, expectedF, sortF64) });
+
+    std::vector<Record> records(n);
+    for (size_t i = 0; i < n; ++i) records[i] = { keys[i], (int64_t)i };
+    std::vector<Record> expectedR = records;
+    std::sort(expectedR.begin(), expectedR.end(), keyLess);
+    report("record", pattern, {
+      run("qsort", records, expectedR, [](Record* a, size_t n) {
+        qsort(a, n, sizeof *a, compareRecords); }),
+      run("std::sort", records, expectedR, [](Record* a, size_t n) {
+        std::sort(a, a + n, keyLess); }),
+      run("sort_by", records, expectedR, sortRecords) });
+  }
+
+  // lower_bound: look up n random keys in the sorted random keys
+  generate("random", keys);
+  std::sort(keys.begin(), keys.end());
+  std::mt19937_64 rng(7);
+  std::vector<int64_t> queries(n);
+  for (int64_t& q : queries) q = keys[rng() % n] + (int64_t)(rng() % 2);
+  size_t sumStd = 0, sumMiscr = 0;
+  double start = now();
+  for (int64_t q : queries)
+    sumStd += (size_t)(std::lower_bound(keys.begin(), keys.end(), q)
+                      - keys.begin());
+  double stdSecs = now() - start;
+  start = now();
+  for (int64_t q : queries)
+    sumMiscr += lowerBoundI64(keys.data(), n, q);
+  double miscrSecs = now() - start;
+  printf("\nns per lookup: std::lower_bound %.2f, lower_bound %.2f%s\n",
+         stdSecs * 1e9 / (double)n, miscrSecs * 1e9 / (double)n,
+         sumStd == sumMiscr ? "" : " (wrong result!)");
+  return 0;
+}
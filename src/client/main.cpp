@@ -0,0 +1,53 @@
+//=== src/client/main.cpp ====================================================//
+//
+// A thin client for `miscrc --daemon`. It forwards its arguments to the daemon
+// and relays the result, so a compile costs a socket round trip instead of a
+// full compiler startup. It deliberately does not link against LLVM.
+//
+// If no daemon is listening, the client runs `miscrc` directly instead.
+//============================================================================//
+#include <cstdio>
+#include <climits>
+#include "daemon/Protocol.hpp"
+
+int main(int argc, char** argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  std::string socketPath = DaemonProtocol::defaultSocketPath();
+
+  sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || !DaemonProtocol::makeAddress(socketPath, addr)
+      || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    if (args.size() == 1 && args[0] == DaemonProtocol::STOP_REQUEST) {
+      fprintf(stderr, "No miscrc daemon is listening on %s\n",
+        socketPath.c_str());
+      return 1;
+    }
+    argv[0] = const_cast<char*>("miscrc");
+    execvp("miscrc", argv);
+    fprintf(stderr, "No miscrc daemon is listening on %s and miscrc is not "
+      "in PATH\n", socketPath.c_str());
+    return 1;
+  }
+
+  // a socket in a shared directory may have been put there by someone else
+  if (!DaemonProtocol::peerIsSameUser(fd)) {
+    fprintf(stderr, "The miscrc daemon on %s belongs to another user\n",
+      socketPath.c_str());
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) cwd[0] = '\0';
+
+  int status;
+  std::string errs;
+  if (!DaemonProtocol::sendRequest(fd, cwd, args)
+      || !DaemonProtocol::recvResponse(fd, status, errs)) {
+    fprintf(stderr, "Lost connection to the miscrc daemon\n");
+    return 1;
+  }
+  fwrite(errs.data(), 1, errs.size(), stderr);
+  close(fd);
+  return status;
+}
@@ -0,0 +1,154 @@
+#ifndef FUZZ_COMPLEXITYBUDGET
+#define FUZZ_COMPLEXITYBUDGET
+
+#include <algorithm>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+#include "GrammarMutator.hpp"
+#include "PhaseProfiler.hpp"
+
+/// @brief Decides whether an input makes some phase scale worse than
+/// linearly, and shrinks and saves inputs that do.
+///
+/// The budget is calibrated on the machine it runs on. The fixed cost of
+/// each phase is measured on the bare prelude, and its linear cost per byte
+/// is measured on large generated programs. The _excess_ of a phase on an
+/// input is its time per byte, minus the fixed cost, relative to that linear
+/// cost. Inputs whose excess is above `factor` in some phase are over budget.
+class ComplexityBudget {
+  using Profile = PhaseProfiler::Profile;
+  static constexpr unsigned NUM_PHASES = PhaseProfiler::NUM_PHASES;
+
+  double fixedCost[NUM_PHASES] = {};
+  double linearCost[NUM_PHASES] = {};
+
+public:
+  /// @brief How many times the calibrated cost per byte a phase may spend.
+  double factor = 10.0;
+
+  /// @brief Smaller inputs are never over budget; their timings are noise.
+  size_t minBytes = 512;
+
+  /// @brief Runs per measurement when confirming and minimizing.
+  unsigned reps = 3;
+
+  /// @brief Upper bound on profiler runs spent minimizing one input.
+  unsigned maxMinimizeRuns = 2000;
+
+  /// @brief Measures the fixed and linear cost of each phase.
+  void calibrate(GrammarMutator& gen) {
+    Profile bare = PhaseProfiler::runMin(GrammarMutator::PRELUDE, 5);
+    std::vector<double> samples[NUM_PHASES];
+    for (unsigned i = 0; i < 7; ++i) {
+      std::string src = gen.generate(60, false);
+      Profile prof = PhaseProfiler::runMin(src, reps);
+      for (unsigned ph = 0; ph < NUM_PHASES; ++ph)
+        samples[ph].push_back(
+          std::max(0.0, prof.seconds[ph] - bare.seconds[ph]) / prof.bytes);
+    }
+    double total = 0;
+    for (unsigned ph = 0; ph < NUM_PHASES; ++ph) {
+      fixedCost[ph] = bare.seconds[ph];
+      std::sort(samples[ph].begin(), samples[ph].end());
+      linearCost[ph] = samples[ph][samples[ph].size() / 2];
+      total += linearCost[ph];
+    }
+    // Phases that do almost nothing on well-formed input (diagnostics, for
+    // one) get a floor so that timer noise cannot put them over budget.
+    for (unsigned ph = 0; ph < NUM_PHASES; ++ph)
+      linearCost[ph] = std::max(linearCost[ph], total / 20);
+  }
+
+  /// @brief The excess of @p phase on an input profiled as @p prof.
+  double excess(const Profile& prof, unsigned phase) const {
+    if (prof.bytes == 0) return 0;
+    double t = std::max(0.0, prof.seconds[phase] - fixedCost[phase]);
+    return t / prof.bytes / linearCost[phase];
+  }
+
+  /// @brief Returns the phase with the largest excess on @p prof.
+  unsigned worstPhase(const Profile& prof, double& worstExcess) const {
+    unsigned worst = 0;
+    worstExcess = 0;
+    for (unsigned ph = 0; ph < NUM_PHASES; ++ph) {
+      double e = excess(prof, ph);
+      if (e > worstExcess) { worst = ph; worstExcess = e; }
+    }
+    return worst;
+  }
+
+  /// @brief True if @p phase is over budget on @p src, measured with
+  /// repetition. The excess is stored in @p measured.
+  bool confirm(llvm::StringRef src, unsigned phase, double& measured) const {
+    if (src.size() < minBytes) return false;
+    measured = excess(PhaseProfiler::runMin(src, reps), phase);
+    return measured > factor;
+  }
+
+  /// @brief Removes as many lines from @p src as possible while @p phase
+  /// stays over budget (delta debugging on lines).
+  std::string minimize(llvm::StringRef src, unsigned phase) const {
+    std::vector<llvm::StringRef> lines;
+    for (llvm::StringRef rest = src; !rest.empty(); ) {
+      size_t nl = rest.find('\n');
+      size_t len = nl == llvm::StringRef::npos ? rest.size() : nl + 1;
+      lines.push_back(rest.take_front(len));
+      rest = rest.drop_front(len);
+    }
+    auto join = [](llvm::ArrayRef<llvm::StringRef> ls) {
+      std::string ret;
+      for (llvm::StringRef l : ls) ret += l;
+      return ret;
+    };
+
+    unsigned runs = 0;
+    double measured;
+    for (size_t chunk = lines.size() / 2; chunk > 0; chunk /= 2) {
+      for (size_t i = 0; i < lines.size() && runs < maxMinimizeRuns; ) {
+        std::vector<llvm::StringRef> candidate(lines.begin(),
+          lines.begin() + i);
+        candidate.insert(candidate.end(),
+          lines.begin() + std::min(lines.size(), i + chunk), lines.end());
+        ++runs;
+        if (confirm(join(candidate), phase, measured)) lines.swap(candidate);
+        else i += chunk;
+      }
+    }
+    return join(lines);
+  }
+
+  /// @brief Writes @p src into @p dir as a regression benchmark and returns
+  /// the file name. The name is derived from the phase and a content hash,
+  /// so the same input is saved only once.
+  std::string save(llvm::StringRef src, unsigned phase, double measured,
+                   llvm::StringRef dir) const {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : src) hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+    std::string name;
+    llvm::raw_string_ostream nameOS(name);
+    nameOS << dir << "/" << PhaseProfiler::phaseName(phase) << "-"
+           << llvm::format_hex_no_prefix(hash, 16) << ".miscr";
+    nameOS.flush();
+
+    llvm::sys::fs::create_directories(dir);
+    std::error_code EC;
+    llvm::raw_fd_ostream out(name, EC);
+    if (EC) return "";
+    out << "// complexity regression: phase "
+        << PhaseProfiler::phaseName(phase) << " at "
+        << llvm::format("%.1f", measured) << "x its linear cost ("
+        << src.size() << " bytes)\n" << src;
+    return name;
+  }
+
+  /// @brief Prints the excess of each phase on @p prof to @p os.
+  void print(llvm::raw_ostream& os, const Profile& prof) const {
+    for (unsigned ph = 0; ph < NUM_PHASES; ++ph)
+      os << "  " << llvm::left_justify(PhaseProfiler::phaseName(ph), 12)
+         << llvm::format("%10.3f ms %8.1fx\n", prof.seconds[ph] * 1e3,
+              excess(prof, ph));
+  }
+};
+
+#endif
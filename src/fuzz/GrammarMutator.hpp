@@ -0,0 +1,308 @@
+#ifndef FUZZ_GRAMMARMUTATOR
+#define FUZZ_GRAMMARMUTATOR
+
+#include <random>
+#include <llvm/ADT/StringMap.h>
+#include "lexer/Lexer.hpp"
+
+/// @brief Generates and mutates MiSCR programs following the grammar in
+/// Parser, so that most mutants get past the parser and exercise the later
+/// phases too.
+///
+/// Mutations work on the token structure of the input rather than its raw
+/// bytes. The Lexer finds the statement boundaries inside block expressions,
+/// and mutants are made by inserting generated statements there, or by
+/// duplicating, deleting, wrapping, or splicing whole statements. Generated
+/// code only refers to the parameters `p: &S` and `n: i32` that every
+/// generated function has, plus names it binds itself.
+class GrammarMutator {
+  std::mt19937_64 rng;
+  unsigned fresh = 0;
+  bool emitErrors = true;
+
+public:
+  explicit GrammarMutator(uint64_t seed) : rng(seed) {}
+
+  /// @brief Declarations that every generated program starts with.
+  static constexpr const char* PRELUDE =
+    "extern func malloc(size: i64): uniq &i8;\n"
+    "extern func free(ptr: uniq &i8): unit;\n"
+    "struct T { a: i32, b: i32 }\n"
+    "struct S { f0: i32, f1: i32, t: T }\n";
+
+  /// @brief Generates a program with @p numFuncs functions. Unless
+  /// @p withErrors is set, the program is free of compile errors.
+  std::string generate(unsigned numFuncs, bool withErrors = true) {
+    emitErrors = withErrors;
+    std::string ret = PRELUDE;
+    std::vector<std::string> funcs;
+    for (unsigned i = 0; i < numFuncs; ++i) ret += genFunc(funcs);
+    emitErrors = true;
+    return ret;
+  }
+
+  /// @brief Returns a mutant of @p src no longer than @p maxSize bytes.
+  /// Statements may be spliced in from @p other.
+  std::string mutate(llvm::StringRef src, llvm::StringRef other,
+                     size_t maxSize) {
+    for (unsigned attempt = 0; attempt < 8; ++attempt) {
+      std::string ret = mutateOnce(src, other);
+      if (ret.size() <= maxSize && ret != src) return ret;
+    }
+    return src.size() <= maxSize ? src.str() : generate(1);
+  }
+
+private:
+
+  /// @brief Statement boundaries found in a program. Each boundary is the
+  /// byte offset just after a `;` or block-opening `{` in a block
+  /// expression, tagged with the offset of that block's `{`.
+  struct Structure {
+    std::vector<std::pair<size_t, size_t>> boundaries;
+    std::vector<std::string> funcs;
+  };
+
+  /// @brief Lexes @p src and returns the byte offset where each token ends.
+  std::vector<size_t> lex(llvm::StringRef src, std::vector<Token>& tokens) {
+    std::vector<size_t> lineStarts = { 0, 0 };
+    for (size_t i = 0; i < src.size(); ++i)
+      if (src[i] == '\n') lineStarts.push_back(i + 1);
+    std::string text = src.str();
+    tokens = Lexer(text).run();
+    std::vector<size_t> ends;
+    for (const Token& tok : tokens) {
+      if (tok.loc.row >= lineStarts.size()) ends.push_back(src.size());
+      else ends.push_back(std::min(src.size(),
+        lineStarts[tok.loc.row] + tok.loc.col - 1 + tok.loc.sz));
+    }
+    return ends;
+  }
+
+  Structure scan(llvm::StringRef src) {
+    Structure ret;
+    std::vector<Token> tokens;
+    std::vector<size_t> ends = lex(src, tokens);
+    // offsets of the enclosing braces; npos marks a non-block brace
+    std::vector<size_t> braces;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      const Token& tok = tokens[i];
+      if (tok.tag == Token::LBRACE) {
+        // `S {` starts a struct or constructor; anything else is a block
+        bool isBlock = i == 0 || tokens[i-1].tag != Token::IDENT;
+        size_t here = ends[i];
+        braces.push_back(isBlock ? here : llvm::StringRef::npos);
+        if (isBlock) ret.boundaries.push_back({ here, here });
+      } else if (tok.tag == Token::RBRACE) {
+        if (!braces.empty()) braces.pop_back();
+      } else if (tok.tag == Token::SEMICOLON) {
+        if (!braces.empty() && braces.back() != llvm::StringRef::npos)
+          ret.boundaries.push_back({ ends[i], braces.back() });
+      } else if (tok.tag == Token::KW_FUNC && i + 1 < tokens.size()
+          && tokens[i+1].tag == Token::IDENT) {
+        // only generated functions are known to take (p: &S, n: i32)
+        size_t begin = ends[i+1] - tokens[i+1].loc.sz;
+        llvm::StringRef sig = src.substr(begin).take_until(
+          [](char c) { return c == '='; });
+        if (sig.find("(p: &S, n: i32): i32") != llvm::StringRef::npos)
+          ret.funcs.push_back(sig.take_until(
+            [](char c) { return c == '('; }).str());
+      }
+    }
+    return ret;
+  }
+
+  /// @brief Renames the variables that @p stmts binds, so that a copy of
+  /// the statements can sit next to the original without shadowing it.
+  std::string freshen(llvm::StringRef stmts) {
+    std::vector<Token> tokens;
+    std::vector<size_t> ends = lex(stmts, tokens);
+    llvm::StringMap<std::string> renames;
+    for (size_t i = 0; i + 1 < tokens.size(); ++i)
+      if (tokens[i].tag == Token::KW_LET && tokens[i+1].tag == Token::IDENT) {
+        llvm::StringRef name = stmts.slice(
+          ends[i+1] - tokens[i+1].loc.sz, ends[i+1]);
+        renames[name] = freshName("r");
+      }
+    std::string ret;
+    size_t copied = 0;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      if (tokens[i].tag != Token::IDENT) continue;
+      size_t begin = ends[i] - tokens[i].loc.sz;
+      auto it = renames.find(stmts.slice(begin, ends[i]));
+      if (it == renames.end()) continue;
+      ret += stmts.slice(copied, begin);
+      ret += it->second;
+      copied = ends[i];
+    }
+    return ret + stmts.drop_front(copied).str();
+  }
+
+  /// @brief Picks a range of whole statements in one block, or returns
+  /// false if there are none.
+  bool pickStatements(const Structure& s, size_t& begin, size_t& end) {
+    if (s.boundaries.size() < 2) return false;
+    size_t i = pick(s.boundaries.size() - 1);
+    size_t block = s.boundaries[i].second;
+    std::vector<size_t> ends;
+    for (size_t j = i + 1; j < s.boundaries.size() && ends.size() < 4; ++j)
+      if (s.boundaries[j].second == block) ends.push_back(j);
+    if (ends.empty()) return false;
+    begin = s.boundaries[i].first;
+    end = s.boundaries[ends[pick(ends.size())]].first;
+    return true;
+  }
+
+  std::string mutateOnce(llvm::StringRef src, llvm::StringRef other) {
+    Structure s = scan(src);
+    if (s.boundaries.empty()) return src.str() + genFunc(s.funcs);
+    size_t at = s.boundaries[pick(s.boundaries.size())].first;
+    size_t begin, end;
+    std::vector<std::string> vars = { "n" };
+    switch (pick(7)) {
+    case 0: case 1: // insert a generated statement
+      return (src.take_front(at) + " " + genStmt(0, s.funcs, vars)
+        + src.drop_front(at)).str();
+    case 2: // duplicate statements
+      if (!pickStatements(s, begin, end)) break;
+      return (src.take_front(end) + freshen(src.slice(begin, end))
+        + src.drop_front(end)).str();
+    case 3: // delete statements
+      if (!pickStatements(s, begin, end)) break;
+      return (src.take_front(begin) + src.drop_front(end)).str();
+    case 4: { // wrap statements in both arms of an if
+      if (!pickStatements(s, begin, end)) break;
+      llvm::StringRef body = src.slice(begin, end);
+      return (src.take_front(begin) + " if (" + genBool(1, s.funcs, vars)
+        + ") {" + body + " } else {" + freshen(body) + " }"
+        + src.drop_front(end)).str();
+    }
+    case 5: { // splice statements from the other input
+      Structure o = scan(other);
+      if (!pickStatements(o, begin, end)) break;
+      return (src.take_front(at) + freshen(other.slice(begin, end))
+        + src.drop_front(at)).str();
+    }
+    default:
+      break;
+    }
+    return src.str() + genFunc(s.funcs);
+  }
+
+  //==========================================================================//
+  // Generators
+  //==========================================================================//
+
+  unsigned pick(size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+  }
+
+  std::string freshName(const char* prefix) {
+    return prefix + std::to_string(fresh++) + "_"
+      + std::to_string(pick(1000000));
+  }
+
+  std::string genFunc(std::vector<std::string>& funcs) {
+    std::string name = freshName("g");
+    std::vector<std::string> vars = { "n" };
+    std::string body;
+    for (unsigned i = 0, e = 1 + pick(6); i < e; ++i)
+      body += "\n  " + genStmt(0, funcs, vars);
+    funcs.push_back(name);
+    return "func " + name + "(p: &S, n: i32): i32 = {" + body + "\n  "
+      + genInt(0, funcs, vars) + "\n};\n";
+  }
+
+  std::string genBlock(unsigned depth, const std::vector<std::string>& funcs,
+                       std::vector<std::string> vars) {
+    std::string ret = "{";
+    for (unsigned i = 0, e = 1 + pick(3); i < e; ++i)
+      ret += " " + genStmt(depth, funcs, vars);
+    return ret + " }";
+  }
+
+  std::string genStmt(unsigned depth, const std::vector<std::string>& funcs,
+                      std::vector<std::string>& vars) {
+    switch (depth > 3 ? pick(3) : pick(10)) {
+    case 0: {
+      std::string v = freshName("v");
+      std::string ret = "let " + v + ": i32 = " + genInt(depth, funcs, vars)
+        + ";";
+      vars.push_back(v);
+      return ret;
+    }
+    case 1:
+      return vars[pick(vars.size())] + " = " + genInt(depth, funcs, vars)
+        + ";";
+    case 2:
+      return std::string(pick(2) ? "p->f0" : "p->f1") + " = "
+        + genInt(depth, funcs, vars) + ";";
+    case 3: {
+      std::string ret = "if (" + genBool(depth, funcs, vars) + ") "
+        + genBlock(depth + 1, funcs, vars);
+      if (pick(2)) ret += " else " + genBlock(depth + 1, funcs, vars);
+      return ret;
+    }
+    case 4:
+      // The borrow checker visits a loop condition twice and cannot yet
+      // handle a `let` being bound twice, so keep conditions simple.
+      return "while (" + vars[pick(vars.size())] + " < "
+        + std::to_string(pick(100)) + ") " + genBlock(depth + 1, funcs, vars);
+    case 5: { // a unique reference freed on every path
+      std::string u = freshName("u");
+      return "let " + u + " = malloc(8); if (" + genBool(depth, funcs, vars)
+        + ") { free(" + u + "); } else { free(" + u + "); }";
+    }
+    case 6: { // a chain of aliases, for union-find and access paths
+      std::string prev = freshName("u");
+      std::string ret = "let " + prev + " = malloc(8);";
+      for (unsigned i = 0, e = 1 + pick(16); i < e; ++i) {
+        std::string next = freshName("u");
+        ret += " let " + next + " = " + prev + ";";
+        prev = next;
+      }
+      return ret + " free(" + prev + ");";
+    }
+    case 7:
+      if (funcs.empty()) break;
+      // a block takes the type of its last statement, so keep it unit
+      return "n = " + funcs[pick(funcs.size())] + "(p, "
+        + genInt(depth, funcs, vars) + ");";
+    case 8: // an error, to exercise diagnostics
+      if (emitErrors && pick(8) == 0)
+        return "let " + freshName("e") + ": i32 = undefined;";
+      break;
+    default:
+      break;
+    }
+    return "n = " + genInt(depth, funcs, vars) + ";";
+  }
+
+  std::string genInt(unsigned depth, const std::vector<std::string>& funcs,
+                     const std::vector<std::string>& vars) {
+    switch (depth > 4 ? pick(3) : pick(7)) {
+    case 0: return std::to_string(pick(100));
+    case 1: return vars[pick(vars.size())];
+    case 2: return pick(2) ? "p->f1" : "p->t.a";
+    case 3: return "(" + genInt(depth + 1, funcs, vars) + " + "
+      + genInt(depth + 1, funcs, vars) + ")";
+    case 4: return "(" + genInt(depth + 1, funcs, vars) + " * "
+      + genInt(depth + 1, funcs, vars) + ")";
+    case 5:
+      if (funcs.empty()) return "n";
+      return funcs[pick(funcs.size())] + "(p, "
+        + genInt(depth + 1, funcs, vars) + ")";
+    default:
+      return "{ let " + freshName("b") + " = " + genInt(depth + 1, funcs, vars)
+        + "; " + genInt(depth + 1, funcs, vars) + " }";
+    }
+  }
+
+  std::string genBool(unsigned depth, const std::vector<std::string>& funcs,
+                      const std::vector<std::string>& vars) {
+    const char* ops[] = { " < ", " == ", " /= " };
+    return "(" + genInt(depth + 1, funcs, vars) + ops[pick(3)]
+      + genInt(depth + 1, funcs, vars) + ")";
+  }
+};
+
+#endif
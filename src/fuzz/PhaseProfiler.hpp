@@ -0,0 +1,125 @@
+#ifndef FUZZ_PHASEPROFILER
+#define FUZZ_PHASEPROFILER
+
+#include <chrono>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include "lexer/Lexer.hpp"
+#include "parser/Parser.hpp"
+#include "sema/Sema.hpp"
+#include "borrowchecker/BorrowChecker.hpp"
+#include "analysis/FunctionSummaries.hpp"
+#include "codegen/Codegen.hpp"
+
+/// @brief Runs the compiler front end on a source text and times each phase
+/// separately. Phases after the first one that rejects the input are skipped.
+class PhaseProfiler {
+public:
+  enum Phase : unsigned {
+    LEX, PARSE, SEMA, BORROW, SUMMARIES, CODEGEN, DIAGNOSTICS, NUM_PHASES
+  };
+
+  static const char* phaseName(unsigned phase) {
+    switch (phase) {
+    case LEX:         return "lex";
+    case PARSE:       return "parse";
+    case SEMA:        return "sema";
+    case BORROW:      return "borrowck";
+    case SUMMARIES:   return "summaries";
+    case CODEGEN:     return "codegen";
+    case DIAGNOSTICS: return "diagnostics";
+    default:          return "unknown";
+    }
+  }
+
+  /// @brief Wall-clock seconds spent in each phase for one input.
+  struct Profile {
+    double seconds[NUM_PHASES] = {};
+    size_t bytes = 0;
+
+    /// @brief Keeps the faster time of each phase. Used to filter out
+    /// scheduling noise by taking the minimum over repeated runs.
+    void keepMin(const Profile& that) {
+      for (unsigned i = 0; i < NUM_PHASES; ++i)
+        seconds[i] = std::min(seconds[i], that.seconds[i]);
+    }
+  };
+
+  /// @brief Compiles @p src up to (but not including) object emission,
+  /// rendering any error messages, and returns the time of each phase.
+  static Profile run(llvm::StringRef src) {
+    // the lexer and LocationTable expect a null-terminated string
+    std::string text = src.str();
+    Profile prof;
+    prof.bytes = text.size();
+    std::vector<LocatedError> errors;
+    Clock::time_point t = Clock::now();
+
+    LocationTable locTab(text.c_str());
+    std::vector<Token> tokens = Lexer(text, &locTab).run();
+    lap(prof, LEX, t);
+
+    Parser parser(tokens);
+    DeclList* decls = parser.decls0();
+    if (decls == nullptr) errors.push_back(parser.getError());
+    else if (parser.hasMore())
+      errors.push_back(LocatedError()
+        << "Parser got stuck:\n" << parser.getCurrentToken().loc);
+    lap(prof, PARSE, t);
+
+    if (errors.empty()) {
+      Sema sema;
+      sema.run(decls, "global");
+      errors = sema.getErrors();
+      lap(prof, SEMA, t);
+
+      if (errors.empty()) {
+        BorrowChecker bc(sema.getTypeContext(), sema.getOntology());
+        bc.checkDecls(decls);
+        errors.assign(bc.errors.begin(), bc.errors.end());
+        lap(prof, BORROW, t);
+      }
+
+      if (errors.empty()) {
+        FunctionSummaries summaries(sema.getOntology(), 1);
+        summaries.run();
+        lap(prof, SUMMARIES, t);
+        {
+          llvm::LLVMContext llvmContext;
+          llvm::Module llvmModule("FuzzModule", llvmContext);
+          Codegen codegen(sema.getOntology(), llvmModule, &summaries);
+          codegen.genDeclList(decls);
+        }
+        lap(prof, CODEGEN, t);
+      }
+    }
+
+    // tearing down Sema is not part of any phase
+    t = Clock::now();
+    std::string rendered;
+    for (LocatedError& err : errors)
+      rendered.append(err.render(text.c_str(), locTab));
+    lap(prof, DIAGNOSTICS, t);
+
+    if (decls != nullptr) decls->deleteRecursive();
+    return prof;
+  }
+
+  /// @brief Runs @p src @p reps times and keeps the fastest time per phase.
+  static Profile runMin(llvm::StringRef src, unsigned reps) {
+    Profile best = run(src);
+    for (unsigned i = 1; i < reps; ++i) best.keepMin(run(src));
+    return best;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static void lap(Profile& prof, Phase phase, Clock::time_point& t) {
+    Clock::time_point now = Clock::now();
+    prof.seconds[phase] = std::chrono::duration<double>(now - t).count();
+    t = now;
+  }
+};
+
+#endif
@@ -0,0 +1,227 @@
+//=== src/fuzz/main.cpp ======================================================//
+//
+// A compile-time complexity fuzzer. Its objective is the time each compiler
+// phase spends per input byte, and it hunts for inputs on which some phase
+// scales worse than linearly. Inputs that go over budget are minimized and
+// saved as regression benchmarks.
+//
+// Built with -DMISCR_LIBFUZZER and -fsanitize=fuzzer, this file provides the
+// libFuzzer entry points and a grammar-aware custom mutator, and reports
+// coarse cost buckets as extra coverage counters so libFuzzer keeps inputs
+// that are slower per byte. Otherwise it has its own main with a simple
+// evolutionary search, and a --replay mode for the saved benchmarks.
+//============================================================================//
+#include <cstring>
+#include <llvm/Support/MemoryBuffer.h>
+#include "ComplexityBudget.hpp"
+
+namespace {
+
+struct Options {
+  double budget = 10.0;
+  size_t minBytes = 512;
+  size_t maxLen = 16384;
+  uint64_t seed = 1;
+  unsigned long runs = 10000;
+  unsigned long maxTotalTime = 0;
+  std::string outDir = "complexity-regressions";
+  bool replay = false;
+  std::vector<std::string> inputs;
+};
+
+/// @brief Parses `--name=value` options. Other arguments are inputs.
+bool parseOptions(int argc, char** argv, Options& opts) {
+  for (int i = 1; i < argc; ++i) {
+    llvm::StringRef arg = argv[i];
+    if (arg.size() < 2 || arg[0] != '-' || arg[1] != '-') {
+      if (arg.empty() || arg[0] != '-') opts.inputs.push_back(arg.str());
+      continue;  // single-dash options belong to libFuzzer
+    }
+    auto [name, value] = arg.drop_front(2).split('=');
+    bool bad = false;
+    if (name == "budget") bad = value.getAsDouble(opts.budget);
+    else if (name == "min-bytes") bad = value.getAsInteger(10, opts.minBytes);
+    else if (name == "max-len") bad = value.getAsInteger(10, opts.maxLen);
+    else if (name == "seed") bad = value.getAsInteger(10, opts.seed);
+    else if (name == "runs") bad = value.getAsInteger(10, opts.runs);
+    else if (name == "max-total-time")
+      bad = value.getAsInteger(10, opts.maxTotalTime);
+    else if (name == "out") opts.outDir = value.str();
+    else if (name == "replay") opts.replay = true;
+    else bad = true;
+    if (bad) {
+      llvm::errs() << "Unknown or malformed option " << arg << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+Options opts;
+ComplexityBudget budget;
+std::unique_ptr<GrammarMutator> mutator;
+unsigned numSaved = 0;
+
+/// @brief Largest excess saved so far per phase. Once a phase has a
+/// regression benchmark, only markedly worse inputs are saved for it, so one
+/// culprit does not flood the output directory.
+double savedExcess[PhaseProfiler::NUM_PHASES] = {};
+
+void init() {
+  mutator = std::make_unique<GrammarMutator>(opts.seed);
+  budget.factor = opts.budget;
+  budget.minBytes = opts.minBytes;
+  budget.calibrate(*mutator);
+}
+
+#ifdef MISCR_LIBFUZZER
+/// @brief One counter per phase and power-of-two excess bucket. libFuzzer
+/// treats a newly set counter as new coverage, so inputs that push any phase
+/// into a costlier bucket are kept in the corpus.
+__attribute__((section("__libfuzzer_extra_counters")))
+uint8_t costCounters[PhaseProfiler::NUM_PHASES][16];
+
+void reportCost(const PhaseProfiler::Profile& prof) {
+  for (unsigned ph = 0; ph < PhaseProfiler::NUM_PHASES; ++ph) {
+    double e = budget.excess(prof, ph) * 4;
+    unsigned bucket = 0;
+    while (e >= 1 && bucket < 15) { e /= 2; ++bucket; }
+    costCounters[ph][bucket] = 1;
+  }
+}
+#endif
+
+/// @brief Profiles @p src once and returns its largest excess. If that is
+/// over budget and holds up under repetition, the input is minimized and
+/// saved.
+double testOne(llvm::StringRef src) {
+  PhaseProfiler::Profile prof = PhaseProfiler::run(src);
+#ifdef MISCR_LIBFUZZER
+  reportCost(prof);
+#endif
+  double worstExcess;
+  unsigned phase = budget.worstPhase(prof, worstExcess);
+  double measured;
+  if (worstExcess > budget.factor && budget.confirm(src, phase, measured)
+      && measured > 1.5 * savedExcess[phase]) {
+    std::string small = budget.minimize(src, phase);
+    if (budget.confirm(small, phase, measured)) {
+      savedExcess[phase] = std::max(savedExcess[phase], measured);
+      ++numSaved;
+      std::string file = budget.save(small, phase, measured, opts.outDir);
+      llvm::errs() << "over budget: " << PhaseProfiler::phaseName(phase)
+                   << " at " << llvm::format("%.1f", measured) << "x ("
+                   << src.size() << " -> " << small.size() << " bytes), saved "
+                   << file << "\n";
+    }
+  }
+  return worstExcess;
+}
+
+int replay() {
+  int status = 0;
+  for (const std::string& file : opts.inputs) {
+    auto buf = llvm::MemoryBuffer::getFile(file, true);
+    if (!buf) {
+      llvm::errs() << "Could not read file " << file << "\n";
+      return 1;
+    }
+    llvm::StringRef src = buf.get()->getBuffer();
+    PhaseProfiler::Profile prof =
+      PhaseProfiler::runMin(src, budget.reps);
+    double worstExcess;
+    unsigned phase = budget.worstPhase(prof, worstExcess);
+    bool over = src.size() >= budget.minBytes && worstExcess > budget.factor;
+    llvm::outs() << file << ": " << (over ? "OVER BUDGET in " : "ok, worst ")
+                 << PhaseProfiler::phaseName(phase) << "\n";
+    budget.print(llvm::outs(), prof);
+    if (over) status = 1;
+  }
+  return status;
+}
+
+/// @brief A small evolutionary search that maximizes the largest excess.
+int search() {
+  struct Entry { std::string src; double score; };
+  std::vector<Entry> corpus;
+  for (const std::string& file : opts.inputs) {
+    if (auto buf = llvm::MemoryBuffer::getFile(file, true))
+      corpus.push_back({ buf.get()->getBuffer().str(), 0 });
+  }
+  while (corpus.size() < 8) corpus.push_back({ mutator->generate(4), 0 });
+  for (Entry& e : corpus) e.score = testOne(e.src);
+
+  std::mt19937_64 rng(opts.seed);
+  auto pick = [&](size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+  };
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long run = 0; run < opts.runs; ++run) {
+    if (opts.maxTotalTime && std::chrono::steady_clock::now() - start
+        > std::chrono::seconds(opts.maxTotalTime)) break;
+    // tournament selection favors the costliest inputs
+    size_t a = pick(corpus.size()), b = pick(corpus.size());
+    const Entry& parent = corpus[a].score >= corpus[b].score
+      ? corpus[a] : corpus[b];
+    std::string child = mutator->mutate(parent.src,
+      corpus[pick(corpus.size())].src, opts.maxLen);
+    double score = testOne(child);
+    if (score > parent.score || pick(16) == 0) {
+      corpus.push_back({ std::move(child), score });
+      if (corpus.size() > 64) {
+        auto worst = std::min_element(corpus.begin(), corpus.end(),
+          [](const Entry& x, const Entry& y) { return x.score < y.score; });
+        corpus.erase(worst);
+      }
+    }
+    if ((run + 1) % 1000 == 0) {
+      double best = 0;
+      for (const Entry& e : corpus) best = std::max(best, e.score);
+      llvm::errs() << "#" << run + 1 << " best excess "
+                   << llvm::format("%.1f", best) << "x, "
+                   << numSaved << " saved\n";
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
+  if (!parseOptions(*argc, *argv, opts)) exit(1);
+  init();
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  testOne(llvm::StringRef((const char*)data, size));
+  return 0;
+}
+
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t* data, size_t size,
+    size_t maxSize, unsigned int seed) {
+  llvm::StringRef src((const char*)data, size);
+  std::string mutant = mutator->mutate(src, src, maxSize);
+  if (mutant.size() > maxSize) return size;
+  memcpy(data, mutant.data(), mutant.size());
+  return mutant.size();
+}
+
+extern "C" size_t LLVMFuzzerCustomCrossOver(const uint8_t* data1,
+    size_t size1, const uint8_t* data2, size_t size2, uint8_t* out,
+    size_t maxOutSize, unsigned int seed) {
+  std::string mutant = mutator->mutate(
+    llvm::StringRef((const char*)data1, size1),
+    llvm::StringRef((const char*)data2, size2), maxOutSize);
+  if (mutant.size() > maxOutSize) return 0;
+  memcpy(out, mutant.data(), mutant.size());
+  return mutant.size();
+}
+
+#ifndef MISCR_LIBFUZZER
+int main(int argc, char** argv) {
+  if (!parseOptions(argc, argv, opts)) return 1;
+  init();
+  return opts.replay ? replay() : search();
+}
+#endif
@@ -0,0 +1,607 @@
+#ifndef ANALYSIS_FUNCTIONSUMMARIES
+#define ANALYSIS_FUNCTIONSUMMARIES
+
+#include <atomic>
+#include <thread>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallBitVector.h>
+#include "common/Ontology.hpp"
+#include "common/ScopeStack.hpp"
+
+/// @brief What a function may do to the memory reachable through its
+/// parameters and to memory in general, as observed by its callers.
+///
+/// Summaries are conservative: a bit that is clear is a guarantee, a bit
+/// that is set only means "maybe". Memory reachable through a parameter
+/// (transitively, through any number of dereferences) is attributed to that
+/// parameter.
+struct FunctionSummary {
+  enum Memory { NONE, READ, READWRITE };
+
+  /// @brief The strongest effect the function may have on memory that is not
+  /// local to it.
+  Memory memory = NONE;
+
+  /// @brief Parameters whose memory may be written.
+  llvm::SmallBitVector writtenParams;
+
+  /// @brief Parameters that may be stored into memory that outlives the call.
+  llvm::SmallBitVector capturedParams;
+
+  /// @brief Parameters that may flow into (or be reachable from) the return
+  /// value.
+  llvm::SmallBitVector returnedParams;
+
+  /// @brief True if the return value may point to memory that did not come
+  /// from a parameter (e.g., a fresh allocation).
+  bool returnsExternal = false;
+
+  explicit FunctionSummary(unsigned numParams = 0)
+    : writtenParams(numParams), capturedParams(numParams),
+      returnedParams(numParams) {}
+
+  /// @brief The most conservative summary, used for extern functions.
+  static FunctionSummary unknown(unsigned numParams) {
+    FunctionSummary s(numParams);
+    s.memory = READWRITE;
+    s.writtenParams.set();
+    s.capturedParams.set();
+    s.returnedParams.set();
+    s.returnsExternal = true;
+    return s;
+  }
+
+  bool isPure() const { return memory == NONE; }
+  bool isReadOnly(unsigned param) const { return !writtenParams[param]; }
+
+  /// @brief True if no copy of the parameter outlives the call, including
+  /// through the return value.
+  bool isNoCapture(unsigned param) const
+    { return !capturedParams[param] && !returnedParams[param]; }
+
+  /// @brief True if any unique references returned are fresh rather than
+  /// handed back from the arguments.
+  bool returnsFresh() const { return returnedParams.none(); }
+
+  bool operator==(const FunctionSummary& that) const {
+    return memory == that.memory && writtenParams == that.writtenParams
+        && capturedParams == that.capturedParams
+        && returnedParams == that.returnedParams
+        && returnsExternal == that.returnsExternal;
+  }
+  bool operator!=(const FunctionSummary& that) const
+    { return !(*this == that); }
+};
+
+/// @brief Computes a FunctionSummary for every function in an Ontology.
+///
+/// Functions are summarized bottom-up over the strongly connected components
+/// (SCCs) of the call graph, so every callee outside a function's own SCC is
+/// summarized before the function itself. Functions in the same SCC are
+/// iterated together to a fixpoint, starting from the most optimistic
+/// summary. SCCs at the same depth of the condensed call graph do not depend
+/// on each other and are summarized in parallel.
+///
+/// Must run after sema (callee names are canonical) and before the AST is
+/// deleted.
+class FunctionSummaries {
+public:
+  FunctionSummaries(const Ontology& ont,
+                    unsigned numThreads = std::thread::hardware_concurrency())
+    : ont(ont), numThreads(numThreads == 0 ? 1 : numThreads) {}
+
+  FunctionSummaries(const FunctionSummaries&) = delete;
+  FunctionSummaries& operator=(const FunctionSummaries&) = delete;
+
+  /// @brief Summarizes every function in the ontology.
+  void run() {
+    // create all entries up front so worker threads never rehash the map
+    for (auto& entry : ont.functionSpace) {
+      FunctionDecl* f = entry.second;
+      unsigned numParams = f->getParameters()->asArrayRef().size();
+      summaries[f] = isSummarized(f)
+        ? FunctionSummary(numParams) : FunctionSummary::unknown(numParams);
+      if (isSummarized(f)) buildCallGraph(f);
+    }
+
+    for (auto& entry : ont.functionSpace)
+      if (isSummarized(entry.second) && !sccIndex.count(entry.second))
+        tarjan(entry.second);
+
+    // group SCCs by depth in the condensed call graph. Tarjan's algorithm
+    // emits SCCs callees-first, so each callee's depth is already known.
+    std::vector<unsigned> depth(sccs.size(), 0);
+    std::vector<std::vector<unsigned>> levels;
+    for (unsigned scc = 0; scc < sccs.size(); ++scc) {
+      for (FunctionDecl* f : sccs[scc])
+        for (FunctionDecl* callee : callees[f])
+          if (sccIndex.count(callee) && sccIndex[callee] != scc)
+            depth[scc] = std::max(depth[scc], depth[sccIndex[callee]] + 1);
+      if (depth[scc] >= levels.size()) levels.resize(depth[scc] + 1);
+      levels[depth[scc]].push_back(scc);
+    }
+
+    for (auto& level : levels) summarizeLevel(level);
+  }
+
+  /// @brief Prepares for summarizing functions one at a time with
+  /// summarize(), as their bodies become available. Until then, every
+  /// function has the most conservative summary.
+  void beginIncremental() {
+    for (auto& entry : ont.functionSpace) {
+      FunctionDecl* f = entry.second;
+      summaries[f] =
+        FunctionSummary::unknown(f->getParameters()->asArrayRef().size());
+    }
+  }
+
+  /// @brief Summarizes @p f, whose body must be available, given the current
+  /// summaries of its callees. Callees that have not been summarized yet are
+  /// assumed to do anything, so the result is sound but may be less precise
+  /// than after run(). `beginIncremental` must have been called.
+  void summarize(FunctionDecl* f) {
+    if (!isSummarized(f)) return;
+    summaries[f] = FunctionSummary(f->getParameters()->asArrayRef().size());
+    summarizeSCC({f});
+  }
+
+  /// @brief Returns the summary of @p f. `run` must have been called.
+  const FunctionSummary& lookup(const FunctionDecl* f) const {
+    auto it = summaries.find(f);
+    assert(it != summaries.end() && "function was not summarized");
+    return it->second;
+  }
+
+private:
+  const Ontology& ont;
+  unsigned numThreads;
+
+  /// @brief Extern and async functions get the most conservative summary.
+  /// The frame of an async function captures every parameter, and its body
+  /// runs after the call has returned.
+  static bool isSummarized(const FunctionDecl* f)
+    { return f->hasBody() && !f->isAsync(); }
+
+  /// @brief Levels with fewer SCCs than this are summarized sequentially
+  /// since spawning threads would cost more than it saves.
+  static constexpr unsigned parallelThreshold = 16;
+
+  llvm::DenseMap<const FunctionDecl*, FunctionSummary> summaries;
+  llvm::DenseMap<FunctionDecl*, std::vector<FunctionDecl*>> callees;
+  std::vector<std::vector<FunctionDecl*>> sccs;
+  llvm::DenseMap<FunctionDecl*, unsigned> sccIndex;
+
+  // Tarjan's algorithm state
+  llvm::DenseMap<FunctionDecl*, unsigned> dfsIndex, lowLink;
+  std::vector<FunctionDecl*> tarjanStack;
+  llvm::DenseMap<FunctionDecl*, bool> onStack;
+
+  /// @brief Records the (non-builtin) callees that appear in @p f's body.
+  void buildCallGraph(FunctionDecl* f) {
+    std::vector<FunctionDecl*>& out = callees[f];
+    std::vector<AST*> worklist = { f->getBody() };
+    while (!worklist.empty()) {
+      AST* ast = worklist.back();
+      worklist.pop_back();
+      if (auto call = CallExp::downcast(ast)) {
+        if (!call->isBuiltin())
+          out.push_back(ont.getFunction(call->getFunction()->asStringRef()));
+        else if (Name* comparator = call->getComparator())
+          out.push_back(ont.getFunction(comparator->asStringRef()));
+      }
+      for (AST* child : ast->getASTChildren()) worklist.push_back(child);
+    }
+  }
+
+  /// @brief Tarjan's SCC algorithm. Only summarized functions are nodes; the
+  /// others already have their (final) summaries.
+  void tarjan(FunctionDecl* f) {
+    unsigned index = dfsIndex.size();
+    dfsIndex[f] = index;
+    lowLink[f] = index;
+    tarjanStack.push_back(f);
+    onStack[f] = true;
+    for (FunctionDecl* callee : callees[f]) {
+      if (!isSummarized(callee)) continue;
+      if (!dfsIndex.count(callee)) {
+        tarjan(callee);
+        lowLink[f] = std::min(lowLink[f], lowLink[callee]);
+      } else if (onStack[callee]) {
+        lowLink[f] = std::min(lowLink[f], dfsIndex[callee]);
+      }
+    }
+    if (lowLink[f] == dfsIndex[f]) {
+      sccs.emplace_back();
+      FunctionDecl* member;
+      do {
+        member = tarjanStack.back();
+        tarjanStack.pop_back();
+        onStack[member] = false;
+        sccIndex[member] = sccs.size() - 1;
+        sccs.back().push_back(member);
+      } while (member != f);
+    }
+  }
+
+  /// @brief Summarizes the SCCs in @p level, which must not call each other.
+  void summarizeLevel(const std::vector<unsigned>& level) {
+    if (level.size() < parallelThreshold || numThreads == 1) {
+      for (unsigned scc : level) summarizeSCC(sccs[scc]);
+      return;
+    }
+    std::atomic<unsigned> next(0);
+    std::vector<std::thread> workers;
+    unsigned n = std::min<unsigned>(numThreads, level.size());
+    for (unsigned i = 0; i < n; ++i) {
+      workers.emplace_back([&]() {
+        for (unsigned j = next++; j < level.size(); j = next++)
+          summarizeSCC(sccs[level[j]]);
+      });
+    }
+    for (std::thread& worker : workers) worker.join();
+  }
+
+  /// @brief Iterates the summaries of all functions in @p scc to a fixpoint.
+  /// Only the entries of @p scc are written.
+  void summarizeSCC(const std::vector<FunctionDecl*>& scc) {
+    bool changed;
+    do {
+      changed = false;
+      for (FunctionDecl* f : scc) {
+        FunctionSummary s = Summarizer(*this, f).run();
+        if (s != summaries[f]) {
+          summaries[f] = std::move(s);
+          changed = true;
+        }
+      }
+    } while (changed);
+  }
+
+  /// @brief What a value may point into: the memory reachable from some
+  /// parameters, memory local to the function (its stack), and/or external
+  /// memory (globals, the heap, or anything else).
+  struct Provenance {
+    llvm::SmallBitVector params;
+    bool local = false;
+    bool external = false;
+
+    explicit Provenance(unsigned numParams = 0) : params(numParams) {}
+
+    bool isEmpty() const { return params.none() && !local && !external; }
+    bool isNonLocal() const { return params.any() || external; }
+
+    /// @brief Adds @p that to this. Returns true if this changed.
+    bool join(const Provenance& that) {
+      bool changed = (that.params & ~params).any()
+        || (that.local && !local) || (that.external && !external);
+      params |= that.params;
+      local |= that.local;
+      external |= that.external;
+      return changed;
+    }
+  };
+
+  /// @brief Computes the summary of one function given the current summaries
+  /// of its callees.
+  ///
+  /// The analysis is flow-insensitive: each local variable has a single
+  /// provenance that is the join of everything ever assigned to it, and the
+  /// body is re-walked until those provenances stop growing.
+  class Summarizer {
+    FunctionSummaries& parent;
+    FunctionDecl* func;
+    unsigned numParams;
+    FunctionSummary out;
+
+    /// @brief Provenance of each local variable. Parameters come first.
+    std::vector<Provenance> vars;
+    /// @brief Variables whose address was taken. Their contents may also be
+    /// written through that address, so reads of them see localContents.
+    std::vector<bool> addressTaken;
+    llvm::DenseMap<LetExp*, unsigned> letVars;
+    ScopeStack<unsigned> scope;
+
+    /// @brief Join of everything stored into the function's own stack memory.
+    Provenance localContents;
+
+    /// @brief Join of the parameters that may have escaped into non-local
+    /// memory; loading from non-local memory may yield any of them.
+    Provenance escaped;
+
+    Provenance returned;
+    bool changed;
+
+  public:
+    Summarizer(FunctionSummaries& parent, FunctionDecl* func)
+      : parent(parent), func(func),
+        numParams(func->getParameters()->asArrayRef().size()),
+        out(numParams), localContents(numParams), escaped(numParams),
+        returned(numParams) {}
+
+    FunctionSummary run() {
+      auto params = func->getParameters()->asArrayRef();
+      for (unsigned i = 0; i < numParams; ++i) {
+        vars.push_back(Provenance(numParams));
+        vars.back().params.set(i);
+        addressTaken.push_back(false);
+        scope.add(params[i].first->asStringRef(), i);
+      }
+      do {
+        changed = false;
+        returned.join(visit(func->getBody()));
+      } while (changed);
+      out.capturedParams = escaped.params;
+      out.returnedParams = returned.params;
+      out.returnsExternal = returned.external;
+      return out;
+    }
+
+  private:
+    Provenance none() const { return Provenance(numParams); }
+
+    /// @brief Provenance of string literals and global constants.
+    Provenance constant() const {
+      Provenance ret = none();
+      ret.external = true;
+      return ret;
+    }
+
+    void note(bool grew) { changed |= grew; }
+
+    void effect(FunctionSummary::Memory m)
+      { if (m > out.memory) out.memory = m; }
+
+    /// @brief Provenance of a value loaded from an address with provenance
+    /// @p addr.
+    Provenance load(const Provenance& addr) {
+      Provenance ret = addr;
+      if (addr.local) ret.join(localContents);
+      if (addr.isNonLocal()) {
+        effect(FunctionSummary::READ);
+        ret.join(escaped);
+        ret.external = true;
+      }
+      return ret;
+    }
+
+    /// @brief Records a store of a value with provenance @p val through an
+    /// address with provenance @p addr.
+    void store(const Provenance& addr, const Provenance& val) {
+      if (addr.local) note(localContents.join(val));
+      if (addr.isNonLocal()) {
+        effect(FunctionSummary::READWRITE);
+        note(escape(val));
+        out.writtenParams |= addr.params;
+      }
+    }
+
+    /// @brief Effect and result of waiting for a future. Any other task may
+    /// run in the meantime, and the result may be anything those tasks saw.
+    Provenance suspend() {
+      effect(FunctionSummary::READWRITE);
+      Provenance ret = escaped;
+      ret.external = true;
+      return ret;
+    }
+
+    /// @brief Records that @p val may be stored in non-local memory.
+    bool escape(const Provenance& val) {
+      Provenance params = none();
+      params.params = val.params;
+      return escaped.join(params);
+    }
+
+    /// @brief Provenance of the value of variable @p var.
+    Provenance read(unsigned var) {
+      Provenance ret = vars[var];
+      if (addressTaken[var]) ret.join(localContents);
+      return ret;
+    }
+
+    /// @brief The target of an assignment or address-of: either a local
+    /// variable (by index) or memory at some address.
+    struct Target { int var; Provenance addr; };
+
+    Target lvalue(Exp* _e) {
+      if (auto e = AscripExp::downcast(_e))
+        return lvalue(e->getAscriptee());
+      if (auto e = DerefExp::downcast(_e))
+        return { -1, visit(e->getOf()) };
+      if (auto e = NameExp::downcast(_e)) {
+        unsigned var = scope.getOrElse(e->getName()->asStringRef(), ~0u);
+        if (var == ~0u) return { -1, constant() };
+        return { (int)var, none() };
+      }
+      if (auto e = ProjectExp::downcast(_e)) {
+        if (e->getKind() == ProjectExp::DOT) return lvalue(e->getBase());
+        return { -1, visit(e->getBase()) };
+      }
+      llvm_unreachable("Summarizer::lvalue() unexpected lvalue");
+    }
+
+    /// @brief Returns the address of @p target, marking a variable as
+    /// address-taken.
+    Provenance addressOf(const Target& target) {
+      if (target.var < 0) return target.addr;
+      if (!addressTaken[target.var]) {
+        addressTaken[target.var] = true;
+        note(true);
+      }
+      note(localContents.join(vars[target.var]));
+      Provenance ret = none();
+      ret.local = true;
+      return ret;
+    }
+
+    void assign(const Target& target, const Provenance& val) {
+      if (target.var < 0) return store(target.addr, val);
+      note(vars[target.var].join(val));
+      note(localContents.join(val));
+    }
+
+    /// @brief Visits @p e for its effects and returns the provenance of its
+    /// value. Values of primitive type cannot point anywhere.
+    Provenance visit(Exp* e) {
+      Provenance ret = visitExp(e);
+      if (e->getType() && PrimitiveType::downcast(e->getType())) return none();
+      return ret;
+    }
+
+    Provenance visitExp(Exp* _e) {
+      if (auto e = AddrOfExp::downcast(_e))
+        return addressOf(lvalue(e->getOf()));
+      if (auto e = AscripExp::downcast(_e))
+        return visit(e->getAscriptee());
+      if (auto e = AssignExp::downcast(_e)) {
+        Target target = lvalue(e->getLHS());
+        assign(target, visit(e->getRHS()));
+        return none();
+      }
+      if (auto e = AwaitExp::downcast(_e)) {
+        visit(e->getInner());
+        return suspend();
+      }
+      if (auto e = BinopExp::downcast(_e)) {
+        visit(e->getLHS());
+        visit(e->getRHS());
+        return none();
+      }
+      if (auto e = BlockExp::downcast(_e)) {
+        Provenance ret = none();
+        scope.push();
+        for (Exp* stmt : e->getStatements()) ret = visit(stmt);
+        scope.pop();
+        return ret;
+      }
+      if (auto e = BorrowExp::downcast(_e))
+        return visit(e->getRefExp());
+      if (auto e = CallExp::downcast(_e))
+        return visitCall(e);
+      if (auto e = ConstrExp::downcast(_e)) {
+        Provenance ret = none();
+        for (Exp* field : e->getFields()->asArrayRef()) ret.join(visit(field));
+        return ret;
+      }
+      if (auto e = DerefExp::downcast(_e))
+        return load(visit(e->getOf()));
+      if (auto e = IfExp::downcast(_e)) {
+        visit(e->getCondExp());
+        Provenance ret = visit(e->getThenExp());
+        if (e->getElseExp()) ret.join(visit(e->getElseExp()));
+        return ret;
+      }
+      if (auto e = IndexExp::downcast(_e)) {
+        visit(e->getIndex());
+        return visit(e->getBase());
+      }
+      if (auto e = LetExp::downcast(_e)) {
+        Provenance val = visit(e->getDefinition());
+        auto inserted = letVars.insert({ e, vars.size() });
+        if (inserted.second) {
+          vars.push_back(none());
+          addressTaken.push_back(false);
+        }
+        unsigned var = inserted.first->second;
+        note(vars[var].join(val));
+        scope.add(e->getBoundIdent()->asStringRef(), var);
+        return none();
+      }
+      if (auto e = MoveExp::downcast(_e))
+        return visit(e->getRefExp());
+      if (auto e = NameExp::downcast(_e)) {
+        unsigned var = scope.getOrElse(e->getName()->asStringRef(), ~0u);
+        if (var == ~0u) return constant();
+        return read(var);
+      }
+      if (auto e = ProjectExp::downcast(_e)) {
+        Provenance base = visit(e->getBase());
+        return e->getKind() == ProjectExp::ARROW ? load(base) : base;
+      }
+      if (auto e = ReturnExp::downcast(_e)) {
+        returned.join(visit(e->getReturnee()));
+        return none();
+      }
+      if (StringLit::downcast(_e))
+        return constant();
+      if (auto e = UnopExp::downcast(_e)) {
+        visit(e->getInner());
+        return none();
+      }
+      if (auto e = WhileExp::downcast(_e)) {
+        visit(e->getCond());
+        visit(e->getBody());
+        return none();
+      }
+      if (BoolLit::downcast(_e) || DecimalLit::downcast(_e)
+          || IntLit::downcast(_e))
+        return none();
+      llvm_unreachable("Summarizer::visitExp() unexpected expression");
+    }
+
+    Provenance visitCall(CallExp* e) {
+      auto args = e->getArguments()->asArrayRef();
+      std::vector<Provenance> argProvs;
+      for (Exp* arg : args) argProvs.push_back(visit(arg));
+      if (e->getBuiltin() == CallExp::BLOCK_ON) return suspend();
+      if (e->getBuiltin() == CallExp::LOWER_BOUND) {
+        load(argProvs[0]);
+        return none();
+      }
+      if (e->isSortCall()) return sort(e, argProvs[0]);
+      if (e->isBuiltin() && !e->isAllocatorCall()) return none();
+
+      // the allocator is summarized like an extern function
+      FunctionSummary allocator = FunctionSummary::unknown(args.size());
+      const FunctionSummary& cs = e->isAllocatorCall() ? allocator
+        : parent.summaries.find(parent.ont.getFunction(
+            e->getFunction()->asStringRef()))->second;
+      effect(cs.memory);
+
+      Provenance ret = none();
+      if (cs.returnsExternal) {
+        ret.join(escaped);
+        ret.external = true;
+      }
+      for (unsigned i = 0; i < argProvs.size(); ++i) {
+        const Provenance& arg = argProvs[i];
+        // extra variadic arguments are treated like extern parameters
+        bool variadic = i >= cs.writtenParams.size();
+        if (variadic || cs.writtenParams[i]) {
+          if (arg.isNonLocal()) out.writtenParams |= arg.params;
+          if (arg.local) {
+            Provenance written = escaped;
+            written.external = true;
+            note(localContents.join(written));
+          }
+        }
+        if (variadic || cs.capturedParams[i]) {
+          note(escape(arg));
+          note(localContents.join(arg));
+        }
+        if (variadic || cs.returnedParams[i])
+          ret.join(arg);
+      }
+      return ret;
+    }
+
+    /// @brief Effect of sorting call @p e on the elements at @p elems. The
+    /// elements are permuted in place, and a comparator is called with
+    /// references to them.
+    Provenance sort(CallExp* e, const Provenance& elems) {
+      Exp* ref = e->getArguments()->asArrayRef()[0];
+      Provenance elem = load(elems);
+      if (PrimitiveType::downcast(RefType::downcast(ref->getType())->inner))
+        elem = none();
+      store(elems, elem);
+      if (Name* comparator = e->getComparator()) {
+        const FunctionSummary& cs = parent.summaries.find(
+          parent.ont.getFunction(comparator->asStringRef()))->second;
+        effect(cs.memory);
+        if (!cs.isNoCapture(0) || !cs.isNoCapture(1)) note(escape(elems));
+      }
+      return none();
+    }
+  };
+};
+
+#endif
@@ -2,9 +2,11 @@
 #define BORROWCHECKER_HPP
 
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include "common/AST.hpp"
 #include "common/LocatedError.hpp"
 #include "common/TypeContext.hpp"
+#include "analysis/FunctionSummaries.hpp"
 #include "borrowchecker/AccessPath.hpp"
 #include "borrowchecker/BorrowState.hpp"
 
@@ -12,7 +14,12 @@
 /// used once and moved refs are replaced.
 class BorrowChecker {
 public:
-  BorrowChecker(TypeContext& tc, const Ontology& ont) : tc(tc), ont(ont) {}
+  /// @brief If @p summaries is given, references to constants may be passed
+  /// to parameters that their summaries show are neither written nor
+  /// captured.
+  BorrowChecker(TypeContext& tc, const Ontology& ont,
+                const FunctionSummaries* summaries = nullptr)
+    : tc(tc), ont(ont), summaries(summaries) {}
 
   /// @brief Borrow-check a declaration.
   void checkDecl(Decl* d) {
@@ -20,7 +27,7 @@ public:
       checkFunctionDecl(funcDecl);
     else if (auto modDecl = ModuleDecl::downcast(d))
       checkModuleDecl(modDecl);
-    else if (StructDecl::downcast(d))
+    else if (StructDecl::downcast(d) || ConstDecl::downcast(d))
       {}
     else
       llvm_unreachable("BorrowChecker::checkDecl(): unrecognized decl form.");
@@ -57,12 +64,14 @@ public:
 
     // TODO: make helper function to narrow the location for block exps
     Location loc;
-    if (auto block = BlockExp::downcast(body))
-      loc = block->getStatements().back()->getLocation();
+    auto blockExp = BlockExp::downcast(body);
+    if (blockExp && !blockExp->getStatements().empty())
+      loc = blockExp->getStatements().back()->getLocation();
     else
       loc = body->getLocation();
     for (AccessPath* ext : looseExtensionsOf(retAP, body->getType()))
       block.use(ext, loc);
+    checkNoConstRef(retAP, body->getType(), loc);
 
     // produce errors for any remaining unused paths
     for (auto unused : block.getUnusedPaths())
@@ -98,8 +107,14 @@ public:
     }
     else if (auto e = AssignExp::downcast(_e)) {
       AccessPath* lhsAP = check(e->getLHS());
+      if (ConstDecl* c = constRootOf(lhsAP))
+        errors.push_back(LocatedError()
+          << "Cannot assign to read-only data of constant "
+          << c->getName()->asStringRef() << ".\n" << e->getLHS()->getLocation()
+        );
       AccessPath* rhsAP = check(e->getRHS());
       Type* rhsType = e->getRHS()->getType();
+      checkNoConstRef(rhsAP, rhsType, e->getRHS()->getLocation());
       auto lhsLooseExts = looseExtensionsOf(lhsAP, rhsType);
       auto rhsLooseExts = looseExtensionsOf(rhsAP, rhsType);
       for (AccessPath* ext : rhsLooseExts)
@@ -108,6 +123,24 @@ public:
         bs->unmove(ext, e->getLHS()->getLocation());
       return nullptr;
     }
+    else if (auto e = AwaitExp::downcast(_e)) {
+      Exp* inner = e->getInner();
+      AccessPath* futureAP = check(inner);
+      for (AccessPath* ext : looseExtensionsOf(futureAP, inner->getType()))
+        bs->use(ext, inner->getLocation());
+      // other tasks run while this one is suspended and must not observe a
+      // moved-out unique reference
+      for (auto moved : bs->getMovedPaths())
+        errors.push_back(LocatedError()
+          << "Moved value " << moved.first->asString() << " moved here:\n"
+          << moved.second << "must be replaced before this await:\n"
+          << e->getLocation()
+        );
+      AccessPath* ret = apm.getRoot(freshInternalVar());
+      for (auto looseExt : looseExtensionsOf(ret, e->getType()))
+        bs->intro(looseExt, e->getLocation());
+      return ret;
+    }
     else if (auto e = BinopExp::downcast(_e)) {
       check(e->getLHS());
       check(e->getRHS());
@@ -137,8 +170,15 @@ public:
       return ret;
     }
     else if (auto e = CallExp::downcast(_e)) {
+      // these builtins only read through their arguments
+      bool readOnly = e->getBuiltin() == CallExp::LOWER_BOUND
+                   || e->getBuiltin() == CallExp::PREFETCH;
+      llvm::SmallVector<AccessPath*> argAPs;
       for (auto arg : e->getArguments()->asArrayRef()) {
         AccessPath* argAP = check(arg);
+        argAPs.push_back(argAP);
+        if (!readOnly && !isBorrowedOnly(e, argAPs.size() - 1))
+          checkNoConstRef(argAP, arg->getType(), arg->getLocation());
         for (AccessPath* ext : looseExtensionsOf(argAP, arg->getType())) {
           bs->use(ext, arg->getLocation());
         }
@@ -147,6 +187,14 @@ public:
       for (auto looseExt : looseExtensionsOf(ret, e->getType())) {
         bs->intro(looseExt, e->getLocation());
       }
+      // a future keeps running while its caller waits, so the unique refs its
+      // arguments borrow must stay untouched until it is awaited
+      if (FutureType::downcast(e->getType())) {
+        auto args = e->getArguments()->asArrayRef();
+        for (unsigned i = 0; i < args.size(); ++i)
+          for (AccessPath* lent : lentBy(args[i], argAPs[i]))
+            bs->lend(lent, ret, e->getLocation());
+      }
       return ret;
     }
     else if (auto e = ConstrExp::downcast(_e)) {
@@ -180,6 +228,7 @@ public:
       AccessPath* thenAP = check(e->getThenExp());
       for (AccessPath* ap : looseExtensionsOf(thenAP, e->getType()))
         bs->use(ap, e->getThenExp()->getLocation());
+      checkNoConstRef(thenAP, e->getType(), e->getThenExp()->getLocation());
 
       if (e->getElseExp() != nullptr) {
         BorrowState afterElse = *afterCond;
@@ -187,6 +236,7 @@ public:
         AccessPath* elseAP = check(e->getElseExp());
         for (AccessPath* ap : looseExtensionsOf(elseAP, e->getType()))
           bs->use(ap, e->getElseExp()->getLocation());
+        checkNoConstRef(elseAP, e->getType(), e->getElseExp()->getLocation());
 
         afterThen.merge(afterElse, e->getLocation(), *afterCond);
         *afterCond = afterThen;
@@ -281,10 +331,81 @@ private:
 
   const Ontology& ont;
 
+  const FunctionSummaries* summaries;
+
   BorrowState* bs;
 
   int nextInternalVar = 0;
 
+  /// @brief Returns the global constant that @p path is rooted at, or nullptr
+  /// if its root is a local variable.
+  ConstDecl* constRootOf(AccessPath* path) {
+    if (path == nullptr) return nullptr;
+    while (auto nonRoot = NonRootPath::downcast(path))
+      path = nonRoot->getBase();
+    return ont.getConst(RootPath::downcast(path)->asString());
+  }
+
+  /// @brief Returns a constant whose read-only data a value of type @p t at
+  /// @p path refers to, or nullptr if there is none.
+  /// @param visiting structs whose fields are already being searched
+  ConstDecl* constTargetOf(AccessPath* path, Type* t,
+                           llvm::SmallPtrSetImpl<StructDecl*>& visiting) {
+    if (auto ty = RefType::downcast(t)) {
+      AccessPath* target = apm.getDeref(path);
+      if (ConstDecl* c = constRootOf(target)) return c;
+      return constTargetOf(target, ty->inner, visiting);
+    }
+    if (auto ty = NameType::downcast(t)) {
+      StructDecl* structDecl = ont.getType(ty->asString);
+      if (!visiting.insert(structDecl).second) return nullptr;
+      for (auto field : structDecl->getFields()->asArrayRef()) {
+        AccessPath* fieldAP =
+          apm.getProject(path, field.first->asStringRef(), false);
+        Type* fieldTy = tc.getTypeFromTypeExp(field.second);
+        if (ConstDecl* c = constTargetOf(fieldAP, fieldTy, visiting))
+          return c;
+      }
+      visiting.erase(structDecl);
+    }
+    return nullptr;
+  }
+
+  /// @brief Pushes an error if the value of type @p t at @p path refers to
+  /// the read-only data of a constant. Such references may only be used
+  /// where the borrow checker follows them (see constRootOf), since writes
+  /// through them would crash.
+  void checkNoConstRef(AccessPath* path, Type* t, Location loc) {
+    if (path == nullptr) return;
+    llvm::SmallPtrSet<StructDecl*, 4> visiting;
+    if (ConstDecl* c = constTargetOf(path, t, visiting))
+      errors.push_back(LocatedError()
+        << "Reference to read-only data of constant "
+        << c->getName()->asStringRef() << " cannot escape here.\n" << loc
+      );
+  }
+
+  /// @brief Returns the unique refs that the argument @p arg gives its callee
+  /// access to: those borrowed by `borrow x`, and those reachable through a
+  /// shared reference such as `&x`.
+  /// @param argAP the access path that checking @p arg returned
+  llvm::SmallVector<AccessPath*> lentBy(Exp* arg, AccessPath* argAP) {
+    if (auto b = BorrowExp::downcast(arg))
+      return looseExtensionsOf(argAP, b->getRefExp()->getType());
+    auto refTy = RefType::downcast(arg->getType());
+    if (argAP == nullptr || refTy == nullptr || refTy->unique) return {};
+    return looseExtensionsOf(apm.getDeref(argAP), refTy->inner);
+  }
+
+  /// @brief True if the summary of the callee of @p call shows that it only
+  /// reads the memory reachable from argument @p i and keeps no copy of it.
+  bool isBorrowedOnly(CallExp* call, unsigned i) {
+    if (summaries == nullptr || call->isBuiltin()) return false;
+    const FunctionSummary& s = summaries->lookup(
+      ont.getFunction(call->getFunction()->asStringRef()));
+    return i < s.writtenParams.size() && s.isReadOnly(i) && s.isNoCapture(i);
+  }
+
   /// @brief Returns a fresh internal variable (like `$42`).
   std::string freshInternalVar()
     { return "$" + std::to_string(++nextInternalVar); }
@@ -304,6 +425,11 @@ private:
     if (auto ty = Constraint::downcast(t)) {
       return {};
     }
+    if (auto ty = FutureType::downcast(t)) {
+      // a future owns its heap-allocated frame, which is freed when the
+      // future is awaited; thus a future must be awaited exactly once
+      return { path };
+    }
     if (auto ty = NameType::downcast(t)) {
       llvm::SmallVector<AccessPath*> ret;
       StructDecl* structDecl = ont.getType(ty->asString);
@@ -33,6 +33,10 @@ class BorrowState {
   /// @brief All _unmoved_ paths with their move and unmove locations.
   llvm::DenseMap<AccessPath*, LocationPair> unmovedPaths;
 
+  /// @brief Paths borrowed by a future, with the future and the location of
+  /// the call that created it. The borrow lasts until the future is used.
+  llvm::DenseMap<AccessPath*, std::pair<AccessPath*, Location>> lentPaths;
+
   llvm::SmallVector<LocatedError>& errors;
 
 public:
@@ -44,6 +48,7 @@ public:
     usedPaths = other.usedPaths;
     movedPaths = other.movedPaths;
     unmovedPaths = other.unmovedPaths;
+    lentPaths = other.lentPaths;
     errors = other.errors;
   }
 
@@ -75,6 +80,7 @@ public:
   /// @return True iff the use was successful. Otherwise an error is pushed.
   bool use(AccessPath* owner, Location loc) {
     assert(owner != nullptr && "Tried to use nullptr");
+    checkNotLent(owner, loc);
     if (Location creationLoc = unusedPaths.lookup(owner)) {
       usedPaths[owner] = LocationPair(creationLoc, loc);
       unusedPaths.erase(owner);
@@ -102,6 +108,7 @@ public:
   /// @param moveLoc Location of `e` in `move e`.
   /// @return true iff the move was successful.
   bool move(AccessPath* path, Location moveLoc) {
+    checkNotLent(path, moveLoc);
     if (Location creatLoc = unusedPaths.lookup(path)) {
       errors.push_back(LocatedError()
         << "Unique reference " << path->asString() << " created here:\n"
@@ -144,6 +151,25 @@ public:
     return false;
   }
 
+  /// @brief Records that the unused @p future, created at @p loc, borrows
+  /// @p path until the future is used (usually by `await`).
+  void lend(AccessPath* path, AccessPath* future, Location loc) {
+    lentPaths[path] = std::make_pair(future, loc);
+  }
+
+  /// @brief Pushes an error if @p path is borrowed by a future that is not
+  /// yet used, since that future may still run and access @p path.
+  /// @param loc location where @p path is used or moved
+  void checkNotLent(AccessPath* path, Location loc) {
+    auto it = lentPaths.find(path);
+    if (it == lentPaths.end() || !unusedPaths.count(it->second.first)) return;
+    errors.push_back(LocatedError()
+      << "Unique reference " << path->asString()
+      << " is borrowed by the future created here:\n" << it->second.second
+      << "so it cannot be used before the future is awaited:\n" << loc
+    );
+  }
+
   /// @brief This block and @p other must branch off the same `previous` block.
   /// Merges the changes that @p other makes with the changes `this` makes.
   /// Basically, if either block changes the status of an access path from
@@ -0,0 +1,740 @@
+#ifndef CODEGEN_ALGORITHMBUILDER
+#define CODEGEN_ALGORITHMBUILDER
+
+#include <functional>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+/// @brief Builds the functions behind the sorting and searching builtins
+/// `sort`, `sort_by`, `radix_sort`, and `lower_bound`.
+///
+/// Each function is specialized to one element type and one order, so that
+/// LLVM can inline the comparisons instead of calling a comparator through a
+/// pointer like `qsort` does. The functions are internal to the module and
+/// are built at most once per specialization; helpers refer to each other by
+/// name (`miscr.<algorithm>.<suffix>`).
+///
+/// Local variables are stack slots that SROA promotes at -O1 and up. Every
+/// scan is bounds-checked, so a comparator that is not a strict weak order
+/// (or NaNs among floats) can garble the result but never makes the
+/// algorithms read or write outside the array.
+class AlgorithmBuilder {
+public:
+  /// @brief How two elements are compared: with `<` on signed or unsigned
+  /// integers or on floats, or by calling a function `(&T, &T): bool`.
+  enum Order { SIGNED, UNSIGNED, FLOAT, COMPARATOR };
+
+  /// @param suffix names this specialization in the names of its functions
+  /// @param comparator the comparison function if @p order is COMPARATOR
+  AlgorithmBuilder(llvm::Module& mod, llvm::Type* elemTy, Order order,
+                   llvm::StringRef suffix,
+                   llvm::FunctionCallee comparator = {})
+    : mod(mod), elemTy(elemTy), order(order), suffix(suffix),
+      comparator(comparator), B(mod.getContext()), usize(B.getInt64Ty()),
+      ptrTy(llvm::PointerType::get(mod.getContext(), 0)) {}
+
+  AlgorithmBuilder(const AlgorithmBuilder&) = delete;
+
+  /// @brief `sort(a, n)` sorts `a[0]` to `a[n-1]` with pattern-defeating
+  /// quicksort (Peters, "Pattern-defeating Quicksort", 2021): quicksort
+  /// with median-of-3 (ninther for large ranges) pivots, insertion sort for
+  /// small ranges, linear time on sorted and reverse-sorted runs and on many
+  /// equal elements, and a heapsort fallback that bounds the worst case to
+  /// O(n log n).
+  llvm::Function* getSort() {
+    if (llvm::Function* f = lookup("sort")) return f;
+    llvm::Function* loop = getPdqsortLoop();
+    llvm::Function* f = create("sort", B.getVoidTy(), { ptrTy, usize });
+    llvm::Value* n = f->getArg(1);
+    ifThen(B.CreateICmpULT(n, B.getInt64(2)), [&]{ B.CreateRetVoid(); });
+    // after log2(n) bad partitions, give up on quicksort
+    llvm::Value* log2 = B.CreateSub(B.getInt64(64),
+      B.CreateIntrinsic(llvm::Intrinsic::ctlz, { usize }, { n, B.getFalse() }));
+    B.CreateCall(loop, { arr, B.getInt64(0), n, log2, B.getTrue() });
+    B.CreateRetVoid();
+    return f;
+  }
+
+  /// @brief `radix_sort(a, n)` sorts `a[0]` to `a[n-1]`, which must be
+  /// integers, with a least-significant-digit radix sort: one pass per byte,
+  /// using a scratch array from @p alloc and @p free. The histograms of all
+  /// bytes are counted in a single first pass, and passes over bytes that
+  /// are equal in all elements are skipped. Small arrays use `sort`.
+  llvm::Function* getRadixSort(llvm::FunctionCallee alloc,
+                               llvm::FunctionCallee free) {
+    if (llvm::Function* f = lookup("radix_sort")) return f;
+    llvm::Function* sort = getSort();
+    llvm::Function* f = create("radix_sort", B.getVoidTy(), { ptrTy, usize });
+    llvm::Value* n = f->getArg(1);
+    ifThen(B.CreateICmpULT(n, B.getInt64(64)), [&]{
+      B.CreateCall(sort, { arr, n });
+      B.CreateRetVoid();
+    });
+
+    unsigned bytes = elemTy->getIntegerBitWidth() / 8;
+    llvm::Type* countsTy = llvm::ArrayType::get(usize, bytes * 256);
+    llvm::AllocaInst* counts = slot(countsTy);
+    B.CreateMemSet(counts, B.getInt8(0), bytes * 256 * 8, llvm::MaybeAlign());
+    auto count = [&](llvm::Value* byte, llvm::Value* digit) {
+      llvm::Value* idx = B.CreateAdd(B.CreateMul(byte, B.getInt64(256)),
+        B.CreateZExt(digit, usize));
+      return B.CreateGEP(countsTy, counts, { B.getInt64(0), idx });
+    };
+    // signed keys are compared as unsigned after flipping the sign bit
+    auto key = [&](llvm::Value* x) {
+      if (order == UNSIGNED) return x;
+      return B.CreateXor(x, llvm::ConstantInt::get(elemTy,
+        llvm::APInt::getSignMask(elemTy->getIntegerBitWidth())));
+    };
+    auto digit = [&](llvm::Value* key, llvm::Value* byte) {
+      llvm::Value* shift = B.CreateTrunc(B.CreateMul(byte, B.getInt64(8)),
+        elemTy);
+      return B.CreateAnd(B.CreateLShr(key, shift),
+        llvm::ConstantInt::get(elemTy, 255));
+    };
+
+    llvm::AllocaInst* i = var(B.getInt64(0));
+    loop([&]{ return B.CreateICmpSLT(get(i), n); }, [&]{
+      llvm::Value* k = key(B.CreateLoad(elemTy, at(arr, get(i))));
+      for (unsigned byte = 0; byte < bytes; ++byte) {
+        llvm::Value* c = count(B.getInt64(byte), digit(k, B.getInt64(byte)));
+        B.CreateStore(B.CreateAdd(B.CreateLoad(usize, c), B.getInt64(1)), c);
+      }
+      set(i, B.CreateAdd(get(i), B.getInt64(1)));
+    });
+
+    llvm::Value* scratch =
+      B.CreateCall(alloc, { B.CreateMul(n, B.getInt64(bytes)) });
+    llvm::Value* key0 = key(B.CreateLoad(elemTy, arr));
+    llvm::AllocaInst* src = var(arr);
+    llvm::AllocaInst* dst = var(scratch);
+    llvm::AllocaInst* byte = var(B.getInt64(0));
+    loop([&]{ return B.CreateICmpULT(get(byte), B.getInt64(bytes)); }, [&]{
+      llvm::Value* b = get(byte);
+      llvm::Value* allSame = B.CreateICmpEQ(
+        B.CreateLoad(usize, count(b, digit(key0, b))), n);
+      ifThen(B.CreateNot(allSame), [&]{
+        // turn the counts into the offsets of the buckets
+        llvm::AllocaInst* d = var(B.getInt64(0));
+        llvm::AllocaInst* sum = var(B.getInt64(0));
+        loop([&]{ return B.CreateICmpULT(get(d), B.getInt64(256)); }, [&]{
+          llvm::Value* c = count(b, get(d));
+          llvm::Value* cnt = B.CreateLoad(usize, c);
+          B.CreateStore(get(sum), c);
+          set(sum, B.CreateAdd(get(sum), cnt));
+          set(d, B.CreateAdd(get(d), B.getInt64(1)));
+        });
+        set(i, B.getInt64(0));
+        loop([&]{ return B.CreateICmpSLT(get(i), n); }, [&]{
+          llvm::Value* x = B.CreateLoad(elemTy, at(get(src), get(i)));
+          llvm::Value* c = count(b, digit(key(x), b));
+          llvm::Value* offset = B.CreateLoad(usize, c);
+          B.CreateStore(x, at(get(dst), offset));
+          B.CreateStore(B.CreateAdd(offset, B.getInt64(1)), c);
+          set(i, B.CreateAdd(get(i), B.getInt64(1)));
+        });
+        llvm::Value* oldSrc = get(src);
+        set(src, get(dst));
+        set(dst, oldSrc);
+      });
+      set(byte, B.CreateAdd(b, B.getInt64(1)));
+    });
+    ifThen(B.CreateICmpNE(get(src), arr), [&]{
+      B.CreateMemCpy(arr, llvm::MaybeAlign(), get(src), llvm::MaybeAlign(),
+        B.CreateMul(n, B.getInt64(bytes)));
+    });
+    B.CreateCall(free, { scratch });
+    B.CreateRetVoid();
+    return f;
+  }
+
+  /// @brief `lower_bound(a, n, x)` returns the index of the first of the
+  /// sorted elements `a[0]` to `a[n-1]` that is not less than `x`, or `n`
+  /// if there is none. The binary search is branchless: each step halves
+  /// the range with a conditional move, so there are no mispredictions.
+  llvm::Function* getLowerBound() {
+    if (llvm::Function* f = lookup("lower_bound")) return f;
+    llvm::Function* f =
+      create("lower_bound", usize, { ptrTy, usize, elemTy });
+    llvm::Value* n = f->getArg(1);
+    llvm::AllocaInst* x = var(f->getArg(2));
+    ifThen(B.CreateICmpEQ(n, B.getInt64(0)), [&]{
+      B.CreateRet(B.getInt64(0));
+    });
+    llvm::AllocaInst* base = var(B.getInt64(0));
+    llvm::AllocaInst* len = var(n);
+    loop([&]{ return B.CreateICmpUGT(get(len), B.getInt64(1)); }, [&]{
+      llvm::Value* half = B.CreateLShr(get(len), 1);
+      llvm::Value* mid = B.CreateAdd(get(base), half);
+      set(base, B.CreateSelect(less(at(arr, mid), x), mid, get(base)));
+      set(len, B.CreateSub(get(len), half));
+    });
+    llvm::Value* b = get(base);
+    B.CreateRet(B.CreateAdd(b, B.CreateZExt(less(at(arr, b), x), usize)));
+    return f;
+  }
+
+private:
+  llvm::Module& mod;
+  llvm::Type* elemTy;
+  Order order;
+  std::string suffix;
+  llvm::FunctionCallee comparator;
+  llvm::IRBuilder<> B;
+  llvm::Type* usize;  // counts and indices
+  llvm::Type* ptrTy;
+
+  /// @brief The array (first argument) of the function being built.
+  llvm::Value* arr = nullptr;
+
+  /// @brief Ranges shorter than this are insertion sorted.
+  static constexpr uint64_t INSERTION_SORT_THRESHOLD = 24;
+
+  /// @brief Ranges longer than this get ninther pivots.
+  static constexpr uint64_t NINTHER_THRESHOLD = 128;
+
+  /// @brief Partial insertion sort gives up after moving this many elements.
+  static constexpr uint64_t PARTIAL_INSERTION_SORT_LIMIT = 8;
+
+  /// @brief Block partitioning looks at this many elements per block.
+  static constexpr uint64_t BLOCK_SIZE = 64;
+
+  //==========================================================================//
+  // pdqsort
+  //==========================================================================//
+
+  /// @brief `pdqsort_loop(a, begin, end, badAllowed, leftmost)` sorts
+  /// `a[begin]` to `a[end-1]`. @p leftmost is false if `a[begin-1]` is a
+  /// pivot of an enclosing partition, and thus not greater than any element
+  /// in the range.
+  llvm::Function* getPdqsortLoop() {
+    if (llvm::Function* f = lookup("pdqsort_loop")) return f;
+    llvm::Function* insertionSort = getInsertionSort();
+    llvm::Function* partialInsertionSort = getPartialInsertionSort();
+    llvm::Function* heapsort = getHeapsort();
+    llvm::Function* partitionLeft = getPartitionLeft();
+    llvm::Function* partitionRight = getPartitionRight();
+    llvm::Function* f = create("pdqsort_loop", B.getVoidTy(),
+      { ptrTy, usize, usize, usize, B.getInt1Ty() });
+    llvm::Value* end = f->getArg(2);
+    llvm::AllocaInst* begin = var(f->getArg(1));
+    llvm::AllocaInst* badAllowed = var(f->getArg(3));
+    llvm::AllocaInst* leftmost = var(f->getArg(4));
+
+    // sorts the left partition recursively and loops on the right one
+    loop(nullptr, [&]{
+      llvm::Value* bg = get(begin);
+      llvm::Value* size = B.CreateSub(end, bg);
+      ifThen(B.CreateICmpSLT(size, B.getInt64(INSERTION_SORT_THRESHOLD)),
+        [&]{
+          B.CreateCall(insertionSort, { arr, bg, end });
+          B.CreateRetVoid();
+        });
+
+      // move the pivot to a[begin]
+      llvm::Value* s2 = B.CreateLShr(size, 1);
+      llvm::Value* mid = B.CreateAdd(bg, s2);
+      ifThen(B.CreateICmpSGT(size, B.getInt64(NINTHER_THRESHOLD)), [&]{
+        sort3(bg, mid, add(end, -1));
+        sort3(add(bg, 1), add(mid, -1), add(end, -2));
+        sort3(add(bg, 2), add(mid, 1), add(end, -3));
+        sort3(add(mid, -1), mid, add(mid, 1));
+        swap(at(arr, bg), at(arr, mid));
+      }, [&]{
+        sort3(mid, bg, add(end, -1));
+      });
+
+      // if the pivot equals the enclosing pivot (which is not greater), put
+      // all elements equal to it on the left; they need no more sorting
+      llvm::Value* equalsPrev = andAlso(B.CreateNot(get(leftmost)), [&]{
+        return B.CreateNot(less(at(arr, add(bg, -1)), at(arr, bg)));
+      });
+      ifThen(equalsPrev, [&]{
+        llvm::Value* pivotPos = B.CreateCall(partitionLeft, { arr, bg, end });
+        set(begin, add(pivotPos, 1));
+      }, [&]{
+        llvm::Value* partition =
+          B.CreateCall(partitionRight, { arr, bg, end });
+        llvm::Value* pivotPos = B.CreateExtractValue(partition, 0);
+        llvm::Value* alreadyPartitioned = B.CreateExtractValue(partition, 1);
+        llvm::Value* lSize = B.CreateSub(pivotPos, bg);
+        llvm::Value* rSize = B.CreateSub(end, add(pivotPos, 1));
+        llvm::Value* eighth = B.CreateLShr(size, 3);
+        llvm::Value* unbalanced = B.CreateOr(B.CreateICmpSLT(lSize, eighth),
+          B.CreateICmpSLT(rSize, eighth));
+        ifThen(unbalanced, [&]{
+          set(badAllowed, add(get(badAllowed), -1));
+          ifThen(B.CreateICmpEQ(get(badAllowed), B.getInt64(0)), [&]{
+            B.CreateCall(heapsort, { arr, bg, end });
+            B.CreateRetVoid();
+          });
+          // break patterns that may have caused the bad partition
+          breakPatterns(bg, lSize);
+          breakPatterns(add(pivotPos, 1), rSize);
+        }, [&]{
+          // an already partitioned range may well be sorted
+          llvm::Value* sorted = andAlso(alreadyPartitioned, [&]{
+            return andAlso(
+              B.CreateCall(partialInsertionSort, { arr, bg, pivotPos }),
+              [&]{ return B.CreateCall(partialInsertionSort,
+                     { arr, add(pivotPos, 1), end }); });
+          });
+          ifThen(sorted, [&]{ B.CreateRetVoid(); });
+        });
+        B.CreateCall(f, { arr, bg, pivotPos, get(badAllowed),
+                          get(leftmost) });
+        set(begin, add(pivotPos, 1));
+        set(leftmost, B.getFalse());
+      });
+    });
+    B.CreateUnreachable();
+    return f;
+  }
+
+  /// @brief Swaps a few elements of the @p size elements at @p first to
+  /// break up patterns, such as organ pipes, that lead to bad pivots.
+  void breakPatterns(llvm::Value* first, llvm::Value* size) {
+    llvm::Value* last = B.CreateAdd(first, size);
+    ifThen(B.CreateICmpSGE(size, B.getInt64(INSERTION_SORT_THRESHOLD)),
+      [&]{
+        llvm::Value* quarter = B.CreateLShr(size, 2);
+        swap(at(arr, first), at(arr, B.CreateAdd(first, quarter)));
+        swap(at(arr, add(last, -1)), at(arr, B.CreateSub(last, quarter)));
+        ifThen(B.CreateICmpSGT(size, B.getInt64(NINTHER_THRESHOLD)), [&]{
+          swap(at(arr, add(first, 1)),
+               at(arr, add(B.CreateAdd(first, quarter), 1)));
+          swap(at(arr, add(first, 2)),
+               at(arr, add(B.CreateAdd(first, quarter), 2)));
+          swap(at(arr, add(last, -2)),
+               at(arr, add(B.CreateSub(last, quarter), -1)));
+          swap(at(arr, add(last, -3)),
+               at(arr, add(B.CreateSub(last, quarter), -2)));
+        });
+      });
+  }
+
+  /// @brief `partition_right(a, begin, end)` partitions the range around
+  /// the pivot `a[begin]`: smaller elements go left, equal and greater ones
+  /// right. Returns the final position of the pivot, and whether the range
+  /// was already partitioned (no elements had to be swapped).
+  llvm::Function* getPartitionRight() {
+    if (llvm::Function* f = lookup("partition_right")) return f;
+    llvm::Type* retTy =
+      llvm::StructType::get(mod.getContext(), { usize, B.getInt1Ty() });
+    llvm::Function* f =
+      create("partition_right", retTy, { ptrTy, usize, usize });
+    llvm::Value* begin = f->getArg(1);
+    llvm::Value* end = f->getArg(2);
+    llvm::AllocaInst* pivot = var(B.CreateLoad(elemTy, at(arr, begin)));
+    llvm::AllocaInst* first = var(begin);
+    llvm::AllocaInst* last = var(end);
+    // find the first element not less than the pivot...
+    auto advanceFirst = [&]{
+      loop([&]{ return andAlso(B.CreateICmpSLT(add(get(first), 1), end), [&]{
+        set(first, add(get(first), 1));
+        return less(at(arr, get(first)), pivot);
+      }); }, nullptr);
+    };
+    // ...and the last element less than the pivot
+    auto retreatLast = [&]{
+      loop([&]{ return andAlso(B.CreateICmpSGT(add(get(last), -1), begin),
+        [&]{
+          set(last, add(get(last), -1));
+          return B.CreateNot(less(at(arr, get(last)), pivot));
+        }); }, nullptr);
+    };
+    advanceFirst();
+    ifThen(B.CreateICmpEQ(add(get(first), -1), begin), [&]{
+      // no element was less than the pivot, so the scan must stop at first
+      loop([&]{ return andAlso(B.CreateICmpSLT(get(first), get(last)), [&]{
+        set(last, add(get(last), -1));
+        return B.CreateNot(less(at(arr, get(last)), pivot));
+      }); }, nullptr);
+    }, retreatLast);
+    llvm::Value* alreadyPartitioned =
+      B.CreateICmpSGE(get(first), get(last));
+    auto hoarePartition = [&]{
+      loop([&]{ return B.CreateICmpSLT(get(first), get(last)); }, [&]{
+        swap(at(arr, get(first)), at(arr, get(last)));
+        advanceFirst();
+        retreatLast();
+      });
+    };
+    if (order == COMPARATOR) hoarePartition();
+    else ifThen(B.CreateNot(alreadyPartitioned), [&]{
+      // Cheap comparisons are not worth a branch misprediction each, so
+      // partition blocks at a time (Edelkamp and Weiss, "BlockQuicksort",
+      // 2016): first note the misplaced elements of a block at either end
+      // without branching on them, then swap them pairwise.
+      swap(at(arr, get(first)), at(arr, get(last)));
+      set(first, add(get(first), 1));
+      llvm::Type* offsetsTy = llvm::ArrayType::get(B.getInt8Ty(), BLOCK_SIZE);
+      llvm::AllocaInst* offsetsL = slot(offsetsTy);
+      llvm::AllocaInst* offsetsR = slot(offsetsTy);
+      llvm::AllocaInst* numL = var(B.getInt64(0));
+      llvm::AllocaInst* numR = var(B.getInt64(0));
+      llvm::AllocaInst* startL = var(B.getInt64(0));
+      llvm::AllocaInst* startR = var(B.getInt64(0));
+      auto offsetAt = [&](llvm::AllocaInst* offsets, llvm::Value* k) {
+        return B.CreateGEP(offsetsTy, offsets, { B.getInt64(0), k });
+      };
+      // notes in @p offsets the offsets of the elements of the block that
+      // @p isMisplaced
+      auto scanBlock = [&](llvm::AllocaInst* offsets, llvm::AllocaInst* num,
+          llvm::AllocaInst* start,
+          std::function<llvm::Value*(llvm::Value*)> isMisplaced) {
+        ifThen(B.CreateICmpEQ(get(num), B.getInt64(0)), [&]{
+          set(start, B.getInt64(0));
+          llvm::AllocaInst* j = var(B.getInt64(0));
+          loop([&]{ return B.CreateICmpSLT(get(j), B.getInt64(BLOCK_SIZE)); },
+            [&]{
+              B.CreateStore(B.CreateTrunc(get(j), B.getInt8Ty()),
+                            offsetAt(offsets, get(num)));
+              set(num, B.CreateAdd(get(num),
+                B.CreateZExt(isMisplaced(get(j)), usize)));
+              set(j, add(get(j), 1));
+            });
+        });
+      };
+      loop([&]{ return B.CreateICmpSGT(B.CreateSub(get(last), get(first)),
+                                       B.getInt64(2 * BLOCK_SIZE)); }, [&]{
+        scanBlock(offsetsL, numL, startL, [&](llvm::Value* j) {
+          return B.CreateNot(less(at(arr, B.CreateAdd(get(first), j)), pivot));
+        });
+        // offsets on the right count back from last, which is exclusive
+        scanBlock(offsetsR, numR, startR, [&](llvm::Value* j) {
+          return less(at(arr, B.CreateSub(add(get(last), -1), j)), pivot);
+        });
+        llvm::Value* num = B.CreateSelect(
+          B.CreateICmpULT(get(numL), get(numR)), get(numL), get(numR));
+        llvm::AllocaInst* k = var(B.getInt64(0));
+        loop([&]{ return B.CreateICmpSLT(get(k), num); }, [&]{
+          auto offset = [&](llvm::AllocaInst* offsets, llvm::AllocaInst* start){
+            llvm::Value* o = B.CreateLoad(B.getInt8Ty(),
+              offsetAt(offsets, B.CreateAdd(get(start), get(k))));
+            return B.CreateZExt(o, usize);
+          };
+          swap(at(arr, B.CreateAdd(get(first), offset(offsetsL, startL))),
+               at(arr, B.CreateSub(add(get(last), -1),
+                                   offset(offsetsR, startR))));
+          set(k, add(get(k), 1));
+        });
+        set(numL, B.CreateSub(get(numL), num));
+        set(numR, B.CreateSub(get(numR), num));
+        set(startL, B.CreateAdd(get(startL), num));
+        set(startR, B.CreateAdd(get(startR), num));
+        ifThen(B.CreateICmpEQ(get(numL), B.getInt64(0)),
+          [&]{ set(first, add(get(first), BLOCK_SIZE)); });
+        ifThen(B.CreateICmpEQ(get(numR), B.getInt64(0)),
+          [&]{ set(last, B.CreateSub(get(last), B.getInt64(BLOCK_SIZE))); });
+      });
+      // everything left of first is smaller and everything from last on is
+      // not; partition what remains between them one element at a time
+      set(first, add(get(first), -1));
+      advanceFirst();
+      retreatLast();
+      hoarePartition();
+    });
+    llvm::Value* pivotPos = add(get(first), -1);
+    B.CreateStore(B.CreateLoad(elemTy, at(arr, pivotPos)), at(arr, begin));
+    B.CreateStore(B.CreateLoad(elemTy, pivot), at(arr, pivotPos));
+    llvm::Value* ret = llvm::UndefValue::get(retTy);
+    ret = B.CreateInsertValue(ret, pivotPos, 0);
+    B.CreateRet(B.CreateInsertValue(ret, alreadyPartitioned, 1));
+    return f;
+  }
+
+  /// @brief `partition_left(a, begin, end)` partitions the range around the
+  /// pivot `a[begin]`: equal elements go left, greater ones right. Returns
+  /// the final position of the pivot. Used when no element is less than the
+  /// pivot.
+  llvm::Function* getPartitionLeft() {
+    if (llvm::Function* f = lookup("partition_left")) return f;
+    llvm::Function* f =
+      create("partition_left", usize, { ptrTy, usize, usize });
+    llvm::Value* begin = f->getArg(1);
+    llvm::Value* end = f->getArg(2);
+    llvm::AllocaInst* pivot = var(B.CreateLoad(elemTy, at(arr, begin)));
+    llvm::AllocaInst* first = var(begin);
+    llvm::AllocaInst* last = var(end);
+    // find the last element not greater than the pivot...
+    auto retreatLast = [&]{
+      loop([&]{ return andAlso(B.CreateICmpSGT(get(last), begin), [&]{
+        set(last, add(get(last), -1));
+        return less(pivot, at(arr, get(last)));
+      }); }, nullptr);
+    };
+    // ...and the first element greater than the pivot
+    auto advanceFirst = [&]{
+      loop([&]{ return andAlso(B.CreateICmpSLT(add(get(first), 1), end), [&]{
+        set(first, add(get(first), 1));
+        return B.CreateNot(less(pivot, at(arr, get(first))));
+      }); }, nullptr);
+    };
+    retreatLast();
+    ifThen(B.CreateICmpEQ(add(get(last), 1), end), [&]{
+      // no element was greater than the pivot, so the scan must stop at last
+      loop([&]{ return andAlso(B.CreateICmpSLT(get(first), get(last)), [&]{
+        set(first, add(get(first), 1));
+        return B.CreateNot(less(pivot, at(arr, get(first))));
+      }); }, nullptr);
+    }, advanceFirst);
+    loop([&]{ return B.CreateICmpSLT(get(first), get(last)); }, [&]{
+      swap(at(arr, get(first)), at(arr, get(last)));
+      retreatLast();
+      advanceFirst();
+    });
+    llvm::Value* pivotPos = get(last);
+    B.CreateStore(B.CreateLoad(elemTy, at(arr, pivotPos)), at(arr, begin));
+    B.CreateStore(B.CreateLoad(elemTy, pivot), at(arr, pivotPos));
+    B.CreateRet(pivotPos);
+    return f;
+  }
+
+  /// @brief `insertion_sort(a, begin, end)` sorts the range by insertion.
+  llvm::Function* getInsertionSort() {
+    if (llvm::Function* f = lookup("insertion_sort")) return f;
+    llvm::Function* f =
+      create("insertion_sort", B.getVoidTy(), { ptrTy, usize, usize });
+    buildInsertionSort(f->getArg(1), f->getArg(2), nullptr);
+    B.CreateRetVoid();
+    return f;
+  }
+
+  /// @brief `partial_insertion_sort(a, begin, end)` sorts the range by
+  /// insertion, unless that takes more than a few moves. Returns whether the
+  /// range was sorted.
+  llvm::Function* getPartialInsertionSort() {
+    if (llvm::Function* f = lookup("partial_insertion_sort")) return f;
+    llvm::Function* f = create("partial_insertion_sort", B.getInt1Ty(),
+      { ptrTy, usize, usize });
+    llvm::AllocaInst* moves = var(B.getInt64(0));
+    buildInsertionSort(f->getArg(1), f->getArg(2), moves);
+    B.CreateRet(B.getTrue());
+    return f;
+  }
+
+  /// @brief Builds an insertion sort of `a[begin]` to `a[end-1]`. If
+  /// @p moves is given, counts the moved elements there and returns false
+  /// once there are more than PARTIAL_INSERTION_SORT_LIMIT.
+  void buildInsertionSort(llvm::Value* begin, llvm::Value* end,
+                          llvm::AllocaInst* moves) {
+    llvm::AllocaInst* cur = var(add(begin, 1));
+    llvm::AllocaInst* tmp = slot(elemTy);
+    llvm::AllocaInst* sift = var(begin);
+    loop([&]{ return B.CreateICmpSLT(get(cur), end); }, [&]{
+      llvm::Value* c = get(cur);
+      ifThen(less(at(arr, c), at(arr, add(c, -1))), [&]{
+        B.CreateStore(B.CreateLoad(elemTy, at(arr, c)), tmp);
+        set(sift, c);
+        // shift greater elements right until tmp's place is found
+        loop([&]{
+          llvm::Value* s = get(sift);
+          B.CreateStore(B.CreateLoad(elemTy, at(arr, add(s, -1))),
+            at(arr, s));
+          set(sift, add(s, -1));
+          return andAlso(B.CreateICmpSGT(get(sift), begin),
+            [&]{ return less(tmp, at(arr, add(get(sift), -1))); });
+        }, nullptr);
+        B.CreateStore(B.CreateLoad(elemTy, tmp), at(arr, get(sift)));
+        if (moves == nullptr) return;
+        set(moves, B.CreateAdd(get(moves), B.CreateSub(c, get(sift))));
+        ifThen(B.CreateICmpUGT(get(moves),
+                               B.getInt64(PARTIAL_INSERTION_SORT_LIMIT)),
+               [&]{ B.CreateRet(B.getFalse()); });
+      });
+      set(cur, add(get(cur), 1));
+    });
+  }
+
+  /// @brief `heapsort(a, begin, end)` sorts the range with heapsort.
+  llvm::Function* getHeapsort() {
+    if (llvm::Function* f = lookup("heapsort")) return f;
+    llvm::Function* siftDown = getSiftDown();
+    llvm::Function* f =
+      create("heapsort", B.getVoidTy(), { ptrTy, usize, usize });
+    llvm::Value* heap = at(arr, f->getArg(1));
+    llvm::Value* n = B.CreateSub(f->getArg(2), f->getArg(1));
+    llvm::AllocaInst* i = var(B.CreateLShr(n, 1));
+    loop([&]{ return B.CreateICmpSGT(get(i), B.getInt64(0)); }, [&]{
+      set(i, add(get(i), -1));
+      B.CreateCall(siftDown, { heap, get(i), n });
+    });
+    set(i, n);
+    loop([&]{ return B.CreateICmpSGT(get(i), B.getInt64(1)); }, [&]{
+      set(i, add(get(i), -1));
+      swap(heap, at(heap, get(i)));
+      B.CreateCall(siftDown, { heap, B.getInt64(0), get(i) });
+    });
+    B.CreateRetVoid();
+    return f;
+  }
+
+  /// @brief `sift_down(heap, root, n)` restores the max-heap property of
+  /// `heap[0]` to `heap[n-1]` below @p root.
+  llvm::Function* getSiftDown() {
+    if (llvm::Function* f = lookup("sift_down")) return f;
+    llvm::Function* f =
+      create("sift_down", B.getVoidTy(), { ptrTy, usize, usize });
+    llvm::Value* n = f->getArg(2);
+    llvm::AllocaInst* root = var(f->getArg(1));
+    llvm::AllocaInst* child = var(B.getInt64(0));
+    loop(nullptr, [&]{
+      set(child, add(B.CreateShl(get(root), 1), 1));
+      ifThen(B.CreateICmpSGE(get(child), n), [&]{ B.CreateRetVoid(); });
+      llvm::Value* right = andAlso(B.CreateICmpSLT(add(get(child), 1), n),
+        [&]{ return less(at(arr, get(child)), at(arr, add(get(child), 1))); });
+      set(child, B.CreateSelect(right, add(get(child), 1), get(child)));
+      ifThen(B.CreateNot(less(at(arr, get(root)), at(arr, get(child)))),
+        [&]{ B.CreateRetVoid(); });
+      swap(at(arr, get(root)), at(arr, get(child)));
+      set(root, get(child));
+    });
+    B.CreateUnreachable();
+    return f;
+  }
+
+  //==========================================================================//
+  // Building blocks
+  //==========================================================================//
+
+  /// @brief Returns function `miscr.<name>.<suffix>` if it was built before.
+  llvm::Function* lookup(llvm::StringRef name) {
+    return mod.getFunction(("miscr." + name + "." + suffix).str());
+  }
+
+  /// @brief Starts building function `miscr.<name>.<suffix>`, whose first
+  /// parameter is the array.
+  llvm::Function* create(llvm::StringRef name, llvm::Type* retTy,
+                         llvm::ArrayRef<llvm::Type*> paramTys) {
+    llvm::Function* f = llvm::Function::Create(
+      llvm::FunctionType::get(retTy, paramTys, false),
+      llvm::Function::InternalLinkage, "miscr." + name + "." + suffix, mod);
+    B.SetInsertPoint(llvm::BasicBlock::Create(mod.getContext(), "entry", f));
+    arr = f->getArg(0);
+    return f;
+  }
+
+  /// @brief Returns a new stack slot of type @p ty.
+  llvm::AllocaInst* slot(llvm::Type* ty) {
+    llvm::BasicBlock& entry = B.GetInsertBlock()->getParent()->getEntryBlock();
+    llvm::IRBuilder<> allocaB(&entry, entry.begin());
+    return allocaB.CreateAlloca(ty);
+  }
+
+  /// @brief Returns a new variable initialized to @p init.
+  llvm::AllocaInst* var(llvm::Value* init) {
+    llvm::AllocaInst* v = slot(init->getType());
+    B.CreateStore(init, v);
+    return v;
+  }
+
+  llvm::Value* get(llvm::AllocaInst* v)
+    { return B.CreateLoad(v->getAllocatedType(), v); }
+  void set(llvm::AllocaInst* v, llvm::Value* x) { B.CreateStore(x, v); }
+
+  llvm::Value* add(llvm::Value* i, int64_t k)
+    { return B.CreateAdd(i, B.getInt64(k)); }
+
+  /// @brief The address of element @p i of @p array.
+  llvm::Value* at(llvm::Value* array, llvm::Value* i)
+    { return B.CreateGEP(elemTy, array, i); }
+
+  /// @brief True iff the element at @p a is less than the one at @p b.
+  llvm::Value* less(llvm::Value* a, llvm::Value* b) {
+    if (order == COMPARATOR) return B.CreateCall(comparator, { a, b });
+    llvm::Value* x = B.CreateLoad(elemTy, a);
+    llvm::Value* y = B.CreateLoad(elemTy, b);
+    switch (order) {
+    case SIGNED:   return B.CreateICmpSLT(x, y);
+    case UNSIGNED: return B.CreateICmpULT(x, y);
+    default:       return B.CreateFCmpOLT(x, y);
+    }
+  }
+
+  void swap(llvm::Value* a, llvm::Value* b) {
+    llvm::Value* x = B.CreateLoad(elemTy, a);
+    llvm::Value* y = B.CreateLoad(elemTy, b);
+    B.CreateStore(y, a);
+    B.CreateStore(x, b);
+  }
+
+  /// @brief Orders elements @p i and @p j without branching.
+  void sort2(llvm::Value* i, llvm::Value* j) {
+    llvm::Value* a = at(arr, i);
+    llvm::Value* b = at(arr, j);
+    llvm::Value* x = B.CreateLoad(elemTy, a);
+    llvm::Value* y = B.CreateLoad(elemTy, b);
+    llvm::Value* swapped = less(b, a);
+    B.CreateStore(B.CreateSelect(swapped, y, x), a);
+    B.CreateStore(B.CreateSelect(swapped, x, y), b);
+  }
+
+  /// @brief Orders elements @p i, @p j, and @p k, so that @p j is their
+  /// median.
+  void sort3(llvm::Value* i, llvm::Value* j, llvm::Value* k) {
+    sort2(i, j);
+    sort2(j, k);
+    sort2(i, j);
+  }
+
+  /// @brief Builds `if (cond) then() else otherwise()`. Either branch may
+  /// end in a return.
+  void ifThen(llvm::Value* cond, std::function<void()> then,
+              std::function<void()> otherwise = nullptr) {
+    llvm::LLVMContext& ctx = mod.getContext();
+    llvm::Function* f = B.GetInsertBlock()->getParent();
+    auto thenBB = llvm::BasicBlock::Create(ctx, "then", f);
+    auto elseBB = otherwise ? llvm::BasicBlock::Create(ctx, "else", f)
+                            : nullptr;
+    auto endBB = llvm::BasicBlock::Create(ctx, "endif", f);
+    B.CreateCondBr(cond, thenBB, elseBB ? elseBB : endBB);
+    B.SetInsertPoint(thenBB);
+    then();
+    if (!B.GetInsertBlock()->getTerminator()) B.CreateBr(endBB);
+    if (otherwise) {
+      B.SetInsertPoint(elseBB);
+      otherwise();
+      if (!B.GetInsertBlock()->getTerminator()) B.CreateBr(endBB);
+    }
+    B.SetInsertPoint(endBB);
+  }
+
+  /// @brief Builds `while (cond()) body()`. A null @p cond loops forever,
+  /// and a null @p body makes a loop whose condition does the work.
+  void loop(std::function<llvm::Value*()> cond, std::function<void()> body) {
+    llvm::LLVMContext& ctx = mod.getContext();
+    llvm::Function* f = B.GetInsertBlock()->getParent();
+    auto condBB = llvm::BasicBlock::Create(ctx, "loop", f);
+    auto bodyBB = llvm::BasicBlock::Create(ctx, "body", f);
+    auto endBB = llvm::BasicBlock::Create(ctx, "endloop", f);
+    B.CreateBr(condBB);
+    B.SetInsertPoint(condBB);
+    B.CreateCondBr(cond ? cond() : B.getTrue(), bodyBB, endBB);
+    B.SetInsertPoint(bodyBB);
+    if (body) body();
+    if (!B.GetInsertBlock()->getTerminator()) B.CreateBr(condBB);
+    B.SetInsertPoint(endBB);
+  }
+
+  /// @brief Builds the short-circuiting `lhs && rhs()`.
+  llvm::Value* andAlso(llvm::Value* lhs, std::function<llvm::Value*()> rhs) {
+    llvm::LLVMContext& ctx = mod.getContext();
+    llvm::Function* f = B.GetInsertBlock()->getParent();
+    llvm::BasicBlock* lhsBB = B.GetInsertBlock();
+    auto rhsBB = llvm::BasicBlock::Create(ctx, "and", f);
+    auto endBB = llvm::BasicBlock::Create(ctx, "endand", f);
+    B.CreateCondBr(lhs, rhsBB, endBB);
+    B.SetInsertPoint(rhsBB);
+    llvm::Value* rhsV = rhs();
+    rhsBB = B.GetInsertBlock();
+    B.CreateBr(endBB);
+    B.SetInsertPoint(endBB);
+    llvm::PHINode* phi = B.CreatePHI(B.getInt1Ty(), 2);
+    phi->addIncoming(B.getFalse(), lhsBB);
+    phi->addIncoming(rhsV, rhsBB);
+    return phi;
+  }
+};
+
+#endif
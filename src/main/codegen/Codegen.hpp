@@ -1,39 +1,156 @@
 #ifndef CODEGEN_CODEGEN
 #define CODEGEN_CODEGEN
 
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/InlineAsm.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/Path.h>
+#include "common/CloneTargets.hpp"
 #include "common/ScopeStack.hpp"
 #include "common/TypeContext.hpp"
 #include "common/Ontology.hpp"
+#include "analysis/FunctionSummaries.hpp"
+#include "codegen/AlgorithmBuilder.hpp"
+#include "codegen/SSABuilder.hpp"
+#include "mir/MIRBuilder.hpp"
+#include "mir/MIROptimizer.hpp"
 
 /// @brief LLVM IR code generation from AST.
 class Codegen {
+public:
+  /// @brief Counters reported by `miscrc --stats`.
+  struct Stats {
+    unsigned stringLits = 0;        // string literal occurrences
+    unsigned pooledStringLits = 0;  // occurrences that reused a pooled global
+    unsigned mirFunctions = 0;      // function bodies generated from MIR
+    unsigned mirFallbacks = 0;      // ... and generated from the AST instead
+    MIROptimizer::Stats mir;
+  };
+
+private:
   const Ontology& ont;
+  const FunctionSummaries* summaries;
   llvm::Module& mod;
   llvm::IRBuilder<> B;
 
   /// @brief Maps fully qualified names of structs to their LLVM struct types.
   llvm::StringMap<llvm::StructType*> structTypes;
 
-  /// @brief Maps local variable names to their (stack) addresses.
-  ScopeStack<llvm::AllocaInst*> varAddresses;
+  /// @brief Maps fully qualified names of `#[soa]` structs to the LLVM types
+  /// of their references. A reference to a soa struct is a struct of column
+  /// pointers, one per field, rather than a single pointer.
+  llvm::StringMap<llvm::StructType*> soaRefTypes;
+
+  /// @brief Where a local variable lives. Variables whose address is needed
+  /// get a stack slot; all others are SSA values tracked by `ssa`.
+  struct LocalVar {
+    llvm::AllocaInst* slot;
+    unsigned ssaVar;
+  };
+
+  static constexpr unsigned NO_SSA_VAR = ~0u;
+
+  /// @brief Maps local variable names to where they live.
+  ScopeStack<LocalVar> locals;
+
+  SSABuilder ssa;
+
+  /// @brief Variables of the current function that need a stack slot,
+  /// identified by their binding LetExp or parameter Name.
+  llvm::DenseSet<const AST*> slotVars;
+
+  /// @brief Inserts stack slots at the start of the entry block (see
+  /// genSlot).
+  llvm::IRBuilder<> allocaB;
+
+  /// @brief The stack slots of `let`-bound variables in the enclosing blocks,
+  /// innermost last. Their lifetimes end with the block, so that the backend
+  /// can give the slots of sibling blocks the same stack space.
+  llvm::SmallVector<llvm::AllocaInst*, 16> scopedSlots;
+
+  /// @brief Maps the bytes of each string literal to its global constant, so
+  /// identical literals share one global.
+  llvm::StringMap<llvm::GlobalVariable*> stringPool;
+
+  /// @brief The read-only global of each constant emitted so far.
+  llvm::DenseMap<ConstDecl*, llvm::GlobalVariable*> constGlobals;
+
+  /// @brief The clones of each `#[target_clones]` function, default last.
+  llvm::DenseMap<FunctionDecl*, llvm::SmallVector<llvm::Function*, 4>>
+    targetClones;
+
+  /// @brief Computes a mask of the supported `cloneTargets` with CPUID.
+  /// Created on first use.
+  llvm::Function* cpuFeaturesFunc = nullptr;
+
+  /// @brief Builds the debug locations of instructions if source locations
+  /// are tracked, or null otherwise.
+  std::unique_ptr<llvm::DIBuilder> DIB;
+  llvm::DIFile* diFile = nullptr;
+
+  /// @brief The debug info scope of the function being generated.
+  llvm::DISubprogram* subprogram = nullptr;
+
+  /// @brief The coroutine state of the `async` function being generated.
+  /// All fields are null outside of async functions.
+  struct Coroutine {
+    llvm::Value* id = nullptr;          // token from llvm.coro.id
+    llvm::Value* handle = nullptr;      // frame pointer from llvm.coro.begin
+    llvm::Value* promise = nullptr;     // `{ waiter, result }` in the frame
+    llvm::BasicBlock* cleanup = nullptr;  // frees the frame
+    llvm::BasicBlock* suspend = nullptr;  // returns to the caller or resumer
+  } coro;
+
+  /// @brief True once any coroutine intrinsic has been emitted.
+  bool coroutines = false;
+
+  /// @brief Lower the allocation builtins to libc rather than to the MiSCR
+  /// allocator.
+  bool libcAllocator = false;
+
+  /// @brief True once a call to the MiSCR allocator has been emitted.
+  bool runtimeAllocator = false;
+
+  /// @brief The TypeContext of Sema, if function bodies go through MIR.
+  TypeContext* mirTypes = nullptr;
+
+  Stats stats;
 
 public:
 
   /// @brief Creates and initializes a Codegen object. Stubs of all functions
-  /// in @p ont are added to @p mod.
-  Codegen(const Ontology& ont, llvm::Module& mod)
-    : ont(ont), mod(mod), B(mod.getContext()) {
+  /// in @p ont are added to @p mod. If @p summaries is given, functions get
+  /// the memory and parameter attributes that their summaries justify.
+  Codegen(const Ontology& ont, llvm::Module& mod,
+          const FunctionSummaries* summaries = nullptr)
+    : ont(ont), summaries(summaries), mod(mod), B(mod.getContext()),
+      allocaB(mod.getContext()) {
+
+    // Populates `soaRefTypes` first since fields may refer to soa structs
+    for (llvm::StringRef typeName : ont.typeSpace.keys()) {
+      StructDecl* structDecl = ont.getType(typeName);
+      if (!structDecl->isSoa()) continue;
+      std::vector<llvm::Type*> columnTys(
+        structDecl->getFields()->asArrayRef().size(),
+        llvm::PointerType::get(B.getContext(), 0));
+      soaRefTypes[typeName] = llvm::StructType::create(B.getContext(),
+        columnTys, (typeName + ".ref").str());
+    }
 
-    // Populates `structTypes`
+    // Populates `structTypes`. Bodies are set in a second pass since fields
+    // may refer to structs that come later in `typeSpace`.
+    for (llvm::StringRef typeName : ont.typeSpace.keys()) {
+      structTypes[typeName] =
+        llvm::StructType::create(B.getContext(), typeName);
+    }
     for (llvm::StringRef typeName : ont.typeSpace.keys()) {
       std::vector<llvm::Type*> fieldTys;
       StructDecl* structDecl = ont.getType(typeName);
       for (auto field : structDecl->getFields()->asArrayRef())
         fieldTys.push_back(genType(field.second));
-      auto st = llvm::StructType::get(B.getContext(), fieldTys);
-      st->setName(typeName);
-      structTypes[typeName] = st;
+      structTypes[typeName]->setBody(fieldTys);
     }
 
     // Add all functions to the LLVM module
@@ -44,26 +161,73 @@ public:
       for (auto param : funDecl->getParameters()->asArrayRef()) {
         paramTys.push_back(genType(param.second));
       }
-      llvm::Type* retType = genType(funDecl->getReturnType());
+      // an async function returns the handle of its coroutine frame
+      llvm::Type* retType = funDecl->isAsync()
+        ? llvm::PointerType::get(B.getContext(), 0)
+        : genType(funDecl->getReturnType());
       llvm::FunctionType* funcType =
         llvm::FunctionType::get(retType, paramTys, funDecl->isVariadic());
-
-      llvm::Function* f = llvm::Function::Create(
-        funcType,
-        llvm::Function::ExternalLinkage,
-        ont.mapName(funDecl->getName()->asStringRef()),
-        mod
-      );
+      llvm::StringRef name = ont.mapName(funDecl->getName()->asStringRef());
+      if (const Attribute* clones = funDecl->findAttribute("target_clones"))
+        declareTargetClones(funDecl, funcType, name, clones->getArgs());
+      else
+        declareFunction(funDecl, funcType, name,
+          llvm::Function::ExternalLinkage);
     }
+
+    // Evaluate all constants. Function bodies use their values directly.
+    for (auto& entry : ont.constSpace) getConstGlobal(entry.second);
   }
 
   ~Codegen() {}
   Codegen(const Codegen&) = delete;
   Codegen& operator=(const Codegen&) = delete;
 
+  const Stats& getStats() const { return stats; }
+
+  /// @brief True if the module has coroutines (or awaits them) and must thus
+  /// go through LLVM's coroutine passes before native code generation. Such
+  /// modules also need the async runtime (`libmiscr-async.a`).
+  bool usesCoroutines() const { return coroutines; }
+
+  /// @brief True if the module calls the MiSCR allocator and thus needs the
+  /// allocator runtime (`libmiscr-alloc.a`).
+  bool usesRuntimeAllocator() const { return runtimeAllocator; }
+
+  /// @brief Lowers the builtins `alloc`, `realloc`, and `free` to the libc
+  /// functions of the same names (`malloc` for `alloc`) instead of to the
+  /// MiSCR allocator. Must be called before any code is generated.
+  void useLibcAllocator() { libcAllocator = true; }
+
+  /// @brief Lowers function bodies to MIR (see mir/MIR.hpp) and optimizes
+  /// them there before generating LLVM IR. Functions that MIR does not
+  /// support are generated from the AST as usual. @p tc must be the
+  /// TypeContext of the AST. Must be called before any code is generated.
+  void useMIR(TypeContext& tc) { mirTypes = &tc; }
+
+  /// @brief Tags the generated instructions with the line and column of the
+  /// expression they come from in @p fileName, so that optimization remarks
+  /// can point at MiSCR source code. No DWARF is emitted. Must be called
+  /// before any code is generated.
+  void trackSourceLocations(llvm::StringRef fileName) {
+    DIB = std::make_unique<llvm::DIBuilder>(mod);
+    diFile = DIB->createFile(llvm::sys::path::filename(fileName),
+      llvm::sys::path::parent_path(fileName));
+    DIB->createCompileUnit(llvm::dwarf::DW_LANG_C, diFile, "miscrc", false,
+      "", 0, "", llvm::DICompileUnit::NoDebug);
+    mod.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+      llvm::DEBUG_METADATA_VERSION);
+  }
+
   /// @brief Recursively generates code for all decls in @p declList.
-  void genDeclList(DeclList* declList)
-    { for (Decl* decl : declList->asArrayRef()) genDecl(decl); }
+  void genDeclList(DeclList* declList) {
+    for (Decl* decl : declList->asArrayRef()) genDecl(decl);
+    finish();
+  }
+
+  /// @brief Completes the module after the last decl has been generated.
+  /// Only needs to be called directly if decls are generated one by one.
+  void finish() { if (DIB) DIB->finalize(); }
 
   /// @brief Recursively generates code for @p decl.
   void genDecl(Decl* decl) {
@@ -71,29 +235,214 @@ public:
       genModule(mod);
     else if (auto func = FunctionDecl::downcast(decl))
       genFuncBody(func);
-    else if (decl->id == AST::ID::STRUCT)
+    else if (decl->id == AST::ID::STRUCT || decl->id == AST::ID::CONST)
       {}
     else llvm_unreachable("Unsupported decl");
   }
 
   /// @brief Recursively generates code for all decls in @p mod
-  void genModule(ModuleDecl* mod) { genDeclList(mod->getDecls()); }
+  void genModule(ModuleDecl* mod)
+    { for (Decl* decl : mod->getDecls()->asArrayRef()) genDecl(decl); }
 
 private:
 
+  /// @brief Adds function @p name for @p funDecl to `mod`.
+  llvm::Function* declareFunction(FunctionDecl* funDecl,
+      llvm::FunctionType* funcType, const llvm::Twine& name,
+      llvm::GlobalValue::LinkageTypes linkage) {
+    llvm::Function* f = llvm::Function::Create(funcType, linkage, name, mod);
+    if (funDecl->hasAttribute("cold"))
+      f->addFnAttr(llvm::Attribute::Cold);
+    return f;
+  }
+
+  /// @brief Adds one clone of @p funDecl per target in @p targets, and an
+  /// ifunc named @p name whose resolver picks the best clone for the CPU
+  /// when the program is loaded.
+  void declareTargetClones(FunctionDecl* funDecl, llvm::FunctionType* funcType,
+      llvm::StringRef name, llvm::ArrayRef<std::string> targets) {
+    llvm::SmallVector<llvm::Function*, 4>& clones = targetClones[funDecl];
+    llvm::SmallVector<unsigned, 4> cloneTargetIdxs;
+    for (unsigned i = 0; i < std::size(cloneTargets); ++i) {
+      const CloneTarget& target = cloneTargets[i];
+      if (!llvm::is_contained(targets, target.name)) continue;
+      llvm::Function* clone = declareFunction(funDecl, funcType,
+        name + "." + target.name, llvm::Function::InternalLinkage);
+      clone->addFnAttr("target-features", target.features);
+      clones.push_back(clone);
+      cloneTargetIdxs.push_back(i);
+    }
+    clones.push_back(declareFunction(funDecl, funcType, name + ".default",
+      llvm::Function::InternalLinkage));
+
+    llvm::Function* resolver = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::PointerType::get(B.getContext(), 0),
+        false),
+      llvm::Function::InternalLinkage, name + ".resolver", mod);
+    llvm::GlobalIFunc::create(funcType, 0, llvm::Function::ExternalLinkage,
+      name, resolver, &mod);
+
+    // Tests the clones best first. The default clone comes last.
+    llvm::IRBuilder<> RB(llvm::BasicBlock::Create(mod.getContext(), "entry",
+      resolver));
+    llvm::Value* supported = RB.CreateCall(getCpuFeaturesFunc());
+    for (unsigned i = 0; i < cloneTargetIdxs.size(); ++i) {
+      auto use = llvm::BasicBlock::Create(mod.getContext(), "", resolver);
+      auto next = llvm::BasicBlock::Create(mod.getContext(), "", resolver);
+      llvm::Value* bit = RB.CreateAnd(supported, 1u << cloneTargetIdxs[i]);
+      RB.CreateCondBr(RB.CreateIsNotNull(bit), use, next);
+      RB.SetInsertPoint(use);
+      RB.CreateRet(clones[i]);
+      RB.SetInsertPoint(next);
+    }
+    RB.CreateRet(clones.back());
+  }
+
+  /// @brief Returns the function that sets bit i of its result iff the CPU
+  /// and OS support `cloneTargets[i]`, creating it first if need be.
+  llvm::Function* getCpuFeaturesFunc() {
+    if (cpuFeaturesFunc) return cpuFeaturesFunc;
+    llvm::LLVMContext& ctx = mod.getContext();
+    cpuFeaturesFunc = llvm::Function::Create(
+      llvm::FunctionType::get(B.getInt32Ty(), false),
+      llvm::Function::InternalLinkage, "miscr.cpu_features", mod);
+    auto entry = llvm::BasicBlock::Create(ctx, "entry", cpuFeaturesFunc);
+    auto readXcr0 = llvm::BasicBlock::Create(ctx, "xgetbv", cpuFeaturesFunc);
+    auto test = llvm::BasicBlock::Create(ctx, "test", cpuFeaturesFunc);
+    llvm::IRBuilder<> FB(entry);
+    llvm::Type* i32 = FB.getInt32Ty();
+
+    auto cpuid = llvm::InlineAsm::get(llvm::FunctionType::get(
+        llvm::StructType::get(ctx, { i32, i32, i32, i32 }), { i32, i32 },
+        false),
+      "cpuid", "={ax},={bx},={cx},={dx},{ax},{cx},~{dirflag},~{fpsr},~{flags}",
+      false);
+    auto xgetbv = llvm::InlineAsm::get(llvm::FunctionType::get(
+        llvm::StructType::get(ctx, { i32, i32 }), { i32 }, false),
+      "xgetbv", "={ax},={dx},{cx},~{dirflag},~{fpsr},~{flags}", false);
+
+    llvm::Value* maxLeaf = FB.CreateExtractValue(
+      FB.CreateCall(cpuid, { FB.getInt32(0), FB.getInt32(0) }), 0);
+    llvm::Value* leaf1 =
+      FB.CreateCall(cpuid, { FB.getInt32(1), FB.getInt32(0) });
+    llvm::Value* leaf1Ecx = FB.CreateExtractValue(leaf1, 2);
+    // leaf 7 is only meaningful if the CPU has it
+    llvm::Value* leaf7Ebx = FB.CreateSelect(
+      FB.CreateICmpUGE(maxLeaf, FB.getInt32(7)),
+      FB.CreateExtractValue(
+        FB.CreateCall(cpuid, { FB.getInt32(7), FB.getInt32(0) }), 1),
+      FB.getInt32(0));
+    // XCR0 says which register state the OS saves; XGETBV may only be used
+    // if the OS has set OSXSAVE
+    llvm::Value* osxsave = FB.CreateAnd(leaf1Ecx, 1u << 27);
+    FB.CreateCondBr(FB.CreateIsNotNull(osxsave), readXcr0, test);
+    FB.SetInsertPoint(readXcr0);
+    llvm::Value* xcr0Read =
+      FB.CreateExtractValue(FB.CreateCall(xgetbv, { FB.getInt32(0) }), 0);
+    FB.CreateBr(test);
+    FB.SetInsertPoint(test);
+    llvm::PHINode* xcr0 = FB.CreatePHI(i32, 2);
+    xcr0->addIncoming(FB.getInt32(0), entry);
+    xcr0->addIncoming(xcr0Read, readXcr0);
+
+    auto savesState = [&](uint32_t mask) {
+      return FB.CreateICmpEQ(FB.CreateAnd(xcr0, mask), FB.getInt32(mask));
+    };
+    llvm::Value* avxState = savesState(0x6);        // SSE and AVX
+    llvm::Value* avx512State = savesState(0xe6);    // and opmask, ZMM
+    llvm::Value* mask = FB.getInt32(0);
+    for (unsigned i = 0; i < std::size(cloneTargets); ++i) {
+      const CloneTarget& target = cloneTargets[i];
+      llvm::Value* reg = target.leaf == 7 ? leaf7Ebx : leaf1Ecx;
+      llvm::Value* has =
+        FB.CreateIsNotNull(FB.CreateAnd(reg, 1u << target.bit));
+      if (target.osState == CloneTarget::AVX_STATE)
+        has = FB.CreateAnd(has, avxState);
+      else if (target.osState == CloneTarget::AVX512_STATE)
+        has = FB.CreateAnd(has, avx512State);
+      mask = FB.CreateOr(mask, FB.CreateShl(FB.CreateZExt(has, i32), i));
+    }
+    FB.CreateRet(mask);
+    return cpuFeaturesFunc;
+  }
+
+  /// @brief Adds `readnone`/`readonly` function attributes and `readonly`/
+  /// `nocapture` pointer parameter attributes according to @p summary.
+  void addSummaryAttributes(llvm::Function* f, const FunctionSummary& summary) {
+    if (summary.memory == FunctionSummary::NONE)
+      f->setDoesNotAccessMemory();
+    else if (summary.memory == FunctionSummary::READ)
+      f->setOnlyReadsMemory();
+    for (llvm::Argument& arg : f->args()) {
+      if (!arg.getType()->isPointerTy()) continue;
+      if (summary.isReadOnly(arg.getArgNo()))
+        arg.addAttr(llvm::Attribute::ReadOnly);
+      if (summary.isNoCapture(arg.getArgNo()))
+        arg.addAttr(llvm::Attribute::NoCapture);
+    }
+  }
+
   /// @brief Generates the body of @p funDecl, or does nothing if the function
   /// is extern. The llvm::Function* (with no body) must already be in `mod`.
+  /// Summary attributes are added here rather than when the function is
+  /// declared, since summaries may be computed one function at a time (see
+  /// FunctionSummaries::summarize()).
   void genFuncBody(FunctionDecl* funDecl) {
+    if (!funDecl->hasBody()) return;
+    std::unique_ptr<mir::Function> mirFunc = buildMIR(funDecl);
+    auto genBody = [&](llvm::Function* f) {
+      if (summaries) addSummaryAttributes(f, summaries->lookup(funDecl));
+      if (mirFunc) genFuncBody(*mirFunc, f);
+      else genFuncBody(funDecl, f);
+    };
+    auto clones = targetClones.find(funDecl);
+    if (clones != targetClones.end()) {
+      for (llvm::Function* clone : clones->second) genBody(clone);
+      return;
+    }
     llvm::Function* f = mod.getFunction(
       ont.mapName(funDecl->getName()->asStringRef()));
     assert(f != nullptr && "Function not found in LLVM module");
-    if (!funDecl->hasBody()) return;
-    varAddresses.push();
-    B.SetInsertPoint(llvm::BasicBlock::Create(B.getContext(), "entry", f));
+    genBody(f);
+  }
+
+  /// @brief Builds and optimizes the MIR of @p funDecl, or returns null if
+  /// MIR is off or does not support the function.
+  std::unique_ptr<mir::Function> buildMIR(FunctionDecl* funDecl) {
+    if (mirTypes == nullptr) return nullptr;
+    std::unique_ptr<mir::Function> mirFunc =
+      MIRBuilder(ont, *mirTypes).build(funDecl);
+    if (mirFunc == nullptr) {
+      ++stats.mirFallbacks;
+      return nullptr;
+    }
+    MIROptimizer optimizer(ont, *mirTypes, summaries);
+    optimizer.run(*mirFunc);
+    stats.mir += optimizer.getStats();
+    ++stats.mirFunctions;
+    return mirFunc;
+  }
+
+  /// @brief Generates the body of @p funDecl into @p f.
+  void genFuncBody(FunctionDecl* funDecl, llvm::Function* f) {
+    locals.push();
+    ssa.clear();
+    slotVars.clear();
+    scopedSlots.clear();
+    findSlotVars(funDecl);
+    llvm::BasicBlock* entry =
+      llvm::BasicBlock::Create(B.getContext(), "entry", f);
+    B.SetInsertPoint(entry);
+    ssa.sealBlock(entry);
+    beginSubprogram(funDecl, f);
+    if (funDecl->isAsync()) genCoroBegin(f, funDecl->getBody()->getType());
     initializeFunctionArguments(f, funDecl->getParameters());
     llvm::Value* retVal = genExp(funDecl->getBody());
     // TODO: this is gross
-    if (auto primRT = PrimitiveTypeExp::downcast(funDecl->getReturnType())) {
+    if (funDecl->isAsync()) {
+      genCoroEnd(retVal);
+    } else if (auto primRT =
+               PrimitiveTypeExp::downcast(funDecl->getReturnType())) {
       if (primRT->kind == PrimitiveTypeExp::UNIT)
         B.CreateRetVoid();
       else
@@ -101,24 +450,445 @@ private:
     } else {
       B.CreateRet(retVal);
     }
-    varAddresses.pop();
+    locals.pop();
+    endSubprogram();
+  }
+
+  /// @brief Starts the debug info scope of @p f, which is (a clone of)
+  /// @p funDecl, if source locations are tracked.
+  void beginSubprogram(FunctionDecl* funDecl, llvm::Function* f) {
+    if (!DIB) return;
+    unsigned line = funDecl->getLocation().row;
+    subprogram = DIB->createFunction(diFile, f->getName(), f->getName(),
+      diFile, line, DIB->createSubroutineType(DIB->getOrCreateTypeArray({})),
+      line, llvm::DINode::FlagZero, llvm::DISubprogram::SPFlagDefinition);
+    f->setSubprogram(subprogram);
+  }
+
+  void endSubprogram() {
+    if (!subprogram) return;
+    DIB->finalizeSubprogram(subprogram);
+    subprogram = nullptr;
   }
 
-  /// @brief Initializes stack memory for function arguments. The insertion
-  /// point of `B` must be the beginning of @p f.
+  /// @brief Generates the body of @p f from @p mirFunc, the MIR of its
+  /// function. Blocks are generated in reverse postorder but laid out in
+  /// order of creation, as the AST path lays them out. Stack slots get no
+  /// lifetime markers since MIR has no scopes.
+  void genFuncBody(const mir::Function& mirFunc, llvm::Function* f) {
+    auto params = mirFunc.decl->getParameters()->asArrayRef();
+    for (llvm::Argument& arg : f->args())
+      arg.setName(params[arg.getArgNo()].first->asStringRef());
+    std::vector<mir::Block*> order = mirFunc.reversePostOrder();
+    llvm::SmallPtrSet<mir::Block*, 32> reachable(order.begin(), order.end());
+    MIRValues values;
+    for (mir::Block* b : mirFunc.getBlocks())
+      if (reachable.count(b))
+        values.blocks[b] = llvm::BasicBlock::Create(B.getContext(), b->name,
+                                                    f);
+    beginSubprogram(mirFunc.decl, f);
+    B.SetCurrentDebugLocation(llvm::DebugLoc());
+    for (mir::Block* b : order) {
+      B.SetInsertPoint(values.blocks[b]);
+      llvm::ArrayRef<mir::Inst*> insts = b->getInsts();
+      for (unsigned i = 0; i < insts.size(); ++i) {
+        if (subprogram && insts[i]->loc.exists())
+          B.SetCurrentDebugLocation(llvm::DILocation::get(B.getContext(),
+            insts[i]->loc.row, insts[i]->loc.col, subprogram));
+        values.insts[insts[i]] = genInst(insts, i, values, f);
+      }
+    }
+    // PHI operands, now that every value exists
+    for (mir::Block* b : order) {
+      for (mir::Inst* inst : b->getInsts()) {
+        if (inst->op != mir::Inst::PHI) break;
+        auto phi = llvm::cast<llvm::PHINode>(values.insts[inst]);
+        llvm::ArrayRef<mir::Block*> preds = b->getPredecessors();
+        for (unsigned k = 0; k < preds.size(); ++k)
+          if (llvm::BasicBlock* pred = values.blocks.lookup(preds[k]))
+            phi->addIncoming(values.insts[inst->getOperand(k)], pred);
+      }
+    }
+    B.SetCurrentDebugLocation(llvm::DebugLoc());
+    endSubprogram();
+  }
+
+  /// @brief The LLVM values of the MIR of a function so far.
+  struct MIRValues {
+    llvm::DenseMap<const mir::Inst*, llvm::Value*> insts;
+    llvm::DenseMap<const mir::Block*, llvm::BasicBlock*> blocks;
+  };
+
+  /// @brief Generates the instruction @p insts[i] and returns its value, if
+  /// any.
+  llvm::Value* genInst(llvm::ArrayRef<mir::Inst*> insts, unsigned i,
+                       MIRValues& values, llvm::Function* f) {
+    const mir::Inst* inst = insts[i];
+    auto operand = [&](unsigned k)
+      { return values.insts.lookup(inst->getOperand(k)); };
+    auto pointee = [](const mir::Inst* addr)
+      { return RefType::downcast(addr->type)->inner; };
+    switch (inst->op) {
+    case mir::Inst::PARAM:
+      return f->getArg(inst->index);
+    case mir::Inst::CONST:
+      return genExp(inst->exp);
+    case mir::Inst::CONST_ADDR:
+      return getConstGlobal(ont.getConst(
+        NameExp::downcast(inst->exp)->getName()->asStringRef()));
+    case mir::Inst::UNDEF:
+      return llvm::UndefValue::get(genType(inst->type));
+    case mir::Inst::BINOP:
+      return genBinop(inst->binop, operand(0), operand(1),
+                      isUnsigned(inst->getOperand(0)->type));
+    case mir::Inst::UNOP:
+      return genUnop(inst->unop, operand(0));
+    case mir::Inst::CONSTRUCT: {
+      // IRBuilder folds this to a ConstantStruct if all fields are constants
+      llvm::Value* val = llvm::UndefValue::get(genType(inst->type));
+      for (unsigned k = 0; k < inst->getNumOperands(); ++k)
+        val = B.CreateInsertValue(val, operand(k), k);
+      return val;
+    }
+    case mir::Inst::EXTRACT:
+      return B.CreateExtractValue(operand(0), inst->index);
+    case mir::Inst::INSERT:
+      return B.CreateInsertValue(operand(0), operand(1), inst->index);
+    case mir::Inst::SLOT: {
+      llvm::AllocaInst* slot = genSlot(genType(pointee(inst)));
+      slot->setName(inst->name);
+      return slot;
+    }
+    case mir::Inst::FIELD_ADDR: {
+      auto st = structTypes[NameType::downcast(
+        pointee(inst->getOperand(0)))->asString];
+      return B.CreateGEP(st, operand(0),
+        { B.getInt64(0), B.getInt32(inst->index) });
+    }
+    case mir::Inst::INDEX_ADDR:
+      return B.CreateGEP(genType(pointee(inst->getOperand(0))), operand(0),
+                         operand(1));
+    case mir::Inst::LOAD:
+      if (isCopiedInPlace(insts, i)) return nullptr;
+      return B.CreateLoad(genType(inst->type), operand(0));
+    case mir::Inst::STORE: {
+      const mir::Inst* v = inst->getOperand(1);
+      if (i > 0 && insts[i - 1] == v && isCopiedInPlace(insts, i - 1)) {
+        genMemCpy(operand(0), values.insts.lookup(v->getOperand(0)),
+                  llvm::cast<llvm::StructType>(genType(v->type)));
+        return nullptr;
+      }
+      auto constVal = llvm::dyn_cast<llvm::Constant>(operand(1));
+      auto st = llvm::dyn_cast<llvm::StructType>(operand(1)->getType());
+      if (constVal && st && isLargeStruct(st)) {
+        genMemCpy(operand(0), getStructGlobal(constVal), st);
+        return nullptr;
+      }
+      B.CreateStore(operand(1), operand(0));
+      return nullptr;
+    }
+    case mir::Inst::MOVE:
+    case mir::Inst::BORROW:
+      return operand(0);
+    case mir::Inst::CALL:
+    case mir::Inst::BUILTIN: {
+      llvm::SmallVector<llvm::Value*, 4> args;
+      for (unsigned k = 0; k < inst->getNumOperands(); ++k)
+        args.push_back(operand(k));
+      if (inst->op == mir::Inst::BUILTIN)
+        return genBuiltin(CallExp::downcast(inst->exp), args);
+      return B.CreateCall(getCallee(inst->callee), args);
+    }
+    case mir::Inst::PHI:
+      return B.CreatePHI(genType(inst->type), inst->getNumOperands());
+    case mir::Inst::BR:
+      B.CreateBr(values.blocks[inst->targets[0]]);
+      return nullptr;
+    case mir::Inst::COND_BR: {
+      llvm::BranchInst* br = B.CreateCondBr(operand(0),
+        values.blocks[inst->targets[0]], values.blocks[inst->targets[1]]);
+      if (inst->hint != mir::Inst::NO_HINT)
+        br->setMetadata(llvm::LLVMContext::MD_prof,
+                        branchWeights(inst->hint == mir::Inst::LIKELY));
+      return nullptr;
+    }
+    case mir::Inst::RET:
+      if (inst->getNumOperands() == 0) B.CreateRetVoid();
+      else B.CreateRet(operand(0));
+      return nullptr;
+    }
+    llvm_unreachable("Codegen::genInst() unexpected MIR instruction");
+  }
+
+  /// @brief True if @p insts[i] loads a large struct only to store it right
+  /// away, so that the copy is an `llvm.memcpy`.
+  bool isCopiedInPlace(llvm::ArrayRef<mir::Inst*> insts, unsigned i) {
+    const mir::Inst* load = insts[i];
+    if (load->op != mir::Inst::LOAD || !isInMemoryStruct(load->type)
+        || load->getUsers().size() != 1 || i + 1 == insts.size())
+      return false;
+    const mir::Inst* store = insts[i + 1];
+    return store == load->getUsers()[0] && store->op == mir::Inst::STORE
+      && store->getOperand(1) == load && store->getOperand(0) != load
+      && isLargeStruct(llvm::cast<llvm::StructType>(genType(load->type)));
+  }
+
+  /// @brief Binds the parameters of @p f. The insertion point of `B` must be
+  /// the beginning of @p f.
   void initializeFunctionArguments(llvm::Function* f, ParamList* paramList) {
     auto params = paramList->asArrayRef();
     unsigned int i = 0;
     for (llvm::Argument &arg : f->args()) {
-      llvm::StringRef paramName = params[i].first->asStringRef();
-      llvm::AllocaInst* memCell = B.CreateAlloca(arg.getType());
-      B.CreateStore(&arg, memCell);
-      varAddresses.add(paramName, memCell);
-      memCell->setName(paramName);
+      Name* paramName = params[i].first;
+      arg.setName(paramName->asStringRef());
+      bindLocal(paramName, paramName->asStringRef(), &arg);
       ++i;
     }
   }
 
+  /// @brief Returns the C function @p name (from libc or the async runtime),
+  /// declaring it first if need be.
+  llvm::FunctionCallee getRuntimeFunc(llvm::StringRef name, llvm::Type* ret,
+                                      llvm::ArrayRef<llvm::Type*> params) {
+    return mod.getOrInsertFunction(name,
+      llvm::FunctionType::get(ret, params, false));
+  }
+
+  /// @brief The promise of a coroutine whose result has type @p resultTy: the
+  /// handle of the coroutine that awaits it (or null), then the result unless
+  /// it is unit. The async runtime relies on this layout.
+  llvm::StructType* getPromiseType(Type* resultTy) {
+    llvm::Type* ptrTy = llvm::PointerType::get(B.getContext(), 0);
+    llvm::Type* valueTy = genType(resultTy);
+    if (valueTy->isVoidTy())
+      return llvm::StructType::get(B.getContext(),
+                                   llvm::ArrayRef<llvm::Type*>(ptrTy));
+    return llvm::StructType::get(B.getContext(), { ptrTy, valueTy });
+  }
+
+  /// @brief Returns the address of the promise in the frame of @p future.
+  llvm::Value* genPromiseAddress(llvm::Value* future,
+                                 llvm::StructType* promiseTy) {
+    llvm::Align align = mod.getDataLayout().getABITypeAlign(promiseTy);
+    return B.CreateIntrinsic(llvm::Intrinsic::coro_promise, {},
+      { future, B.getInt32(align.value()), B.getFalse() });
+  }
+
+  /// @brief Starts the coroutine of async function @p f (switched-resume
+  /// lowering). The frame is allocated with malloc unless CoroElide places
+  /// it in the frame of the caller.
+  void genCoroBegin(llvm::Function* f, Type* resultTy) {
+    llvm::LLVMContext& ctx = B.getContext();
+    llvm::PointerType* ptrTy = llvm::PointerType::get(ctx, 0);
+    llvm::Value* null = llvm::ConstantPointerNull::get(ptrTy);
+    coroutines = true;
+    f->setPresplitCoroutine();
+
+    llvm::StructType* promiseTy = getPromiseType(resultTy);
+    llvm::Align align = mod.getDataLayout().getABITypeAlign(promiseTy);
+    llvm::AllocaInst* promise = genSlot(promiseTy);
+    promise->setName("promise");
+    promise->setAlignment(align);
+    coro.promise = promise;
+    coro.id = B.CreateIntrinsic(llvm::Intrinsic::coro_id, {},
+      { B.getInt32(align.value()), promise, null, null });
+
+    llvm::BasicBlock* entry = B.GetInsertBlock();
+    auto allocBlock = llvm::BasicBlock::Create(ctx, "coro.alloc", f);
+    auto beginBlock = llvm::BasicBlock::Create(ctx, "coro.begin", f);
+    B.CreateCondBr(B.CreateIntrinsic(llvm::Intrinsic::coro_alloc, {},
+      { coro.id }), allocBlock, beginBlock);
+    B.SetInsertPoint(allocBlock);
+    ssa.sealBlock(allocBlock);
+    llvm::Value* size =
+      B.CreateIntrinsic(llvm::Intrinsic::coro_size, { B.getInt64Ty() }, {});
+    llvm::Value* mem =
+      B.CreateCall(getRuntimeFunc("malloc", ptrTy, { B.getInt64Ty() }), size);
+    B.CreateBr(beginBlock);
+    B.SetInsertPoint(beginBlock);
+    ssa.sealBlock(beginBlock);
+    llvm::PHINode* frame = B.CreatePHI(ptrTy, 2);
+    frame->addIncoming(null, entry);
+    frame->addIncoming(mem, allocBlock);
+    coro.handle = B.CreateIntrinsic(llvm::Intrinsic::coro_begin, {},
+      { coro.id, frame });
+    B.CreateStore(null, B.CreateStructGEP(promiseTy, promise, 0));
+
+    coro.cleanup = llvm::BasicBlock::Create(ctx, "coro.cleanup");
+    coro.suspend = llvm::BasicBlock::Create(ctx, "coro.suspend");
+  }
+
+  /// @brief Finishes the coroutine with @p result: stores it in the promise,
+  /// wakes the waiter, and stops at the final suspend point. The frame stays
+  /// alive until the awaiter has taken the result and destroyed it.
+  void genCoroEnd(llvm::Value* result) {
+    llvm::LLVMContext& ctx = B.getContext();
+    llvm::Type* ptrTy = llvm::PointerType::get(ctx, 0);
+    llvm::Function* f = B.GetInsertBlock()->getParent();
+    auto promiseTy = llvm::cast<llvm::StructType>(
+      llvm::cast<llvm::AllocaInst>(coro.promise)->getAllocatedType());
+    if (promiseTy->getNumElements() > 1)
+      B.CreateStore(result, B.CreateStructGEP(promiseTy, coro.promise, 1));
+    llvm::Value* waiter =
+      B.CreateLoad(ptrTy, B.CreateStructGEP(promiseTy, coro.promise, 0));
+    B.CreateCall(getRuntimeFunc("miscr_async_wake", B.getVoidTy(), { ptrTy }),
+      waiter);
+    llvm::Value* none = llvm::ConstantTokenNone::get(ctx);
+    llvm::Value* suspended = B.CreateIntrinsic(llvm::Intrinsic::coro_suspend,
+      {}, { none, B.getTrue() });
+    llvm::SwitchInst* sw = B.CreateSwitch(suspended, coro.suspend, 1);
+    sw->addCase(B.getInt8(1), coro.cleanup);
+
+    f->insert(f->end(), coro.cleanup);
+    B.SetInsertPoint(coro.cleanup);
+    llvm::Value* mem = B.CreateIntrinsic(llvm::Intrinsic::coro_free, {},
+      { coro.id, coro.handle });
+    B.CreateCall(getRuntimeFunc("free", B.getVoidTy(), { ptrTy }), mem);
+    B.CreateBr(coro.suspend);
+
+    f->insert(f->end(), coro.suspend);
+    B.SetInsertPoint(coro.suspend);
+    B.CreateIntrinsic(llvm::Intrinsic::coro_end, {},
+      { coro.handle, B.getFalse(), none });
+    B.CreateRet(coro.handle);
+    coro = Coroutine();
+  }
+
+  /// @brief Suspends the current coroutine until @p future has completed
+  /// (unless it already has), then takes its result.
+  llvm::Value* genAwait(llvm::Value* future, Type* resultTy) {
+    llvm::LLVMContext& ctx = B.getContext();
+    llvm::Function* f = B.GetInsertBlock()->getParent();
+    auto waitBlock = llvm::BasicBlock::Create(ctx, "await.wait", f);
+    auto readyBlock = llvm::BasicBlock::Create(ctx, "await.ready", f);
+    B.CreateCondBr(B.CreateIntrinsic(llvm::Intrinsic::coro_done, {},
+      { future }), readyBlock, waitBlock);
+
+    B.SetInsertPoint(waitBlock);
+    ssa.sealBlock(waitBlock);
+    llvm::StructType* promiseTy = getPromiseType(resultTy);
+    B.CreateStore(coro.handle, genPromiseAddress(future, promiseTy));
+    llvm::Value* suspended = B.CreateIntrinsic(llvm::Intrinsic::coro_suspend,
+      {}, { llvm::ConstantTokenNone::get(ctx), B.getFalse() });
+    llvm::SwitchInst* sw = B.CreateSwitch(suspended, coro.suspend, 2);
+    sw->addCase(B.getInt8(0), readyBlock);
+    sw->addCase(B.getInt8(1), coro.cleanup);
+
+    B.SetInsertPoint(readyBlock);
+    ssa.sealBlock(readyBlock);
+    return genTakeResult(future, promiseTy);
+  }
+
+  /// @brief Loads the result of the completed @p future and destroys its
+  /// frame.
+  llvm::Value* genTakeResult(llvm::Value* future,
+                             llvm::StructType* promiseTy) {
+    llvm::Value* result = nullptr;
+    if (promiseTy->getNumElements() > 1)
+      result = B.CreateLoad(promiseTy->getElementType(1), B.CreateStructGEP(
+        promiseTy, genPromiseAddress(future, promiseTy), 1));
+    B.CreateIntrinsic(llvm::Intrinsic::coro_destroy, {}, { future });
+    return result;
+  }
+
+  /// @brief Binds local variable @p name (bound by @p binder) to initial
+  /// value @p v, in a stack slot if `slotVars` says it needs one.
+  void bindLocal(const AST* binder, llvm::StringRef name, llvm::Value* v) {
+    if (v == nullptr) {  // unit-typed; there is nothing to store
+      locals.add(name, LocalVar{ nullptr, NO_SSA_VAR });
+      return;
+    }
+    if (slotVars.count(binder)) {
+      llvm::AllocaInst* slot = binder->id == AST::ID::LET
+        ? genScopedSlot(v->getType(), name)
+        : genSlot(v->getType());  // parameters live throughout
+      slot->setName(name);
+      B.CreateStore(v, slot);
+      locals.add(name, LocalVar{ slot, NO_SSA_VAR });
+      return;
+    }
+    unsigned var = ssa.addVariable(v->getType());
+    ssa.writeVariable(var, B.GetInsertBlock(), v);
+    if (llvm::isa<llvm::Instruction>(v) && !v->hasName()) v->setName(name);
+    locals.add(name, LocalVar{ nullptr, var });
+  }
+
+  /// @brief Creates a stack slot of type @p ty at the start of the entry
+  /// block, where LLVM expects static allocas, even if the entry block has
+  /// already been terminated.
+  llvm::AllocaInst* genSlot(llvm::Type* ty) {
+    llvm::BasicBlock& entry = B.GetInsertBlock()->getParent()->getEntryBlock();
+    allocaB.SetInsertPoint(&entry, entry.begin());
+    return allocaB.CreateAlloca(ty);
+  }
+
+  /// @brief Creates a stack slot of type @p ty for a `let`-bound variable
+  /// named @p name, whose lifetime starts here and ends with the enclosing
+  /// block.
+  llvm::AllocaInst* genScopedSlot(llvm::Type* ty, llvm::StringRef name) {
+    llvm::AllocaInst* slot = genSlot(ty);
+    slot->setName(name);
+    B.CreateLifetimeStart(slot,
+      B.getInt64(mod.getDataLayout().getTypeAllocSize(ty)));
+    scopedSlots.push_back(slot);
+    return slot;
+  }
+
+  /// @brief Ends the lifetimes of the stack slots created since
+  /// `scopedSlots` had @p size entries.
+  void genEndOfScope(size_t size) {
+    while (scopedSlots.size() > size) {
+      llvm::AllocaInst* slot = scopedSlots.pop_back_val();
+      B.CreateLifetimeEnd(slot, B.getInt64(
+        mod.getDataLayout().getTypeAllocSize(slot->getAllocatedType())));
+    }
+  }
+
+  /// @brief Fills `slotVars` with the variables of @p funDecl whose address
+  /// is taken or that are assigned through a projection.
+  void findSlotVars(FunctionDecl* funDecl) {
+    ScopeStack<const AST*> binders;
+    for (auto param : funDecl->getParameters()->asArrayRef())
+      binders.add(param.first->asStringRef(), param.first);
+    findSlotVars(funDecl->getBody(), binders);
+  }
+
+  void findSlotVars(AST* ast, ScopeStack<const AST*>& binders) {
+    if (auto e = AddrOfExp::downcast(ast)) {
+      markSlotVar(e->getOf(), binders);
+    } else if (auto e = AssignExp::downcast(ast)) {
+      Exp* lhs = e->getLHS();
+      while (auto ascrip = AscripExp::downcast(lhs))
+        lhs = ascrip->getAscriptee();
+      if (!NameExp::downcast(lhs)) markSlotVar(lhs, binders);
+    } else if (auto e = BlockExp::downcast(ast)) {
+      binders.push();
+      for (Exp* stmt : e->getStatements()) findSlotVars(stmt, binders);
+      binders.pop();
+      return;
+    } else if (auto e = LetExp::downcast(ast)) {
+      findSlotVars(e->getDefinition(), binders);
+      binders.add(e->getBoundIdent()->asStringRef(), e);
+      return;
+    }
+    for (AST* child : ast->getASTChildren()) findSlotVars(child, binders);
+  }
+
+  /// @brief Marks the variable that lvalue @p e is stored in, if any.
+  void markSlotVar(Exp* e, ScopeStack<const AST*>& binders) {
+    while (true) {
+      if (auto ascrip = AscripExp::downcast(e)) e = ascrip->getAscriptee();
+      else if (auto proj = ProjectExp::downcast(e);
+               proj && proj->getKind() == ProjectExp::DOT) e = proj->getBase();
+      else break;
+    }
+    if (auto name = NameExp::downcast(e)) {
+      const AST* binder =
+        binders.getOrElse(name->getName()->asStringRef(), nullptr);
+      if (binder) slotVars.insert(binder);
+    }
+  }
+
   /// @brief Generates LLVM IR that computes @p lvalue. Returns the _address_
   /// of the computed value rather than the value itself.
   llvm::Value* genExpByReference(Exp* lvalue) {
@@ -127,9 +897,15 @@ private:
       return genExp(e->getOf());
     }
     if (auto e = NameExp::downcast(lvalue)) {
-      llvm::AllocaInst* variableAddress =
-        varAddresses.getOrElse(e->getName()->asStringRef(), nullptr);
-      assert(variableAddress && "variable not found");
+      llvm::Value* variableAddress;
+      if (ConstDecl* c = ont.getConst(e->getName()->asStringRef()))
+        variableAddress = getConstGlobal(c);
+      else variableAddress = locals.getOrElse(
+        e->getName()->asStringRef(), LocalVar{ nullptr, NO_SSA_VAR }).slot;
+      assert(variableAddress && "variable has no stack slot");
+      llvm::StringRef soa = soaStructOf(e->getType());
+      if (!soa.empty())
+        return genSoaRefFromAddress(soa, variableAddress);
       return variableAddress;
     }
     if (auto e = ProjectExp::downcast(lvalue)) {
@@ -142,37 +918,28 @@ private:
     return nullptr;
   }
 
+  /// @brief Points the debug location of `B` at an expression for as long as
+  /// it lives, if source locations are tracked.
+  class DebugLocScope {
+    llvm::IRBuilder<>& B;
+    llvm::DebugLoc saved;
+  public:
+    DebugLocScope(Codegen& cg, Exp* exp)
+      : B(cg.B), saved(cg.B.getCurrentDebugLocation()) {
+      if (cg.subprogram == nullptr) return;
+      Location loc = exp->getLocation();
+      B.SetCurrentDebugLocation(llvm::DILocation::get(B.getContext(),
+        loc.row, loc.col, cg.subprogram));
+    }
+    ~DebugLocScope() { B.SetCurrentDebugLocation(saved); }
+  };
+
   /// @brief Generates LLVM IR that performs the computation `_exp`.
   llvm::Value* genExp(Exp* exp) {
+    DebugLocScope locScope(*this, exp);
     if (auto e = BinopExp::downcast(exp)) {
-      llvm::Value* v1 = genExp(e->getLHS());
-      llvm::Value* v2 = genExp(e->getRHS());
-      switch (e->getBinop()) {
-      case BinopExp::ADD: return B.CreateAdd(v1, v2);
-      case BinopExp::AND: return B.CreateAnd(v1, v2);
-      case BinopExp::DIV: return B.CreateSDiv(v1, v2);
-      case BinopExp::GE:  return B.CreateICmpSGE(v1, v2);
-      case BinopExp::GT:  return B.CreateICmpSGT(v1, v2);
-      case BinopExp::LE:  return B.CreateICmpSLE(v1, v2);
-      case BinopExp::LT:  return B.CreateICmpSLT(v1, v2);
-      case BinopExp::MOD: return B.CreateSRem(v1, v2);
-      case BinopExp::MUL: return B.CreateMul(v1, v2);
-      case BinopExp::OR:  return B.CreateOr(v1, v2);
-      case BinopExp::SUB: return B.CreateSub(v1, v2);
-      case BinopExp::EQ: {
-        llvm::Type* operandType = v1->getType();
-        if (operandType->isIntegerTy()) return B.CreateICmpEQ(v1, v2);
-        if (operandType->isFloatingPointTy()) return B.CreateFCmpOEQ(v1, v2);
-        llvm_unreachable("Unsupported type for == operator");
-      }
-      case BinopExp::NE: {
-        llvm::Type* operandType = v1->getType();
-        if (operandType->isIntegerTy()) return B.CreateICmpNE(v1, v2);
-        if (operandType->isFloatingPointTy()) return B.CreateFCmpONE(v1, v2);
-        llvm_unreachable("Unsupported type for /= operator");
-      }
-      default: llvm_unreachable("Unsupported binary operator");
-      }
+      return genBinop(e->getBinop(), genExp(e->getLHS()), genExp(e->getRHS()),
+                      isUnsigned(e->getLHS()->getType()));
     }
     else if (auto e = AddrOfExp::downcast(exp)) {
       return genExpByReference(e->getOf());
@@ -181,16 +948,40 @@ private:
       return genExp(e->getAscriptee());
     }
     else if (auto e = AssignExp::downcast(exp)) {
+      Exp* lhs = e->getLHS();
+      while (auto ascrip = AscripExp::downcast(lhs))
+        lhs = ascrip->getAscriptee();
+      if (auto name = NameExp::downcast(lhs)) {
+        LocalVar var = locals.getOrElse(name->getName()->asStringRef(),
+          LocalVar{ nullptr, NO_SSA_VAR });
+        if (var.ssaVar != NO_SSA_VAR) {
+          ssa.writeVariable(var.ssaVar, B.GetInsertBlock(),
+            genExp(e->getRHS()));
+          return nullptr;
+        }
+      }
       llvm::Value* lhsAddr = genExpByReference(e->getLHS());
-      llvm::Value* rhs = genExp(e->getRHS());
-      B.CreateStore(rhs, lhsAddr);
+      llvm::StringRef soa = soaStructOf(e->getLHS()->getType());
+      if (!soa.empty())
+        genSoaStore(soa, genExp(e->getRHS()), lhsAddr);
+      else if (isInMemoryStruct(e->getLHS()->getType()))
+        genExpInto(e->getRHS(), lhsAddr);
+      else
+        B.CreateStore(genExp(e->getRHS()), lhsAddr);
       return nullptr;
     }
+    else if (auto e = AwaitExp::downcast(exp)) {
+      return genAwait(genExp(e->getInner()), e->getType());
+    }
     else if (auto e = BlockExp::downcast(exp)) {
       llvm::Value* lastStmtVal = nullptr;
+      locals.push();
+      size_t outerSlots = scopedSlots.size();
       for (Exp* stmt : e->getStatements()) {
         lastStmtVal = genExp(stmt);
       }
+      genEndOfScope(outerSlots);
+      locals.pop();
       return lastStmtVal;
     }
     else if (auto e = BoolLit::downcast(exp)) {
@@ -200,56 +991,58 @@ private:
       return genExp(e->getRefExp());
     }
     else if (auto e = CallExp::downcast(exp)) {
+      if (e->isBuiltin()) return genBuiltinCall(e);
       std::vector<llvm::Value*> args;
       for (Exp* arg : e->getArguments()->asArrayRef())
         { args.push_back(genExp(arg)); }
 
-      llvm::StringRef funName = ont.mapName(e->getFunction()->asStringRef());
-      llvm::Function* callee = mod.getFunction(funName);
-      llvm::FunctionType* calleeType = callee->getFunctionType();
-      return B.CreateCall(callee, args);
+      return B.CreateCall(getCallee(e->getFunction()), args);
     }
     else if (auto e = ConstrExp::downcast(exp)) {
-      std::vector<llvm::Value*> args;
-      for (Exp* arg : e->getFields()->asArrayRef())
-        { args.push_back(genExp(arg)); }
-      
+      // Built in registers. IRBuilder folds this to a ConstantStruct if all
+      // fields are constants.
       llvm::StructType* st = structTypes[e->getStruct()->asStringRef()];
-      llvm::Value* mem = B.CreateAlloca(st);
+      llvm::Value* val = llvm::UndefValue::get(st);
       unsigned int fieldIdx = 0;
-      for (auto argV : args) {
-        llvm::Value* fieldAddr = B.CreateGEP(st, mem,
-          { B.getInt64(0), B.getInt32(fieldIdx) });
-        B.CreateStore(argV, fieldAddr);
-        ++fieldIdx;
-      }
-      return B.CreateLoad(st, mem);
+      for (Exp* field : e->getFields()->asArrayRef())
+        val = B.CreateInsertValue(val, genExp(field), fieldIdx++);
+      return val;
+    }
+    else if (auto e = DecimalLit::downcast(exp)) {
+      return llvm::ConstantFP::get(genType(e->getType()), e->asDouble());
     }
     else if (auto e = DerefExp::downcast(exp)) {
       llvm::Value* ofExp = genExp(e->getOf());
+      llvm::StringRef soa = soaStructOf(e->getType());
+      if (!soa.empty())
+        return genSoaLoad(soa, ofExp);
       llvm::Type* tyToLoad = genType(e->getType());
       return B.CreateLoad(tyToLoad, ofExp);
     }
     else if (auto e = NameExp::downcast(exp)) {
-      llvm::AllocaInst* variableAddress =
-        varAddresses.getOrElse(e->getName()->asStringRef(), nullptr);
-      assert(variableAddress && "Unbound variable");
+      if (ConstDecl* c = ont.getConst(e->getName()->asStringRef()))
+        return getConstGlobal(c)->getInitializer();
+      LocalVar var = locals.getOrElse(e->getName()->asStringRef(),
+        LocalVar{ nullptr, NO_SSA_VAR });
+      if (var.ssaVar != NO_SSA_VAR)
+        return ssa.readVariable(var.ssaVar, B.GetInsertBlock());
+      if (var.slot == nullptr) return nullptr;  // unit-typed
       llvm::Type* varType = genType(e->getType());
-      return B.CreateLoad(varType, variableAddress);
+      return B.CreateLoad(varType, var.slot);
     }
     else if (auto e = IfExp::downcast(exp)) {
       llvm::Function* f = B.GetInsertBlock()->getParent();
-      llvm::Value* condition = genExp(e->getCondExp());
       auto thenBlock = llvm::BasicBlock::Create(B.getContext(), "then");
       auto elseBlock = llvm::BasicBlock::Create(B.getContext(), "else");
       auto contBlock = llvm::BasicBlock::Create(B.getContext(), "ifcont");
       if (e->getElseExp() != nullptr)
-        B.CreateCondBr(condition, thenBlock, elseBlock);
+        genCondBr(e->getCondExp(), thenBlock, elseBlock);
       else
-        B.CreateCondBr(condition, thenBlock, contBlock);
+        genCondBr(e->getCondExp(), thenBlock, contBlock);
 
       f->insert(f->end(), thenBlock);
       B.SetInsertPoint(thenBlock);
+      ssa.sealBlock(thenBlock);
       llvm::Value* thenResult = genExp(e->getThenExp());
       B.CreateBr(contBlock);
       thenBlock = B.GetInsertBlock();
@@ -258,6 +1051,7 @@ private:
       if (e->getElseExp() != nullptr) {
         f->insert(f->end(), elseBlock);
         B.SetInsertPoint(elseBlock);
+        ssa.sealBlock(elseBlock);
         elseResult = genExp(e->getElseExp());
         B.CreateBr(contBlock);
         elseBlock = B.GetInsertBlock();
@@ -265,6 +1059,7 @@ private:
 
       f->insert(f->end(), contBlock);
       B.SetInsertPoint(contBlock);
+      ssa.sealBlock(contBlock);
       llvm::Type* retTy = genType(e->getType());
       if (!retTy->isVoidTy()) {
         llvm::PHINode* phiNode = B.CreatePHI(retTy, 2);
@@ -279,18 +1074,24 @@ private:
       llvm::Value* baseV = genExp(e->getBase());
       llvm::Value* indexV = genExp(e->getIndex());
       RefType* baseType = RefType::downcast(e->getBase()->getType());
+      llvm::StringRef soa = soaStructOf(baseType->inner);
+      if (!soa.empty())
+        return genSoaIndex(soa, baseV, indexV);
       return B.CreateGEP(genType(baseType->inner), baseV, indexV);
     }
     else if (auto e = IntLit::downcast(exp)) {
       return llvm::ConstantInt::get(genType(e->getType()), e->asLong());
     }
     else if (auto e = LetExp::downcast(exp)) {
-      llvm::Value* v = genExp(e->getDefinition());
-      llvm::StringRef boundIdentName = e->getBoundIdent()->asStringRef();
-      llvm::AllocaInst* memCell = B.CreateAlloca(v->getType());
-      B.CreateStore(v, memCell);
-      varAddresses.add(boundIdentName, memCell);
-      memCell->setName(boundIdentName);
+      Exp* def = e->getDefinition();
+      llvm::StringRef name = e->getBoundIdent()->asStringRef();
+      if (slotVars.count(e) && isInMemoryStruct(def->getType())) {
+        llvm::AllocaInst* slot = genScopedSlot(genType(def->getType()), name);
+        genExpInto(def, slot);
+        locals.add(name, LocalVar{ slot, NO_SSA_VAR });
+        return nullptr;
+      }
+      bindLocal(e, name, genExp(def));
       return nullptr;
     }
     else if (auto e = MoveExp::downcast(exp)) {
@@ -301,14 +1102,10 @@ private:
         e->getTypeName());
     }
     else if (auto e = StringLit::downcast(exp)) {
-      return B.CreateGlobalString(e->processEscapes());
+      return genStringLit(e->getValue());
     }
     else if (auto e = UnopExp::downcast(exp)) {
-      llvm::Value* innerV = genExp(e->getInner());
-      switch (e->getUnop()) {
-      case UnopExp::NEG: return B.CreateNeg(innerV);
-      case UnopExp::NOT: return B.CreateNot(innerV);
-      }
+      return genUnop(e->getUnop(), genExp(e->getInner()));
     }
     else if (auto e = WhileExp::downcast(exp)) {
       llvm::Function* f = B.GetInsertBlock()->getParent();
@@ -319,22 +1116,514 @@ private:
 
       f->insert(f->end(), condBlock);
       B.SetInsertPoint(condBlock);
-      llvm::Value* condResult = genExp(e->getCond());
-      B.CreateCondBr(condResult, bodyBlock, contBlock);
+      genCondBr(e->getCond(), bodyBlock, contBlock);
 
       f->insert(f->end(), bodyBlock);
       B.SetInsertPoint(bodyBlock);
+      ssa.sealBlock(bodyBlock);
       genExp(e->getBody());
       B.CreateBr(condBlock);
+      ssa.sealBlock(condBlock);  // the back edge is its last predecessor
 
       f->insert(f->end(), contBlock);
       B.SetInsertPoint(contBlock);
+      ssa.sealBlock(contBlock);
       return nullptr;
     }
     llvm_unreachable("Codegen::genExp() fallthrough");
     return nullptr;
   }
 
+  /// @brief True if @p ty is a struct that is stored with the ordinary
+  /// struct layout (i.e., not `#[soa]`).
+  bool isInMemoryStruct(Type* ty)
+    { return NameType::downcast(ty) && soaStructOf(ty).empty(); }
+
+  /// @brief True if a copy of struct type @p st is lowered to `llvm.memcpy`
+  /// rather than an aggregate load and store.
+  bool isLargeStruct(llvm::StructType* st)
+    { return mod.getDataLayout().getTypeAllocSize(st) > 16; }
+
+  /// @brief Generates the struct-valued @p exp directly into the memory at
+  /// @p dest. Constructors store their fields in place, and copies of large
+  /// structs (including constant ones) become `llvm.memcpy`s.
+  void genExpInto(Exp* exp, llvm::Value* dest) {
+    while (auto ascrip = AscripExp::downcast(exp))
+      exp = ascrip->getAscriptee();
+    auto st = llvm::cast<llvm::StructType>(genType(exp->getType()));
+
+    if (auto e = ConstrExp::downcast(exp); e && !isConstantExp(e)) {
+      // All fields are evaluated before the first store, since they may read
+      // the destination (e.g., `p = Point{ p.y, p.x }`).
+      llvm::SmallVector<std::pair<llvm::Value*, llvm::Value*>, 8> stores;
+      genConstrStores(e, dest, stores);
+      for (auto [addr, val] : stores) B.CreateStore(val, addr);
+      return;
+    }
+
+    llvm::Value* src = genStructAddress(exp);
+    if (src == nullptr) {
+      llvm::Value* val = genExp(exp);
+      auto constVal = llvm::dyn_cast<llvm::Constant>(val);
+      if (constVal == nullptr || !isLargeStruct(st)) {
+        B.CreateStore(val, dest);
+        return;
+      }
+      src = getStructGlobal(constVal);
+    } else if (!isLargeStruct(st)) {
+      B.CreateStore(B.CreateLoad(st, src), dest);
+      return;
+    }
+    genMemCpy(dest, src, st);
+  }
+
+  /// @brief Copies the struct of type @p st at @p src to @p dest.
+  void genMemCpy(llvm::Value* dest, llvm::Value* src, llvm::StructType* st) {
+    const llvm::DataLayout& DL = mod.getDataLayout();
+    llvm::Align align = DL.getABITypeAlign(st);
+    B.CreateMemCpy(dest, align, src, align, DL.getTypeAllocSize(st));
+  }
+
+  /// @brief Returns a new constant global holding struct @p constVal, to
+  /// copy large constant structs from.
+  llvm::GlobalVariable* getStructGlobal(llvm::Constant* constVal) {
+    auto global = new llvm::GlobalVariable(mod, constVal->getType(), true,
+      llvm::GlobalValue::PrivateLinkage, constVal, ".struct");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return global;
+  }
+
+  /// @brief Evaluates the fields of @p e and appends the stores that put them
+  /// in the struct at @p dest. Nested constructors are flattened.
+  void genConstrStores(ConstrExp* e, llvm::Value* dest,
+      llvm::SmallVectorImpl<std::pair<llvm::Value*, llvm::Value*>>& stores) {
+    llvm::StructType* st = structTypes[e->getStruct()->asStringRef()];
+    unsigned int fieldIdx = 0;
+    for (Exp* field : e->getFields()->asArrayRef()) {
+      llvm::Value* fieldAddr = B.CreateGEP(st, dest,
+        { B.getInt64(0), B.getInt32(fieldIdx++) });
+      while (auto ascrip = AscripExp::downcast(field))
+        field = ascrip->getAscriptee();
+      auto fieldConstr = ConstrExp::downcast(field);
+      if (fieldConstr && !isConstantExp(fieldConstr)
+          && isInMemoryStruct(fieldConstr->getType()))
+        genConstrStores(fieldConstr, fieldAddr, stores);
+      else
+        stores.push_back({ fieldAddr, genExp(field) });
+    }
+  }
+
+  /// @brief Returns the address of struct-valued @p exp if it is already in
+  /// memory (a dereference or a variable with a stack slot), or nullptr.
+  llvm::Value* genStructAddress(Exp* exp) {
+    if (auto e = DerefExp::downcast(exp))
+      return genExp(e->getOf());
+    if (auto e = ProjectExp::downcast(exp);
+        e && e->getKind() == ProjectExp::ARROW)
+      return genExpByReference(e);
+    if (auto e = NameExp::downcast(exp)) {
+      if (ConstDecl* c = ont.getConst(e->getName()->asStringRef()))
+        return getConstGlobal(c);
+      return locals.getOrElse(e->getName()->asStringRef(),
+        LocalVar{ nullptr, NO_SSA_VAR }).slot;
+    }
+    return nullptr;
+  }
+
+  /// @brief True if @p exp is a constant expression whose evaluation has no
+  /// effects, such as a constructor of literals.
+  bool isConstantExp(Exp* exp) {
+    switch (exp->id) {
+    case AST::ID::BOOL_LIT:
+    case AST::ID::DEC_LIT:
+    case AST::ID::INT_LIT:
+    case AST::ID::STRING_LIT:
+      return true;
+    case AST::ID::ENAME:
+      return ont.getConst(
+        NameExp::downcast(exp)->getName()->asStringRef()) != nullptr;
+    case AST::ID::ASCRIP:
+      return isConstantExp(AscripExp::downcast(exp)->getAscriptee());
+    case AST::ID::UNOP_EXP:
+      return isConstantExp(UnopExp::downcast(exp)->getInner());
+    case AST::ID::BINOP_EXP: {
+      auto e = BinopExp::downcast(exp);
+      return isConstantExp(e->getLHS()) && isConstantExp(e->getRHS());
+    }
+    case AST::ID::CONSTR:
+      for (Exp* field : ConstrExp::downcast(exp)->getFields()->asArrayRef())
+        if (!isConstantExp(field)) return false;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /// @brief True iff @p ty is an unsigned integer type (i.e., `usize`).
+  static bool isUnsigned(Type* ty) {
+    auto primTy = PrimitiveType::downcast(ty);
+    return primTy != nullptr && primTy->kind == PrimitiveType::USIZE;
+  }
+
+  /// @brief Generates the binary operation @p op on @p v1 and @p v2. Division,
+  /// remainder, right shifts, and comparisons are unsigned if @p isUnsigned.
+  llvm::Value* genBinop(BinopExp::Binop op, llvm::Value* v1, llvm::Value* v2,
+                        bool isUnsigned) {
+    if (v1->getType()->isFloatingPointTy()) return genFloatBinop(op, v1, v2);
+    switch (op) {
+    case BinopExp::ADD: return B.CreateAdd(v1, v2);
+    case BinopExp::AND: return B.CreateAnd(v1, v2);
+    case BinopExp::BITAND: return B.CreateAnd(v1, v2);
+    case BinopExp::BITOR:  return B.CreateOr(v1, v2);
+    case BinopExp::BITXOR: return B.CreateXor(v1, v2);
+    case BinopExp::SHL: return B.CreateShl(v1, genShiftAmount(v2));
+    case BinopExp::SHR:
+      return isUnsigned ? B.CreateLShr(v1, genShiftAmount(v2))
+                        : B.CreateAShr(v1, genShiftAmount(v2));
+    case BinopExp::DIV:
+      return isUnsigned ? B.CreateUDiv(v1, v2) : B.CreateSDiv(v1, v2);
+    case BinopExp::EQ:  return B.CreateICmpEQ(v1, v2);
+    case BinopExp::GE:
+      return isUnsigned ? B.CreateICmpUGE(v1, v2) : B.CreateICmpSGE(v1, v2);
+    case BinopExp::GT:
+      return isUnsigned ? B.CreateICmpUGT(v1, v2) : B.CreateICmpSGT(v1, v2);
+    case BinopExp::LE:
+      return isUnsigned ? B.CreateICmpULE(v1, v2) : B.CreateICmpSLE(v1, v2);
+    case BinopExp::LT:
+      return isUnsigned ? B.CreateICmpULT(v1, v2) : B.CreateICmpSLT(v1, v2);
+    case BinopExp::MOD:
+      return isUnsigned ? B.CreateURem(v1, v2) : B.CreateSRem(v1, v2);
+    case BinopExp::MUL: return B.CreateMul(v1, v2);
+    case BinopExp::NE:  return B.CreateICmpNE(v1, v2);
+    case BinopExp::OR:  return B.CreateOr(v1, v2);
+    case BinopExp::SUB: return B.CreateSub(v1, v2);
+    default: llvm_unreachable("Unsupported binary operator");
+    }
+  }
+
+  /// @brief Masks shift amount @p v to less than its bit width, so shifting
+  /// by the width or more wraps around (like Rust's `wrapping_shl`) instead of
+  /// producing poison. x86 masks shift counts itself, so this usually costs
+  /// nothing.
+  llvm::Value* genShiftAmount(llvm::Value* v)
+    { return B.CreateAnd(v, v->getType()->getIntegerBitWidth() - 1); }
+
+  /// @brief Generates the binary operation @p op on floating-point values
+  /// @p v1 and @p v2.
+  llvm::Value* genFloatBinop(BinopExp::Binop op, llvm::Value* v1,
+                             llvm::Value* v2) {
+    switch (op) {
+    case BinopExp::ADD: return B.CreateFAdd(v1, v2);
+    case BinopExp::DIV: return B.CreateFDiv(v1, v2);
+    case BinopExp::EQ:  return B.CreateFCmpOEQ(v1, v2);
+    case BinopExp::GE:  return B.CreateFCmpOGE(v1, v2);
+    case BinopExp::GT:  return B.CreateFCmpOGT(v1, v2);
+    case BinopExp::LE:  return B.CreateFCmpOLE(v1, v2);
+    case BinopExp::LT:  return B.CreateFCmpOLT(v1, v2);
+    case BinopExp::MOD: return B.CreateFRem(v1, v2);
+    case BinopExp::MUL: return B.CreateFMul(v1, v2);
+    case BinopExp::NE:  return B.CreateFCmpUNE(v1, v2);
+    case BinopExp::SUB: return B.CreateFSub(v1, v2);
+    default: llvm_unreachable("Unsupported floating-point binary operator");
+    }
+  }
+
+  /// @brief Generates the unary operation @p op on @p v.
+  llvm::Value* genUnop(UnopExp::Unop op, llvm::Value* v) {
+    switch (op) {
+    case UnopExp::NEG:
+      if (v->getType()->isFloatingPointTy()) return B.CreateFNeg(v);
+      return B.CreateNeg(v);
+    case UnopExp::NOT: return B.CreateNot(v);
+    }
+    llvm_unreachable("Unsupported unary operator");
+  }
+
+  /// @brief Returns the read-only global that holds the value of constant
+  /// @p c, evaluating and emitting it first if need be.
+  llvm::GlobalVariable* getConstGlobal(ConstDecl* c) {
+    if (llvm::GlobalVariable* global = constGlobals.lookup(c)) return global;
+    llvm::Constant* init = genConstant(c->getInit());
+    auto global = new llvm::GlobalVariable(mod, init->getType(), true,
+      llvm::GlobalValue::InternalLinkage, init, c->getName()->asStringRef());
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    constGlobals[c] = global;
+    return global;
+  }
+
+  /// @brief Evaluates the initializer @p exp of a constant at compile time.
+  /// The data of array literals is put in private read-only globals.
+  llvm::Constant* genConstant(Exp* exp) {
+    if (auto e = ArrayLit::downcast(exp)) {
+      std::vector<llvm::Constant*> elements;
+      for (Exp* element : e->getElements()->asArrayRef())
+        elements.push_back(genConstant(element));
+      auto arrayTy = llvm::ArrayType::get(
+        genType(RefType::downcast(e->getType())->inner), elements.size());
+      auto global = new llvm::GlobalVariable(mod, arrayTy, true,
+        llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(arrayTy, elements), ".array");
+      global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+      return global;
+    }
+    if (auto e = AscripExp::downcast(exp))
+      return genConstant(e->getAscriptee());
+    if (auto e = BinopExp::downcast(exp)) {
+      return llvm::cast<llvm::Constant>(genBinop(e->getBinop(),
+        genConstant(e->getLHS()), genConstant(e->getRHS()),
+        isUnsigned(e->getLHS()->getType())));
+    }
+    if (auto e = ConstrExp::downcast(exp)) {
+      std::vector<llvm::Constant*> fields;
+      for (Exp* field : e->getFields()->asArrayRef())
+        fields.push_back(genConstant(field));
+      return llvm::ConstantStruct::get(
+        structTypes[e->getStruct()->asStringRef()], fields);
+    }
+    if (auto e = DecimalLit::downcast(exp))
+      return llvm::ConstantFP::get(genType(e->getType()), e->asDouble());
+    if (auto e = UnopExp::downcast(exp)) {
+      return llvm::cast<llvm::Constant>(
+        genUnop(e->getUnop(), genConstant(e->getInner())));
+    }
+    // literals and names of other constants
+    return llvm::cast<llvm::Constant>(genExp(exp));
+  }
+
+  /// @brief Generates a conditional branch on @p cond. If @p cond is a call
+  /// to `likely` or `unlikely`, the hint becomes branch weights on the branch
+  /// itself rather than an llvm.expect call.
+  void genCondBr(Exp* cond, llvm::BasicBlock* ifTrue,
+                 llvm::BasicBlock* ifFalse) {
+    auto call = CallExp::downcast(cond);
+    if (call == nullptr || (call->getBuiltin() != CallExp::LIKELY
+                            && call->getBuiltin() != CallExp::UNLIKELY)) {
+      B.CreateCondBr(genExp(cond), ifTrue, ifFalse);
+      return;
+    }
+    llvm::Value* condV = genExp(call->getArguments()->asArrayRef()[0]);
+    B.CreateCondBr(condV, ifTrue, ifFalse,
+                   branchWeights(call->getBuiltin() == CallExp::LIKELY));
+  }
+
+  /// @brief The branch weights of a conditional branch that is @p likely (or
+  /// else unlikely) to be taken.
+  llvm::MDNode* branchWeights(bool likely) {
+    // same weights that llvm.expect lowers to
+    const uint32_t hot = 2000, cold = 1;
+    llvm::MDBuilder MDB(B.getContext());
+    return likely ? MDB.createBranchWeights(hot, cold)
+                  : MDB.createBranchWeights(cold, hot);
+  }
+
+  /// @brief Generates code for a call to a compiler builtin.
+  llvm::Value* genBuiltinCall(CallExp* e) {
+    llvm::SmallVector<llvm::Value*, 3> argVs;
+    for (Exp* arg : e->getArguments()->asArrayRef())
+      argVs.push_back(genExp(arg));
+    return genBuiltin(e, argVs);
+  }
+
+  /// @brief Generates code for the builtin call @p e whose arguments have
+  /// been evaluated to @p argVs.
+  llvm::Value* genBuiltin(CallExp* e, llvm::ArrayRef<llvm::Value*> argVs) {
+    llvm::ArrayRef<Exp*> args = e->getArguments()->asArrayRef();
+    switch (e->getBuiltin()) {
+    case CallExp::LIKELY:
+    case CallExp::UNLIKELY:
+      return B.CreateIntrinsic(llvm::Intrinsic::expect, { B.getInt1Ty() },
+        { argVs[0], B.getInt1(e->getBuiltin() == CallExp::LIKELY) });
+    case CallExp::PREFETCH: {
+      llvm::Value* ref = argVs[0];
+      llvm::Value* rw = B.getInt32(IntLit::downcast(args[1])->asLong());
+      llvm::Value* locality = B.getInt32(IntLit::downcast(args[2])->asLong());
+      llvm::Value* dataCache = B.getInt32(1);
+
+      // a reference to a soa struct prefetches every column
+      llvm::SmallVector<llvm::Value*, 4> addrs;
+      if (auto soaRefTy = llvm::dyn_cast<llvm::StructType>(ref->getType())) {
+        for (unsigned i = 0; i < soaRefTy->getNumElements(); ++i)
+          addrs.push_back(B.CreateExtractValue(ref, i));
+      } else {
+        addrs.push_back(ref);
+      }
+      for (llvm::Value* addr : addrs)
+        B.CreateIntrinsic(llvm::Intrinsic::prefetch, { addr->getType() },
+          { addr, rw, locality, dataCache });
+      return nullptr;
+    }
+    case CallExp::BITREVERSE:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::bitreverse,
+                                    argVs[0]);
+    case CallExp::BSWAP: {
+      llvm::Value* v = argVs[0];
+      if (v->getType()->isIntegerTy(8)) return v;  // one byte, nothing to swap
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::bswap, v);
+    }
+    case CallExp::CLZ:
+    case CallExp::CTZ:
+      // a zero operand is defined to give the bit width
+      return B.CreateBinaryIntrinsic(e->getBuiltin() == CallExp::CLZ ?
+        llvm::Intrinsic::ctlz : llvm::Intrinsic::cttz, argVs[0],
+        B.getFalse());
+    case CallExp::POPCOUNT:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::ctpop, argVs[0]);
+    case CallExp::ROTL:
+    case CallExp::ROTR: {
+      // a funnel shift of a value with itself is a rotate
+      llvm::Value* v = argVs[0];
+      llvm::Value* n = argVs[1];
+      return B.CreateIntrinsic(e->getBuiltin() == CallExp::ROTL ?
+        llvm::Intrinsic::fshl : llvm::Intrinsic::fshr, { v->getType() },
+        { v, v, n });
+    }
+    case CallExp::ABS:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::fabs, argVs[0]);
+    case CallExp::CEIL:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::ceil, argVs[0]);
+    case CallExp::FLOOR:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::floor, argVs[0]);
+    case CallExp::ROUND:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::round, argVs[0]);
+    case CallExp::SQRT:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::sqrt, argVs[0]);
+    case CallExp::TRUNC:
+      return B.CreateUnaryIntrinsic(llvm::Intrinsic::trunc, argVs[0]);
+    case CallExp::MAX:
+    case CallExp::MIN:
+      return B.CreateBinaryIntrinsic(e->getBuiltin() == CallExp::MAX ?
+        llvm::Intrinsic::maxnum : llvm::Intrinsic::minnum, argVs[0],
+        argVs[1]);
+    case CallExp::FMA:
+      return B.CreateIntrinsic(llvm::Intrinsic::fma, { argVs[0]->getType() },
+        argVs);
+    case CallExp::ALLOC:
+    case CallExp::FREE:
+    case CallExp::REALLOC: {
+      llvm::CallInst* call =
+        B.CreateCall(getAllocatorFunc(e->getBuiltin()), argVs);
+      return e->getBuiltin() == CallExp::FREE ? nullptr : call;
+    }
+    case CallExp::SOA_ALLOC:
+      return genSoaAlloc(soaStructOf(RefType::downcast(e->getType())->inner),
+                         argVs[0]);
+    case CallExp::SOA_FREE:
+      // the first column starts at the beginning of the allocation
+      B.CreateCall(getAllocatorFunc(CallExp::FREE),
+                   B.CreateExtractValue(argVs[0], 0));
+      return nullptr;
+    case CallExp::LOWER_BOUND:
+    case CallExp::RADIX_SORT:
+    case CallExp::SORT:
+    case CallExp::SORT_BY:
+      return genAlgorithmCall(e, argVs);
+    case CallExp::BLOCK_ON: {
+      // runs the event loop until the future has completed
+      coroutines = true;
+      llvm::Value* future = argVs[0];
+      B.CreateCall(getRuntimeFunc("miscr_async_run", B.getVoidTy(),
+        { future->getType() }), future);
+      return genTakeResult(future, getPromiseType(e->getType()));
+    }
+    case CallExp::NOT_BUILTIN:
+      break;
+    }
+    llvm_unreachable("Codegen::genBuiltinCall() unexpected builtin");
+  }
+
+  /// @brief Generates a call to a sorting or searching builtin. The
+  /// algorithm is specialized to the element type and the comparison.
+  llvm::Value* genAlgorithmCall(CallExp* e,
+                                llvm::ArrayRef<llvm::Value*> argVs) {
+    llvm::ArrayRef<Exp*> args = e->getArguments()->asArrayRef();
+    Type* elemTy = RefType::downcast(args[0]->getType())->inner;
+    llvm::Type* llvmElemTy = genType(elemTy);
+    std::string suffix = elemTy->asString();
+    llvm::FunctionCallee comparator;
+    AlgorithmBuilder::Order order = AlgorithmBuilder::SIGNED;
+    if (Name* comparatorName = e->getComparator()) {
+      comparator = getCallee(comparatorName);
+      suffix = "by." + ont.mapName(comparatorName->asStringRef()).str();
+      order = AlgorithmBuilder::COMPARATOR;
+    }
+    else if (llvmElemTy->isFloatingPointTy())
+      order = AlgorithmBuilder::FLOAT;
+    else if (isUnsigned(elemTy))
+      order = AlgorithmBuilder::UNSIGNED;
+    AlgorithmBuilder AB(mod, llvmElemTy, order, suffix, comparator);
+    switch (e->getBuiltin()) {
+    case CallExp::LOWER_BOUND:
+      return B.CreateCall(AB.getLowerBound(), argVs);
+    case CallExp::RADIX_SORT:
+      B.CreateCall(AB.getRadixSort(getAllocatorFunc(CallExp::ALLOC),
+                                   getAllocatorFunc(CallExp::FREE)), argVs);
+      return nullptr;
+    default:
+      B.CreateCall(AB.getSort(), argVs);
+      return nullptr;
+    }
+  }
+
+  /// @brief Returns the function named @p name. A function with target
+  /// clones is called through its ifunc.
+  llvm::FunctionCallee getCallee(Name* name) {
+    llvm::StringRef funName = ont.mapName(name->asStringRef());
+    if (llvm::Function* callee = mod.getFunction(funName)) return callee;
+    llvm::GlobalIFunc* ifunc = mod.getNamedIFunc(funName);
+    return llvm::FunctionCallee(
+      llvm::cast<llvm::FunctionType>(ifunc->getValueType()), ifunc);
+  }
+
+  /// @brief Declares the allocator function behind @p builtin (`alloc`,
+  /// `realloc`, or `free`). The MiSCR allocator's functions get the
+  /// attributes that LLVM infers for libc's, so that it can, e.g., remove
+  /// allocations that are never used.
+  llvm::FunctionCallee getAllocatorFunc(CallExp::Builtin builtin) {
+    llvm::LLVMContext& ctx = B.getContext();
+    llvm::Type* ptrTy = llvm::PointerType::get(ctx, 0);
+    llvm::Type* i64Ty = B.getInt64Ty();
+    bool libc = libcAllocator;
+    runtimeAllocator |= !libc;
+    if (builtin == CallExp::ALLOC) {
+      llvm::FunctionCallee f = getRuntimeFunc(libc ? "malloc" : "miscr_alloc",
+                                              ptrTy, { i64Ty });
+      if (!libc) addAllocatorAttrs(f, llvm::AllocFnKind::Alloc
+        | llvm::AllocFnKind::Uninitialized, 0);
+      return f;
+    }
+    if (builtin == CallExp::REALLOC) {
+      llvm::FunctionCallee f = getRuntimeFunc(
+        libc ? "realloc" : "miscr_realloc", ptrTy, { ptrTy, i64Ty });
+      if (!libc) addAllocatorAttrs(f, llvm::AllocFnKind::Realloc
+        | llvm::AllocFnKind::Uninitialized, 1);
+      return f;
+    }
+    llvm::FunctionCallee f = getRuntimeFunc(libc ? "free" : "miscr_free",
+                                            B.getVoidTy(), { ptrTy });
+    if (!libc) addAllocatorAttrs(f, llvm::AllocFnKind::Free, -1);
+    return f;
+  }
+
+  /// @brief Marks @p callee as an allocator function of kind @p kind in the
+  /// "miscr" family. @p sizeArg is the argument that is the size of the
+  /// allocation, if any.
+  void addAllocatorAttrs(llvm::FunctionCallee callee, llvm::AllocFnKind kind,
+                         int sizeArg) {
+    auto f = llvm::dyn_cast<llvm::Function>(callee.getCallee());
+    if (f == nullptr || !f->isDeclaration()) return;
+    llvm::LLVMContext& ctx = f->getContext();
+    f->addFnAttr(llvm::Attribute::getWithAllocKind(ctx, kind));
+    f->addFnAttr("alloc-family", "miscr");
+    f->addFnAttr(llvm::Attribute::NoUnwind);
+    f->addFnAttr(llvm::Attribute::WillReturn);
+    if (sizeArg >= 0) {
+      f->addFnAttr(llvm::Attribute::getWithAllocSizeArgs(ctx, sizeArg, {}));
+      f->addRetAttr(llvm::Attribute::NoAlias);
+    }
+    if (f->getFunctionType()->getParamType(0)->isPointerTy())
+      f->addParamAttr(0, llvm::Attribute::AllocatedPointer);
+  }
+
   /// @brief Generates code for a ProjectExp.
   llvm::Value* genProjectExp(Exp* base, Name* field, ProjectExp::Kind kind,
                              llvm::StringRef typeName) {
@@ -342,20 +1631,34 @@ private:
     StructDecl* structDecl = ont.getType(typeName);
     unsigned int fieldIndex = 0;
     llvm::Type* fieldType;
+    llvm::StringRef fieldSoa;
     for (auto f : structDecl->getFields()->asArrayRef()) {
       if (f.first->asStringRef() == field->asStringRef()) {
         fieldType = genType(f.second);
+        fieldSoa = soaStructOf(f.second);
         break;
       }
       ++fieldIndex;
     }
     assert(fieldIndex < structDecl->getFields()->asArrayRef().size());
+
+    // A reference to a soa struct already holds a pointer to each column, so
+    // projecting a field is just picking the right column.
+    if (structDecl->isSoa() && kind != ProjectExp::DOT) {
+      llvm::Value* column = B.CreateExtractValue(baseV, fieldIndex);
+      if (kind == ProjectExp::BRACKETS) return column;
+      return B.CreateLoad(fieldType, column);
+    }
+
     switch (kind) {
     case ProjectExp::DOT:
       return B.CreateExtractValue(baseV, fieldIndex);
-    case ProjectExp::BRACKETS:
-      return B.CreateGEP(structTypes[typeName], baseV,
+    case ProjectExp::BRACKETS: {
+      llvm::Value* fieldAddr = B.CreateGEP(structTypes[typeName], baseV,
         { B.getInt64(0), B.getInt32(fieldIndex) });
+      if (!fieldSoa.empty()) return genSoaRefFromAddress(fieldSoa, fieldAddr);
+      return fieldAddr;
+    }
     case ProjectExp::ARROW:
       return B.CreateLoad(
         fieldType,
@@ -367,14 +1670,129 @@ private:
     return nullptr;
   }
 
+  /// @brief Returns the fully qualified name of @p ty if it names a `#[soa]`
+  /// struct, or the empty string otherwise.
+  llvm::StringRef soaStructOf(Type* ty) {
+    if (auto nameTy = NameType::downcast(ty))
+      if (soaRefTypes.count(nameTy->asString)) return nameTy->asString;
+    return "";
+  }
+
+  /// @brief Returns the fully qualified name of @p texp if it names a `#[soa]`
+  /// struct, or the empty string otherwise.
+  llvm::StringRef soaStructOf(TypeExp* texp) {
+    if (auto nameTexp = NameTypeExp::downcast(texp))
+      if (soaRefTypes.count(nameTexp->getName()->asStringRef()))
+        return nameTexp->getName()->asStringRef();
+    return "";
+  }
+
+  /// @brief Builds a reference to the single soa struct stored (with the
+  /// ordinary struct layout) at @p addr. Its columns have length one.
+  llvm::Value* genSoaRefFromAddress(llvm::StringRef typeName,
+                                   llvm::Value* addr) {
+    llvm::StructType* st = structTypes[typeName];
+    llvm::Value* ref = llvm::UndefValue::get(soaRefTypes[typeName]);
+    for (unsigned i = 0; i < st->getNumElements(); ++i) {
+      llvm::Value* column = B.CreateGEP(st, addr,
+        { B.getInt64(0), B.getInt32(i) });
+      ref = B.CreateInsertValue(ref, column, i);
+    }
+    return ref;
+  }
+
+  /// @brief Allocates @p n elements of soa struct @p typeName with a single
+  /// call to the allocator, laying the columns out one after another.
+  llvm::Value* genSoaAlloc(llvm::StringRef typeName, llvm::Value* n) {
+    llvm::StructType* st = structTypes[typeName];
+    const llvm::DataLayout& DL = mod.getDataLayout();
+    llvm::Value* size = B.getInt64(0);
+    std::vector<llvm::Value*> offsets;
+    for (llvm::Type* elemTy : st->elements()) {
+      // rounds up to the alignment of the column's elements
+      uint64_t align = DL.getABITypeAlign(elemTy).value();
+      size = B.CreateAnd(B.CreateAdd(size, B.getInt64(align - 1)),
+                         B.getInt64(~(align - 1)));
+      offsets.push_back(size);
+      size = B.CreateAdd(size,
+        B.CreateMul(n, B.getInt64(DL.getTypeAllocSize(elemTy))));
+    }
+    llvm::Value* base = B.CreateCall(getAllocatorFunc(CallExp::ALLOC), size);
+    llvm::Value* ref = llvm::UndefValue::get(soaRefTypes[typeName]);
+    for (unsigned i = 0; i < offsets.size(); ++i) {
+      llvm::Value* column = B.CreateGEP(B.getInt8Ty(), base, offsets[i]);
+      ref = B.CreateInsertValue(ref, column, i);
+    }
+    return ref;
+  }
+
+  /// @brief Loads the soa struct referenced by @p ref, gathering one element
+  /// from each column.
+  llvm::Value* genSoaLoad(llvm::StringRef typeName, llvm::Value* ref) {
+    llvm::StructType* st = structTypes[typeName];
+    llvm::Value* val = llvm::UndefValue::get(st);
+    for (unsigned i = 0; i < st->getNumElements(); ++i) {
+      llvm::Value* elem = B.CreateLoad(st->getElementType(i),
+        B.CreateExtractValue(ref, i));
+      val = B.CreateInsertValue(val, elem, i);
+    }
+    return val;
+  }
+
+  /// @brief Stores the struct value @p val into the columns of @p ref.
+  void genSoaStore(llvm::StringRef typeName, llvm::Value* val,
+                   llvm::Value* ref) {
+    llvm::StructType* st = structTypes[typeName];
+    for (unsigned i = 0; i < st->getNumElements(); ++i)
+      B.CreateStore(B.CreateExtractValue(val, i), B.CreateExtractValue(ref, i));
+  }
+
+  /// @brief Offsets every column of @p ref by @p index elements.
+  llvm::Value* genSoaIndex(llvm::StringRef typeName, llvm::Value* ref,
+                           llvm::Value* index) {
+    llvm::StructType* st = structTypes[typeName];
+    llvm::Value* ret = llvm::UndefValue::get(soaRefTypes[typeName]);
+    for (unsigned i = 0; i < st->getNumElements(); ++i) {
+      llvm::Value* column = B.CreateGEP(st->getElementType(i),
+        B.CreateExtractValue(ref, i), index);
+      ret = B.CreateInsertValue(ret, column, i);
+    }
+    return ret;
+  }
+
+  /// @brief Returns a pointer to a null-terminated global copy of @p bytes,
+  /// reusing the global of an earlier identical literal. The globals are
+  /// `unnamed_addr` constants so that the linker may also merge them with
+  /// equal strings from other object files.
+  llvm::Constant* genStringLit(llvm::StringRef bytes) {
+    ++stats.stringLits;
+    llvm::GlobalVariable*& global = stringPool[bytes];
+    if (global != nullptr) {
+      ++stats.pooledStringLits;
+      return global;
+    }
+    llvm::Constant* init =
+      llvm::ConstantDataArray::getString(B.getContext(), bytes);
+    global = new llvm::GlobalVariable(mod, init->getType(), true,
+      llvm::GlobalValue::PrivateLinkage, init, ".str");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(llvm::Align(1));
+    return global;
+  }
+
   /// @brief Converts a Type to an llvm::Type
   llvm::Type* genType(Type* ty) {
     if (auto constraint = Constraint::downcast(ty)) {
       switch (constraint->kind) {
       case Constraint::DECIMAL:   return B.getDoubleTy();
+      case Constraint::INDEX:     return B.getInt64Ty();
+      case Constraint::INTEGER:   return B.getInt32Ty();
       case Constraint::NUMERIC:   return B.getInt32Ty();
       }
     }
+    if (FutureType::downcast(ty)) {
+      return llvm::PointerType::get(B.getContext(), 0);  // coroutine handle
+    }
     if (auto nameTy = NameType::downcast(ty)) {
       return structTypes[nameTy->asString];
     }
@@ -387,10 +1805,15 @@ private:
       case PrimitiveType::i16:    return B.getInt16Ty();
       case PrimitiveType::i32:    return B.getInt32Ty();
       case PrimitiveType::i64:    return B.getInt64Ty();
+      case PrimitiveType::ISIZE:  return B.getInt64Ty();
+      case PrimitiveType::USIZE:  return B.getInt64Ty();
       case PrimitiveType::UNIT:   return B.getVoidTy();
       }
     }
     if (auto refTy = RefType::downcast(ty)) {
+      llvm::StringRef soa = soaStructOf(refTy->inner);
+      if (!soa.empty())
+        return soaRefTypes[soa];
       return llvm::PointerType::get(B.getContext(), 0);
     }
     if (auto tyVar = TypeVar::downcast(ty)) {
@@ -410,13 +1833,18 @@ private:
       case PrimitiveTypeExp::i16:    return B.getInt16Ty();
       case PrimitiveTypeExp::i32:    return B.getInt32Ty();
       case PrimitiveTypeExp::i64:    return B.getInt64Ty();
+      case PrimitiveTypeExp::ISIZE:  return B.getInt64Ty();
+      case PrimitiveTypeExp::USIZE:  return B.getInt64Ty();
       case PrimitiveTypeExp::UNIT:   return B.getVoidTy();
       }
     }
     if (auto nameTexp = NameTypeExp::downcast(texp)) {
       return structTypes[nameTexp->getName()->asStringRef()];
     }
-    if (RefTypeExp::downcast(texp)) {
+    if (auto refTexp = RefTypeExp::downcast(texp)) {
+      llvm::StringRef soa = soaStructOf(refTexp->getPointeeType());
+      if (!soa.empty())
+        return soaRefTypes[soa];
       return llvm::PointerType::get(B.getContext(), 0);
     }
     llvm_unreachable("Codegen::genType(TypeExp*) case unimplemented");
@@ -0,0 +1,130 @@
+#ifndef CODEGEN_SSABUILDER
+#define CODEGEN_SSABUILDER
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/ValueHandle.h>
+
+/// @brief Constructs SSA form on the fly while Codegen emits a function, so
+/// that local variables need no stack slots. This is the algorithm of Braun
+/// et al., "Simple and Efficient Construction of Static Single Assignment
+/// Form" (CC 2013).
+///
+/// Codegen reports each definition with writeVariable() and asks for the
+/// reaching definition with readVariable(). A block must be sealed once all
+/// of its predecessors are known (i.e., branch to it); reads in an unsealed
+/// block get placeholder PHIs that are completed when it is sealed. PHIs that
+/// turn out to merge a single value are removed.
+class SSABuilder {
+  std::vector<llvm::Type*> varTypes;
+
+  /// @brief The definition of each variable at the end of each block so far.
+  /// Tracking handles follow the replacement of trivial PHIs.
+  llvm::DenseMap<std::pair<unsigned, llvm::BasicBlock*>,
+                 llvm::TrackingVH<llvm::Value>> currentDef;
+
+  llvm::DenseMap<llvm::BasicBlock*,
+                 llvm::SmallVector<std::pair<unsigned, llvm::PHINode*>, 4>>
+    incompletePhis;
+
+  llvm::SmallPtrSet<llvm::BasicBlock*, 16> sealedBlocks;
+
+public:
+
+  /// @brief Starts a new variable of type @p ty and returns its handle.
+  unsigned addVariable(llvm::Type* ty) {
+    varTypes.push_back(ty);
+    return varTypes.size() - 1;
+  }
+
+  /// @brief Records that @p var is @p val at the end of @p bb (so far).
+  void writeVariable(unsigned var, llvm::BasicBlock* bb, llvm::Value* val)
+    { currentDef[{ var, bb }] = val; }
+
+  /// @brief Returns the value of @p var that reaches the end of @p bb.
+  llvm::Value* readVariable(unsigned var, llvm::BasicBlock* bb) {
+    auto it = currentDef.find({ var, bb });
+    if (it != currentDef.end()) return it->second;
+    return readVariableRecursive(var, bb);
+  }
+
+  /// @brief Declares that all predecessors of @p bb are known, and completes
+  /// the PHIs created for reads in @p bb.
+  void sealBlock(llvm::BasicBlock* bb) {
+    sealedBlocks.insert(bb);
+    auto it = incompletePhis.find(bb);
+    if (it == incompletePhis.end()) return;
+    auto pending = std::move(it->second);
+    incompletePhis.erase(it);
+    for (auto [var, phi] : pending) addPhiOperands(var, phi);
+  }
+
+  /// @brief Forgets all variables and blocks. Call between functions.
+  void clear() {
+    varTypes.clear();
+    currentDef.clear();
+    incompletePhis.clear();
+    sealedBlocks.clear();
+  }
+
+private:
+
+  llvm::Value* readVariableRecursive(unsigned var, llvm::BasicBlock* bb) {
+    llvm::Value* val;
+    if (!sealedBlocks.count(bb)) {
+      llvm::PHINode* phi = newPhi(var, bb);
+      incompletePhis[bb].push_back({ var, phi });
+      val = phi;
+    } else if (llvm::BasicBlock* pred = bb->getSinglePredecessor()) {
+      val = readVariable(var, pred);
+    } else {
+      // the PHI is written first to break cycles through loops
+      llvm::PHINode* phi = newPhi(var, bb);
+      writeVariable(var, bb, phi);
+      val = addPhiOperands(var, phi);
+    }
+    writeVariable(var, bb, val);
+    return val;
+  }
+
+  llvm::PHINode* newPhi(unsigned var, llvm::BasicBlock* bb) {
+    if (bb->empty()) return llvm::PHINode::Create(varTypes[var], 0, "", bb);
+    return llvm::PHINode::Create(varTypes[var], 0, "", &bb->front());
+  }
+
+  llvm::Value* addPhiOperands(unsigned var, llvm::PHINode* phi) {
+    for (llvm::BasicBlock* pred : llvm::predecessors(phi->getParent()))
+      phi->addIncoming(readVariable(var, pred), pred);
+    return tryRemoveTrivialPhi(phi);
+  }
+
+  /// @brief Replaces @p phi by its only operand (other than itself) if it
+  /// has one, and then retries the PHIs that used it.
+  llvm::Value* tryRemoveTrivialPhi(llvm::PHINode* phi) {
+    if (!sealedBlocks.count(phi->getParent())) return phi;
+    llvm::Value* same = nullptr;
+    for (llvm::Value* op : phi->incoming_values()) {
+      if (op == same || op == phi) continue;
+      if (same != nullptr) return phi;
+      same = op;
+    }
+    // no operands: the block is unreachable
+    if (same == nullptr) same = llvm::UndefValue::get(phi->getType());
+
+    llvm::SmallVector<llvm::WeakTrackingVH, 4> users;
+    for (llvm::User* user : phi->users())
+      if (user != phi && llvm::isa<llvm::PHINode>(user))
+        users.push_back(user);
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+    for (llvm::WeakTrackingVH& user : users)
+      if (auto userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user))
+        tryRemoveTrivialPhi(userPhi);
+    return same;
+  }
+};
+
+#endif
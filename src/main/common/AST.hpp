@@ -31,12 +31,12 @@ public:
   enum ID : unsigned char {
 
     // expressions and statements
-    ADDR_OF, ASCRIP, ASSIGN, BINOP_EXP, BLOCK, BORROW, BOOL_LIT, CALL, CONSTR,
-    DEC_LIT, DEREF, ENAME, IF, INDEX, INT_LIT, LET, MOVE, PROJECT, RETURN,
-    STRING_LIT, UNOP_EXP, WHILE,
+    ADDR_OF, ARRAY_LIT, ASCRIP, ASSIGN, AWAIT, BINOP_EXP, BLOCK, BORROW,
+    BOOL_LIT, CALL, CONSTR, DEC_LIT, DEREF, ENAME, IF, INDEX, INT_LIT, LET,
+    MOVE, PROJECT, RETURN, STRING_LIT, UNOP_EXP, WHILE,
 
     // declarations
-    FUNC, MODULE, STRUCT,
+    CONST, FUNC, MODULE, STRUCT,
 
     // type expressions
     NAME_TEXP, PRIMITIVE_TEXP, REF_TEXP,
@@ -114,7 +114,8 @@ protected:
 class PrimitiveTypeExp : public TypeExp {
 public:
 
-  enum Kind : unsigned char { BOOL, f32, f64, i8, i16, i32, i64, UNIT };
+  enum Kind : unsigned char
+    { BOOL, f32, f64, i8, i16, i32, i64, ISIZE, USIZE, UNIT };
 
   /// @brief The kind of primitive type this represents.
   const Kind kind;
@@ -137,6 +138,8 @@ public:
     case i16:    return "i16";
     case i32:    return "i32";
     case i64:    return "i64";
+    case ISIZE:  return "isize";
+    case USIZE:  return "usize";
     case UNIT:   return "unit";
     }
     llvm_unreachable("PrimitiveTypeExp::getKindAsString unhandled switch case");
@@ -183,11 +186,11 @@ protected:
 public:
   static Exp* downcast(AST* ast) {
     switch (ast->id) {
-    case ADDR_OF: case ASCRIP: case ASSIGN: case BINOP_EXP: case BLOCK:
-    case BOOL_LIT: case BORROW: case CALL: case CONSTR: case DEC_LIT:
-    case DEREF: case ENAME: case IF: case INDEX: case INT_LIT: case LET:
-    case MOVE: case PROJECT: case RETURN: case STRING_LIT: case UNOP_EXP:
-    case WHILE: return static_cast<Exp*>(ast);
+    case ADDR_OF: case ARRAY_LIT: case ASCRIP: case ASSIGN: case AWAIT:
+    case BINOP_EXP: case BLOCK: case BOOL_LIT: case BORROW: case CALL:
+    case CONSTR: case DEC_LIT: case DEREF: case ENAME: case IF: case INDEX:
+    case INT_LIT: case LET: case MOVE: case PROJECT: case RETURN:
+    case STRING_LIT: case UNOP_EXP: case WHILE: return static_cast<Exp*>(ast);
     default: return nullptr;
     }
   }
@@ -222,6 +225,9 @@ public:
   bool isEmpty() const { return exps.empty(); }
   bool nonEmpty() const { return !exps.empty(); }
   llvm::ArrayRef<Exp*> asArrayRef() const { return exps; }
+
+  /// @brief Removes the last expression and returns it.
+  Exp* popBack() { return exps.pop_back_val(); }
 };
 
 /// @brief A boolean literal (`true` or `false`).
@@ -264,11 +270,14 @@ public:
 /// @brief A string literal.
 class StringLit : public Exp {
   const char* ptr;
+  std::string value;
 public:
 
   /// @brief Creates a string literal. The @p loc and @p ptr should point to
-  /// the open quote of the string literal. 
-  StringLit(Location loc, const char* ptr) : Exp(STRING_LIT, loc), ptr(ptr) {}
+  /// the open quote of the string literal. Escape sequences are processed
+  /// here, once, so later phases can use the bytes directly.
+  StringLit(Location loc, const char* ptr)
+    : Exp(STRING_LIT, loc), ptr(ptr), value(processEscapes(ptr, loc.sz)) {}
   static StringLit* downcast(AST* ast)
     { return ast->id == STRING_LIT ? static_cast<StringLit*>(ast) : nullptr; }
 
@@ -276,11 +285,17 @@ public:
   std::string asString() const
     { return std::string(ptr+1, getLocation().sz-2); }
 
-  /// @brief Returns the contents of the string with escape sequences processed. 
-  std::string processEscapes() const {
+  /// @brief Returns the contents of the string with escape sequences
+  /// processed.
+  llvm::StringRef getValue() const { return value; }
+
+private:
+  /// @brief Processes the escape sequences of the quoted literal of length
+  /// @p sz at @p ptr.
+  static std::string processEscapes(const char* ptr, unsigned sz) {
     std::string ret;
-    ret.reserve(getLocation().sz);
-    const char* const end = ptr + getLocation().sz - 1;
+    ret.reserve(sz);
+    const char* const end = ptr + sz - 1;
     for (const char* p = ptr + 1; p < end; ++p) {
       if (*p == '\\') {
         switch (*(++p)) {
@@ -334,7 +349,8 @@ public:
 /// @brief An arithmetic, logical, or comparison binary operator expression.
 class BinopExp : public Exp {
 public:
-  enum Binop { ADD, AND, DIV, EQ, GE, GT, LE, LT, MOD, MUL, NE, OR, SUB };
+  enum Binop { ADD, AND, BITAND, BITOR, BITXOR, DIV, EQ, GE, GT, LE, LT, MOD,
+               MUL, NE, OR, SHL, SHR, SUB };
 private:
   Binop binop;
   Exp* lhs;
@@ -354,6 +370,9 @@ public:
     switch (binop) {
     case ADD:   return "ADD";
     case AND:   return "AND";
+    case BITAND: return "BITAND";
+    case BITOR: return "BITOR";
+    case BITXOR: return "BITXOR";
     case DIV:   return "DIV";
     case EQ:    return "EQ";
     case GE:    return "GE";
@@ -364,6 +383,8 @@ public:
     case MUL:   return "MUL";
     case NE:    return "NE";
     case OR:    return "OR";
+    case SHL:   return "SHL";
+    case SHR:   return "SHR";
     case SUB:   return "SUB";
     }
     llvm_unreachable("BinopExp::getBinopAsEnumString() unhandled switch case");
@@ -412,9 +433,24 @@ public:
 };
 
 /// @brief A function call.
+///
+/// If no user function matches an unqualified callee name, the Canonicalizer
+/// may resolve the call to a compiler builtin instead. Builtins are typed by
+/// the Unifier and lowered by Codegen directly; they have no FunctionDecl.
 class CallExp : public Exp {
+public:
+  enum Builtin { NOT_BUILTIN, ABS, ALLOC, BITREVERSE, BLOCK_ON, BSWAP, CEIL,
+                 CLZ, CTZ, FLOOR, FMA, FREE, LIKELY, LOWER_BOUND, MAX, MIN,
+                 POPCOUNT, PREFETCH, RADIX_SORT, REALLOC, ROTL, ROTR, ROUND,
+                 SOA_ALLOC, SOA_FREE, SORT, SORT_BY, SQRT, TRUNC, UNLIKELY };
+private:
   Name* function;
   ExpList* arguments;
+  Builtin builtin = NOT_BUILTIN;
+
+  /// @brief The comparison function of a `sort_by` call. The Canonicalizer
+  /// moves it here from the last argument.
+  Name* comparator = nullptr;
 public:
   CallExp(Location loc, Name* function, ExpList* arguments)
     : Exp(CALL, loc), function(function), arguments(arguments) {}
@@ -422,6 +458,57 @@ public:
     { return ast->id == CALL ? static_cast<CallExp*>(ast) : nullptr; }
   Name* getFunction() const { return function; }
   ExpList* getArguments() const { return arguments; }
+  Builtin getBuiltin() const { return builtin; }
+  void setBuiltin(Builtin b) { builtin = b; }
+  bool isBuiltin() const { return builtin != NOT_BUILTIN; }
+  Name* getComparator() const { return comparator; }
+  void setComparator(Name* c) { comparator = c; }
+
+  /// @brief True if this calls the heap allocator (`alloc`, `realloc`,
+  /// `free`, `soa_alloc`, or `soa_free`).
+  bool isAllocatorCall() const {
+    return builtin == ALLOC || builtin == FREE || builtin == REALLOC
+        || builtin == SOA_ALLOC || builtin == SOA_FREE;
+  }
+
+  /// @brief True if this sorts the elements behind its first argument in
+  /// place (`sort`, `sort_by`, or `radix_sort`).
+  bool isSortCall() const
+    { return builtin == SORT || builtin == SORT_BY || builtin == RADIX_SORT; }
+
+  /// @brief Returns the builtin called @p name, or NOT_BUILTIN.
+  static Builtin builtinFromName(llvm::StringRef name) {
+    if (name == "abs")        return ABS;
+    if (name == "alloc")      return ALLOC;
+    if (name == "bitreverse") return BITREVERSE;
+    if (name == "block_on")   return BLOCK_ON;
+    if (name == "bswap")      return BSWAP;
+    if (name == "ceil")       return CEIL;
+    if (name == "clz")        return CLZ;
+    if (name == "ctz")        return CTZ;
+    if (name == "floor")      return FLOOR;
+    if (name == "fma")        return FMA;
+    if (name == "free")       return FREE;
+    if (name == "likely")     return LIKELY;
+    if (name == "lower_bound") return LOWER_BOUND;
+    if (name == "max")        return MAX;
+    if (name == "min")        return MIN;
+    if (name == "popcount")   return POPCOUNT;
+    if (name == "prefetch")   return PREFETCH;
+    if (name == "radix_sort") return RADIX_SORT;
+    if (name == "realloc")    return REALLOC;
+    if (name == "rotl")       return ROTL;
+    if (name == "rotr")       return ROTR;
+    if (name == "round")      return ROUND;
+    if (name == "soa_alloc")  return SOA_ALLOC;
+    if (name == "soa_free")   return SOA_FREE;
+    if (name == "sort")       return SORT;
+    if (name == "sort_by")    return SORT_BY;
+    if (name == "sqrt")       return SQRT;
+    if (name == "trunc")      return TRUNC;
+    if (name == "unlikely")   return UNLIKELY;
+    return NOT_BUILTIN;
+  }
 };
 
 /// @brief A struct constructor invocation.
@@ -437,6 +524,19 @@ public:
   ExpList* getFields() const { return fields; }
 };
 
+/// @brief An array literal such as `[1, 2, 3]`. Its value is a borrowed
+/// reference to the first element. Array literals may only appear in the
+/// initializers of constants, whose data lives in read-only memory.
+class ArrayLit : public Exp {
+  ExpList* elements;
+public:
+  ArrayLit(Location loc, ExpList* elements)
+    : Exp(ARRAY_LIT, loc), elements(elements) {}
+  static ArrayLit* downcast(AST* ast)
+    { return ast->id == ARRAY_LIT ? static_cast<ArrayLit*>(ast) : nullptr; }
+  ExpList* getElements() const { return elements; }
+};
+
 /// @brief A type ascription expression.
 class AscripExp : public Exp {
   Exp* ascriptee;
@@ -596,18 +696,64 @@ public:
   Exp* getRefExp() const { return refExp; }
 };
 
+/// @brief Suspends the enclosing `async` function until the future produced
+/// by @p inner completes, and evaluates to its result. Only allowed inside an
+/// `async` function.
+class AwaitExp : public Exp {
+  Exp* inner;
+public:
+  AwaitExp(Location loc, Exp* inner) : Exp(AWAIT, loc), inner(inner) {}
+  static AwaitExp* downcast(AST* ast)
+    { return ast->id == AWAIT ? static_cast<AwaitExp*>(ast) : nullptr; }
+  Exp* getInner() const { return inner; }
+};
+
 //============================================================================//
 //=== DECLARATIONS
 //============================================================================//
 
+/// @brief An attribute attached to a declaration (e.g., `#[soa]`). Attributes
+/// are not AST nodes; they are stored by value inside the Decl they annotate.
+/// Arguments are stored as they appear in the source code except that string
+/// literal arguments have their surrounding quotes removed.
+class Attribute {
+  Location location;
+  std::string name;
+  llvm::SmallVector<std::string, 2> args;
+public:
+  Attribute(Location loc, llvm::StringRef name,
+            llvm::SmallVector<std::string, 2> args = {})
+    : location(loc), name(name), args(args) {}
+  Location getLocation() const { return location; }
+  llvm::StringRef getName() const { return name; }
+  llvm::ArrayRef<std::string> getArgs() const { return args; }
+};
+
 /// @brief A declaration.
 class Decl : public AST {
 protected:
   Name* name;
+  llvm::SmallVector<Attribute, 0> attributes;
   Decl(ID id, Location loc, Name* name) : AST(id, loc), name(name) {}
   ~Decl() {}
 public:
   Name* getName() const { return name; }
+
+  llvm::ArrayRef<Attribute> getAttributes() const { return attributes; }
+  void setAttributes(llvm::SmallVector<Attribute, 0> attrs)
+    { attributes = std::move(attrs); }
+
+  /// @brief Returns the attribute named @p attrName, or nullptr if this decl
+  /// does not have one.
+  const Attribute* findAttribute(llvm::StringRef attrName) const {
+    for (const Attribute& attr : attributes)
+      if (attr.getName() == attrName) return &attr;
+    return nullptr;
+  }
+
+  /// @brief True iff this decl has an attribute named @p attrName.
+  bool hasAttribute(llvm::StringRef attrName) const
+    { return findAttribute(attrName) != nullptr; }
 };
 
 /// @brief A list of declarations.
@@ -661,12 +807,15 @@ public:
 class FunctionDecl : public Decl {
   ParamList* parameters;
   bool variadic;
+  bool async = false;
   TypeExp* returnType;
   Exp* body;
+  bool external;
 public:
   FunctionDecl(Location loc, Name* name, ParamList* params, TypeExp* returnType,
     Exp* body = nullptr, bool variadic = false) : Decl(FUNC, loc, name),
-    parameters(params), returnType(returnType), body(body), variadic(variadic){}
+    parameters(params), returnType(returnType), body(body),
+    external(body == nullptr), variadic(variadic) {}
   static FunctionDecl* downcast(AST* ast)
     { return ast->id == FUNC ? static_cast<FunctionDecl*>(ast) : nullptr; }
   ParamList* getParameters() const { return parameters; }
@@ -674,14 +823,39 @@ public:
   Exp* getBody() const { return body; }
   bool isVariadic() const { return variadic; }
 
-  /// @brief Returns true iff this function has no body.
-  bool isExtern() const { return body == nullptr; }
+  /// @brief True for an `async func`. Calling it returns a future of the
+  /// declared return type, and its body may `await` other futures.
+  bool isAsync() const { return async; }
+  void markAsync() { async = true; }
+
+  /// @brief Returns true iff this function is declared without a body.
+  bool isExtern() const { return external; }
 
   /// @brief True iff not an `extern` function and getBody() is not nullptr.
+  /// A function whose body is deferred or released has no body either.
   bool hasBody() const { return body != nullptr; }
+
+  /// @brief Marks this function as having a body that the parser skipped
+  /// (see Parser::deferBodies()) and that is set later with setBody().
+  void deferBody() { external = false; }
+
+  /// @brief Sets the body of a function whose body was deferred.
+  void setBody(Exp* newBody) { body = newBody; }
+
+  /// @brief Deletes the body once it is no longer needed. The function is
+  /// still not extern.
+  void releaseBody() {
+    if (body != nullptr) body->deleteRecursive();
+    body = nullptr;
+  }
 };
 
 /// @brief A struct declaration.
+///
+/// A struct annotated with `#[soa]` has a struct-of-arrays memory layout: a
+/// reference to it is a tuple of per-field column pointers rather than a
+/// single pointer, so indexing a reference and projecting a field only touches
+/// that field's column.
 class StructDecl : public Decl {
   ParamList* fields;
 public:
@@ -690,6 +864,23 @@ public:
   static StructDecl* downcast(AST* ast)
     { return ast->id == STRUCT ? static_cast<StructDecl*>(ast) : nullptr; }
   ParamList* getFields() const { return fields; }
+
+  /// @brief True iff this struct has a struct-of-arrays layout.
+  bool isSoa() const { return hasAttribute("soa"); }
+};
+
+/// @brief A global constant such as `const N: i32 = 16;`. The initializer is
+/// evaluated at compile time and the value is placed in read-only memory.
+class ConstDecl : public Decl {
+  TypeExp* type;
+  Exp* init;
+public:
+  ConstDecl(Location loc, Name* name, TypeExp* type, Exp* init)
+    : Decl(CONST, loc, name), type(type), init(init) {}
+  static ConstDecl* downcast(AST* ast)
+    { return ast->id == CONST ? static_cast<ConstDecl*>(ast) : nullptr; }
+  TypeExp* getType() const { return type; }
+  Exp* getInit() const { return init; }
 };
 
 //============================================================================//
@@ -697,10 +888,14 @@ public:
 llvm::SmallVector<AST*> AST::getASTChildren() {
   if (auto ast = AddrOfExp::downcast(this))
     return { ast->getOf() };
+  if (auto ast = ArrayLit::downcast(this))
+    return { ast->getElements() };
   if (auto ast = AscripExp::downcast(this))
     return { ast->getAscriptee(), ast->getAscripter() };
   if (auto ast = AssignExp::downcast(this))
     return { ast->getLHS(), ast->getRHS() };
+  if (auto ast = AwaitExp::downcast(this))
+    return { ast->getInner() };
   if (auto ast = BinopExp::downcast(this))
     return { ast->getLHS(), ast->getRHS() };
   if (auto ast = BlockExp::downcast(this)) {
@@ -710,8 +905,13 @@ llvm::SmallVector<AST*> AST::getASTChildren() {
   }
   if (auto ast = BorrowExp::downcast(this))
     return { ast->getRefExp() };
-  if (auto ast = CallExp::downcast(this))
+  if (auto ast = CallExp::downcast(this)) {
+    if (Name* comparator = ast->getComparator())
+      return { ast->getFunction(), ast->getArguments(), comparator };
     return { ast->getFunction(), ast->getArguments() };
+  }
+  if (auto ast = ConstDecl::downcast(this))
+    return { ast->getName(), ast->getType(), ast->getInit() };
   if (auto ast = ConstrExp::downcast(this))
     return { ast->getStruct(), ast->getFields() };
   if (auto ast = DeclList::downcast(this)) {
@@ -782,8 +982,10 @@ llvm::SmallVector<AST*> AST::getASTChildren() {
 const char* AST::IDToString(AST::ID id) {
   switch (id) {
   case AST::ID::ADDR_OF:            return "ADDR_OF";
+  case AST::ID::ARRAY_LIT:          return "ARRAY_LIT";
   case AST::ID::ASCRIP:             return "ASCRIP";
   case AST::ID::ASSIGN:             return "ASSIGN";
+  case AST::ID::AWAIT:              return "AWAIT";
   case AST::ID::BINOP_EXP:          return "BINOP_EXP";
   case AST::ID::BLOCK:              return "BLOCK";
   case AST::ID::BORROW:             return "BORROW";
@@ -804,6 +1006,7 @@ const char* AST::IDToString(AST::ID id) {
   case AST::ID::UNOP_EXP:           return "UNOP_EXP";
   case AST::ID::WHILE:              return "WHILE";
 
+  case AST::ID::CONST:              return "CONST";
   case AST::ID::FUNC:               return "FUNC";
   case AST::ID::MODULE:             return "MODULE";
   case AST::ID::STRUCT:             return "STRUCT";
@@ -823,8 +1026,10 @@ const char* AST::IDToString(AST::ID id) {
 
 AST::ID stringToASTID(const std::string& str) {
        if (str == "ADDR_OF")             return AST::ID::ADDR_OF;
+  else if (str == "ARRAY_LIT")           return AST::ID::ARRAY_LIT;
   else if (str == "ASCRIP")              return AST::ID::ASCRIP;
   else if (str == "ASSIGN")              return AST::ID::ASSIGN;
+  else if (str == "AWAIT")               return AST::ID::AWAIT;
   else if (str == "BINOP_EXP")           return AST::ID::BINOP_EXP;
   else if (str == "BLOCK")               return AST::ID::BLOCK;
   else if (str == "BORROW")              return AST::ID::BORROW;
@@ -845,6 +1050,7 @@ AST::ID stringToASTID(const std::string& str) {
   else if (str == "UNOP_EXP")            return AST::ID::UNOP_EXP;
   else if (str == "WHILE")               return AST::ID::WHILE;
 
+  else if (str == "CONST")               return AST::ID::CONST;
   else if (str == "FUNC")                return AST::ID::FUNC;
   else if (str == "MODULE")              return AST::ID::MODULE;
   else if (str == "STRUCT")              return AST::ID::STRUCT;
@@ -0,0 +1,39 @@
+#ifndef COMMON_CLONETARGETS
+#define COMMON_CLONETARGETS
+
+#include <llvm/ADT/StringRef.h>
+
+/// @brief A target that `#[target_clones(...)]` can compile a function for,
+/// and how to detect it at load time with CPUID.
+struct CloneTarget {
+  /// @brief Which register state the OS must save (per XCR0) for the target.
+  enum OSState { NO_STATE, AVX_STATE, AVX512_STATE };
+
+  const char* name;      // as written in the attribute
+  const char* features;  // LLVM `target-features`
+  unsigned leaf;         // CPUID leaf: the bit is in ECX of 1, EBX of 7
+  unsigned bit;
+  OSState osState;
+};
+
+/// @brief All clone targets, from most to least preferred. The dispatcher
+/// picks the first clone whose target the CPU supports.
+static constexpr CloneTarget cloneTargets[] = {
+  { "avx512f", "+avx512f", 7, 16, CloneTarget::AVX512_STATE },
+  { "avx2",    "+avx2",    7,  5, CloneTarget::AVX_STATE },
+  { "fma",     "+fma",     1, 12, CloneTarget::AVX_STATE },
+  { "avx",     "+avx",     1, 28, CloneTarget::AVX_STATE },
+  { "bmi2",    "+bmi2",    7,  8, CloneTarget::NO_STATE },
+  { "popcnt",  "+popcnt",  1, 23, CloneTarget::NO_STATE },
+  { "sse4.2",  "+sse4.2",  1, 20, CloneTarget::NO_STATE },
+};
+
+/// @brief Returns the clone target named @p name, or nullptr if there is
+/// none. The generic `default` target is not in the table.
+inline const CloneTarget* findCloneTarget(llvm::StringRef name) {
+  for (const CloneTarget& target : cloneTargets)
+    if (name == target.name) return &target;
+  return nullptr;
+}
+
+#endif
@@ -7,9 +7,11 @@
 /// @brief Maps the fully qualified names of all decls to their definitions in
 /// the AST.
 ///
-/// There are three distinct "spaces" of fully-qualified names (type space,
-/// function space, and module space). The parser can always tell when a symbol
-/// is being used as a type, function, or module, so these spaces can overlap.
+/// There are four distinct "spaces" of fully-qualified names (type space,
+/// function space, module space, and constant space). The parser can always
+/// tell when a symbol is being used as a type, function, or module, so these
+/// spaces can overlap. Constants are used as expressions, where local
+/// variables shadow them.
 class Ontology {
 
 public:
@@ -18,10 +20,11 @@ public:
   llvm::StringMap<StructDecl*> typeSpace;
   llvm::StringMap<FunctionDecl*> functionSpace;
   llvm::StringMap<ModuleDecl*> moduleSpace;
+  llvm::StringMap<ConstDecl*> constSpace;
 
   llvm::StringMap<std::string> mappedFuncNames;
 
-  enum struct Space { FUNCTION, MODULE, TYPE };
+  enum struct Space { CONST, FUNCTION, MODULE, TYPE };
 
   /// @brief The fully-qualified name of the "main" entry point procedure.
   /// Empty if no entry point has been found.
@@ -33,6 +36,8 @@ public:
     { moduleSpace[fqn] = decl; }
   void record(llvm::StringRef fqn, FunctionDecl* decl)
     { functionSpace[fqn] = decl; }
+  void record(llvm::StringRef fqn, ConstDecl* decl)
+    { constSpace[fqn] = decl; }
 
   void recordMapName(llvm::StringRef fqn, FunctionDecl* decl,
       llvm::StringRef mappedName) {
@@ -43,6 +48,7 @@ public:
   /// @brief Looks for a declaration with `name` in the specified `space`.
   Decl* getDecl(llvm::StringRef name, Space space) const {
     switch (space) {
+    case Space::CONST: return constSpace.lookup(name);
     case Space::FUNCTION: return functionSpace.lookup(name);
     case Space::MODULE: return moduleSpace.lookup(name);
     case Space::TYPE: return typeSpace.lookup(name);
@@ -67,6 +73,11 @@ public:
     return moduleSpace.lookup(name);
   }
 
+  /// @brief Finds a global constant. Returns nullptr if not found.
+  ConstDecl* getConst(llvm::StringRef name) const {
+    return constSpace.lookup(name);
+  }
+
   /// @brief Returns the mapped version of `name` if it exists, otherwise
   /// just returns `name` itself.
   llvm::StringRef mapName(llvm::StringRef name) const {
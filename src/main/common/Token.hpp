@@ -15,14 +15,15 @@ public:
     ERROR,
 
     // keywords
-    KW_BOOL, KW_BORROW, KW_CASE, KW_ELSE, KW_EXTERN, KW_f32, KW_f64, KW_FALSE,
-    KW_FUNC, KW_i8, KW_i16, KW_i32, KW_i64, KW_IF, KW_LET, KW_MATCH, KW_MODULE,
-    KW_MOVE, KW_OF, KW_PROC, KW_RETURN, KW_STR, KW_STRUCT, KW_THEN, KW_TRUE,
-    KW_UNIQ, KW_UNIT, KW_WHILE,
+    KW_ASYNC, KW_AWAIT, KW_BOOL, KW_BORROW, KW_CASE, KW_CONST, KW_ELSE,
+    KW_EXTERN, KW_f32, KW_f64, KW_FALSE, KW_FUNC, KW_i8, KW_i16, KW_i32, KW_i64,
+    KW_IF, KW_ISIZE, KW_LET, KW_MATCH, KW_MODULE, KW_MOVE, KW_OF, KW_PROC,
+    KW_RETURN, KW_STR, KW_STRUCT, KW_THEN, KW_TRUE, KW_UNIQ, KW_UNIT, KW_USIZE,
+    KW_WHILE,
 
     // operators
-    OP_ADD, OP_DIV, OP_EQ, OP_GE, OP_GT, OP_LE, OP_LT, OP_MOD, OP_MUL, OP_NE,
-    OP_OR, OP_SUB,
+    OP_ADD, OP_BITOR, OP_BITXOR, OP_DIV, OP_EQ, OP_GE, OP_GT, OP_LE, OP_LT,
+    OP_MOD, OP_MUL, OP_NE, OP_OR, OP_SHL, OP_SHR, OP_SUB,
 
     // literal values
     LIT_DEC, LIT_INT, LIT_STRING,
@@ -58,9 +59,12 @@ public:
     switch (tag) {
     case ERROR:           return "ERROR";
     case IDENT:           return "IDENT";
+    case KW_ASYNC:        return "KW_ASYNC";
+    case KW_AWAIT:        return "KW_AWAIT";
     case KW_BOOL:         return "KW_BOOL";
     case KW_BORROW:       return "KW_BORROW";
     case KW_CASE:         return "KW_CASE";
+    case KW_CONST:        return "KW_CONST";
     case KW_ELSE:         return "KW_ELSE";
     case KW_EXTERN:       return "KW_EXTERN";
     case KW_FALSE:        return "KW_FALSE";
@@ -85,6 +89,8 @@ public:
     case KW_i16:          return "KW_i16";
     case KW_i32:          return "KW_i32";
     case KW_i64:          return "KW_i64";
+    case KW_ISIZE:        return "KW_ISIZE";
+    case KW_USIZE:        return "KW_USIZE";
     case KW_STR:          return "KW_STR";
     case OP_GE:           return "OP_GE";
     case OP_GT:           return "OP_GT";
@@ -93,6 +99,10 @@ public:
     case OP_EQ:           return "OP_EQ";
     case OP_NE:           return "OP_NE";
     case OP_OR:           return "OP_OR";
+    case OP_BITOR:        return "OP_BITOR";
+    case OP_BITXOR:       return "OP_BITXOR";
+    case OP_SHL:          return "OP_SHL";
+    case OP_SHR:          return "OP_SHR";
     case OP_ADD:          return "OP_ADD";
     case OP_SUB:          return "OP_SUB";
     case OP_MUL:          return "OP_MUL";
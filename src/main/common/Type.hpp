@@ -18,7 +18,8 @@ class TypeContext;
 /// `Type*` a `const Type*`, but `const` is always omitted to save keystrokes.
 class Type {
 public:
-  enum class ID : unsigned char { CONSTRAINT, NAME, PRIMITIVE, REF, VAR };
+  enum class ID : unsigned char
+    { CONSTRAINT, FUTURE, NAME, PRIMITIVE, REF, VAR };
 
   /// @brief What kind of type this is.
   const ID id;
@@ -37,11 +38,16 @@ class PrimitiveType : public Type {
   friend class TypeContext;
 
 public:
-  enum Kind : unsigned char { BOOL, f32, f64, i8, i16, i32, i64, UNIT };
+  /// @brief `isize` and `usize` are pointer-width integers (64 bits).
+  enum Kind : unsigned char
+    { BOOL, f32, f64, i8, i16, i32, i64, ISIZE, USIZE, UNIT };
 
   /// @brief The kind of primitive type this is.
   const Kind kind;
 
+  /// @brief True iff this is an integer type (of any width or signedness).
+  bool isInteger() const { return i8 <= kind && kind <= USIZE; }
+
   static PrimitiveType* downcast(Type* ty)
     {return ty->id==ID::PRIMITIVE ? static_cast<PrimitiveType*>(ty) : nullptr;}
 
@@ -55,7 +61,12 @@ class Constraint : public Type {
   friend class TypeContext;
 
 public:
-  enum Kind : unsigned char { DECIMAL, NUMERIC };
+  /// @brief `decimal` is any floating-point type, `numeric` is any integer or
+  /// floating-point type, and `integer` and `index` are any integer type. An
+  /// `index` that is never resolved defaults to `isize`, so that an index or a
+  /// variable that counts through indices never needs to be extended to
+  /// pointer width.
+  enum Kind : unsigned char { DECIMAL, INDEX, INTEGER, NUMERIC };
 
   /// @brief The kind of type constraint this is.
   const Kind kind;
@@ -88,6 +99,24 @@ private:
   ~RefType() {}
 };
 
+/// @brief The result of calling an `async` function: a suspended computation
+/// that produces an @p inner when it is awaited. Futures have no type
+/// expression syntax; they only arise from calls.
+class FutureType : public Type {
+  friend class TypeContext;
+public:
+
+  /// @brief The type of the awaited result.
+  Type* const inner;
+
+  static FutureType* downcast(Type* ty)
+    { return ty->id == ID::FUTURE ? static_cast<FutureType*>(ty) : nullptr; }
+
+private:
+  FutureType(Type* inner) : Type(ID::FUTURE), inner(inner) {}
+  ~FutureType() {}
+};
+
 /// @brief A user-defined data type.
 class NameType : public Type {
   friend class TypeContext;
@@ -120,9 +149,14 @@ std::string Type::asString() {
   if (auto ty = Constraint::downcast(this)) {
     switch (ty->kind) {
     case Constraint::DECIMAL:   return "decimal";
+    case Constraint::INDEX:     return "index";
+    case Constraint::INTEGER:   return "integer";
     case Constraint::NUMERIC:   return "numeric";
     }
   }
+  if (auto ty = FutureType::downcast(this)) {
+    return "async " + ty->inner->asString();
+  }
   if (auto ty = NameType::downcast(this)) {
     return ty->asString;
   }
@@ -135,6 +169,8 @@ std::string Type::asString() {
     case PrimitiveType::i16:    return "i16";
     case PrimitiveType::i32:    return "i32";
     case PrimitiveType::i64:    return "i64";
+    case PrimitiveType::ISIZE:  return "isize";
+    case PrimitiveType::USIZE:  return "usize";
     case PrimitiveType::UNIT:   return "unit";
     }
   }
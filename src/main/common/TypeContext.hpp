@@ -19,10 +19,14 @@ class TypeContext {
   PrimitiveType i16   = PrimitiveType::i16;
   PrimitiveType i32   = PrimitiveType::i32;
   PrimitiveType i64   = PrimitiveType::i64;
+  PrimitiveType isize = PrimitiveType::ISIZE;
+  PrimitiveType usize = PrimitiveType::USIZE;
   PrimitiveType unit  = PrimitiveType::UNIT;
 
   // type constraints
   Constraint decimal  = Constraint::DECIMAL;
+  Constraint index    = Constraint::INDEX;
+  Constraint integer  = Constraint::INTEGER;
   Constraint numeric  = Constraint::NUMERIC;
 
   /// @brief Counter for generating fresh type variables.
@@ -34,6 +38,9 @@ class TypeContext {
   /// @brief Stores all unique reference types, indexed by their inner type.
   llvm::DenseMap<Type*, RefType*> uniqRefTypes;
 
+  /// @brief Stores all future types, indexed by their inner type.
+  llvm::DenseMap<Type*, FutureType*> futureTypes;
+
   /// @brief Stores all NameType objects indexed by their names.
   llvm::StringMap<NameType*> nameTypes;
 
@@ -53,9 +60,13 @@ public:
   PrimitiveType* getI16() { return &i16; }
   PrimitiveType* getI32() { return &i32; }
   PrimitiveType* getI64() { return &i64; }
+  PrimitiveType* getIsize() { return &isize; }
+  PrimitiveType* getUsize() { return &usize; }
   PrimitiveType* getUnit() { return &unit; }
 
   Constraint* getDecimal() { return &decimal; }
+  Constraint* getIndex() { return &index; }
+  Constraint* getInteger() { return &integer; }
   Constraint* getNumeric() { return &numeric; }
 
   RefType* getRefType(Type* inner, bool unique = false) {
@@ -66,6 +77,13 @@ public:
     return ret;
   }
 
+  FutureType* getFutureType(Type* inner) {
+    if (FutureType* ret = futureTypes.lookup(inner)) return ret;
+    FutureType* ret = new FutureType(inner);
+    futureTypes[inner] = ret;
+    return ret;
+  }
+
   NameType* getNameType(llvm::StringRef name) {
     if (NameType* ret = nameTypes.lookup(name)) return ret;
     NameType* ret = new NameType(name);
@@ -98,6 +116,8 @@ public:
       case PrimitiveTypeExp::i16:    return &i16;
       case PrimitiveTypeExp::i32:    return &i32;
       case PrimitiveTypeExp::i64:    return &i64;
+      case PrimitiveTypeExp::ISIZE:  return &isize;
+      case PrimitiveTypeExp::USIZE:  return &usize;
       case PrimitiveTypeExp::UNIT:   return &unit;
       }
     }
@@ -109,10 +129,12 @@ public:
   void clear() {
     for (auto ty : refTypes) { delete ty.second; }
     for (auto ty : uniqRefTypes) { delete ty.second; }
+    for (auto ty : futureTypes) { delete ty.second; }
     for (auto name : nameTypes.keys()) { delete nameTypes[name]; }
     for (auto ty : typeVars) { delete ty; }
     refTypes.clear();
     uniqRefTypes.clear();
+    futureTypes.clear();
     nameTypes.clear();
     typeVars.clear();
   }
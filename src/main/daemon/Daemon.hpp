@@ -0,0 +1,171 @@
+#ifndef DAEMON_DAEMON
+#define DAEMON_DAEMON
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "daemon/Protocol.hpp"
+#include "driver/CompileJob.hpp"
+
+/// @brief Keeps the compiler resident and serves compile requests from thin
+/// clients over a Unix socket (see DaemonProtocol). This saves clients the
+/// cost of process startup, LLVM static initialization, and option parsing.
+///
+/// The main thread accepts connections and hands them to a fixed pool of
+/// worker threads. Each connection carries one request, which may name
+/// several input files; these are compiled in order by the worker.
+class Daemon {
+  std::string socketPath;
+  unsigned numWorkers;
+  llvm::raw_ostream& log;
+
+  int listenFd = -1;
+  std::atomic<bool> stopping{false};
+
+  std::mutex queueMutex;
+  std::condition_variable queueCV;
+  std::deque<int> pendingConnections;
+
+public:
+  Daemon(std::string socketPath, unsigned numWorkers, llvm::raw_ostream& log)
+    : socketPath(std::move(socketPath)),
+      numWorkers(numWorkers == 0 ? 1 : numWorkers), log(log) {}
+
+  Daemon(const Daemon&) = delete;
+  Daemon& operator=(const Daemon&) = delete;
+
+  /// @brief Listens on the socket and serves requests until a client sends
+  /// DaemonProtocol::STOP_REQUEST. Returns the exit status for `miscrc`.
+  int serve() {
+    std::signal(SIGPIPE, SIG_IGN);
+    if (!listen()) return 1;
+    log << "miscrc daemon listening on " << socketPath << " with "
+        << numWorkers << " workers\n";
+    log.flush();
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < numWorkers; ++i)
+      workers.emplace_back([this]() { workerLoop(); });
+
+    while (!stopping) {
+      int conn = accept(listenFd, nullptr, nullptr);
+      if (conn < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      std::lock_guard<std::mutex> lock(queueMutex);
+      pendingConnections.push_back(conn);
+      queueCV.notify_one();
+    }
+
+    stopping = true;
+    queueCV.notify_all();
+    for (std::thread& worker : workers) worker.join();
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return 0;
+  }
+
+private:
+
+  /// @brief Binds and listens on `socketPath`, replacing a stale socket
+  /// file left behind by a daemon that did not shut down cleanly. The
+  /// default socket is kept in a directory that only this user can access.
+  bool listen() {
+    sockaddr_un addr;
+    if (!DaemonProtocol::makeAddress(socketPath, addr)) {
+      log << "Socket path is too long: " << socketPath << "\n";
+      return false;
+    }
+    std::string dir = DaemonProtocol::defaultSocketDir();
+    if (socketPath == DaemonProtocol::defaultSocketPath()
+        && !DaemonProtocol::makePrivateDir(dir)) {
+      log << "Refusing to listen in " << dir << ", which other users can "
+          << "access or which does not belong to this user\n";
+      return false;
+    }
+
+    // refuse to steal the socket of a live daemon
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0) {
+      close(probe);
+      log << "A miscrc daemon is already listening on " << socketPath
+          << "\n";
+      return false;
+    }
+    close(probe);
+    unlink(socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0
+        || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0
+        || ::listen(listenFd, SOMAXCONN) != 0) {
+      log << "Could not listen on " << socketPath << ": "
+          << std::strerror(errno) << "\n";
+      return false;
+    }
+    chmod(socketPath.c_str(), 0600);
+    return true;
+  }
+
+  /// @brief Takes connections off the queue and serves them until stopped.
+  void workerLoop() {
+    while (true) {
+      int conn;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueCV.wait(lock,
+          [this]() { return stopping || !pendingConnections.empty(); });
+        if (pendingConnections.empty()) return;
+        conn = pendingConnections.front();
+        pendingConnections.pop_front();
+      }
+      serveConnection(conn);
+      close(conn);
+    }
+  }
+
+  /// @brief Reads one request from @p conn, runs it, and sends the response.
+  /// Connections from other users are dropped unanswered.
+  void serveConnection(int conn) {
+    if (!DaemonProtocol::peerIsSameUser(conn)) {
+      log << "Dropped a connection from another user\n";
+      log.flush();
+      return;
+    }
+    std::string cwd;
+    std::vector<std::string> args;
+    if (!DaemonProtocol::recvRequest(conn, cwd, args)) return;
+
+    if (args.size() == 1 && args[0] == DaemonProtocol::STOP_REQUEST) {
+      DaemonProtocol::sendResponse(conn, 0, "");
+      stopping = true;
+      shutdown(listenFd, SHUT_RDWR);
+      return;
+    }
+
+    std::string errBuf;
+    llvm::raw_string_ostream errs(errBuf);
+    int status = 0;
+    std::vector<CompileJob> jobs;
+    std::string argErr;
+    if (!CompileJob::fromArgs(args, cwd, jobs, argErr)) {
+      errs << argErr << "\n";
+      status = 1;
+    }
+    for (const CompileJob& job : jobs) {
+      status = job.run(errs);
+      if (status != 0) break;
+    }
+    errs.flush();
+    DaemonProtocol::sendResponse(conn, status, errBuf);
+  }
+
+};
+
+#endif
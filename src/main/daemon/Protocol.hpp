@@ -0,0 +1,155 @@
+#ifndef DAEMON_PROTOCOL
+#define DAEMON_PROTOCOL
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// @brief The wire protocol spoken between `miscrc --daemon` and the thin
+/// client. This header must not depend on LLVM so that the client stays
+/// cheap to start.
+///
+/// A request is the client's working directory followed by its command-line
+/// arguments (without the program name). A response is the exit status
+/// followed by everything the job wrote to stderr. Integers are sent as
+/// native-endian uint32; strings as a uint32 length followed by the bytes.
+///
+/// Both ends only talk to peers running as the same user, since a request
+/// reads and writes files with the daemon's permissions.
+namespace DaemonProtocol {
+
+  /// @brief A request consisting of exactly this argument stops the daemon.
+  constexpr const char* STOP_REQUEST = "--stop-daemon";
+
+  /// @brief The longest string either end accepts. This bounds the memory
+  /// that a broken or hostile peer can make the other end allocate.
+  constexpr uint32_t MAX_STRING_SIZE = 64 << 20;
+
+  /// @brief The most arguments the daemon accepts in one request.
+  constexpr uint32_t MAX_ARGS = 4096;
+
+  /// @brief Returns the directory of the default socket: `$XDG_RUNTIME_DIR`,
+  /// which only the user can access, or else a per-user directory in /tmp
+  /// that the daemon creates with mode 0700.
+  inline std::string defaultSocketDir() {
+    if (const char* env = std::getenv("XDG_RUNTIME_DIR"); env && *env)
+      return env;
+    return "/tmp/miscrc-" + std::to_string(getuid());
+  }
+
+  /// @brief Returns the socket path from `$MISCRC_SOCKET`, or a per-user
+  /// default in defaultSocketDir().
+  inline std::string defaultSocketPath() {
+    if (const char* env = std::getenv("MISCRC_SOCKET")) return env;
+    return defaultSocketDir() + "/miscrc.sock";
+  }
+
+  /// @brief Creates directory @p dir with mode 0700 if it does not exist.
+  /// Returns false unless @p dir is then a directory that belongs to this
+  /// user and that nobody else can access.
+  inline bool makePrivateDir(const std::string& dir) {
+    mkdir(dir.c_str(), 0700);
+    struct stat st;
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode)
+        && st.st_uid == getuid() && (st.st_mode & 077) == 0;
+  }
+
+  /// @brief True iff the process at the other end of @p fd runs as this
+  /// user.
+  inline bool peerIsSameUser(int fd) {
+#ifdef SO_PEERCRED
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+        && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+  }
+
+  /// @brief Fills @p addr for the socket at @p path. Returns false if the
+  /// path is too long.
+  inline bool makeAddress(const std::string& path, sockaddr_un& addr) {
+    addr = sockaddr_un();
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    path.copy(addr.sun_path, path.size());
+    return true;
+  }
+
+  inline bool writeAll(int fd, const void* buf, size_t n) {
+    const char* p = static_cast<const char*>(buf);
+    while (n > 0) {
+      ssize_t written = write(fd, p, n);
+      if (written <= 0) return false;
+      p += written;
+      n -= written;
+    }
+    return true;
+  }
+
+  inline bool readAll(int fd, void* buf, size_t n) {
+    char* p = static_cast<char*>(buf);
+    while (n > 0) {
+      ssize_t got = read(fd, p, n);
+      if (got <= 0) return false;
+      p += got;
+      n -= got;
+    }
+    return true;
+  }
+
+  inline bool sendU32(int fd, uint32_t x) { return writeAll(fd, &x, 4); }
+
+  inline bool recvU32(int fd, uint32_t& x) { return readAll(fd, &x, 4); }
+
+  inline bool sendString(int fd, const std::string& s) {
+    return sendU32(fd, s.size()) && writeAll(fd, s.data(), s.size());
+  }
+
+  inline bool recvString(int fd, std::string& s) {
+    uint32_t size;
+    if (!recvU32(fd, size) || size > MAX_STRING_SIZE) return false;
+    s.resize(size);
+    return readAll(fd, &s[0], size);
+  }
+
+  inline bool sendRequest(int fd, const std::string& cwd,
+                          const std::vector<std::string>& args) {
+    if (!sendString(fd, cwd) || !sendU32(fd, args.size())) return false;
+    for (const std::string& arg : args)
+      if (!sendString(fd, arg)) return false;
+    return true;
+  }
+
+  inline bool recvRequest(int fd, std::string& cwd,
+                          std::vector<std::string>& args) {
+    uint32_t numArgs;
+    if (!recvString(fd, cwd) || !recvU32(fd, numArgs) || numArgs > MAX_ARGS)
+      return false;
+    args.resize(numArgs);
+    for (std::string& arg : args)
+      if (!recvString(fd, arg)) return false;
+    return true;
+  }
+
+  inline bool sendResponse(int fd, int status, const std::string& errs)
+    { return sendU32(fd, status) && sendString(fd, errs); }
+
+  inline bool recvResponse(int fd, int& status, std::string& errs) {
+    uint32_t st;
+    if (!recvU32(fd, st) || !recvString(fd, errs)) return false;
+    status = st;
+    return true;
+  }
+
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef DRIVER_BACKEND
+#define DRIVER_BACKEND
+
+#include <mutex>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+/// @brief The parts of compilation that `miscrc` runs in-process after
+/// codegen: linking in bitcode libraries, the LLVM optimization pipeline, and
+/// native object emission. Linking the program is left to clang.
+class Backend {
+public:
+
+  /// @brief Creates a target machine for the target triple of @p mod, and
+  /// sets the data layout of @p mod to match it. With @p forReports, each
+  /// function gets its own section and a `.stack_sizes` entry (see
+  /// MachineCodeReport). Returns nullptr and writes to @p errs on failure.
+  static std::unique_ptr<llvm::TargetMachine> createTargetMachine(
+      llvm::Module& mod, unsigned optLevel, bool forReports,
+      llvm::raw_ostream& errs) {
+    static std::once_flag targetsInitialized;
+    std::call_once(targetsInitialized, []() {
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmPrinter();
+      llvm::InitializeNativeTargetAsmParser();  // for inline assembly
+    });
+    std::string err;
+    const llvm::Target* target =
+      llvm::TargetRegistry::lookupTarget(mod.getTargetTriple(), err);
+    if (target == nullptr) {
+      errs << "Cannot generate code: " << err << "\n";
+      return nullptr;
+    }
+    llvm::TargetOptions opts;
+    opts.FunctionSections = forReports;
+    opts.EmitStackSizeSection = forReports;
+    llvm::CodeGenOptLevel cgLevel = optLevel == 0 ? llvm::CodeGenOptLevel::None
+      : optLevel == 1 ? llvm::CodeGenOptLevel::Less
+      : optLevel == 2 ? llvm::CodeGenOptLevel::Default
+      : llvm::CodeGenOptLevel::Aggressive;
+    std::unique_ptr<llvm::TargetMachine> tm(target->createTargetMachine(
+      mod.getTargetTriple(), "generic", "", opts, llvm::Reloc::PIC_, {},
+      cgLevel));
+    mod.setDataLayout(tm->createDataLayout());
+    return tm;
+  }
+
+  /// @brief Reads the LLVM bitcode file at @p path into @p ctx. Returns
+  /// nullptr and writes to @p errs on failure.
+  static std::unique_ptr<llvm::Module> readBitcode(llvm::StringRef path,
+      llvm::LLVMContext& ctx, llvm::raw_ostream& errs) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+      errs << "Could not read " << path << ": "
+           << buffer.getError().message() << "\n";
+      return nullptr;
+    }
+    auto lib = llvm::parseBitcodeFile(buffer.get()->getMemBufferRef(), ctx);
+    if (!lib) {
+      errs << "Could not read " << path << ": "
+           << llvm::toString(lib.takeError()) << "\n";
+      return nullptr;
+    }
+    return std::move(*lib);
+  }
+
+  /// @brief Links the definitions of the functions and globals that @p mod
+  /// declares, and whatever they need in turn, from @p lib (e.g. a C file
+  /// compiled by `clang -emit-llvm`) into @p mod, so that they can be
+  /// inlined. Symbols are matched by their LLVM names, which for `extern`
+  /// functions are their unqualified names (see Ontology::mapName). @p lib is
+  /// consumed. Returns false and writes to @p errs on failure.
+  ///
+  /// A program may be made of several modules that each link @p lib (see
+  /// CompilerInstance::stream()), so the linked functions that can be copied
+  /// (see findSharedDefinitions()) get internal linkage, and are deleted
+  /// once every call is inlined. The other definitions must exist only once.
+  /// Unless @p definesShared, @p mod only declares them, and the names it
+  /// declares are added to @p needed. With @p definesShared, @p mod defines
+  /// them, including the ones in @p needed.
+  static bool linkBitcode(llvm::Module& mod, std::unique_ptr<llvm::Module> lib,
+                          bool definesShared, llvm::StringSet<>& needed,
+                          llvm::raw_ostream& errs) {
+    // clang and miscrc may spell the same target with different vendors, and
+    // may lay it out in different (but compatible) words
+    llvm::Triple libTriple(lib->getTargetTriple());
+    llvm::Triple triple(mod.getTargetTriple());
+    if (libTriple.getArch() == triple.getArch()
+        && libTriple.getOS() == triple.getOS()) {
+      lib->setTargetTriple(mod.getTargetTriple());
+      if (!mod.getDataLayout().isDefault())
+        lib->setDataLayout(mod.getDataLayout());
+    }
+
+    llvm::StringSet<> shared = findSharedDefinitions(*lib);
+    for (const auto& entry : shared) {
+      llvm::GlobalValue* gv = lib->getNamedValue(entry.getKey());
+      if (definesShared) {
+        if (needed.count(entry.getKey()) && !mod.getNamedValue(gv->getName()))
+          declareLike(mod, *gv);
+      }
+      else if (auto f = llvm::dyn_cast<llvm::Function>(gv)) {
+        f->deleteBody();
+        f->setComdat(nullptr);
+      }
+      else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+        var->setInitializer(nullptr);
+        var->setComdat(nullptr);
+        var->setLinkage(llvm::GlobalValue::ExternalLinkage);
+      }
+    }
+
+    std::string name = lib->getModuleIdentifier();
+    bool failed = llvm::Linker::linkModules(mod, std::move(lib),
+      llvm::Linker::LinkOnlyNeeded,
+      [&](llvm::Module& m, const llvm::StringSet<>& linked) {
+        llvm::internalizeModule(m, [&](const llvm::GlobalValue& gv) {
+          return !gv.hasName() || !linked.count(gv.getName())
+            || !llvm::isa<llvm::Function>(gv) || shared.count(gv.getName());
+        });
+      });
+    if (failed) {
+      errs << "Could not link " << name << "\n";
+      return false;
+    }
+    if (!definesShared)
+      for (const auto& entry : shared)
+        if (mod.getNamedValue(entry.getKey())) needed.insert(entry.getKey());
+    return true;
+  }
+
+  /// @brief Returns the names of the definitions in @p lib with external
+  /// linkage that a program must not have more than one copy of: every
+  /// global variable, and the functions that refer (directly or through
+  /// other local definitions) to a global variable with local linkage that is
+  /// not constant. Each copy of such a function would have its own state,
+  /// like a `static` counter in C. The other functions are copied freely,
+  /// since the external definitions they refer to can be declared instead.
+  static llvm::StringSet<> findSharedDefinitions(llvm::Module& lib) {
+    llvm::SmallPtrSet<const llvm::GlobalValue*, 16> stateful;
+    llvm::SmallVector<const llvm::GlobalValue*, 16> worklist;
+    for (const llvm::GlobalVariable& gv : lib.globals())
+      if (gv.hasLocalLinkage() && !gv.isConstant()) {
+        stateful.insert(&gv);
+        worklist.push_back(&gv);
+      }
+    while (!worklist.empty()) {
+      const llvm::GlobalValue* gv = worklist.pop_back_val();
+      llvm::SmallVector<const llvm::User*, 16> users(gv->users());
+      while (!users.empty()) {
+        const llvm::User* user = users.pop_back_val();
+        const llvm::GlobalValue* referrer = nullptr;
+        if (auto inst = llvm::dyn_cast<llvm::Instruction>(user))
+          referrer = inst->getFunction();
+        else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(user))
+          referrer = var;
+        else if (llvm::isa<llvm::ConstantExpr>(user)
+                 || llvm::isa<llvm::ConstantAggregate>(user))
+          users.append(user->user_begin(), user->user_end());
+        // references from external definitions need no more copies
+        if (referrer != nullptr && stateful.insert(referrer).second
+            && referrer->hasLocalLinkage())
+          worklist.push_back(referrer);
+      }
+    }
+
+    llvm::StringSet<> shared;
+    for (const llvm::GlobalVariable& gv : lib.globals())
+      if (!gv.isDeclaration() && !gv.hasLocalLinkage())
+        shared.insert(gv.getName());
+    for (const llvm::Function& f : lib)
+      if (!f.isDeclaration() && !f.hasLocalLinkage() && stateful.contains(&f))
+        shared.insert(f.getName());
+    return shared;
+  }
+
+  /// @brief Adds a declaration of @p gv (a function or global variable of
+  /// another module in the same context) to @p mod.
+  static void declareLike(llvm::Module& mod, const llvm::GlobalValue& gv) {
+    if (auto f = llvm::dyn_cast<llvm::Function>(&gv))
+      llvm::Function::Create(f->getFunctionType(),
+        llvm::GlobalValue::ExternalLinkage, f->getName(), mod);
+    else
+      new llvm::GlobalVariable(mod, gv.getValueType(), false,
+        llvm::GlobalValue::ExternalLinkage, nullptr, gv.getName());
+  }
+
+  /// @brief Runs LLVM's default optimization pipeline for level @p optLevel
+  /// (0 to 3) on @p mod. Level 0 only runs the passes that code generation
+  /// needs, such as the lowering of coroutines. Passes emit their remarks
+  /// through the diagnostic handler and remark streamer of the module's
+  /// context.
+  static void optimize(llvm::Module& mod, llvm::TargetMachine& tm,
+                       unsigned optLevel) {
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB(&tm);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    if (optLevel == 0) {
+      PB.buildO0DefaultPipeline(llvm::OptimizationLevel::O0).run(mod, MAM);
+      return;
+    }
+    llvm::OptimizationLevel level = optLevel == 1 ? llvm::OptimizationLevel::O1
+      : optLevel == 2 ? llvm::OptimizationLevel::O2
+      : llvm::OptimizationLevel::O3;
+    PB.buildPerModuleDefaultPipeline(level).run(mod, MAM);
+  }
+
+  /// @brief Moves the definitions of @p funcs, which must have external
+  /// linkage, out of @p mod and into a new module that is returned. Globals
+  /// and functions with local linkage that they (transitively) refer to are
+  /// copied along since they cannot be referenced across modules. Everything
+  /// else, including ifuncs, is only declared in the new module. @p mod keeps
+  /// declarations of @p funcs.
+  static std::unique_ptr<llvm::Module> extractFunctions(llvm::Module& mod,
+      llvm::ArrayRef<llvm::Function*> funcs) {
+    llvm::SmallPtrSet<const llvm::GlobalValue*, 32> cloned;
+    llvm::SmallPtrSet<const llvm::User*, 32> visited;
+    llvm::SmallVector<const llvm::User*, 32> worklist;
+    for (llvm::Function* f : funcs) { cloned.insert(f); worklist.push_back(f); }
+    auto visitOperand = [&](const llvm::Value* v) {
+      if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(v)) {
+        if (gv->hasLocalLinkage() && !llvm::isa<llvm::GlobalIFunc>(gv)
+            && cloned.insert(gv).second)
+          worklist.push_back(gv);
+      }
+      else if (auto c = llvm::dyn_cast<llvm::Constant>(v))
+        worklist.push_back(c);
+    };
+    while (!worklist.empty()) {
+      const llvm::User* u = worklist.pop_back_val();
+      if (!visited.insert(u).second) continue;
+      if (auto f = llvm::dyn_cast<llvm::Function>(u)) {
+        for (const llvm::BasicBlock& bb : *f)
+          for (const llvm::Instruction& inst : bb)
+            for (const llvm::Value* op : inst.operand_values())
+              visitOperand(op);
+      }
+      else if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(u)) {
+        if (gv->hasInitializer()) visitOperand(gv->getInitializer());
+      }
+      else {
+        for (const llvm::Value* op : u->operand_values()) visitOperand(op);
+      }
+    }
+
+    llvm::ValueToValueMapTy vmap;
+    std::unique_ptr<llvm::Module> part = llvm::CloneModule(mod, vmap,
+      [&](const llvm::GlobalValue* gv) { return cloned.contains(gv); });
+
+    // An ifunc must be defined along with its resolver, which stays in
+    // `mod`, so the new module declares a plain function instead.
+    for (llvm::GlobalIFunc& ifunc : mod.ifuncs()) {
+      llvm::Function* decl = llvm::Function::Create(
+        llvm::cast<llvm::FunctionType>(ifunc.getValueType()),
+        llvm::GlobalValue::ExternalLinkage, "", part.get());
+      auto clone = llvm::cast_or_null<llvm::GlobalIFunc>(vmap.lookup(&ifunc));
+      if (clone != nullptr && clone->getParent() == part.get()) {
+        clone->replaceAllUsesWith(decl);
+        clone->eraseFromParent();
+      } else {
+        // older versions of CloneModule leave references to ifuncs as is
+        ifunc.replaceUsesWithIf(decl, [&](llvm::Use& use) {
+          auto inst = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+          return inst != nullptr && inst->getModule() == part.get();
+        });
+      }
+      decl->setName(ifunc.getName());
+    }
+
+    for (llvm::Function* f : funcs) f->deleteBody();
+    return part;
+  }
+
+  /// @brief Emits @p mod as a native object file into @p obj. Returns false
+  /// and writes to @p errs on failure.
+  static bool emitObject(llvm::Module& mod, llvm::TargetMachine& tm,
+                         llvm::SmallVectorImpl<char>& obj,
+                         llvm::raw_ostream& errs) {
+    llvm::legacy::PassManager pm;
+    llvm::raw_svector_ostream os(obj);
+    if (tm.addPassesToEmitFile(pm, os, nullptr,
+                               llvm::CodeGenFileType::ObjectFile)) {
+      errs << "Cannot emit object code for " << mod.getTargetTriple() << "\n";
+      return false;
+    }
+    pm.run(mod);
+    return true;
+  }
+};
+
+#endif
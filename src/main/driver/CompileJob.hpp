@@ -0,0 +1,360 @@
+#ifndef DRIVER_COMPILEJOB
+#define DRIVER_COMPILEJOB
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <llvm/IR/LLVMRemarkStreamer.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include "driver/CompilerInstance.hpp"
+#include "driver/MachineCodeReport.hpp"
+#include "driver/RemarkPrinter.hpp"
+
+extern char** environ;
+
+/// @brief Compiles one MiSCR source file from start to finish, as `miscrc`
+/// does: reads it, runs a CompilerInstance on it, writes the LLVM IR, and
+/// (unless emitting LLVM IR) invokes clang to produce a native binary.
+///
+/// A CompileJob touches no global state, so several can run concurrently on
+/// different threads (as they do in `miscrc --daemon`).
+class CompileJob {
+public:
+  std::string inFile;
+  std::string outFile;
+  std::string workDir;
+  bool emitLLVM = false;
+  bool skipBorrowChecking = false;
+  bool libcAllocator = false;
+  bool mir = false;
+  bool stream = false;
+  bool printStats = false;
+
+  /// @brief LLVM bitcode files to link needed definitions from, as with
+  /// `--link-bitcode=FILE` (see `CompilerInstance::Options::bitcodeFiles`).
+  std::vector<std::string> bitcodeFiles;
+  MachineCodeReport::Format stackUsage = MachineCodeReport::NONE;
+  MachineCodeReport::Format sizeReport = MachineCodeReport::NONE;
+  unsigned optLevel = 0;
+
+  /// @brief Regexes of the passes whose remarks of each kind are printed, as
+  /// with `-Rpass=`, `-Rpass-missed=`, and `-Rpass-analysis=`.
+  std::string remarksPassed, remarksMissed, remarksAnalysis;
+
+  /// @brief Also write all remarks to `STEM.opt.yaml`.
+  bool saveOptRecord = false;
+
+  /// @brief Builds one job per input file from command-line style @p args
+  /// (not including the program name). Relative paths are resolved against
+  /// @p cwd. Returns false and sets @p err if the arguments are malformed.
+  static bool fromArgs(llvm::ArrayRef<std::string> args, llvm::StringRef cwd,
+                       std::vector<CompileJob>& jobs, std::string& err) {
+    CompileJob proto;
+    proto.workDir = cwd.str();
+    std::vector<std::string> inFiles;
+    for (size_t i = 0; i < args.size(); ++i) {
+      llvm::StringRef arg = args[i];
+      if (arg == "-b" || arg == "--b")
+        proto.skipBorrowChecking = true;
+      else if (arg == "-emit-llvm" || arg == "--emit-llvm")
+        proto.emitLLVM = true;
+      else if (arg == "-libc-alloc" || arg == "--libc-alloc")
+        proto.libcAllocator = true;
+      else if (arg == "-mir" || arg == "--mir")
+        proto.mir = true;
+      else if (arg == "-stream" || arg == "--stream")
+        proto.stream = true;
+      else if (arg == "-stats" || arg == "--stats")
+        proto.printStats = true;
+      else if (arg.consume_front("--stack-usage")
+               || arg.consume_front("-stack-usage")) {
+        if (!parseReportOption(arg, proto.stackUsage, err)) return false;
+      }
+      else if (arg.consume_front("--size-report")
+               || arg.consume_front("-size-report")) {
+        if (!parseReportOption(arg, proto.sizeReport, err)) return false;
+      }
+      else if (arg.size() == 3 && arg.consume_front("-O")
+               && arg[0] >= '0' && arg[0] <= '3')
+        proto.optLevel = arg[0] - '0';
+      else if (arg.consume_front("-Rpass-missed="))
+        proto.remarksMissed = arg.str();
+      else if (arg.consume_front("-Rpass-analysis="))
+        proto.remarksAnalysis = arg.str();
+      else if (arg.consume_front("-Rpass="))
+        proto.remarksPassed = arg.str();
+      else if (arg.consume_front("--link-bitcode=")
+               || arg.consume_front("-link-bitcode="))
+        proto.bitcodeFiles.push_back(resolve(cwd, arg));
+      else if (arg == "-fsave-optimization-record")
+        proto.saveOptRecord = true;
+      else if (arg == "-o" || arg == "--o") {
+        if (++i == args.size()) { err = "Missing file after -o"; return false; }
+        proto.outFile = resolve(cwd, args[i]);
+      }
+      else if (!arg.empty() && arg.front() == '-') {
+        err = ("Unknown option " + arg).str();
+        return false;
+      }
+      else inFiles.push_back(resolve(cwd, arg));
+    }
+    if (inFiles.empty()) { err = "No input files"; return false; }
+    if (proto.stream && proto.emitLLVM) {
+      err = "Cannot use --stream with --emit-llvm";
+      return false;
+    }
+    if (inFiles.size() > 1 && !proto.outFile.empty()) {
+      err = "Cannot use -o with multiple input files";
+      return false;
+    }
+    for (std::string& inFile : inFiles) {
+      jobs.push_back(proto);
+      jobs.back().inFile = inFile;
+    }
+    return true;
+  }
+
+  /// @brief Runs this job. Diagnostics are written to @p errs. Returns the
+  /// process exit status that `miscrc` would have.
+  int run(llvm::raw_ostream& errs) const {
+
+    // read MiSCR source code from input file
+    auto maybeSrcCode = llvm::MemoryBuffer::getFile(inFile, true);
+    if (!maybeSrcCode) {
+      errs << "Could not read file " << inFile << "\n";
+      return 1;
+    }
+    CompilerInstance::Options opts;
+    opts.name = inFile;
+    opts.optLevel = optLevel;
+    opts.libcAllocator = libcAllocator;
+    opts.mir = mir;
+    opts.stream = stream;
+    opts.bitcodeFiles = bitcodeFiles;
+    bool wantRemarks = saveOptRecord || !remarksPassed.empty()
+      || !remarksMissed.empty() || !remarksAnalysis.empty();
+    opts.trackSourceLocations = wantRemarks;
+    opts.skipBorrowChecking = skipBorrowChecking;
+    CompilerInstance ci(opts);
+    bool ok = ci.parse(maybeSrcCode.get()->getBuffer()) && (stream
+      || (ci.analyze() && (skipBorrowChecking || ci.borrowCheck())
+          && ci.generate()));
+    if (!ok) {
+      errs << ci.renderErrors();
+      return 1;
+    }
+    llvm::StringRef srcCode = ci.getSource();
+    llvm::LLVMContext& llvmContext = ci.getLLVMContext();
+    if (printStats && !stream)
+      printCodegenStats(ci.getCodegen()->getStats(), errs);
+
+    llvm::StringRef outFileStem = inFile;
+    size_t lastSlash = outFileStem.find_last_of('/');
+    if (lastSlash != llvm::StringRef::npos)
+      outFileStem = outFileStem.substr(lastSlash + 1);
+    outFileStem.consume_back(".miscr");
+
+    // Optimization remarks are printed as they are emitted, and recorded in
+    // YAML if requested.
+    std::unique_ptr<llvm::ToolOutputFile> optRecord;
+    if (wantRemarks) {
+      auto printer = std::make_unique<RemarkPrinter>(remarksPassed,
+        remarksMissed, remarksAnalysis, srcCode.data(),
+        *ci.getLocationTable(), errs);
+      std::string regexErr;
+      if (!printer->isValid(regexErr)) {
+        errs << "Invalid -Rpass regex: " << regexErr << "\n";
+        return 1;
+      }
+      llvmContext.setDiagnosticHandler(std::move(printer));
+    }
+    if (saveOptRecord) {
+      auto record = llvm::setupLLVMOptimizationRemarks(llvmContext,
+        resolve(workDir, (outFileStem + ".opt.yaml").str()), "", "yaml",
+        false);
+      if (!record) {
+        errs << llvm::toString(record.takeError()) << "\n";
+        return 1;
+      }
+      optRecord = std::move(*record);
+    }
+
+    // The reports need native code, so the object file is emitted here
+    // rather than by clang, which then only links it.
+    bool wantObj = stackUsage != MachineCodeReport::NONE
+      || sizeReport != MachineCodeReport::NONE;
+    MachineCodeReport report;
+    llvm::SmallString<0> obj;
+    std::vector<std::string> inputFiles;
+
+    if (stream) {
+      // each partition is written to `STEM.N.o` as soon as it is generated
+      bool ok = ci.stream([&](llvm::Module& part) {
+        obj.clear();
+        if (!ci.emitObject(part, obj, wantObj)) return false;
+        if (wantObj && !report.read(obj, ci.getOntology())) {
+          errs << "Could not read the emitted object file\n";
+          return false;
+        }
+        inputFiles.push_back(resolve(workDir, (outFileStem + "."
+          + std::to_string(inputFiles.size()) + ".o").str()));
+        std::error_code EC;
+        llvm::raw_fd_ostream outDotO(inputFiles.back(), EC);
+        outDotO << obj.str();
+        return !EC;
+      });
+      if (!ok) {
+        errs << ci.renderErrors();
+        return 1;
+      }
+      if (printStats) printCodegenStats(ci.getCodegen()->getStats(), errs);
+    }
+    else {
+      // Coroutines are lowered here even at -O0, since clang is told not to
+      // run any LLVM passes on the emitted IR.
+      bool coroutines = ci.getCodegen()->usesCoroutines();
+      if ((optLevel > 0 || coroutines) && !ci.optimize()) {
+        errs << ci.renderErrors();
+        return 1;
+      }
+      if (wantObj) {
+        if (!ci.emitObject(obj, true)) {
+          errs << ci.renderErrors();
+          return 1;
+        }
+        if (!report.read(obj, ci.getOntology())) {
+          errs << "Could not read the emitted object file\n";
+          return 1;
+        }
+      }
+    }
+    if (wantObj) {
+      if (stackUsage != MachineCodeReport::NONE)
+        report.printStackUsage(errs, stackUsage, inFile);
+      if (sizeReport != MachineCodeReport::NONE)
+        report.printSizeReport(errs, sizeReport);
+    }
+
+    if (optRecord) optRecord->keep();
+
+    // output LLVM IR (or the object file already emitted) to a file
+    bool linkObj = stream || (!obj.empty() && !emitLLVM);
+    if (!stream) {
+      inputFiles.push_back(emitLLVM && !outFile.empty() ? outFile
+        : resolve(workDir, (outFileStem + (linkObj ? ".o" : ".ll")).str()));
+      std::error_code EC;
+      llvm::raw_fd_ostream outDotLL(inputFiles.back(), EC);
+      if (linkObj) outDotLL << obj.str();
+      else outDotLL << *ci.getModule();
+      outDotLL.flush();
+    }
+
+    // invoke clang to compile the LLVM IR to a native binary
+    if (!emitLLVM) {
+      std::string binFile = outFile.empty()
+        ? resolve(workDir, outFileStem) : outFile;
+      std::vector<const char*> clangArgs = { "clang" };
+      std::string optFlag = "-O" + std::to_string(optLevel);
+      if (!linkObj) {
+        // the IR is already optimized; clang only generates code
+        clangArgs.insert(clangArgs.end(),
+          { optFlag.c_str(), "-Xclang", "-disable-llvm-passes" });
+      }
+      // math builtins may lower to libm calls on targets without an
+      // instruction for them (e.g., llvm.round on x86 before SSE4.1)
+      clangArgs.insert(clangArgs.end(), { "-o", binFile.c_str() });
+      for (const std::string& inputFile : inputFiles)
+        clangArgs.push_back(inputFile.c_str());
+      std::string asyncLib, allocLib;
+      if (ci.getCodegen()->usesCoroutines()) {
+        if (!findRuntime("libmiscr-async.a", asyncLib)) {
+          errs << "Could not find the async runtime " << asyncLib
+               << " (build it with `./build.sh runtime`)\n";
+          return 1;
+        }
+        clangArgs.push_back(asyncLib.c_str());
+      }
+      if (ci.getCodegen()->usesRuntimeAllocator()) {
+        if (!findRuntime("libmiscr-alloc.a", allocLib)) {
+          errs << "Could not find the allocator runtime " << allocLib
+               << " (build it with `./build.sh runtime`, or compile with "
+                  "--libc-alloc)\n";
+          return 1;
+        }
+        clangArgs.insert(clangArgs.end(), { allocLib.c_str(), "-pthread" });
+      }
+      clangArgs.insert(clangArgs.end(), { "-lm", nullptr });
+      pid_t childPID;
+      if (posix_spawnp(&childPID, "clang", nullptr, nullptr,
+                       const_cast<char**>(clangArgs.data()), environ) != 0) {
+        errs << "Could not find clang. " << (linkObj ? "Object code" : "LLVM")
+             << " was output to " << inputFiles.front()
+             << (inputFiles.size() > 1 ? " and others" : "") << "\n";
+        return 1;
+      }
+      int status;
+      waitpid(childPID, &status, 0);
+      if (status != 0) return 1;
+      for (const std::string& inputFile : inputFiles)
+        unlink(inputFile.c_str());
+    }
+
+    return 0;
+  }
+
+private:
+  /// @brief Parses what follows the name of a report option: nothing, or
+  /// `=` and a format.
+  static bool parseReportOption(llvm::StringRef suffix,
+      MachineCodeReport::Format& format, std::string& err) {
+    if (suffix.empty()) {
+      format = MachineCodeReport::TEXT;
+      return true;
+    }
+    if (suffix.consume_front("=")
+        && MachineCodeReport::parseFormat(suffix, format)) return true;
+    err = ("Unknown report format " + suffix).str();
+    return false;
+  }
+
+  static void printCodegenStats(const Codegen::Stats& stats,
+                                llvm::raw_ostream& os) {
+    double hitRate = stats.stringLits == 0 ? 0.0
+      : 100.0 * stats.pooledStringLits / stats.stringLits;
+    os << "string literals: " << stats.stringLits << ", pooled: "
+       << stats.pooledStringLits << " ("
+       << llvm::format("%.1f", hitRate) << "% hit rate)\n";
+    if (stats.mirFunctions + stats.mirFallbacks == 0) return;
+    os << "MIR functions: " << stats.mirFunctions << ", fallbacks: "
+       << stats.mirFallbacks << "\n"
+       << "MIR moves propagated: " << stats.mir.movesPropagated
+       << ", borrows removed: " << stats.mir.borrowsRemoved
+       << ", structs replaced: " << stats.mir.structsReplaced
+       << ", slots promoted: " << stats.mir.slotsPromoted
+       << ", loads forwarded: " << stats.mir.loadsForwarded
+       << ", dead instructions: " << stats.mir.instsRemoved << "\n";
+  }
+
+  /// @brief Sets @p path to where runtime library @p libName should be: next
+  /// to the `miscrc` executable. Returns false if it is not there.
+  static bool findRuntime(llvm::StringRef libName, std::string& path) {
+    std::string exe = llvm::sys::fs::getMainExecutable(nullptr, nullptr);
+    llvm::SmallString<128> lib(llvm::sys::path::parent_path(exe));
+    llvm::sys::path::append(lib, libName);
+    path = lib.str().str();
+    return llvm::sys::fs::exists(path);
+  }
+
+  /// @brief Resolves @p path against directory @p cwd unless it is absolute.
+  static std::string resolve(llvm::StringRef cwd, llvm::StringRef path) {
+    if (cwd.empty() || (!path.empty() && path.front() == '/'))
+      return path.str();
+    return (cwd + "/" + path).str();
+  }
+};
+
+#endif
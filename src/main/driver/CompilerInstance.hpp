@@ -0,0 +1,385 @@
+#ifndef DRIVER_COMPILERINSTANCE
+#define DRIVER_COMPILERINSTANCE
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include "lexer/Lexer.hpp"
+#include "parser/Parser.hpp"
+#include "sema/Sema.hpp"
+#include "borrowchecker/BorrowChecker.hpp"
+#include "analysis/FunctionSummaries.hpp"
+#include "codegen/Codegen.hpp"
+#include "driver/Backend.hpp"
+
+/// @brief The MiSCR compiler as a library. A CompilerInstance compiles one
+/// source text to an LLVM module (and optionally a native object) in memory.
+/// It owns everything involved: a copy of the source, its LocationTable, the
+/// AST, Sema, the LLVMContext, and the module.
+///
+/// Options are passed explicitly and nothing is global, so independent
+/// instances can run concurrently on different threads.
+///
+/// Each stage returns false if it failed, and its errors can then be read
+/// with getErrors() or renderErrors(). Stages must run in order; compile()
+/// runs all of them that the options ask for. With `Options::stream`, parse()
+/// is followed by stream() instead, which runs the other stages one function
+/// at a time.
+class CompilerInstance {
+public:
+  struct Options {
+    /// @brief Names the module and (with trackSourceLocations) the file in
+    /// debug locations.
+    std::string name = "input.miscr";
+    bool skipBorrowChecking = false;
+    /// @brief Tags instructions with MiSCR source locations, which
+    /// optimization remarks need.
+    bool trackSourceLocations = false;
+    unsigned optLevel = 0;
+    std::string targetTriple = "x86_64-pc-linux-gnu";
+    /// @brief Lowers the allocation builtins to libc's `malloc`, `realloc`,
+    /// and `free` instead of to the MiSCR allocator.
+    bool libcAllocator = false;
+    /// @brief Lowers function bodies through the mid-level IR (see
+    /// `mir::Function`) and its optimizations.
+    bool mir = false;
+    /// @brief parse() only parses function signatures, and stream() compiles
+    /// the bodies.
+    bool stream = false;
+    /// @brief With stream(), the number of LLVM instructions that are
+    /// generated before they are optimized and emitted as a partition.
+    unsigned partitionBudget = 20000;
+    /// @brief LLVM bitcode files whose definitions of the functions that the
+    /// module calls (such as C helpers declared with `extern func`) are linked
+    /// into it before it is optimized, so they can be inlined.
+    std::vector<std::string> bitcodeFiles;
+  };
+
+private:
+  Options opts;
+  std::unique_ptr<llvm::MemoryBuffer> source;
+  std::unique_ptr<LocationTable> locTab;
+  std::vector<Token> tokens;
+  std::unique_ptr<Parser> parser;
+  DeclList* decls = nullptr;
+  Sema sema;
+  std::unique_ptr<FunctionSummaries> summaries;
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::vector<std::unique_ptr<llvm::Module>> bitcodeLibs;
+  /// @brief Definitions from `bitcodeLibs` that partitions only declare, and
+  /// that getModule() must define (see Backend::linkBitcode()).
+  llvm::StringSet<> sharedBitcodeDefs;
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<Codegen> codegen;
+  std::unique_ptr<llvm::TargetMachine> tm;
+  std::vector<LocatedError> errors;
+
+  enum Stage { EMPTY, PARSED, ANALYZED, CHECKED, GENERATED, OPTIMIZED };
+  Stage stage = EMPTY;
+  bool failed = false;
+
+public:
+  CompilerInstance() : CompilerInstance(Options()) {}
+  explicit CompilerInstance(Options opts)
+    : opts(std::move(opts)), context(new llvm::LLVMContext) {}
+  CompilerInstance(const CompilerInstance&) = delete;
+
+  ~CompilerInstance() {
+    codegen.reset();
+    module.reset();
+    if (decls != nullptr) decls->deleteRecursive();
+  }
+
+  const Options& getOptions() const { return opts; }
+  llvm::StringRef getSource() const
+    { return source ? source->getBuffer() : llvm::StringRef(); }
+  DeclList* getDecls() const { return decls; }
+  Sema& getSema() { return sema; }
+  const Ontology& getOntology() const { return sema.getOntology(); }
+  llvm::LLVMContext& getLLVMContext() { return *context; }
+
+  /// @brief The generated module, or null before generate().
+  llvm::Module* getModule() const { return module.get(); }
+
+  /// @brief The code generator, for its statistics. Null before generate().
+  const Codegen* getCodegen() const { return codegen.get(); }
+
+  /// @brief The target machine of the module, or null before generate().
+  llvm::TargetMachine* getTargetMachine() const { return tm.get(); }
+
+  const std::vector<LocatedError>& getErrors() const { return errors; }
+  bool hasErrors() const { return !errors.empty(); }
+
+  /// @brief Renders all errors with snippets of the source.
+  std::string renderErrors() const {
+    const char* text = source ? source->getBufferStart() : "";
+    LocationTable noLocations(text);
+    std::string out;
+    for (LocatedError err : errors)
+      out.append(err.render(text, locTab ? *locTab : noLocations));
+    return out;
+  }
+
+  /// @brief The LocationTable of the source. Null before parse().
+  const LocationTable* getLocationTable() const { return locTab.get(); }
+
+  /// @brief Runs every stage on @p text: up to codegen, then the optimizer
+  /// if the optimization level or coroutines ask for it.
+  bool compile(llvm::StringRef text) {
+    if (!parse(text) || !analyze()) return false;
+    if (!opts.skipBorrowChecking && !borrowCheck()) return false;
+    if (!generate()) return false;
+    if (opts.optLevel > 0 || codegen->usesCoroutines()) return optimize();
+    return true;
+  }
+
+  /// @brief Lexes and parses (a copy of) @p text. With `Options::stream`,
+  /// function bodies are left to stream() and the tokens are kept until then.
+  bool parse(llvm::StringRef text) {
+    if (!advance(EMPTY, PARSED)) return false;
+    source = llvm::MemoryBuffer::getMemBufferCopy(text, opts.name);
+    locTab = std::make_unique<LocationTable>(source->getBufferStart());
+    tokens = Lexer(source->getBuffer(), locTab.get()).run();
+    parser = std::make_unique<Parser>(tokens);
+    if (opts.stream) parser->deferBodies();
+    decls = parser->decls0();
+    if (decls == nullptr) return fail(parser->getError());
+    if (parser->hasMore())
+      return fail(LocatedError()
+        << "Parser got stuck:\n" << parser->getCurrentToken().loc);
+    if (!opts.stream) {
+      parser.reset();
+      tokens = std::vector<Token>();
+    }
+    return true;
+  }
+
+  /// @brief Runs semantic analysis.
+  bool analyze() {
+    if (!advance(PARSED, ANALYZED)) return false;
+    sema.run(decls, "global");
+    return takeErrors(sema.getErrors());
+  }
+
+  /// @brief Runs the borrow checker.
+  bool borrowCheck() {
+    if (!advance(ANALYZED, CHECKED)) return false;
+    summaries = std::make_unique<FunctionSummaries>(sema.getOntology());
+    summaries->run();
+    BorrowChecker bc(sema.getTypeContext(), sema.getOntology(),
+                     summaries.get());
+    bc.checkDecls(decls);
+    return takeErrors(bc.errors);
+  }
+
+  /// @brief Generates the LLVM module, links in `Options::bitcodeFiles`, and
+  /// verifies it. Skips the borrow checker if it has not run.
+  bool generate() {
+    if (stage == ANALYZED) stage = CHECKED;
+    if (!advance(CHECKED, GENERATED)) return false;
+    if (summaries == nullptr) {
+      summaries = std::make_unique<FunctionSummaries>(sema.getOntology());
+      summaries->run();
+    }
+    if (!createCodegen()) return false;
+    codegen->genDeclList(decls);
+    return linkBitcode(*module) && verify(*module);
+  }
+
+  /// @brief Runs every stage after parse() one function at a time, and hands
+  /// the generated code to @p emit as a sequence of optimized modules (the
+  /// partitions) that together make up the program. Requires
+  /// `Options::stream`.
+  ///
+  /// Only signatures, structs, and constants are analyzed up front. Then each
+  /// function body is parsed, analyzed, borrow-checked, and generated, and
+  /// its AST is deleted. Once the functions generated since the last
+  /// partition reach `Options::partitionBudget` instructions, they are moved
+  /// into a partition of their own, so memory use is bounded by the partition
+  /// size rather than by the size of the program. The last partition is
+  /// getModule(), which keeps what the functions share (such as constants
+  /// and target clones).
+  ///
+  /// The code may be slower than with compile(): a function only sees the
+  /// summaries (see FunctionSummaries) of the functions before it, and calls
+  /// are only inlined within a partition. Stops if @p emit returns false.
+  bool stream(llvm::function_ref<bool(llvm::Module&)> emit) {
+    if (!opts.stream)
+      return fail(LocatedError() << "Streaming was not enabled.\n");
+    if (!advance(PARSED, OPTIMIZED)) return false;
+    sema.declare(decls, "global");
+    if (!takeErrors(sema.getErrors())) return false;
+    summaries = std::make_unique<FunctionSummaries>(sema.getOntology());
+    summaries->beginIncremental();
+    if (!createCodegen()) return false;
+
+    BorrowChecker bc(sema.getTypeContext(), sema.getOntology(),
+                     summaries.get());
+    std::vector<llvm::Function*> pending;
+    unsigned pendingInsts = 0;
+    auto emitPending = [&]() {
+      if (pending.empty()) return true;
+      std::unique_ptr<llvm::Module> part =
+        Backend::extractFunctions(*module, pending);
+      pending.clear();
+      pendingInsts = 0;
+      return emitPartition(*part, emit);
+    };
+    Sema::forEachFunction(decls, "global",
+        [&](FunctionDecl* f, llvm::StringRef scope) {
+      if (failed || f->isExtern()) return;
+      if (!parser->parseBody(f)) { fail(parser->getError()); return; }
+      sema.analyzeBody(f, scope);
+      sema.forgetTypeVars();
+      if (!takeErrors(sema.getErrors())) return;
+      if (!opts.skipBorrowChecking) {
+        bc.checkFunctionDecl(f);
+        if (!takeErrors(bc.errors)) return;
+      }
+      summaries->summarize(f);
+      codegen->genDecl(f);
+      f->releaseBody();
+      // the clones of a #[target_clones] function stay in the module
+      llvm::Function* llvmFunc = module->getFunction(
+        getOntology().mapName(f->getName()->asStringRef()));
+      if (llvmFunc == nullptr || llvmFunc->hasLocalLinkage()) return;
+      pending.push_back(llvmFunc);
+      pendingInsts += llvmFunc->getInstructionCount();
+      if (pendingInsts >= opts.partitionBudget) emitPending();
+    });
+    parser.reset();
+    tokens = std::vector<Token>();
+    if (failed || !emitPending()) return false;
+    codegen->finish();
+    return emitPartition(*module, emit);
+  }
+
+  /// @brief Runs LLVM's optimization pipeline (at -O0, only the passes that
+  /// code generation needs). Passes report remarks to the diagnostic handler
+  /// of getLLVMContext().
+  bool optimize() {
+    if (!advance(GENERATED, OPTIMIZED)) return false;
+    Backend::optimize(*module, *tm, opts.optLevel);
+    return true;
+  }
+
+  /// @brief Emits the module as a native object file into @p obj. With
+  /// @p forReports, the object has what MachineCodeReport reads.
+  bool emitObject(llvm::SmallVectorImpl<char>& obj, bool forReports = false) {
+    if (failed || stage < GENERATED)
+      return fail(LocatedError() << "Nothing to emit.\n");
+    return emitObject(*module, obj, forReports);
+  }
+
+  /// @brief Emits @p mod, which is the module or a partition of stream(), as
+  /// a native object file into @p obj.
+  bool emitObject(llvm::Module& mod, llvm::SmallVectorImpl<char>& obj,
+                  bool forReports = false) {
+    if (forReports && !createTargetMachine(forReports))
+      return false;
+    std::string err;
+    llvm::raw_string_ostream os(err);
+    if (!Backend::emitObject(mod, *tm, obj, os))
+      return fail(LocatedError() << llvm::StringRef(os.str()));
+    return true;
+  }
+
+  /// @brief Prints the module as textual LLVM IR.
+  std::string getIR() const {
+    std::string ir;
+    llvm::raw_string_ostream os(ir);
+    if (module) module->print(os, nullptr);
+    return os.str();
+  }
+
+private:
+  /// @brief Moves from stage @p from to stage @p to, unless an earlier stage
+  /// failed or the stages ran out of order.
+  bool advance(Stage from, Stage to) {
+    if (failed) return false;
+    if (stage != from)
+      return fail(LocatedError() << "Compiler stages ran out of order.\n");
+    stage = to;
+    return true;
+  }
+
+  bool fail(LocatedError err) {
+    errors.push_back(std::move(err));
+    failed = true;
+    return false;
+  }
+
+  /// @brief Fails with @p stageErrors unless there are none. The errors of
+  /// a stage accumulate, so only the first call that sees them fails.
+  bool takeErrors(llvm::ArrayRef<LocatedError> stageErrors) {
+    if (stageErrors.empty()) return true;
+    errors.insert(errors.end(), stageErrors.begin(), stageErrors.end());
+    failed = true;
+    return false;
+  }
+
+  /// @brief Creates the (empty) module and its code generator. The target
+  /// machine is created first, since struct sizes and alignments depend on
+  /// the data layout it gives the module.
+  bool createCodegen() {
+    module = std::make_unique<llvm::Module>(opts.name, *context);
+    module->setTargetTriple(opts.targetTriple);
+    module->setSourceFileName(opts.name);
+    if (!createTargetMachine(false)) return false;
+    codegen = std::make_unique<Codegen>(sema.getOntology(), *module,
+                                        summaries.get());
+    if (opts.trackSourceLocations) codegen->trackSourceLocations(opts.name);
+    if (opts.libcAllocator) codegen->useLibcAllocator();
+    if (opts.mir) codegen->useMIR(sema.getTypeContext());
+    return true;
+  }
+
+  /// @brief Fails with the verifier's message if @p mod is malformed.
+  bool verify(llvm::Module& mod) {
+    std::string verifierErr;
+    llvm::raw_string_ostream os(verifierErr);
+    if (llvm::verifyModule(mod, &os))
+      return fail(LocatedError() << llvm::StringRef(os.str()));
+    return true;
+  }
+
+  /// @brief Links what @p mod needs from `Options::bitcodeFiles` into it.
+  /// The files are read once, and each module or partition links a copy.
+  /// Definitions with state are only linked into getModule(), which is the
+  /// last partition.
+  bool linkBitcode(llvm::Module& mod) {
+    std::string err;
+    llvm::raw_string_ostream os(err);
+    if (bitcodeLibs.empty()) {
+      for (const std::string& path : opts.bitcodeFiles) {
+        bitcodeLibs.push_back(Backend::readBitcode(path, *context, os));
+        if (bitcodeLibs.back() == nullptr)
+          return fail(LocatedError() << llvm::StringRef(os.str()));
+      }
+    }
+    for (const std::unique_ptr<llvm::Module>& lib : bitcodeLibs)
+      if (!Backend::linkBitcode(mod, llvm::CloneModule(*lib),
+                                &mod == module.get(), sharedBitcodeDefs, os))
+        return fail(LocatedError() << llvm::StringRef(os.str()));
+    return true;
+  }
+
+  /// @brief Links, verifies, and optimizes partition @p part of stream() and
+  /// hands it to @p emit.
+  bool emitPartition(llvm::Module& part,
+                     llvm::function_ref<bool(llvm::Module&)> emit) {
+    if (!linkBitcode(part) || !verify(part)) return false;
+    Backend::optimize(part, *tm, opts.optLevel);
+    if (emit(part)) return true;
+    return fail(LocatedError() << "Could not emit a partition.\n");
+  }
+
+  bool createTargetMachine(bool forReports) {
+    std::string err;
+    llvm::raw_string_ostream os(err);
+    tm = Backend::createTargetMachine(*module, opts.optLevel, forReports, os);
+    if (tm == nullptr) return fail(LocatedError() << llvm::StringRef(os.str()));
+    return true;
+  }
+};
+
+#endif
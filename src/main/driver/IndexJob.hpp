@@ -0,0 +1,131 @@
+#ifndef DRIVER_INDEXJOB
+#define DRIVER_INDEXJOB
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include "driver/CompilerInstance.hpp"
+#include "index/Indexer.hpp"
+
+/// @brief Updates and queries a SymbolIndex, as `miscrc --index` does.
+///
+/// The index is updated incrementally: files whose modification time and
+/// size are unchanged are not read again, files that no longer exist are
+/// dropped, and only the remaining input files are parsed and analyzed.
+class IndexJob {
+public:
+  std::string indexFile;
+  std::vector<std::string> inFiles;
+
+  /// @brief If nonempty, the symbol whose occurrences are printed after the
+  /// index is updated. A trailing `*` matches all symbols with that prefix,
+  /// and `global::` may be left off.
+  std::string query;
+
+  /// @brief Runs this job. Query results are written to @p out and
+  /// diagnostics to @p errs. Returns the process exit status that `miscrc`
+  /// would have.
+  int run(llvm::raw_ostream& out, llvm::raw_ostream& errs) const {
+    SymbolIndex::Builder builder;
+    bool changed = true;
+    if (llvm::sys::fs::exists(indexFile)) {
+      std::string err;
+      if (auto index = SymbolIndex::open(indexFile, err)) {
+        builder.load(*index);
+        changed = false;
+      }
+      else errs << err << "; rebuilding it\n";
+    }
+
+    for (const std::string& path : builder.getFiles())
+      if (!llvm::sys::fs::exists(path)) {
+        builder.removeFile(path);
+        changed = true;
+      }
+
+    bool failed = false;
+    for (const std::string& inFile : inFiles) {
+      llvm::SmallString<128> path(inFile);
+      llvm::sys::fs::make_absolute(path);
+      llvm::sys::path::remove_dots(path, true);
+      llvm::sys::fs::file_status status;
+      if (llvm::sys::fs::status(path, status)) {
+        errs << "Could not read file " << inFile << "\n";
+        failed = true;
+        continue;
+      }
+      uint64_t mtime = llvm::sys::toTimeT(status.getLastModificationTime());
+      if (builder.isUpToDate(path, mtime, status.getSize())) continue;
+      if (!indexOne(builder, path, mtime, status.getSize(), errs))
+        failed = true;
+      else changed = true;
+    }
+
+    if (changed) {
+      std::string err;
+      if (!builder.write(indexFile, err)) {
+        errs << err << "\n";
+        return 1;
+      }
+    }
+
+    if (!query.empty()) {
+      std::string err;
+      auto index = SymbolIndex::open(indexFile, err);
+      if (index == nullptr) {
+        errs << err << "\n";
+        return 1;
+      }
+      printQuery(*index, query, out);
+    }
+    return failed ? 1 : 0;
+  }
+
+  /// @brief Prints every occurrence of the symbols matching @p query in
+  /// @p index as `FILE:ROW:COL: KIND SYMBOL`, declarations first.
+  static void printQuery(const SymbolIndex& index, llvm::StringRef query,
+                         llvm::raw_ostream& out) {
+    std::string name = query.str();
+    if (!llvm::StringRef(name).startswith("global"))
+      name = "global::" + name;
+    std::pair<unsigned, unsigned> range;
+    if (llvm::StringRef(name).endswith("*"))
+      range = index.findPrefix(llvm::StringRef(name).drop_back());
+    else if (auto symbol = index.find(name))
+      range = { *symbol, *symbol + 1 };
+    for (unsigned symbol = range.first; symbol < range.second; ++symbol) {
+      std::vector<SymbolIndex::Occurrence> occs = index.getOccurrences(symbol);
+      std::stable_partition(occs.begin(), occs.end(), [](auto& occ)
+        { return SymbolIndex::isDecl(occ.kind); });
+      for (const SymbolIndex::Occurrence& occ : occs)
+        out << index.getFilePath(occ.file) << ":" << occ.row << ":" << occ.col
+            << ": " << SymbolIndex::kindToString(occ.kind) << " "
+            << index.getSymbol(symbol) << "\n";
+    }
+  }
+
+private:
+  /// @brief Parses and analyzes @p path and replaces its occurrences in
+  /// @p builder. If that fails, the errors are written to @p errs and the
+  /// old occurrences (if any) are kept.
+  static bool indexOne(SymbolIndex::Builder& builder, llvm::StringRef path,
+                       uint64_t mtime, uint64_t size, llvm::raw_ostream& errs) {
+    auto maybeSrcCode = llvm::MemoryBuffer::getFile(path, true);
+    if (!maybeSrcCode) {
+      errs << "Could not read file " << path << "\n";
+      return false;
+    }
+    CompilerInstance::Options opts;
+    opts.name = path.str();
+    CompilerInstance ci(opts);
+    if (!ci.parse(maybeSrcCode.get()->getBuffer()) || !ci.analyze()) {
+      errs << ci.renderErrors();
+      return false;
+    }
+    builder.beginFile(path, mtime, size);
+    Indexer(ci.getOntology(), builder).run(ci.getDecls());
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef DRIVER_MACHINECODEREPORT
+#define DRIVER_MACHINECODEREPORT
+
+#include <llvm/Object/ELFObjectFile.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/LEB128.h>
+#include "common/Ontology.hpp"
+
+/// @brief Reports the stack frame size and machine code size of each MiSCR
+/// function in a native object file emitted by Backend.
+///
+/// Both numbers are read back from the object: code sizes from the ELF symbol
+/// table, and frame sizes from the `.stack_sizes` section, which the backend
+/// fills in from each function's MachineFrameInfo. The object must be emitted
+/// with one section per function so that each `.stack_sizes` entry links to
+/// exactly one function.
+///
+/// Functions that the compiler generates itself (like `miscr.cpu_features`
+/// or the sorting routines) are reported under their symbol names, in the
+/// pseudo-module GENERATED, so that the totals cover all of the code.
+class MachineCodeReport {
+public:
+  enum Format { NONE, TEXT, JSON };
+
+  /// @brief The module that compiler-generated functions are listed in.
+  static constexpr const char* GENERATED = "(generated)";
+
+  struct Function {
+    std::string name;     // fully qualified MiSCR name
+    Location loc;         // location of the FunctionDecl
+    uint64_t codeBytes = 0;
+    uint64_t frameBytes = 0;
+    bool dynamicFrame = true;  // no static frame size (e.g., dynamic allocas)
+    bool generated = false;    // made by the compiler; `loc` is meaningless
+  };
+
+  std::vector<Function> functions;
+
+  /// @brief Parses a report format name (`text` or `json`).
+  static bool parseFormat(llvm::StringRef name, Format& format) {
+    if (name == "text") format = TEXT;
+    else if (name == "json") format = JSON;
+    else return false;
+    return true;
+  }
+
+  /// @brief Collects the sizes of the functions of @p ont from object file
+  /// @p obj. Returns false if @p obj is not a 64-bit little-endian ELF file.
+  bool read(llvm::StringRef obj, const Ontology& ont) {
+    // fully qualified names of the functions, by their symbol names
+    llvm::StringMap<llvm::StringRef> bySymbol;
+    for (auto& entry : ont.functionSpace)
+      if (!entry.second->isExtern())
+        bySymbol[ont.mapName(entry.first())] = entry.first();
+
+    auto objOrErr = llvm::object::ObjectFile::createObjectFile(
+      llvm::MemoryBufferRef(obj, "object"));
+    if (!objOrErr) {
+      llvm::consumeError(objOrErr.takeError());
+      return false;
+    }
+    auto elf =
+      llvm::dyn_cast<llvm::object::ELF64LEObjectFile>(objOrErr->get());
+    if (elf == nullptr) return false;
+
+    // function symbols, by the index of the section they are in
+    llvm::DenseMap<uint64_t, size_t> bySection;
+    for (const llvm::object::ELFSymbolRef& sym : elf->symbols()) {
+      auto type = sym.getType();
+      auto name = sym.getName();
+      auto section = sym.getSection();
+      if (!type || !name || !section) {
+        if (!type) llvm::consumeError(type.takeError());
+        if (!name) llvm::consumeError(name.takeError());
+        if (!section) llvm::consumeError(section.takeError());
+        continue;
+      }
+      if (*type != llvm::object::SymbolRef::ST_Function
+          || *section == elf->section_end()) continue;
+      // target clones are named like `symbol.avx2`
+      auto [symbol, clone] = name->split('.');
+      auto fqn = bySymbol.find(symbol);
+      Function f;
+      if (fqn == bySymbol.end()) {
+        f.name = name->str();
+        f.generated = true;
+      } else {
+        f.name = fqn->second.str();
+        if (!clone.empty()) f.name += ("." + clone).str();
+        f.loc = ont.getFunction(fqn->second)->getLocation();
+      }
+      f.codeBytes = sym.getSize();
+      bySection[(*section)->getIndex()] = functions.size();
+      functions.push_back(f);
+    }
+
+    // each .stack_sizes entry is an address followed by a ULEB128 size
+    const auto& file = elf->getELFFile();
+    auto sections = file.sections();
+    if (!sections) {
+      llvm::consumeError(sections.takeError());
+      return true;
+    }
+    for (const auto& shdr : *sections) {
+      auto name = file.getSectionName(shdr);
+      if (!name || *name != ".stack_sizes") {
+        if (!name) llvm::consumeError(name.takeError());
+        continue;
+      }
+      auto contents = file.getSectionContents(shdr);
+      auto it = bySection.find(shdr.sh_link);
+      if (!contents || contents->size() <= 8 || it == bySection.end()) {
+        if (!contents) llvm::consumeError(contents.takeError());
+        continue;
+      }
+      Function& f = functions[it->second];
+      f.frameBytes = llvm::decodeULEB128(contents->data() + 8);
+      f.dynamicFrame = false;
+    }
+    return true;
+  }
+
+  /// @brief Prints the frame size and location of every function, largest
+  /// frame first.
+  void printStackUsage(llvm::raw_ostream& os, Format format,
+                       llvm::StringRef srcFile) {
+    llvm::sort(functions, [](const Function& a, const Function& b) {
+      if (a.dynamicFrame != b.dynamicFrame) return a.dynamicFrame;
+      if (a.frameBytes != b.frameBytes) return a.frameBytes > b.frameBytes;
+      return a.name < b.name;
+    });
+    if (format == JSON) {
+      llvm::json::OStream J(os, 2);
+      J.objectBegin();
+      J.attributeArray("stackUsage", [&]() {
+        for (const Function& f : functions) J.object([&]() {
+          J.attribute("function", f.name);
+          if (f.generated) J.attribute("file", nullptr);
+          else {
+            J.attribute("file", srcFile);
+            J.attribute("line", f.loc.row);
+            J.attribute("col", f.loc.col);
+          }
+          if (f.dynamicFrame) J.attribute("frameBytes", nullptr);
+          else J.attribute("frameBytes", f.frameBytes);
+        });
+      });
+      J.objectEnd();
+      os << "\n";
+      return;
+    }
+    os << "stack usage (bytes):\n";
+    for (const Function& f : functions) {
+      if (f.dynamicFrame) os << "  dynamic";
+      else os << llvm::format("%9llu", (unsigned long long)f.frameBytes);
+      os << "  " << f.name << "  ";
+      if (f.generated) os << GENERATED << "\n";
+      else os << srcFile << ":" << f.loc.row << ":" << f.loc.col << "\n";
+    }
+  }
+
+  /// @brief Prints the machine code size of every function and of every
+  /// module (the functions directly in it), largest first.
+  void printSizeReport(llvm::raw_ostream& os, Format format) {
+    llvm::sort(functions, [](const Function& a, const Function& b) {
+      if (a.codeBytes != b.codeBytes) return a.codeBytes > b.codeBytes;
+      return a.name < b.name;
+    });
+    std::vector<std::pair<std::string, uint64_t>> modules;
+    {
+      llvm::StringMap<uint64_t> moduleBytes;
+      for (const Function& f : functions) {
+        llvm::StringRef name = f.name;
+        if (f.generated) moduleBytes[GENERATED] += f.codeBytes;
+        else moduleBytes[name.substr(0, name.rfind("::"))] += f.codeBytes;
+      }
+      for (auto& entry : moduleBytes)
+        modules.push_back({ entry.first().str(), entry.second });
+      llvm::sort(modules, [](const auto& a, const auto& b) {
+        if (a.second != b.second) return a.second > b.second;
+        return a.first < b.first;
+      });
+    }
+    uint64_t total = 0;
+    for (const Function& f : functions) total += f.codeBytes;
+
+    if (format == JSON) {
+      llvm::json::OStream J(os, 2);
+      J.objectBegin();
+      J.attributeArray("functions", [&]() {
+        for (const Function& f : functions) J.object([&]() {
+          J.attribute("name", f.name);
+          J.attribute("bytes", f.codeBytes);
+        });
+      });
+      J.attributeArray("modules", [&]() {
+        for (const auto& m : modules) J.object([&]() {
+          J.attribute("name", m.first);
+          J.attribute("bytes", m.second);
+        });
+      });
+      J.attribute("totalBytes", total);
+      J.objectEnd();
+      os << "\n";
+      return;
+    }
+    os << "code size by function (bytes):\n";
+    for (const Function& f : functions)
+      os << llvm::format("%9llu", (unsigned long long)f.codeBytes) << "  "
+         << f.name << "\n";
+    os << "code size by module (bytes):\n";
+    for (const auto& m : modules)
+      os << llvm::format("%9llu", (unsigned long long)m.second) << "  "
+         << m.first << "\n";
+    os << llvm::format("%9llu", (unsigned long long)total) << "  total\n";
+  }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef DRIVER_REMARKPRINTER
+#define DRIVER_REMARKPRINTER
+
+#include <optional>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/Support/Regex.h>
+#include "common/LocatedError.hpp"
+
+/// @brief Prints the optimization remarks that LLVM passes emit, such as a
+/// loop that was not vectorized, with a snippet of the MiSCR source code that
+/// they are about. Remarks are located through the debug locations that
+/// Codegen attaches when it tracks source locations.
+///
+/// Like clang's `-Rpass`, `-Rpass-missed`, and `-Rpass-analysis`, each kind of
+/// remark is only printed for passes whose names match a regex.
+class RemarkPrinter : public llvm::DiagnosticHandler {
+  std::optional<llvm::Regex> passed;
+  std::optional<llvm::Regex> missed;
+  std::optional<llvm::Regex> analysis;
+  const char* srcText;
+  const LocationTable& locTab;
+  llvm::raw_ostream& out;
+
+public:
+  /// @brief An empty regex disables that kind of remark.
+  RemarkPrinter(llvm::StringRef passedRegex, llvm::StringRef missedRegex,
+                llvm::StringRef analysisRegex, const char* srcText,
+                const LocationTable& locTab, llvm::raw_ostream& out)
+    : srcText(srcText), locTab(locTab), out(out) {
+    if (!passedRegex.empty()) passed.emplace(passedRegex);
+    if (!missedRegex.empty()) missed.emplace(missedRegex);
+    if (!analysisRegex.empty()) analysis.emplace(analysisRegex);
+  }
+
+  /// @brief Checks that each regex is well formed. Sets @p err otherwise.
+  bool isValid(std::string& err) const {
+    for (const std::optional<llvm::Regex>* re : { &passed, &missed, &analysis })
+      if (*re && !(*re)->isValid(err)) return false;
+    return true;
+  }
+
+  bool isPassedOptRemarkEnabled(llvm::StringRef passName) const override
+    { return passed && passed->match(passName); }
+  bool isMissedOptRemarkEnabled(llvm::StringRef passName) const override
+    { return missed && missed->match(passName); }
+  bool isAnalysisRemarkEnabled(llvm::StringRef passName) const override
+    { return analysis && analysis->match(passName); }
+  bool isAnyRemarkEnabled() const override
+    { return passed || missed || analysis; }
+
+  bool handleDiagnostics(const llvm::DiagnosticInfo& DI) override {
+    auto remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&DI);
+    if (remark == nullptr) return false;  // LLVM prints everything else
+    const char* option;
+    if (remark->isPassed()) option = "-Rpass";
+    else if (remark->isMissed()) option = "-Rpass-missed";
+    else if (remark->isAnalysis()) option = "-Rpass-analysis";
+    else return true;
+    // The remark streamer sees all remarks (for the YAML record); only the
+    // enabled ones are printed.
+    if (!remark->isEnabled()) return true;
+
+    LocatedError msg('\0', true);
+    msg << "\x1B[1;32mremark\x1B[37m:\x1B[0m " << remark->getMsg() << " ["
+        << option << "=" << remark->getPassName() << "]\n";
+    if (remark->isLocationAvailable()) {
+      llvm::DiagnosticLocation loc = remark->getLocation();
+      if (loc.getLine() > 0 && loc.getColumn() > 0)
+        msg << selectWord(loc.getLine(), loc.getColumn());
+    }
+    out << msg.render(srcText, locTab);
+    return true;
+  }
+
+private:
+  /// @brief Debug locations have no length, so this selects the identifier
+  /// or keyword that starts at @p row and @p col (or one character).
+  Location selectWord(unsigned row, unsigned col) {
+    const char* p = locTab.findRow(row, srcText) + col - 1;
+    unsigned sz = 0;
+    while (isalnum(p[sz]) || p[sz] == '_') ++sz;
+    return Location(row, col, std::max(sz, 1u));
+  }
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef INDEX_INDEXER
+#define INDEX_INDEXER
+
+#include "common/AST.hpp"
+#include "common/Ontology.hpp"
+#include "index/SymbolIndex.hpp"
+
+/// @brief Adds the declarations of and references to global symbols in an
+/// analyzed AST to a SymbolIndex::Builder.
+///
+/// Symbols are the fully-qualified names from the Ontology. A struct field
+/// `f` of struct `S` is named `S.f` (e.g. `global::M::Point.x`), so field
+/// accesses, whose struct the Unifier resolved, can be found like any other
+/// reference. Local variables and builtins are not indexed.
+class Indexer {
+  const Ontology& ont;
+  SymbolIndex::Builder& builder;
+
+public:
+  Indexer(const Ontology& ont, SymbolIndex::Builder& builder)
+    : ont(ont), builder(builder) {}
+  Indexer(const Indexer&) = delete;
+
+  /// @brief Indexes all declarations in @p decls into the current file of
+  /// the builder. Sema must have run on @p decls without errors.
+  void run(DeclList* decls) { visit(decls); }
+
+private:
+  void visit(AST* ast) {
+    if (auto decl = FunctionDecl::downcast(ast)) {
+      addDecl(decl->getName(), decl->isExtern() ? SymbolIndex::EXTERN_FUNC
+                                                : SymbolIndex::FUNC);
+    }
+    else if (auto decl = StructDecl::downcast(ast)) {
+      llvm::StringRef structName = decl->getName()->asStringRef();
+      addDecl(decl->getName(), SymbolIndex::STRUCT);
+      for (auto field : decl->getFields()->asArrayRef())
+        builder.add((structName + "." + field.first->asStringRef()).str(),
+                    field.first->getLocation(), SymbolIndex::FIELD);
+    }
+    else if (auto decl = ConstDecl::downcast(ast)) {
+      addDecl(decl->getName(), SymbolIndex::CONST);
+    }
+    else if (auto decl = ModuleDecl::downcast(ast)) {
+      addDecl(decl->getName(), SymbolIndex::MODULE);
+    }
+    else if (auto exp = CallExp::downcast(ast)) {
+      if (!exp->isBuiltin())
+        addRef(exp->getFunction(), SymbolIndex::CALL);
+      if (Name* comparator = exp->getComparator())
+        addRef(comparator, SymbolIndex::CALL);
+    }
+    else if (auto exp = ConstrExp::downcast(ast)) {
+      addRef(exp->getStruct(), SymbolIndex::CONSTR);
+    }
+    else if (auto texp = NameTypeExp::downcast(ast)) {
+      addRef(texp->getName(), SymbolIndex::TYPE);
+    }
+    else if (auto exp = ProjectExp::downcast(ast)) {
+      if (ont.getType(exp->getTypeName()) != nullptr) {
+        Name* field = exp->getFieldName();
+        builder.add((exp->getTypeName() + "." + field->asStringRef()).str(),
+                    field->getLocation(), SymbolIndex::PROJECT);
+      }
+    }
+    for (AST* child : ast->getASTChildren()) visit(child);
+  }
+
+  void addDecl(Name* name, SymbolIndex::Kind kind)
+    { builder.add(name->asStringRef(), name->getLocation(), kind); }
+
+  /// @brief Adds a reference to the global @p name unless it is unbound.
+  void addRef(Name* name, SymbolIndex::Kind kind) {
+    llvm::StringRef fqn = name->asStringRef();
+    if (ont.getFunction(fqn) || ont.getType(fqn))
+      builder.add(fqn, name->getLocation(), kind);
+  }
+};
+
+#endif
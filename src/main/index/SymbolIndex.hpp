@@ -0,0 +1,375 @@
+#ifndef INDEX_SYMBOLINDEX
+#define INDEX_SYMBOLINDEX
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include "common/Location.hpp"
+
+/// @brief A read-only, memory-mapped index of the declarations of and
+/// references to the fully-qualified symbols of many MiSCR source files
+/// (see Indexer and `miscrc --index`).
+///
+/// On disk, an index is a header followed by four sections, with all integers
+/// in little-endian byte order and no padding, so the file can be used in
+/// place once mapped:
+///   1. Files       -- source file paths (sorted), modification times, sizes
+///   2. Symbols     -- symbol names (sorted), each with a range of postings
+///   3. Postings    -- occurrences (file, row, column, kind) grouped by symbol
+///                     and sorted by file and position
+///   4. Strings     -- the characters of all paths and names
+///
+/// Looking up a symbol is a binary search in the symbol table, so queries do
+/// not depend on how many files are indexed. Indexes are built and updated
+/// with SymbolIndex::Builder.
+class SymbolIndex {
+public:
+
+  /// @brief Bumped whenever the format changes. Indexes of other versions
+  /// are rejected (and rebuilt by `miscrc --index`).
+  static constexpr uint32_t version = 1;
+
+  /// @brief What a symbol occurrence is.
+  enum Kind : uint8_t {
+    // declarations
+    FUNC, EXTERN_FUNC, STRUCT, FIELD, CONST, MODULE,
+    // references
+    CALL, CONSTR, TYPE, PROJECT,
+  };
+
+  static bool isDecl(Kind kind) { return kind < CALL; }
+
+  static const char* kindToString(Kind kind) {
+    switch (kind) {
+    case FUNC:        return "func";
+    case EXTERN_FUNC: return "extern func";
+    case STRUCT:      return "struct";
+    case FIELD:       return "field";
+    case CONST:       return "const";
+    case MODULE:      return "module";
+    case CALL:        return "call";
+    case CONSTR:      return "constructor";
+    case TYPE:        return "type";
+    case PROJECT:     return "field access";
+    }
+    llvm_unreachable("SymbolIndex::kindToString() unhandled switch case");
+    return nullptr;
+  }
+
+  /// @brief One declaration of or reference to a symbol.
+  struct Occurrence {
+    unsigned file;    // index into the file table
+    unsigned short row, col;
+    Kind kind;
+  };
+
+  class Builder;
+
+private:
+  using u16 = llvm::support::ulittle16_t;
+  using u32 = llvm::support::ulittle32_t;
+  using u64 = llvm::support::ulittle64_t;
+
+  struct Header {
+    char magic[8];
+    u32 version, numFiles, numSymbols, numPostings, stringsSize;
+  };
+  struct FileEntry { u32 pathOffset, pathSize; u64 mtime, size; };
+  struct SymbolEntry { u32 nameOffset, nameSize, firstPosting, numPostings; };
+  struct Posting { u32 file; u16 row, col; uint8_t kind; };
+
+  static constexpr char magic[8] = { 'M','i','S','C','R','I','d','x' };
+
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  const Header* header;
+  const FileEntry* files;
+  const SymbolEntry* symbols;
+  const Posting* postings;
+  const char* strings;
+
+  SymbolIndex() {}
+
+public:
+  SymbolIndex(const SymbolIndex&) = delete;
+
+  /// @brief Maps the index file at @p path. Returns null and sets @p err if
+  /// it cannot be read or is not an index of this version.
+  static std::unique_ptr<SymbolIndex> open(llvm::StringRef path,
+                                           std::string& err) {
+    auto bufOrErr = llvm::MemoryBuffer::getFile(path, false, false);
+    if (!bufOrErr) {
+      err = "Could not read " + path.str() + ": "
+        + bufOrErr.getError().message();
+      return nullptr;
+    }
+    std::unique_ptr<SymbolIndex> index(new SymbolIndex());
+    index->buffer = std::move(*bufOrErr);
+    if (!index->mapSections()) {
+      err = path.str() + " is not a MiSCR symbol index (of version "
+        + std::to_string(version) + ")";
+      return nullptr;
+    }
+    return index;
+  }
+
+  unsigned getNumFiles() const { return header->numFiles; }
+  unsigned getNumSymbols() const { return header->numSymbols; }
+
+  llvm::StringRef getFilePath(unsigned file) const
+    { return string(files[file].pathOffset, files[file].pathSize); }
+
+  /// @brief The modification time (in seconds since the epoch) and size of
+  /// @p file when it was indexed.
+  std::pair<uint64_t, uint64_t> getFileStamp(unsigned file) const
+    { return { files[file].mtime, files[file].size }; }
+
+  llvm::StringRef getSymbol(unsigned symbol) const
+    { return string(symbols[symbol].nameOffset, symbols[symbol].nameSize); }
+
+  /// @brief Returns the symbol named @p name, if it occurs anywhere.
+  std::optional<unsigned> find(llvm::StringRef name) const {
+    unsigned i = lowerBound(name);
+    if (i < getNumSymbols() && getSymbol(i) == name) return i;
+    return std::nullopt;
+  }
+
+  /// @brief Returns the (possibly empty) range of the symbols whose names
+  /// start with @p prefix.
+  std::pair<unsigned, unsigned> findPrefix(llvm::StringRef prefix) const {
+    unsigned begin = lowerBound(prefix), end = begin;
+    while (end < getNumSymbols() && getSymbol(end).startswith(prefix)) ++end;
+    return { begin, end };
+  }
+
+  /// @brief Returns the occurrences of @p symbol, sorted by file, row, and
+  /// column.
+  std::vector<Occurrence> getOccurrences(unsigned symbol) const {
+    std::vector<Occurrence> ret;
+    const SymbolEntry& entry = symbols[symbol];
+    ret.reserve(entry.numPostings);
+    for (unsigned i = 0; i < entry.numPostings; ++i) {
+      const Posting& p = postings[entry.firstPosting + i];
+      ret.push_back({ p.file, p.row, p.col, Kind(p.kind) });
+    }
+    return ret;
+  }
+
+private:
+  llvm::StringRef string(uint32_t offset, uint32_t size) const
+    { return llvm::StringRef(strings + offset, size); }
+
+  /// @brief The first symbol whose name is not less than @p name.
+  unsigned lowerBound(llvm::StringRef name) const {
+    unsigned lo = 0, hi = getNumSymbols();
+    while (lo < hi) {
+      unsigned mid = lo + (hi - lo) / 2;
+      if (getSymbol(mid) < name) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  /// @brief Points the section pointers into `buffer` after checking that
+  /// everything they refer to is inside it.
+  bool mapSections() {
+    const char* begin = buffer->getBufferStart();
+    uint64_t size = buffer->getBufferSize();
+    if (size < sizeof(Header)) return false;
+    header = reinterpret_cast<const Header*>(begin);
+    if (!std::equal(magic, magic + 8, header->magic)
+        || header->version != version) return false;
+    uint64_t offset = sizeof(Header);
+    files = reinterpret_cast<const FileEntry*>(begin + offset);
+    offset += uint64_t(header->numFiles) * sizeof(FileEntry);
+    symbols = reinterpret_cast<const SymbolEntry*>(begin + offset);
+    offset += uint64_t(header->numSymbols) * sizeof(SymbolEntry);
+    postings = reinterpret_cast<const Posting*>(begin + offset);
+    offset += uint64_t(header->numPostings) * sizeof(Posting);
+    strings = begin + offset;
+    if (offset + header->stringsSize != size) return false;
+    uint32_t stringsSize = header->stringsSize;
+    for (unsigned i = 0; i < header->numFiles; ++i)
+      if (uint64_t(files[i].pathOffset) + files[i].pathSize > stringsSize)
+        return false;
+    for (unsigned i = 0; i < header->numSymbols; ++i) {
+      const SymbolEntry& s = symbols[i];
+      if (uint64_t(s.nameOffset) + s.nameSize > stringsSize
+          || uint64_t(s.firstPosting) + s.numPostings > header->numPostings)
+        return false;
+    }
+    for (unsigned i = 0; i < header->numPostings; ++i)
+      if (postings[i].file >= header->numFiles || postings[i].kind > PROJECT)
+        return false;
+    return true;
+  }
+};
+
+/// @brief Collects symbol occurrences per source file and writes them as a
+/// SymbolIndex. An existing index can be loaded first so that only the files
+/// that changed need to be indexed again.
+class SymbolIndex::Builder {
+  /// @brief An occurrence of symbol number `symbol` (see `symbolNames`).
+  struct Entry { unsigned symbol; unsigned short row, col; Kind kind; };
+
+  struct FileRecord {
+    uint64_t mtime, size;
+    std::vector<Entry> entries;
+  };
+
+  std::map<std::string, FileRecord> files;
+  llvm::StringMap<unsigned> symbolIds;
+  std::vector<llvm::StringRef> symbolNames;
+  FileRecord* current = nullptr;
+
+public:
+  Builder() {}
+  Builder(const Builder&) = delete;
+
+  /// @brief Adds all the files of @p index.
+  void load(const SymbolIndex& index) {
+    std::vector<FileRecord*> records;
+    for (unsigned file = 0; file < index.getNumFiles(); ++file) {
+      FileRecord& record = files[index.getFilePath(file).str()];
+      std::tie(record.mtime, record.size) = index.getFileStamp(file);
+      record.entries.clear();
+      records.push_back(&record);
+    }
+    for (unsigned symbol = 0; symbol < index.getNumSymbols(); ++symbol) {
+      unsigned id = intern(index.getSymbol(symbol));
+      for (const Occurrence& occ : index.getOccurrences(symbol))
+        records[occ.file]->entries.push_back({ id, occ.row, occ.col,
+                                               occ.kind });
+    }
+  }
+
+  /// @brief True iff @p path is indexed with modification time @p mtime and
+  /// size @p size.
+  bool isUpToDate(llvm::StringRef path, uint64_t mtime, uint64_t size) const {
+    auto it = files.find(path.str());
+    return it != files.end() && it->second.mtime == mtime
+      && it->second.size == size;
+  }
+
+  /// @brief The paths of all files in the index.
+  std::vector<std::string> getFiles() const {
+    std::vector<std::string> ret;
+    for (auto& entry : files) ret.push_back(entry.first);
+    return ret;
+  }
+
+  /// @brief Forgets everything about @p path.
+  void removeFile(llvm::StringRef path) {
+    files.erase(path.str());
+    current = nullptr;
+  }
+
+  /// @brief Starts (re-)indexing @p path, forgetting its old occurrences.
+  /// add() then adds occurrences to it.
+  void beginFile(llvm::StringRef path, uint64_t mtime, uint64_t size) {
+    current = &files[path.str()];
+    current->mtime = mtime;
+    current->size = size;
+    current->entries.clear();
+  }
+
+  /// @brief Adds an occurrence of @p symbol at @p loc to the current file.
+  void add(llvm::StringRef symbol, Location loc, Kind kind) {
+    assert(current != nullptr && "beginFile() was not called");
+    current->entries.push_back({ intern(symbol), loc.row, loc.col, kind });
+  }
+
+  /// @brief Writes the index to @p path, replacing any file there only once
+  /// the new index is complete. Returns false and sets @p err on failure.
+  bool write(llvm::StringRef path, std::string& err) const {
+    std::string strings;
+    std::vector<FileEntry> fileTable;
+    for (auto& entry : files) {
+      fileTable.push_back({ u32(strings.size()), u32(entry.first.size()),
+                            u64(entry.second.mtime), u64(entry.second.size) });
+      strings += entry.first;
+    }
+
+    // invert the per-file records into per-symbol posting lists; files are
+    // visited in path order, so each list ends up sorted by file
+    std::vector<std::vector<Posting>> bySymbol(symbolNames.size());
+    unsigned fileIdx = 0;
+    for (auto& entry : files) {
+      std::vector<Entry> entries = entry.second.entries;
+      std::sort(entries.begin(), entries.end(), [](auto& a, auto& b)
+        { return std::tie(a.row, a.col, a.kind)
+               < std::tie(b.row, b.col, b.kind); });
+      for (const Entry& e : entries)
+        bySymbol[e.symbol].push_back({ u32(fileIdx), u16(e.row), u16(e.col),
+                                       uint8_t(e.kind) });
+      ++fileIdx;
+    }
+
+    std::vector<unsigned> order;
+    for (unsigned id = 0; id < symbolNames.size(); ++id)
+      if (!bySymbol[id].empty()) order.push_back(id);
+    std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b)
+      { return symbolNames[a] < symbolNames[b]; });
+    std::vector<SymbolEntry> symbolTable;
+    std::vector<Posting> postings;
+    for (unsigned id : order) {
+      symbolTable.push_back({ u32(strings.size()),
+        u32(symbolNames[id].size()), u32(postings.size()),
+        u32(bySymbol[id].size()) });
+      strings += symbolNames[id];
+      postings.insert(postings.end(), bySymbol[id].begin(),
+                      bySymbol[id].end());
+    }
+
+    Header header;
+    std::copy(magic, magic + 8, header.magic);
+    header.version = version;
+    header.numFiles = fileTable.size();
+    header.numSymbols = symbolTable.size();
+    header.numPostings = postings.size();
+    header.stringsSize = strings.size();
+
+    std::string tmpPath = (path + ".tmp").str();
+    {
+      std::error_code EC;
+      llvm::raw_fd_ostream os(tmpPath, EC);
+      if (EC) {
+        err = "Could not write " + tmpPath + ": " + EC.message();
+        return false;
+      }
+      writeRaw(os, &header, 1);
+      writeRaw(os, fileTable.data(), fileTable.size());
+      writeRaw(os, symbolTable.data(), symbolTable.size());
+      writeRaw(os, postings.data(), postings.size());
+      os << strings;
+      os.close();
+      if (os.has_error()) {
+        err = "Could not write " + tmpPath + ": " + os.error().message();
+        os.clear_error();
+        return false;
+      }
+    }
+    if (std::error_code EC = llvm::sys::fs::rename(tmpPath, path)) {
+      err = "Could not replace " + path.str() + ": " + EC.message();
+      return false;
+    }
+    return true;
+  }
+
+private:
+  unsigned intern(llvm::StringRef symbol) {
+    auto inserted = symbolIds.try_emplace(symbol, symbolNames.size());
+    if (inserted.second) symbolNames.push_back(inserted.first->first());
+    return inserted.first->second;
+  }
+
+  template <typename T>
+  static void writeRaw(llvm::raw_ostream& os, const T* data, size_t n)
+    { os.write(reinterpret_cast<const char*>(data), n * sizeof(T)); }
+};
+
+#endif
@@ -74,11 +74,13 @@ private:
     
     case ST::ANGLE_L:
       if (c == '=') tok.stepAndCapture(Token::OP_LE);
+      else if (c == '<') tok.stepAndCapture(Token::OP_SHL);
       else tok.capture(Token::OP_LT);
       break;
 
     case ST::ANGLE_R:
       if (c == '=') tok.stepAndCapture(Token::OP_GE);
+      else if (c == '>') tok.stepAndCapture(Token::OP_SHR);
       else tok.capture(Token::OP_GT);
       break;
 
@@ -101,6 +103,7 @@ private:
       else if (c == '+') tok.stepAndCapture(Token::OP_ADD);
       else if (c == '*') tok.stepAndCapture(Token::OP_MUL);
       else if (c == '%') tok.stepAndCapture(Token::OP_MOD);
+      else if (c == '^') tok.stepAndCapture(Token::OP_BITXOR);
       else if (c == '~') tok.stepAndCapture(Token::TILDE);
       else if (c == '(') tok.stepAndCapture(Token::LPAREN);
       else if (c == ')') tok.stepAndCapture(Token::RPAREN);
@@ -218,7 +221,7 @@ private:
 
     case ST::PIPE:
       if (c == '|') tok.stepAndCapture(Token::OP_OR);
-      else tok.capture(Token::ERROR);
+      else tok.capture(Token::OP_BITOR);
       break;
 
     case ST::STRING:
@@ -251,6 +254,7 @@ private:
     case ST::IDENT: tok.capture(identOrKeywordTy(tok.selection())); break;
     case ST::LINE_COMMENT_L: tok.capture(Token::DOC_COMMENT_L); break;
     case ST::LINE_COMMENT_R: tok.capture(Token::DOC_COMMENT_R); break;
+    case ST::PIPE: tok.capture(Token::OP_BITOR); break;
 
     case ST::FSLASH_FSLASH:
     case ST::LINE_COMMENT: /* discard non-doc comments */ break;
@@ -262,7 +266,6 @@ private:
     case ST::MULTILINE_COMMENT_STAR:
     case ST::MULTILINE_DOC_COMMENT:
     case ST::MULTILINE_DOC_COMMENT_STAR:
-    case ST::PIPE:
     case ST::STRING:
     case ST::STRING_BSLASH:
       tok.capture(Token::ERROR);
@@ -304,8 +307,13 @@ private:
       if (s == "unit") return Token::KW_UNIT;
       return Token::IDENT;
     case 5:
+      if (s == "async") return Token::KW_ASYNC;
+      if (s == "await") return Token::KW_AWAIT;
+      if (s == "const") return Token::KW_CONST;
       if (s == "false") return Token::KW_FALSE;
+      if (s == "isize") return Token::KW_ISIZE;
       if (s == "match") return Token::KW_MATCH;
+      if (s == "usize") return Token::KW_USIZE;
       if (s == "while") return Token::KW_WHILE;
       return Token::IDENT;
     case 6:
@@ -2,21 +2,17 @@
 //
 // The main entry point for the MiSCR compiler.
 //============================================================================//
-#include <unistd.h>
-#include <wait.h>
-#include <llvm/IR/Verifier.h>
+#include <thread>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Support/CommandLine.h>
-#include <llvm/Support/MemoryBuffer.h>
-#include "lexer/Lexer.hpp"
-#include "parser/Parser.hpp"
-#include "sema/Sema.hpp"
-#include "borrowchecker/BorrowChecker.hpp"
-#include "codegen/Codegen.hpp"
+#include "daemon/Daemon.hpp"
+#include "driver/CompileJob.hpp"
+#include "driver/IndexJob.hpp"
 
 llvm::cl::OptionCategory miscrOptions("MiSCR Options");
 
-llvm::cl::opt<std::string> inFileOpt(llvm::cl::Positional,
-  llvm::cl::desc("FILE.miscr"), llvm::cl::Required,
+llvm::cl::list<std::string> inFilesOpt(llvm::cl::Positional,
+  llvm::cl::desc("FILE.miscr..."),
   llvm::cl::cat(miscrOptions));
 
 llvm::cl::opt<bool> skipBorrowCheckingOpt("b",
@@ -27,11 +23,110 @@ llvm::cl::opt<bool> emitLLVMOpt("emit-llvm",
   llvm::cl::desc("Emit output as LLVM IR"),
   llvm::cl::cat(miscrOptions));
 
+llvm::cl::opt<bool> libcAllocatorOpt("libc-alloc",
+  llvm::cl::desc("Use libc's malloc, realloc, and free for the allocation "
+                 "builtins"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<bool> mirOpt("mir",
+  llvm::cl::desc("Optimize function bodies in MiSCR's mid-level IR before "
+                 "generating LLVM IR"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<bool> streamOpt("stream",
+  llvm::cl::desc("Compile one function at a time, emitting object files as "
+                 "they fill up, to bound memory use"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::list<std::string> linkBitcodeOpt("link-bitcode",
+  llvm::cl::desc("Link the definitions of extern functions from LLVM bitcode "
+                 "FILE so that they can be inlined"),
+  llvm::cl::value_desc("FILE.bc"),
+  llvm::cl::cat(miscrOptions));
+
 llvm::cl::opt<std::string> outFileOpt("o",
   llvm::cl::desc("Write output to FILE"),
   llvm::cl::value_desc("FILE"),
   llvm::cl::cat(miscrOptions));
 
+llvm::cl::opt<std::string> stackUsageOpt("stack-usage",
+  llvm::cl::desc("Report the stack frame size of each function"),
+  llvm::cl::value_desc("text|json"),
+  llvm::cl::ValueOptional,
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> sizeReportOpt("size-report",
+  llvm::cl::desc("Report the machine code size of each function and module"),
+  llvm::cl::value_desc("text|json"),
+  llvm::cl::ValueOptional,
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<unsigned> optLevelOpt("O",
+  llvm::cl::desc("Optimization level (0 to 3)"),
+  llvm::cl::Prefix,
+  llvm::cl::init(0),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> remarksPassedOpt("Rpass",
+  llvm::cl::desc("Report optimizations by passes matching REGEX"),
+  llvm::cl::value_desc("REGEX"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> remarksMissedOpt("Rpass-missed",
+  llvm::cl::desc("Report missed optimizations by passes matching REGEX"),
+  llvm::cl::value_desc("REGEX"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> remarksAnalysisOpt("Rpass-analysis",
+  llvm::cl::desc("Report optimization analyses by passes matching REGEX"),
+  llvm::cl::value_desc("REGEX"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<bool> saveOptRecordOpt("fsave-optimization-record",
+  llvm::cl::desc("Write optimization remarks to FILE.opt.yaml"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<bool> daemonOpt("daemon",
+  llvm::cl::desc("Stay resident and serve compile requests from "
+                 "miscrc-client over a Unix socket"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> socketOpt("socket",
+  llvm::cl::desc("Socket path for --daemon (default: $MISCRC_SOCKET or "
+                 "/tmp/miscrc-UID.sock)"),
+  llvm::cl::value_desc("PATH"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<unsigned> workersOpt("j",
+  llvm::cl::desc("Number of worker threads for --daemon"),
+  llvm::cl::value_desc("N"),
+  llvm::cl::init(std::thread::hardware_concurrency()),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> indexOpt("index",
+  llvm::cl::desc("Add the input files to the symbol index INDEX instead of "
+                 "compiling them"),
+  llvm::cl::value_desc("INDEX"),
+  llvm::cl::cat(miscrOptions));
+
+llvm::cl::opt<std::string> queryOpt("query",
+  llvm::cl::desc("With --index, print the declarations of and references to "
+                 "SYMBOL (or to all symbols starting with PREFIX)"),
+  llvm::cl::value_desc("SYMBOL|PREFIX*"),
+  llvm::cl::cat(miscrOptions));
+
+/// @brief Sets @p format from report option @p opt if it was given.
+bool reportFormat(llvm::cl::opt<std::string>& opt,
+                  MachineCodeReport::Format& format) {
+  if (opt.getNumOccurrences() == 0) return true;
+  if (opt.empty()) format = MachineCodeReport::TEXT;
+  else if (!MachineCodeReport::parseFormat(opt, format)) {
+    llvm::errs() << "miscrc: unknown report format " << opt << "\n";
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char** argv) {
 
   // parse command-line options
@@ -41,92 +136,52 @@ int main(int argc, char** argv) {
   });
   llvm::cl::ParseCommandLineOptions(argc, argv);
 
-  // read MiSCR source code from input file
-  auto maybeSrcCode = llvm::MemoryBuffer::getFile(inFileOpt.getValue(), true);
-  if (!maybeSrcCode) {
-    llvm::errs() << "Could not read file " << inFileOpt.getValue() << "\n";
-    return 1;
+  if (daemonOpt) {
+    std::string socketPath = socketOpt.empty()
+      ? DaemonProtocol::defaultSocketPath() : socketOpt.getValue();
+    return Daemon(socketPath, workersOpt, llvm::errs()).serve();
   }
-  llvm::StringRef srcCode = maybeSrcCode.get()->getBuffer();
-  
-  // lex
-  LocationTable locTab(srcCode.data());
-  std::vector<Token> tokens = Lexer(srcCode, &locTab).run();
-
-  // parse
-  Parser parser(tokens);
-  DeclList* decls = parser.decls0();
-  if (decls == nullptr) {
-    llvm::errs() << parser.getError().render(srcCode.data(), locTab);
-    return 1;
+
+  if (!indexOpt.empty()) {
+    IndexJob job;
+    job.indexFile = indexOpt;
+    job.inFiles.assign(inFilesOpt.begin(), inFilesOpt.end());
+    job.query = queryOpt;
+    return job.run(llvm::outs(), llvm::errs());
   }
-  if (parser.hasMore()) {
-    llvm::errs() << (LocatedError()
-      << "Parser got stuck:\n" << parser.getCurrentToken().loc
-    ).render(srcCode.data(), locTab);
+  if (!queryOpt.empty()) {
+    llvm::errs() << "miscrc: --query requires --index\n";
     return 1;
   }
 
-  // analyze (semantically)
-  Sema sema;
-  sema.run(decls, "global");
-  if (sema.hasErrors()) {
-    for (LocatedError err : sema.getErrors())
-      llvm::errs() << err.render(srcCode.data(), locTab);
+  if (inFilesOpt.empty()) {
+    llvm::errs() << "miscrc: no input file\n";
     return 1;
   }
-
-  // borrow check
-  if (!skipBorrowCheckingOpt) {
-    BorrowChecker bc(sema.getTypeContext(), sema.getOntology());
-    bc.checkDecls(decls);
-    if (!bc.errors.empty()) {
-      for (LocatedError err : bc.errors)
-        llvm::errs() << err.render(srcCode.data(), locTab);
-      return 1;
-    }
+  if (inFilesOpt.size() > 1) {
+    llvm::errs() << "miscrc: only --index accepts multiple input files\n";
+    return 1;
   }
-
-  // LLVM IR code generation
-  llvm::LLVMContext llvmContext;
-  llvm::Module llvmModule("MyModule", llvmContext);
-  llvmModule.setTargetTriple("x86_64-pc-linux-gnu");
-  llvmModule.setModuleIdentifier(inFileOpt);
-  llvmModule.setSourceFileName(inFileOpt);
-  Codegen codegen(sema.getOntology(), llvmModule);
-  codegen.genDeclList(decls);
-  if (llvm::verifyModule(llvmModule, &llvm::errs())) return 1;
-
-  // output LLVM IR to a file
-  llvm::StringRef outFileStem = inFileOpt.getValue();
-  size_t lastSlash = outFileStem.find_last_of('/');
-  if (lastSlash != llvm::StringRef::npos)
-    outFileStem = outFileStem.substr(lastSlash + 1);
-  outFileStem.consume_back(".miscr");
-  std::string llFile = emitLLVMOpt && !outFileOpt.empty() ?
-    outFileOpt.getValue() : (outFileStem + ".ll").str();
-  std::error_code EC;
-  llvm::raw_fd_ostream outDotLL(llFile, EC);
-  outDotLL << llvmModule;
-  outDotLL.flush();
-  decls->deleteRecursive();
-
-  // invoke clang to compile the LLVM IR to a native binary
-  if (!emitLLVMOpt) {
-    pid_t childPID = fork();
-    if (childPID == 0) {
-      std::string outFile = outFileOpt.empty()
-        ? outFileStem.str() : outFileOpt.getValue();
-      execlp("clang", "clang", "-o", outFile.c_str(), llFile.c_str(), nullptr);
-      llvm::errs() << "Could not find clang. LLVM was output to "
-                   << llFile.c_str() << "\n";
-      return -1;
-    } else {
-      int status;
-      wait(&status);
-      if (status == 0) execlp("rm", "rm", llFile.c_str(), nullptr);
-    }
+  if (streamOpt && emitLLVMOpt) {
+    llvm::errs() << "miscrc: cannot use --stream with --emit-llvm\n";
+    return 1;
   }
-
-  return 0;
-}
\ No newline at end of file
+  CompileJob job;
+  job.inFile = inFilesOpt.front();
+  job.outFile = outFileOpt;
+  job.emitLLVM = emitLLVMOpt;
+  job.skipBorrowChecking = skipBorrowCheckingOpt;
+  job.libcAllocator = libcAllocatorOpt;
+  job.mir = mirOpt;
+  job.stream = streamOpt;
+  job.bitcodeFiles.assign(linkBitcodeOpt.begin(), linkBitcodeOpt.end());
+  job.printStats = llvm::AreStatisticsEnabled();  // LLVM's own -stats option
+  job.optLevel = std::min(optLevelOpt.getValue(), 3u);
+  job.remarksPassed = remarksPassedOpt;
+  job.remarksMissed = remarksMissedOpt;
+  job.remarksAnalysis = remarksAnalysisOpt;
+  job.saveOptRecord = saveOptRecordOpt;
+  if (!reportFormat(stackUsageOpt, job.stackUsage)
+      || !reportFormat(sizeReportOpt, job.sizeReport)) return 1;
+  return job.run(llvm::errs());
+}
@@ -0,0 +1,500 @@
+#ifndef MIR_MIR
+#define MIR_MIR
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/raw_ostream.h>
+#include "common/AST.hpp"
+#include "common/Type.hpp"
+
+/// @brief MiSCR's mid-level IR (MIR): a typed control-flow graph in SSA form
+/// that sits between the AST and LLVM IR.
+///
+/// Unlike LLVM IR, MIR keeps the MiSCR type of every value and the `move`
+/// and `borrow` operations of the source, so the passes in MIROptimizer can
+/// use facts that are lost in LLVM IR, e.g. which memory can only be reached
+/// through the values of one function.
+namespace mir {
+
+class Block;
+class Function;
+
+/// @brief An instruction, which is also the value it computes.
+class Inst {
+public:
+  enum Op : unsigned char {
+    PARAM,       // parameter number `index`
+    CONST,       // the value of literal or constant name `exp`
+    CONST_ADDR,  // the address of the global of constant name `exp`
+    UNDEF,       // an unspecified value (e.g., a variable read before set)
+    BINOP,       // `binop` of operands 0 and 1
+    UNOP,        // `unop` of operand 0
+    CONSTRUCT,   // a struct whose fields are the operands
+    EXTRACT,     // field `index` of struct operand 0
+    INSERT,      // struct operand 0 with field `index` set to operand 1
+    SLOT,        // the address of a stack slot
+    FIELD_ADDR,  // the address of field `index` of the struct at operand 0
+    INDEX_ADDR,  // address operand 0 offset by operand 1 elements
+    LOAD,        // the value at address operand 0
+    STORE,       // stores operand 1 at address operand 0
+    MOVE,        // operand 0, moved out of its binding
+    BORROW,      // operand 0, borrowed
+    CALL,        // a call of `callee` with the operands as arguments
+    BUILTIN,     // the builtin call `exp` with the operands as arguments
+    PHI,         // operand i if control came from predecessor i
+    BR,          // jumps to `targets[0]`
+    COND_BR,     // jumps to `targets[0]` if operand 0, else to `targets[1]`
+    RET,         // returns operand 0, if any
+  };
+
+  /// @brief A branch hint of a COND_BR, from `likely` or `unlikely`.
+  enum Hint : unsigned char { NO_HINT, LIKELY, UNLIKELY };
+
+  const Op op;
+
+  /// @brief The type of the value. Addresses have reference types, and
+  /// instructions without a value (e.g., STORE) have a null type.
+  Type* const type;
+
+  const Location loc;
+
+  unsigned index = 0;
+  BinopExp::Binop binop = BinopExp::ADD;
+  UnopExp::Unop unop = UnopExp::NOT;
+  Exp* exp = nullptr;
+  Name* callee = nullptr;
+  /// @brief For a SLOT, the variable it holds, if any.
+  llvm::StringRef name;
+  Block* targets[2] = { nullptr, nullptr };
+  Hint hint = NO_HINT;
+
+  Inst(Op op, Type* type, Location loc) : op(op), type(type), loc(loc) {}
+  Inst(const Inst&) = delete;
+  Inst& operator=(const Inst&) = delete;
+
+  /// @brief The block this is in, or null once it has been erased.
+  Block* getParent() const { return parent; }
+
+  llvm::ArrayRef<Inst*> getOperands() const { return ops; }
+  Inst* getOperand(unsigned i) const { return ops[i]; }
+  unsigned getNumOperands() const { return ops.size(); }
+
+  void addOperand(Inst* v) {
+    ops.push_back(v);
+    v->users.push_back(this);
+  }
+
+  void setOperand(unsigned i, Inst* v) {
+    ops[i]->removeUser(this);
+    ops[i] = v;
+    v->users.push_back(this);
+  }
+
+  /// @brief The instructions that use this one, once per use.
+  llvm::ArrayRef<Inst*> getUsers() const { return users; }
+  bool hasUsers() const { return !users.empty(); }
+
+  /// @brief Makes every user of this instruction use @p v instead.
+  void replaceAllUsesWith(Inst* v) {
+    assert(v != this && "replacing a value with itself");
+    while (!users.empty()) {
+      Inst* user = users.back();
+      for (unsigned i = 0; i < user->ops.size(); ++i)
+        if (user->ops[i] == this) user->setOperand(i, v);
+    }
+  }
+
+  bool isTerminator() const { return op >= BR; }
+
+  /// @brief True if this computes a value other than unit.
+  bool hasValue() const { return type != nullptr && !isUnit(type); }
+
+  /// @brief True if erasing this (when it has no users) could change what
+  /// the program does.
+  bool hasSideEffects() const {
+    switch (op) {
+    case STORE:
+    case CALL:
+    case BR:
+    case COND_BR:
+    case RET:
+      return true;
+    case BUILTIN:
+      return !isPureBuiltin(CallExp::downcast(exp)->getBuiltin());
+    default:
+      return false;
+    }
+  }
+
+  /// @brief True if a call to @p builtin neither writes memory nor has any
+  /// other effect.
+  static bool isPureBuiltin(CallExp::Builtin builtin) {
+    switch (builtin) {
+    case CallExp::ALLOC:
+    case CallExp::BLOCK_ON:
+    case CallExp::FREE:
+    case CallExp::PREFETCH:
+    case CallExp::RADIX_SORT:
+    case CallExp::REALLOC:
+    case CallExp::SOA_ALLOC:
+    case CallExp::SOA_FREE:
+    case CallExp::SORT:
+    case CallExp::SORT_BY:
+    case CallExp::NOT_BUILTIN:
+      return false;
+    default:
+      return true;
+    }
+  }
+
+  static bool isUnit(Type* ty) {
+    auto primTy = PrimitiveType::downcast(ty);
+    return primTy != nullptr && primTy->kind == PrimitiveType::UNIT;
+  }
+
+private:
+  friend class Function;
+  Block* parent = nullptr;
+  llvm::SmallVector<Inst*, 2> ops;
+  llvm::SmallVector<Inst*, 2> users;
+
+  void removeUser(Inst* user)
+    { users.erase(std::find(users.begin(), users.end(), user)); }
+};
+
+/// @brief A basic block: PHIs first and a terminator last.
+class Block {
+  friend class Function;
+  std::vector<Inst*> insts;
+  std::vector<Block*> preds;
+public:
+  const unsigned id;
+  /// @brief Names the LLVM basic block (e.g., `whileCond`).
+  const llvm::StringRef name;
+  Block(unsigned id, llvm::StringRef name) : id(id), name(name) {}
+
+  llvm::ArrayRef<Inst*> getInsts() const { return insts; }
+
+  /// @brief The predecessors, in the order of the operands of the PHIs.
+  llvm::ArrayRef<Block*> getPredecessors() const { return preds; }
+
+  Inst* getTerminator() const {
+    if (insts.empty() || !insts.back()->isTerminator()) return nullptr;
+    return insts.back();
+  }
+
+  llvm::SmallVector<Block*, 2> getSuccessors() const {
+    llvm::SmallVector<Block*, 2> succs;
+    if (Inst* term = getTerminator())
+      for (Block* target : term->targets)
+        if (target != nullptr) succs.push_back(target);
+    return succs;
+  }
+};
+
+/// @brief The MIR of one function. Owns its blocks and instructions.
+class Function {
+  std::vector<std::unique_ptr<Block>> blocks;
+  std::vector<std::unique_ptr<Inst>> arena;  // includes erased instructions
+public:
+  FunctionDecl* const decl;
+
+  explicit Function(FunctionDecl* decl) : decl(decl) {}
+  Function(const Function&) = delete;
+  Function& operator=(const Function&) = delete;
+
+  /// @brief The blocks in order of creation, the entry block first.
+  std::vector<Block*> getBlocks() const {
+    std::vector<Block*> result;
+    for (auto& b : blocks) result.push_back(b.get());
+    return result;
+  }
+
+  Block* getEntry() const { return blocks.front().get(); }
+
+  Block* addBlock(llvm::StringRef name = "") {
+    blocks.push_back(std::make_unique<Block>(blocks.size(), name));
+    return blocks.back().get();
+  }
+
+  /// @brief Records the edge from @p from to @p to. The PHIs of @p to must
+  /// get an operand for it.
+  void addEdge(Block* from, Block* to) { to->preds.push_back(from); }
+
+  /// @brief Creates an instruction that is not in any block yet.
+  Inst* create(Inst::Op op, Type* type, Location loc,
+               llvm::ArrayRef<Inst*> ops = {}) {
+    arena.push_back(std::make_unique<Inst>(op, type, loc));
+    Inst* inst = arena.back().get();
+    for (Inst* v : ops) inst->addOperand(v);
+    return inst;
+  }
+
+  void append(Block* b, Inst* inst) {
+    inst->parent = b;
+    b->insts.push_back(inst);
+  }
+
+  /// @brief Inserts @p inst right before @p pos.
+  void insertBefore(Inst* pos, Inst* inst) {
+    Block* b = pos->parent;
+    inst->parent = b;
+    b->insts.insert(std::find(b->insts.begin(), b->insts.end(), pos), inst);
+  }
+
+  /// @brief Inserts @p inst at the start of @p b (e.g., a PHI).
+  void prepend(Block* b, Inst* inst) {
+    inst->parent = b;
+    b->insts.insert(b->insts.begin(), inst);
+  }
+
+  /// @brief Removes @p inst, which must have no users, from its block.
+  void erase(Inst* inst) {
+    assert(!inst->hasUsers() && "erasing an instruction that is still used");
+    for (Inst* op : inst->ops) op->removeUser(inst);
+    inst->ops.clear();
+    std::vector<Inst*>& insts = inst->parent->insts;
+    insts.erase(std::find(insts.begin(), insts.end(), inst));
+    inst->parent = nullptr;
+  }
+
+  /// @brief Replaces all uses of @p inst by @p v and erases @p inst.
+  void replace(Inst* inst, Inst* v) {
+    inst->replaceAllUsesWith(v);
+    erase(inst);
+  }
+
+  /// @brief The blocks reachable from the entry in reverse postorder, so
+  /// each block comes after its dominators.
+  std::vector<Block*> reversePostOrder() const {
+    std::vector<Block*> order;
+    llvm::SmallPtrSet<Block*, 32> visited;
+    std::vector<std::pair<Block*, unsigned>> stack{ { getEntry(), 0 } };
+    visited.insert(getEntry());
+    while (!stack.empty()) {
+      auto& [b, next] = stack.back();
+      llvm::SmallVector<Block*, 2> succs = b->getSuccessors();
+      if (next < succs.size()) {
+        Block* succ = succs[next++];
+        if (visited.insert(succ).second) stack.push_back({ succ, 0 });
+        continue;
+      }
+      order.push_back(b);
+      stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+  }
+
+  /// @brief The number of instructions in the function.
+  unsigned size() const {
+    unsigned n = 0;
+    for (auto& b : blocks) n += b->insts.size();
+    return n;
+  }
+
+  void print(llvm::raw_ostream& os) const;
+};
+
+inline const char* opName(Inst::Op op) {
+  static const char* const names[] = { "param", "const", "const_addr",
+    "undef", "binop", "unop", "construct", "extract", "insert", "slot",
+    "field_addr", "index_addr", "load", "store", "move", "borrow", "call",
+    "builtin", "phi", "br", "cond_br", "ret" };
+  return names[op];
+}
+
+inline const char* binopName(BinopExp::Binop binop) {
+  static const char* const names[] = { "+", "&&", "&", "|", "^", "/", "==",
+    ">=", ">", "<=", "<", "%", "*", "/=", "||", "<<", ">>", "-" };
+  return names[binop];
+}
+
+/// @brief Prints the callee, constant, or literal @p exp of an instruction.
+inline void printExp(llvm::raw_ostream& os, Exp* exp) {
+  if (auto call = CallExp::downcast(exp))
+    os << " " << call->getFunction()->asStringRef();
+  else if (auto name = NameExp::downcast(exp))
+    os << " " << name->getName()->asStringRef();
+  else if (auto lit = IntLit::downcast(exp))
+    os << " " << lit->asLong();
+  else if (auto lit = DecimalLit::downcast(exp))
+    os << " " << lit->asDouble();
+  else if (auto lit = BoolLit::downcast(exp))
+    os << (lit->getValue() ? " true" : " false");
+  else if (auto lit = StringLit::downcast(exp))
+    os << " \"" << lit->getValue() << "\"";
+}
+
+/// @brief Prints the function in a format like `%2 = binop + %0, %1 : i32`.
+/// Values are numbered in order of appearance.
+inline void Function::print(llvm::raw_ostream& os) const {
+  llvm::DenseMap<const Inst*, unsigned> numbers;
+  unsigned next = 0;
+  for (auto& b : blocks)
+    for (Inst* inst : b->insts) numbers[inst] = next++;
+  os << "func " << decl->getName()->asStringRef() << "\n";
+  for (auto& b : blocks) {
+    os << "bb" << b->id << ":";
+    if (!b->preds.empty()) {
+      os << "  ; preds";
+      for (Block* pred : b->preds) os << " bb" << pred->id;
+    }
+    os << "\n";
+    for (Inst* inst : b->insts) {
+      os << "  ";
+      if (inst->hasValue()) os << "%" << numbers[inst] << " = ";
+      os << opName(inst->op);
+      if (inst->op == Inst::BINOP) os << " " << binopName(inst->binop);
+      if (inst->op == Inst::UNOP)
+        os << (inst->unop == UnopExp::NEG ? " -" : " ~");
+      if (inst->op == Inst::CALL) os << " " << inst->callee->asStringRef();
+      if (inst->exp != nullptr) printExp(os, inst->exp);
+      const char* sep = " ";
+      for (Inst* op : inst->getOperands()) {
+        os << sep << "%" << numbers[op];
+        sep = ", ";
+      }
+      if (inst->op == Inst::PARAM || inst->op == Inst::EXTRACT
+          || inst->op == Inst::INSERT || inst->op == Inst::FIELD_ADDR)
+        os << sep << inst->index;
+      for (Block* target : inst->targets)
+        if (target != nullptr) os << " bb" << target->id;
+      if (inst->hint != Inst::NO_HINT)
+        os << (inst->hint == Inst::LIKELY ? " likely" : " unlikely");
+      if (inst->hasValue()) os << " : " << inst->type->asString();
+      os << "\n";
+    }
+  }
+}
+
+/// @brief Constructs SSA form for variables defined in some blocks and used
+/// in others. This is the algorithm of Braun et al. that SSABuilder also
+/// implements, for MIR: MIRBuilder uses it for local variables while it
+/// builds the CFG, and MIROptimizer to promote stack slots.
+///
+/// A block must be sealed once all of its predecessors are known, and
+/// definitions must be written before they are read in the same block.
+class SSAConstructor {
+  Function& fn;
+  std::vector<Type*> varTypes;
+  llvm::DenseMap<std::pair<unsigned, Block*>, Inst*> currentDef;
+  llvm::DenseMap<Block*, llvm::SmallVector<std::pair<unsigned, Inst*>, 4>>
+    incompletePhis;
+  llvm::SmallPtrSet<Block*, 16> sealedBlocks;
+
+  /// @brief What each removed trivial PHI was replaced by. `currentDef` may
+  /// still refer to removed PHIs.
+  llvm::DenseMap<Inst*, Inst*> replacements;
+
+public:
+  explicit SSAConstructor(Function& fn) : fn(fn) {}
+
+  /// @brief Starts a new variable of type @p ty and returns its handle.
+  unsigned addVariable(Type* ty) {
+    varTypes.push_back(ty);
+    return varTypes.size() - 1;
+  }
+
+  /// @brief Records that @p var is @p v at the end of @p b (so far).
+  void writeVariable(unsigned var, Block* b, Inst* v)
+    { currentDef[{ var, b }] = v; }
+
+  /// @brief Returns the value of @p var that reaches the end of @p b.
+  Inst* readVariable(unsigned var, Block* b) {
+    auto it = currentDef.find({ var, b });
+    if (it != currentDef.end()) return resolve(it->second);
+    return readVariableRecursive(var, b);
+  }
+
+  bool isSealed(Block* b) const { return sealedBlocks.count(b); }
+
+  /// @brief Declares that all predecessors of @p b are known, and completes
+  /// the PHIs created for reads in @p b.
+  void sealBlock(Block* b) {
+    sealedBlocks.insert(b);
+    auto it = incompletePhis.find(b);
+    if (it == incompletePhis.end()) return;
+    auto pending = std::move(it->second);
+    incompletePhis.erase(it);
+    for (auto [var, phi] : pending) addPhiOperands(var, phi);
+  }
+
+  /// @brief Replaces all uses of @p inst by @p v and erases @p inst, which
+  /// may be a definition that was written.
+  void replace(Inst* inst, Inst* v) {
+    replacements[inst] = v;
+    fn.replace(inst, v);
+  }
+
+private:
+  Inst* resolve(Inst* v) {
+    for (auto it = replacements.find(v); it != replacements.end();
+         it = replacements.find(v))
+      v = it->second;
+    return v;
+  }
+
+  Inst* readVariableRecursive(unsigned var, Block* b) {
+    Inst* v;
+    if (!sealedBlocks.count(b)) {
+      Inst* phi = newPhi(var, b);
+      incompletePhis[b].push_back({ var, phi });
+      v = phi;
+    } else if (b->getPredecessors().size() == 1) {
+      v = readVariable(var, b->getPredecessors()[0]);
+    } else {
+      // the PHI is written first to break cycles through loops
+      Inst* phi = newPhi(var, b);
+      writeVariable(var, b, phi);
+      v = addPhiOperands(var, phi);
+    }
+    writeVariable(var, b, v);
+    return v;
+  }
+
+  Inst* newPhi(unsigned var, Block* b) {
+    Inst* phi = fn.create(Inst::PHI, varTypes[var], Location());
+    fn.prepend(b, phi);
+    return phi;
+  }
+
+  Inst* addPhiOperands(unsigned var, Inst* phi) {
+    for (Block* pred : phi->getParent()->getPredecessors())
+      phi->addOperand(readVariable(var, pred));
+    return tryRemoveTrivialPhi(phi);
+  }
+
+  /// @brief Replaces @p phi by its only operand (other than itself) if it
+  /// has one, and then retries the PHIs that used it.
+  Inst* tryRemoveTrivialPhi(Inst* phi) {
+    if (!sealedBlocks.count(phi->getParent())) return phi;
+    Inst* same = nullptr;
+    for (Inst* op : phi->getOperands()) {
+      if (op == same || op == phi) continue;
+      if (same != nullptr) return phi;
+      same = op;
+    }
+    // no operands: the block is unreachable
+    if (same == nullptr) {
+      same = fn.create(Inst::UNDEF, phi->type, Location());
+      fn.prepend(fn.getEntry(), same);
+    }
+
+    llvm::SmallVector<Inst*, 4> users;
+    for (Inst* user : phi->getUsers())
+      if (user != phi && user->op == Inst::PHI) users.push_back(user);
+    replace(phi, same);
+    for (Inst* user : users)
+      if (user->getParent() != nullptr) tryRemoveTrivialPhi(user);
+    return same;
+  }
+};
+
+} // end namespace mir
+
+#endif
@@ -0,0 +1,450 @@
+#ifndef MIR_MIRBUILDER
+#define MIR_MIRBUILDER
+
+#include <llvm/ADT/DenseSet.h>
+#include "common/Ontology.hpp"
+#include "common/ScopeStack.hpp"
+#include "common/TypeContext.hpp"
+#include "mir/MIR.hpp"
+
+/// @brief Lowers the body of a function from the typed AST (after Resolver)
+/// to MIR. Local variables become SSA values as the CFG is built, except for
+/// those whose address is taken, which get a SLOT. Assigning a field of a
+/// struct in an SSA variable builds a new struct value with INSERT.
+///
+/// Returns null for functions that MIR does not support yet: `async`
+/// functions, `block_on`, and `#[soa]` structs. Codegen generates those
+/// directly from the AST.
+class MIRBuilder {
+  const Ontology& ont;
+  TypeContext& tc;
+  std::unique_ptr<mir::Function> fn;
+  std::unique_ptr<mir::SSAConstructor> ssa;
+  mir::Block* cur = nullptr;
+
+  static constexpr unsigned NO_SSA_VAR = ~0u;
+  struct LocalVar {
+    mir::Inst* slot;
+    unsigned ssaVar;
+  };
+  ScopeStack<LocalVar> locals;
+
+  /// @brief The binders (LetExps and parameter Names) of variables whose
+  /// address is taken.
+  llvm::DenseSet<const AST*> slotVars;
+
+  bool unsupported = false;
+
+public:
+  MIRBuilder(const Ontology& ont, TypeContext& tc) : ont(ont), tc(tc) {}
+
+  /// @brief Builds the MIR of @p funDecl, which must have a body, or returns
+  /// null if it uses something MIR does not support.
+  std::unique_ptr<mir::Function> build(FunctionDecl* funDecl) {
+    if (funDecl->isAsync()) return nullptr;
+    fn = std::make_unique<mir::Function>(funDecl);
+    ssa = std::make_unique<mir::SSAConstructor>(*fn);
+    locals = ScopeStack<LocalVar>();
+    slotVars.clear();
+    unsupported = false;
+    findSlotVars(funDecl);
+
+    cur = fn->addBlock("entry");
+    ssa->sealBlock(cur);
+    unsigned paramNo = 0;
+    for (auto param : funDecl->getParameters()->asArrayRef()) {
+      Type* ty = tc.getTypeFromTypeExp(param.second);
+      checkSupported(ty);
+      mir::Inst* v = append(mir::Inst::PARAM, ty, param.first->getLocation());
+      v->index = paramNo++;
+      bindLocal(param.first, param.first->asStringRef(), v, ty);
+    }
+
+    mir::Inst* retVal = genExp(funDecl->getBody());
+    mir::Inst* ret = append(mir::Inst::RET, nullptr,
+                            funDecl->getBody()->getLocation());
+    if (!mir::Inst::isUnit(tc.getTypeFromTypeExp(funDecl->getReturnType())))
+      ret->addOperand(use(retVal));
+
+    ssa.reset();
+    if (unsupported) return nullptr;
+    return std::move(fn);
+  }
+
+private:
+
+  mir::Inst* append(mir::Inst::Op op, Type* ty, Location loc,
+                    llvm::ArrayRef<mir::Inst*> ops = {}) {
+    mir::Inst* inst = fn->create(op, ty, loc, ops);
+    fn->append(cur, inst);
+    return inst;
+  }
+
+  /// @brief Returns @p v as an operand. A unit value (null) cannot be one.
+  mir::Inst* use(mir::Inst* v) {
+    if (v != nullptr) return v;
+    unsupported = true;
+    mir::Inst* undef = fn->create(mir::Inst::UNDEF, tc.getUnit(), Location());
+    fn->append(cur, undef);
+    return undef;
+  }
+
+  /// @brief Notes that the function is unsupported if @p ty involves a
+  /// `#[soa]` struct, whose references are not addresses.
+  void checkSupported(Type* ty) {
+    if (auto refTy = RefType::downcast(ty)) ty = refTy->inner;
+    if (auto nameTy = NameType::downcast(ty))
+      if (StructDecl* st = ont.getType(nameTy->asString); st && st->isSoa())
+        unsupported = true;
+  }
+
+  void br(mir::Block* to) {
+    append(mir::Inst::BR, nullptr, Location())->targets[0] = to;
+    fn->addEdge(cur, to);
+  }
+
+  /// @brief Branches on @p cond. A call to `likely` or `unlikely` becomes a
+  /// hint on the branch.
+  void condBr(Exp* cond, mir::Block* ifTrue, mir::Block* ifFalse) {
+    mir::Inst::Hint hint = mir::Inst::NO_HINT;
+    if (auto call = CallExp::downcast(cond)) {
+      if (call->getBuiltin() == CallExp::LIKELY) hint = mir::Inst::LIKELY;
+      if (call->getBuiltin() == CallExp::UNLIKELY) hint = mir::Inst::UNLIKELY;
+      if (hint != mir::Inst::NO_HINT)
+        cond = call->getArguments()->asArrayRef()[0];
+    }
+    mir::Inst* condV = use(genExp(cond));
+    mir::Inst* inst = append(mir::Inst::COND_BR, nullptr, cond->getLocation(),
+                             { condV });
+    inst->targets[0] = ifTrue;
+    inst->targets[1] = ifFalse;
+    inst->hint = hint;
+    fn->addEdge(cur, ifTrue);
+    fn->addEdge(cur, ifFalse);
+  }
+
+  /// @brief Binds local variable @p name (bound by @p binder) of type @p ty
+  /// to initial value @p v, in a SLOT if `slotVars` says it needs one.
+  void bindLocal(const AST* binder, llvm::StringRef name, mir::Inst* v,
+                 Type* ty) {
+    if (v == nullptr) {  // unit-typed; there is nothing to store
+      locals.add(name, LocalVar{ nullptr, NO_SSA_VAR });
+      return;
+    }
+    if (slotVars.count(binder)) {
+      mir::Inst* slot = append(mir::Inst::SLOT, tc.getRefType(ty),
+                               binder->getLocation());
+      slot->name = name;
+      append(mir::Inst::STORE, nullptr, binder->getLocation(), { slot, v });
+      locals.add(name, LocalVar{ slot, NO_SSA_VAR });
+      return;
+    }
+    unsigned var = ssa->addVariable(ty);
+    ssa->writeVariable(var, cur, v);
+    locals.add(name, LocalVar{ nullptr, var });
+  }
+
+  LocalVar lookup(NameExp* e) {
+    return locals.getOrElse(e->getName()->asStringRef(),
+                            LocalVar{ nullptr, NO_SSA_VAR });
+  }
+
+  /// @brief Fills `slotVars` with the variables of @p funDecl whose address
+  /// is taken.
+  void findSlotVars(FunctionDecl* funDecl) {
+    ScopeStack<const AST*> binders;
+    for (auto param : funDecl->getParameters()->asArrayRef())
+      binders.add(param.first->asStringRef(), param.first);
+    findSlotVars(funDecl->getBody(), binders);
+  }
+
+  void findSlotVars(AST* ast, ScopeStack<const AST*>& binders) {
+    if (auto e = AddrOfExp::downcast(ast)) {
+      Exp* of = e->getOf();
+      while (true) {
+        if (auto ascrip = AscripExp::downcast(of)) of = ascrip->getAscriptee();
+        else if (auto proj = ProjectExp::downcast(of);
+                 proj && proj->getKind() == ProjectExp::DOT)
+          of = proj->getBase();
+        else break;
+      }
+      if (auto name = NameExp::downcast(of)) {
+        const AST* binder =
+          binders.getOrElse(name->getName()->asStringRef(), nullptr);
+        if (binder) slotVars.insert(binder);
+      }
+    } else if (auto e = BlockExp::downcast(ast)) {
+      binders.push();
+      for (Exp* stmt : e->getStatements()) findSlotVars(stmt, binders);
+      binders.pop();
+      return;
+    } else if (auto e = LetExp::downcast(ast)) {
+      findSlotVars(e->getDefinition(), binders);
+      binders.add(e->getBoundIdent()->asStringRef(), e);
+      return;
+    }
+    for (AST* child : ast->getASTChildren()) findSlotVars(child, binders);
+  }
+
+  /// @brief Returns the index of field @p field of struct @p typeName.
+  unsigned fieldIndex(llvm::StringRef typeName, Name* field) {
+    unsigned i = 0;
+    for (auto f : ont.getType(typeName)->getFields()->asArrayRef()) {
+      if (f.first->asStringRef() == field->asStringRef()) return i;
+      ++i;
+    }
+    llvm_unreachable("MIRBuilder::fieldIndex() no such field");
+  }
+
+  mir::Inst* fieldAddr(mir::Inst* base, ProjectExp* e, Type* fieldTy) {
+    mir::Inst* addr = append(mir::Inst::FIELD_ADDR, tc.getRefType(fieldTy),
+                             e->getLocation(), { base });
+    addr->index = fieldIndex(e->getTypeName(), e->getFieldName());
+    return addr;
+  }
+
+  /// @brief Builds the _address_ of @p lvalue.
+  mir::Inst* genAddress(Exp* lvalue) {
+    while (auto ascrip = AscripExp::downcast(lvalue))
+      lvalue = ascrip->getAscriptee();
+    if (auto e = DerefExp::downcast(lvalue))
+      return use(genExp(e->getOf()));
+    if (auto e = NameExp::downcast(lvalue)) {
+      if (ont.getConst(e->getName()->asStringRef())) {
+        mir::Inst* addr = append(mir::Inst::CONST_ADDR,
+          tc.getRefType(e->getType()), e->getLocation());
+        addr->exp = e;
+        return addr;
+      }
+      if (mir::Inst* slot = lookup(e).slot) return slot;
+    }
+    if (auto e = ProjectExp::downcast(lvalue)) {
+      if (e->getKind() == ProjectExp::ARROW)
+        return fieldAddr(use(genExp(e->getBase())), e, e->getType());
+      if (e->getKind() == ProjectExp::DOT)
+        return fieldAddr(genAddress(e->getBase()), e, e->getType());
+    }
+    unsupported = true;
+    return use(nullptr);
+  }
+
+  /// @brief Builds `x.f1.f2... = rhs` for a variable `x` in SSA form by
+  /// inserting the new value into each enclosing struct value. Returns false
+  /// if @p lhs is not such a projection.
+  bool genFieldAssign(Exp* lhs, Exp* rhs) {
+    llvm::SmallVector<ProjectExp*, 4> path;  // innermost field first
+    Exp* root = lhs;
+    while (true) {
+      if (auto ascrip = AscripExp::downcast(root))
+        root = ascrip->getAscriptee();
+      else if (auto proj = ProjectExp::downcast(root);
+               proj && proj->getKind() == ProjectExp::DOT) {
+        path.push_back(proj);
+        root = proj->getBase();
+      }
+      else break;
+    }
+    auto name = NameExp::downcast(root);
+    if (path.empty() || name == nullptr) return false;
+    LocalVar var = lookup(name);
+    if (var.ssaVar == NO_SSA_VAR) return false;
+
+    mir::Inst* v = use(genExp(rhs));
+    // the struct values that enclose the assigned field, outermost first
+    llvm::SmallVector<mir::Inst*, 4> aggs{ ssa->readVariable(var.ssaVar, cur) };
+    for (unsigned i = path.size() - 1; i > 0; --i) {
+      mir::Inst* field = append(mir::Inst::EXTRACT, path[i]->getType(),
+                                path[i]->getLocation(), { aggs.back() });
+      field->index = fieldIndex(path[i]->getTypeName(),
+                                path[i]->getFieldName());
+      aggs.push_back(field);
+    }
+    for (unsigned i = 0; i < path.size(); ++i) {
+      mir::Inst* agg = aggs[path.size() - 1 - i];
+      v = append(mir::Inst::INSERT, agg->type, path[i]->getLocation(),
+                 { agg, v });
+      v->index = fieldIndex(path[i]->getTypeName(), path[i]->getFieldName());
+    }
+    ssa->writeVariable(var.ssaVar, cur, v);
+    return true;
+  }
+
+  /// @brief Builds the computation @p exp and returns its value, which is
+  /// null if it is unit.
+  mir::Inst* genExp(Exp* exp) {
+    checkSupported(exp->getType());
+    Location loc = exp->getLocation();
+    Type* ty = exp->getType();
+    if (auto e = BinopExp::downcast(exp)) {
+      mir::Inst* lhs = use(genExp(e->getLHS()));
+      mir::Inst* rhs = use(genExp(e->getRHS()));
+      mir::Inst* v = append(mir::Inst::BINOP, ty, loc, { lhs, rhs });
+      v->binop = e->getBinop();
+      return v;
+    }
+    else if (auto e = AddrOfExp::downcast(exp)) {
+      return genAddress(e->getOf());
+    }
+    else if (auto e = AscripExp::downcast(exp)) {
+      return genExp(e->getAscriptee());
+    }
+    else if (auto e = AssignExp::downcast(exp)) {
+      Exp* lhs = e->getLHS();
+      while (auto ascrip = AscripExp::downcast(lhs))
+        lhs = ascrip->getAscriptee();
+      if (auto name = NameExp::downcast(lhs)) {
+        LocalVar var = lookup(name);
+        if (var.ssaVar != NO_SSA_VAR) {
+          ssa->writeVariable(var.ssaVar, cur, use(genExp(e->getRHS())));
+          return nullptr;
+        }
+      }
+      if (genFieldAssign(lhs, e->getRHS())) return nullptr;
+      mir::Inst* addr = genAddress(lhs);
+      if (mir::Inst* v = genExp(e->getRHS()))
+        append(mir::Inst::STORE, nullptr, loc, { addr, v });
+      return nullptr;
+    }
+    else if (auto e = BlockExp::downcast(exp)) {
+      mir::Inst* lastStmtVal = nullptr;
+      locals.push();
+      for (Exp* stmt : e->getStatements()) lastStmtVal = genExp(stmt);
+      locals.pop();
+      return lastStmtVal;
+    }
+    else if (auto e = BorrowExp::downcast(exp)) {
+      return append(mir::Inst::BORROW, ty, loc,
+                    { use(genExp(e->getRefExp())) });
+    }
+    else if (auto e = CallExp::downcast(exp)) {
+      if (e->getBuiltin() == CallExp::BLOCK_ON) {
+        unsupported = true;
+        return nullptr;
+      }
+      llvm::SmallVector<mir::Inst*, 4> args;
+      for (Exp* arg : e->getArguments()->asArrayRef())
+        args.push_back(use(genExp(arg)));
+      mir::Inst* v = append(e->isBuiltin() ? mir::Inst::BUILTIN
+                                           : mir::Inst::CALL, ty, loc, args);
+      if (e->isBuiltin()) v->exp = e;
+      else v->callee = e->getFunction();
+      return v->hasValue() ? v : nullptr;
+    }
+    else if (auto e = ConstrExp::downcast(exp)) {
+      llvm::SmallVector<mir::Inst*, 4> fields;
+      for (Exp* field : e->getFields()->asArrayRef())
+        fields.push_back(use(genExp(field)));
+      return append(mir::Inst::CONSTRUCT, ty, loc, fields);
+    }
+    else if (auto e = DerefExp::downcast(exp)) {
+      mir::Inst* addr = use(genExp(e->getOf()));
+      if (mir::Inst::isUnit(ty)) return nullptr;
+      return append(mir::Inst::LOAD, ty, loc, { addr });
+    }
+    else if (auto e = NameExp::downcast(exp)) {
+      if (ont.getConst(e->getName()->asStringRef())) {
+        mir::Inst* v = append(mir::Inst::CONST, ty, loc);
+        v->exp = e;
+        return v;
+      }
+      LocalVar var = lookup(e);
+      if (var.ssaVar != NO_SSA_VAR) return ssa->readVariable(var.ssaVar, cur);
+      if (var.slot == nullptr) return nullptr;  // unit-typed
+      return append(mir::Inst::LOAD, ty, loc, { var.slot });
+    }
+    else if (auto e = IfExp::downcast(exp)) {
+      mir::Block* thenBlock = fn->addBlock("then");
+      mir::Block* elseBlock = e->getElseExp() ? fn->addBlock("else") : nullptr;
+      mir::Block* contBlock = fn->addBlock("ifcont");
+      condBr(e->getCondExp(), thenBlock, elseBlock ? elseBlock : contBlock);
+
+      cur = thenBlock;
+      ssa->sealBlock(thenBlock);
+      mir::Inst* thenResult = genExp(e->getThenExp());
+      br(contBlock);
+
+      mir::Inst* elseResult = nullptr;
+      if (elseBlock != nullptr) {
+        cur = elseBlock;
+        ssa->sealBlock(elseBlock);
+        elseResult = genExp(e->getElseExp());
+        br(contBlock);
+      }
+
+      cur = contBlock;
+      ssa->sealBlock(contBlock);
+      if (thenResult == nullptr || elseResult == nullptr) return nullptr;
+      mir::Inst* phi = fn->create(mir::Inst::PHI, ty, loc,
+                                  { thenResult, elseResult });
+      fn->prepend(contBlock, phi);
+      return phi;
+    }
+    else if (auto e = IndexExp::downcast(exp)) {
+      mir::Inst* base = use(genExp(e->getBase()));
+      mir::Inst* index = use(genExp(e->getIndex()));
+      return append(mir::Inst::INDEX_ADDR, ty, loc, { base, index });
+    }
+    else if (auto e = LetExp::downcast(exp)) {
+      mir::Inst* v = genExp(e->getDefinition());
+      bindLocal(e, e->getBoundIdent()->asStringRef(), v,
+                e->getDefinition()->getType());
+      return nullptr;
+    }
+    else if (auto e = MoveExp::downcast(exp)) {
+      return append(mir::Inst::MOVE, ty, loc,
+                    { use(genExp(e->getRefExp())) });
+    }
+    else if (auto e = ProjectExp::downcast(exp)) {
+      mir::Inst* base = use(genExp(e->getBase()));
+      switch (e->getKind()) {
+      case ProjectExp::DOT: {
+        mir::Inst* v = append(mir::Inst::EXTRACT, ty, loc, { base });
+        v->index = fieldIndex(e->getTypeName(), e->getFieldName());
+        return v;
+      }
+      case ProjectExp::BRACKETS:
+        return fieldAddr(base, e, RefType::downcast(ty)->inner);
+      case ProjectExp::ARROW:
+        return append(mir::Inst::LOAD, ty, loc, { fieldAddr(base, e, ty) });
+      }
+      llvm_unreachable("MIRBuilder::genExp() unexpected projection");
+    }
+    else if (exp->id == AST::ID::BOOL_LIT || exp->id == AST::ID::DEC_LIT
+             || exp->id == AST::ID::INT_LIT
+             || exp->id == AST::ID::STRING_LIT) {
+      mir::Inst* v = append(mir::Inst::CONST, ty, loc);
+      v->exp = exp;
+      return v;
+    }
+    else if (auto e = UnopExp::downcast(exp)) {
+      mir::Inst* v = append(mir::Inst::UNOP, ty, loc,
+                            { use(genExp(e->getInner())) });
+      v->unop = e->getUnop();
+      return v;
+    }
+    else if (auto e = WhileExp::downcast(exp)) {
+      mir::Block* condBlock = fn->addBlock("whileCond");
+      mir::Block* bodyBlock = fn->addBlock("whileBody");
+      mir::Block* contBlock = fn->addBlock("whileCont");
+      br(condBlock);
+
+      cur = condBlock;
+      condBr(e->getCond(), bodyBlock, contBlock);
+
+      cur = bodyBlock;
+      ssa->sealBlock(bodyBlock);
+      genExp(e->getBody());
+      br(condBlock);
+      ssa->sealBlock(condBlock);  // the back edge is its last predecessor
+
+      cur = contBlock;
+      ssa->sealBlock(contBlock);
+      return nullptr;
+    }
+    // `await`, `return`, and array literals outside constants
+    unsupported = true;
+    return nullptr;
+  }
+};
+
+#endif
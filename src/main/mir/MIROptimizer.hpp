@@ -0,0 +1,590 @@
+#ifndef MIR_MIROPTIMIZER
+#define MIR_MIROPTIMIZER
+
+#include <optional>
+#include <llvm/ADT/DenseSet.h>
+#include "analysis/FunctionSummaries.hpp"
+#include "common/Ontology.hpp"
+#include "common/TypeContext.hpp"
+#include "mir/MIR.hpp"
+
+/// @brief The MIR passes, which run in this order:
+///
+///   1. propagateMoves: a `move` is its operand once the borrow checker is
+///      done with it.
+///   2. removeDeadBorrows: likewise `borrow`; an unused borrow disappears.
+///   3. scalarReplaceStructs: struct values are taken apart into their
+///      fields, struct stack slots into one slot per field, and stack slots
+///      that are only loaded and stored become SSA values.
+///   4. forwardLoads: loads of memory that no other code can reach get the
+///      value last stored (or loaded) there.
+///   5. removeDeadCode.
+///
+/// Passes 1 and 2 also make the rest simpler, since every use of a
+/// reference is then a use of the instruction that created it.
+class MIROptimizer {
+public:
+  /// @brief Counters reported by `miscrc --stats`.
+  struct Stats {
+    unsigned movesPropagated = 0;
+    unsigned borrowsRemoved = 0;
+    unsigned structsReplaced = 0;  // struct values and slots taken apart
+    unsigned slotsPromoted = 0;    // stack slots turned into SSA values
+    unsigned loadsForwarded = 0;
+    unsigned instsRemoved = 0;     // dead instructions
+
+    Stats& operator+=(const Stats& that) {
+      movesPropagated += that.movesPropagated;
+      borrowsRemoved += that.borrowsRemoved;
+      structsReplaced += that.structsReplaced;
+      slotsPromoted += that.slotsPromoted;
+      loadsForwarded += that.loadsForwarded;
+      instsRemoved += that.instsRemoved;
+      return *this;
+    }
+  };
+
+private:
+  const Ontology& ont;
+  TypeContext& tc;
+  const FunctionSummaries* summaries;
+  Stats stats;
+
+public:
+  /// @brief Without @p summaries, every address passed to a function is
+  /// assumed to be captured.
+  MIROptimizer(const Ontology& ont, TypeContext& tc,
+               const FunctionSummaries* summaries = nullptr)
+    : ont(ont), tc(tc), summaries(summaries) {}
+
+  const Stats& getStats() const { return stats; }
+
+  void run(mir::Function& fn) {
+    propagateMoves(fn);
+    removeDeadBorrows(fn);
+    scalarReplaceStructs(fn);
+    forwardLoads(fn);
+    removeDeadCode(fn);
+  }
+
+  void propagateMoves(mir::Function& fn) {
+    for (mir::Inst* inst : allInsts(fn)) {
+      if (inst->op != mir::Inst::MOVE) continue;
+      fn.replace(inst, inst->getOperand(0));
+      ++stats.movesPropagated;
+    }
+  }
+
+  void removeDeadBorrows(mir::Function& fn) {
+    for (mir::Inst* inst : allInsts(fn)) {
+      if (inst->op != mir::Inst::BORROW) continue;
+      if (inst->hasUsers()) inst->replaceAllUsesWith(inst->getOperand(0));
+      fn.erase(inst);
+      ++stats.borrowsRemoved;
+    }
+  }
+
+  void scalarReplaceStructs(mir::Function& fn) {
+    splitStructAccesses(fn);
+    splitStructSlots(fn);
+    promoteSlots(fn);
+    foldExtracts(fn);
+  }
+
+  /// @brief Forwards stored and loaded values to later loads of the same
+  /// address, for memory whose every alias is a value of this function: the
+  /// stack slots and fresh allocations (`alloc` and `realloc`) whose
+  /// addresses never escape. Such memory can only change by stores to it
+  /// and by calls that are passed an address in it and may write there.
+  ///
+  /// A `uniq &` that came from elsewhere (a parameter, a call, or a load)
+  /// does not qualify even though no other unique reference points to the
+  /// same memory: `borrow` makes untracked aliases.
+  ///
+  /// Facts flow into a block from its single predecessor, if it has only
+  /// one. Address computations are deduplicated the same way so that equal
+  /// addresses are the same value.
+  void forwardLoads(mir::Function& fn) {
+    llvm::DenseMap<mir::Inst*, mir::Inst*> roots = findLocalMemory(fn);
+    llvm::DenseMap<mir::Block*, ForwardState> states;
+    for (mir::Block* b : fn.reversePostOrder()) {
+      ForwardState& state = states[b];
+      if (b->getPredecessors().size() == 1) {
+        auto pred = states.find(b->getPredecessors()[0]);
+        if (pred != states.end() && pred->first != b) state = pred->second;
+      }
+      for (mir::Inst* inst : llvm::SmallVector<mir::Inst*, 16>(
+             b->getInsts().begin(), b->getInsts().end()))
+        forwardThrough(fn, inst, roots, state);
+    }
+  }
+
+  /// @brief Removes instructions whose values are unused and that have no
+  /// side effects, and PHIs that merge a single value.
+  void removeDeadCode(mir::Function& fn) {
+    std::vector<mir::Inst*> worklist = allInsts(fn);
+    for (mir::Inst* inst : worklist)
+      if (inst->op == mir::Inst::PHI && inst->getParent() != nullptr)
+        removeTrivialPhi(fn, inst);
+    worklist = allInsts(fn);
+    while (!worklist.empty()) {
+      mir::Inst* inst = worklist.back();
+      worklist.pop_back();
+      if (inst->getParent() == nullptr || inst->hasUsers()
+          || inst->hasSideEffects())
+        continue;
+      for (mir::Inst* op : inst->getOperands()) worklist.push_back(op);
+      fn.erase(inst);
+      ++stats.instsRemoved;
+    }
+  }
+
+private:
+
+  static std::vector<mir::Inst*> allInsts(mir::Function& fn) {
+    std::vector<mir::Inst*> result;
+    for (mir::Block* b : fn.getBlocks())
+      result.insert(result.end(), b->getInsts().begin(), b->getInsts().end());
+    return result;
+  }
+
+  /// @brief The type of field @p i of the struct type @p ty.
+  Type* fieldType(Type* ty, unsigned i) {
+    StructDecl* st = ont.getType(NameType::downcast(ty)->asString);
+    return tc.getTypeFromTypeExp(st->getFields()->asArrayRef()[i].second);
+  }
+
+  unsigned numFields(Type* ty) {
+    return ont.getType(NameType::downcast(ty)->asString)
+      ->getFields()->asArrayRef().size();
+  }
+
+  static bool isStruct(Type* ty)
+    { return ty != nullptr && NameType::downcast(ty) != nullptr; }
+
+  /// @brief The type of the memory at address @p addr.
+  static Type* pointee(mir::Inst* addr)
+    { return RefType::downcast(addr->type)->inner; }
+
+  mir::Inst* insertFieldAddr(mir::Function& fn, mir::Inst* pos,
+                             mir::Inst* base, unsigned i) {
+    mir::Inst* addr = fn.create(mir::Inst::FIELD_ADDR,
+      tc.getRefType(fieldType(pointee(base), i)), pos->loc, { base });
+    addr->index = i;
+    fn.insertBefore(pos, addr);
+    return addr;
+  }
+
+  /// @brief Narrows struct loads whose value is only taken apart to loads of
+  /// the fields used, and stores of constructed structs to stores of the
+  /// fields. Constant structs are left whole, to be copied from a global.
+  void splitStructAccesses(mir::Function& fn) {
+    std::vector<mir::Inst*> worklist = allInsts(fn);
+    while (!worklist.empty()) {
+      mir::Inst* inst = worklist.back();
+      worklist.pop_back();
+      if (inst->getParent() == nullptr) continue;
+      if (inst->op == mir::Inst::LOAD && isStruct(inst->type)
+          && inst->hasUsers()
+          && llvm::all_of(inst->getUsers(), [](mir::Inst* user)
+               { return user->op == mir::Inst::EXTRACT; })) {
+        llvm::SmallVector<mir::Inst*, 4> users(inst->getUsers().begin(),
+                                               inst->getUsers().end());
+        for (mir::Inst* extract : users) {
+          if (extract->getParent() == nullptr) continue;  // a duplicate use
+          mir::Inst* addr = insertFieldAddr(fn, inst, inst->getOperand(0),
+                                            extract->index);
+          mir::Inst* load = fn.create(mir::Inst::LOAD, extract->type,
+                                      extract->loc, { addr });
+          fn.insertBefore(inst, load);
+          fn.replace(extract, load);
+          worklist.push_back(load);  // it may be a struct taken apart too
+        }
+        fn.erase(inst);
+        ++stats.structsReplaced;
+      } else if (inst->op == mir::Inst::STORE
+                 && inst->getOperand(1)->op == mir::Inst::CONSTRUCT
+                 && !isConstant(inst->getOperand(1))) {
+        splitStore(fn, inst);
+        ++stats.structsReplaced;
+      }
+    }
+  }
+
+  /// @brief True if @p v is a literal or a struct of them.
+  static bool isConstant(mir::Inst* v) {
+    if (v->op == mir::Inst::CONST) return true;
+    return v->op == mir::Inst::CONSTRUCT
+      && llvm::all_of(v->getOperands(), isConstant);
+  }
+
+  /// @brief Replaces a store of a constructed struct by stores of its
+  /// fields, recursively.
+  void splitStore(mir::Function& fn, mir::Inst* store) {
+    mir::Inst* addr = store->getOperand(0);
+    mir::Inst* construct = store->getOperand(1);
+    for (unsigned i = 0; i < construct->getNumOperands(); ++i) {
+      mir::Inst* fieldStore = fn.create(mir::Inst::STORE, nullptr, store->loc,
+        { insertFieldAddr(fn, store, addr, i), construct->getOperand(i) });
+      fn.insertBefore(store, fieldStore);
+      if (construct->getOperand(i)->op == mir::Inst::CONSTRUCT)
+        splitStore(fn, fieldStore);
+    }
+    fn.erase(store);
+  }
+
+  /// @brief True if @p inst is a load from @p addr or a store to it (but not
+  /// of it).
+  static bool isAccessOf(mir::Inst* inst, mir::Inst* addr) {
+    if (inst->op == mir::Inst::LOAD) return true;
+    return inst->op == mir::Inst::STORE && inst->getOperand(0) == addr
+      && inst->getOperand(1) != addr;
+  }
+
+  /// @brief Splits each struct slot that is only accessed as a whole or
+  /// through the addresses of its fields into one slot per field.
+  void splitStructSlots(mir::Function& fn) {
+    std::vector<mir::Inst*> worklist;
+    for (mir::Inst* inst : allInsts(fn))
+      if (inst->op == mir::Inst::SLOT) worklist.push_back(inst);
+    while (!worklist.empty()) {
+      mir::Inst* slot = worklist.back();
+      worklist.pop_back();
+      if (!isStruct(pointee(slot))) continue;
+      bool splittable = llvm::all_of(slot->getUsers(), [&](mir::Inst* user) {
+        return user->op == mir::Inst::FIELD_ADDR || isAccessOf(user, slot);
+      });
+      if (!splittable) continue;
+
+      std::vector<mir::Inst*> fieldSlots;
+      for (unsigned i = 0; i < numFields(pointee(slot)); ++i) {
+        fieldSlots.push_back(fn.create(mir::Inst::SLOT,
+          tc.getRefType(fieldType(pointee(slot), i)), slot->loc));
+        fn.insertBefore(slot, fieldSlots.back());
+        worklist.push_back(fieldSlots.back());
+      }
+      llvm::SmallVector<mir::Inst*, 8> users(slot->getUsers().begin(),
+                                             slot->getUsers().end());
+      for (mir::Inst* user : users) {
+        if (user->getParent() == nullptr) continue;
+        if (user->op == mir::Inst::FIELD_ADDR) {
+          fn.replace(user, fieldSlots[user->index]);
+        } else if (user->op == mir::Inst::LOAD) {
+          mir::Inst* construct = fn.create(mir::Inst::CONSTRUCT, user->type,
+                                           user->loc);
+          for (unsigned i = 0; i < fieldSlots.size(); ++i) {
+            mir::Inst* load = fn.create(mir::Inst::LOAD,
+              pointee(fieldSlots[i]), user->loc, { fieldSlots[i] });
+            fn.insertBefore(user, load);
+            construct->addOperand(load);
+          }
+          fn.insertBefore(user, construct);
+          fn.replace(user, construct);
+        } else {
+          mir::Inst* v = user->getOperand(1);
+          for (unsigned i = 0; i < fieldSlots.size(); ++i) {
+            mir::Inst* field = fn.create(mir::Inst::EXTRACT,
+              pointee(fieldSlots[i]), user->loc, { v });
+            field->index = i;
+            fn.insertBefore(user, field);
+            fn.insertBefore(user, fn.create(mir::Inst::STORE, nullptr,
+              user->loc, { fieldSlots[i], field }));
+          }
+          fn.erase(user);
+        }
+      }
+      fn.erase(slot);
+      ++stats.structsReplaced;
+    }
+  }
+
+  /// @brief Turns the slots that are only loaded and stored (i.e., whose
+  /// address is not used otherwise) into SSA values.
+  void promoteSlots(mir::Function& fn) {
+    mir::SSAConstructor ssa(fn);
+    llvm::DenseMap<mir::Inst*, unsigned> vars;
+    std::vector<mir::Inst*> slots;
+    for (mir::Inst* inst : allInsts(fn)) {
+      if (inst->op != mir::Inst::SLOT) continue;
+      if (!llvm::all_of(inst->getUsers(), [&](mir::Inst* user)
+            { return isAccessOf(user, inst); }))
+        continue;
+      vars[inst] = ssa.addVariable(pointee(inst));
+      slots.push_back(inst);
+    }
+    if (slots.empty()) return;
+
+    // A block is sealed once all its predecessors are filled. In reverse
+    // postorder that is right away, except for loop headers, which are
+    // sealed when the last block of the loop is filled.
+    std::vector<mir::Block*> order = fn.reversePostOrder();
+    llvm::SmallPtrSet<mir::Block*, 32> reachable(order.begin(), order.end());
+    llvm::SmallPtrSet<mir::Block*, 32> filled;
+    auto trySeal = [&](mir::Block* b) {
+      if (ssa.isSealed(b)) return;
+      for (mir::Block* pred : b->getPredecessors())
+        if (reachable.count(pred) && !filled.count(pred)) return;
+      ssa.sealBlock(b);
+    };
+    for (mir::Block* b : order) {
+      trySeal(b);
+      for (mir::Inst* inst : llvm::SmallVector<mir::Inst*, 16>(
+             b->getInsts().begin(), b->getInsts().end())) {
+        if (inst->op != mir::Inst::LOAD && inst->op != mir::Inst::STORE)
+          continue;
+        auto var = vars.find(inst->getOperand(0));
+        if (var == vars.end()) continue;
+        if (inst->op == mir::Inst::STORE) {
+          ssa.writeVariable(var->second, b, inst->getOperand(1));
+          fn.erase(inst);
+        } else {
+          ssa.replace(inst, ssa.readVariable(var->second, b));
+        }
+      }
+      filled.insert(b);
+      for (mir::Block* succ : b->getSuccessors())
+        if (filled.count(succ)) trySeal(succ);
+    }
+    for (mir::Block* b : fn.getBlocks()) if (!ssa.isSealed(b)) ssa.sealBlock(b);
+    for (mir::Inst* slot : slots) {
+      // unreachable blocks may still access the slot
+      if (slot->hasUsers()) continue;
+      fn.erase(slot);
+      ++stats.slotsPromoted;
+    }
+  }
+
+  /// @brief Replaces each EXTRACT of a field of a struct value that is built
+  /// in this function by the field: from a CONSTRUCT or INSERT directly, and
+  /// from a PHI of structs by a PHI of the fields.
+  void foldExtracts(mir::Function& fn) {
+    llvm::DenseMap<std::pair<mir::Inst*, unsigned>, mir::Inst*> fieldPhis;
+    std::vector<mir::Inst*> worklist;
+    for (mir::Inst* inst : allInsts(fn))
+      if (inst->op == mir::Inst::EXTRACT) worklist.push_back(inst);
+    while (!worklist.empty()) {
+      mir::Inst* extract = worklist.back();
+      worklist.pop_back();
+      if (extract->getParent() == nullptr) continue;
+      unsigned i = extract->index;
+      mir::Inst* agg = extract->getOperand(0);
+      while (agg->op == mir::Inst::INSERT && agg->index != i)
+        agg = agg->getOperand(0);
+      mir::Inst* field = nullptr;
+      if (agg->op == mir::Inst::CONSTRUCT) {
+        field = agg->getOperand(i);
+      } else if (agg->op == mir::Inst::INSERT) {
+        field = agg->getOperand(1);
+      } else if (agg->op == mir::Inst::PHI) {
+        mir::Inst*& phi = fieldPhis[{ agg, i }];
+        if (phi == nullptr) {
+          phi = fn.create(mir::Inst::PHI, extract->type, agg->loc);
+          fn.prepend(agg->getParent(), phi);
+          llvm::ArrayRef<mir::Block*> preds =
+            agg->getParent()->getPredecessors();
+          for (unsigned k = 0; k < preds.size(); ++k) {
+            mir::Inst* predField = fn.create(mir::Inst::EXTRACT,
+              extract->type, extract->loc, { agg->getOperand(k) });
+            predField->index = i;
+            fn.insertBefore(preds[k]->getTerminator(), predField);
+            phi->addOperand(predField);
+            worklist.push_back(predField);
+          }
+        }
+        field = phi;
+      } else if (agg->op == mir::Inst::UNDEF) {
+        field = fn.create(mir::Inst::UNDEF, extract->type, extract->loc);
+        fn.insertBefore(agg, field);
+      }
+      if (field == nullptr) {
+        if (agg != extract->getOperand(0)) extract->setOperand(0, agg);
+        continue;
+      }
+      fn.replace(extract, field);
+      ++stats.structsReplaced;
+    }
+  }
+
+  /// @brief Replaces @p phi by its only operand (other than itself) if it
+  /// has one.
+  void removeTrivialPhi(mir::Function& fn, mir::Inst* phi) {
+    mir::Inst* same = nullptr;
+    for (mir::Inst* op : phi->getOperands()) {
+      if (op == same || op == phi) continue;
+      if (same != nullptr) return;
+      same = op;
+    }
+    if (same == nullptr) return;  // unreachable; left to removeDeadCode
+    llvm::SmallVector<mir::Inst*, 4> users;
+    for (mir::Inst* user : phi->getUsers())
+      if (user != phi && user->op == mir::Inst::PHI) users.push_back(user);
+    fn.replace(phi, same);
+    for (mir::Inst* user : users)
+      if (user->getParent() != nullptr) removeTrivialPhi(fn, user);
+  }
+
+  /// @brief Whether the call @p inst may capture its argument @p i, or write
+  /// through it.
+  bool mayCapture(mir::Inst* inst, unsigned i) {
+    if (inst->op == mir::Inst::BUILTIN) {
+      switch (CallExp::downcast(inst->exp)->getBuiltin()) {
+      case CallExp::FREE:
+      case CallExp::LOWER_BOUND:
+      case CallExp::PREFETCH:
+      case CallExp::RADIX_SORT:
+      case CallExp::REALLOC:
+      case CallExp::SOA_FREE:
+      case CallExp::SORT:
+        return false;
+      default:  // the comparator of `sort_by` gets addresses in the array
+        return true;
+      }
+    }
+    FunctionDecl* callee = ont.getFunction(inst->callee->asStringRef());
+    if (summaries == nullptr || callee == nullptr
+        || i >= callee->getParameters()->asArrayRef().size())
+      return true;
+    return !summaries->lookup(callee).isNoCapture(i);
+  }
+
+  bool mayWrite(mir::Inst* inst, unsigned i) {
+    if (inst->op == mir::Inst::BUILTIN) {
+      CallExp::Builtin builtin = CallExp::downcast(inst->exp)->getBuiltin();
+      return builtin != CallExp::LOWER_BOUND && builtin != CallExp::PREFETCH;
+    }
+    FunctionDecl* callee = ont.getFunction(inst->callee->asStringRef());
+    if (summaries == nullptr || callee == nullptr
+        || i >= callee->getParameters()->asArrayRef().size())
+      return true;
+    return !summaries->lookup(callee).isReadOnly(i);
+  }
+
+  /// @brief Maps each address in memory that only this function can reach
+  /// to the SLOT or allocation it is in.
+  llvm::DenseMap<mir::Inst*, mir::Inst*> findLocalMemory(mir::Function& fn) {
+    llvm::DenseMap<mir::Inst*, mir::Inst*> roots;
+    for (mir::Inst* inst : allInsts(fn)) {
+      bool fresh = inst->op == mir::Inst::SLOT;
+      if (inst->op == mir::Inst::BUILTIN) {
+        CallExp::Builtin builtin = CallExp::downcast(inst->exp)->getBuiltin();
+        fresh = builtin == CallExp::ALLOC || builtin == CallExp::REALLOC;
+      }
+      if (!fresh) continue;
+      std::vector<mir::Inst*> derived{ inst };
+      bool escapes = false;
+      for (unsigned k = 0; k < derived.size() && !escapes; ++k) {
+        mir::Inst* addr = derived[k];
+        for (mir::Inst* user : addr->getUsers()) {
+          switch (user->op) {
+          case mir::Inst::LOAD:
+            continue;
+          case mir::Inst::STORE:
+            escapes |= user->getOperand(1) == addr;
+            continue;
+          case mir::Inst::FIELD_ADDR:
+          case mir::Inst::INDEX_ADDR:
+            if (user->getOperand(0) == addr) derived.push_back(user);
+            else escapes = true;
+            continue;
+          case mir::Inst::CALL:
+          case mir::Inst::BUILTIN:
+            for (unsigned i = 0; i < user->getNumOperands(); ++i)
+              if (user->getOperand(i) == addr) escapes |= mayCapture(user, i);
+            continue;
+          default:
+            escapes = true;
+          }
+        }
+      }
+      if (escapes) continue;
+      for (mir::Inst* addr : derived) roots[addr] = inst;
+    }
+    return roots;
+  }
+
+  /// @brief The values known to be in memory, and the address computations
+  /// seen, at some point of a block.
+  struct ForwardState {
+    llvm::SmallVector<std::pair<mir::Inst*, mir::Inst*>, 8> known;
+    llvm::DenseMap<std::tuple<unsigned, mir::Inst*, mir::Inst*, long>,
+                   mir::Inst*> addrs;
+  };
+
+  /// @brief The value of @p v if it is an integer literal.
+  static std::optional<long> constInt(mir::Inst* v) {
+    if (v->op != mir::Inst::CONST) return std::nullopt;
+    if (auto lit = IntLit::downcast(v->exp)) return lit->asLong();
+    return std::nullopt;
+  }
+
+  /// @brief True if addresses @p a and @p b in the same memory may overlap.
+  static bool mayAlias(mir::Inst* a, mir::Inst* b) {
+    if (a == b) return true;
+    if (a->op != b->op || a->getOperand(0) != b->getOperand(0)) return true;
+    if (a->op == mir::Inst::FIELD_ADDR) return a->index == b->index;
+    if (a->op == mir::Inst::INDEX_ADDR) {
+      std::optional<long> i = constInt(a->getOperand(1));
+      std::optional<long> j = constInt(b->getOperand(1));
+      return !i || !j || *i == *j;
+    }
+    return true;
+  }
+
+  void forwardThrough(mir::Function& fn, mir::Inst* inst,
+                      const llvm::DenseMap<mir::Inst*, mir::Inst*>& roots,
+                      ForwardState& state) {
+    auto rootOf = [&](mir::Inst* addr) { return roots.lookup(addr); };
+    auto forget = [&](mir::Inst* root, mir::Inst* addr) {
+      llvm::erase_if(state.known, [&](auto& entry) {
+        return rootOf(entry.first) == root
+          && (addr == nullptr || mayAlias(entry.first, addr));
+      });
+    };
+    switch (inst->op) {
+    case mir::Inst::FIELD_ADDR:
+    case mir::Inst::INDEX_ADDR: {
+      // constant indices are compared by value, other indices by identity
+      std::tuple<unsigned, mir::Inst*, mir::Inst*, long> key{ inst->op,
+        inst->getOperand(0), nullptr, inst->index };
+      if (inst->op == mir::Inst::INDEX_ADDR) {
+        std::optional<long> i = constInt(inst->getOperand(1));
+        std::get<2>(key) = i ? nullptr : inst->getOperand(1);
+        std::get<3>(key) = i.value_or(0);
+      }
+      auto [it, added] = state.addrs.insert({ key, inst });
+      if (!added) fn.replace(inst, it->second);
+      return;
+    }
+    case mir::Inst::LOAD: {
+      mir::Inst* addr = inst->getOperand(0);
+      if (rootOf(addr) == nullptr) return;
+      for (auto& [knownAddr, v] : state.known) {
+        if (knownAddr != addr || v->type != inst->type) continue;
+        fn.replace(inst, v);
+        ++stats.loadsForwarded;
+        return;
+      }
+      state.known.push_back({ addr, inst });
+      return;
+    }
+    case mir::Inst::STORE: {
+      mir::Inst* addr = inst->getOperand(0);
+      if (mir::Inst* root = rootOf(addr)) {
+        forget(root, addr);
+        state.known.push_back({ addr, inst->getOperand(1) });
+      }
+      return;
+    }
+    case mir::Inst::CALL:
+    case mir::Inst::BUILTIN:
+      for (unsigned i = 0; i < inst->getNumOperands(); ++i)
+        if (mir::Inst* root = rootOf(inst->getOperand(i)))
+          if (mayWrite(inst, i)) forget(root, nullptr);
+      return;
+    default:
+      return;
+    }
+  }
+};
+
+#endif
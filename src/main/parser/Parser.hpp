@@ -2,6 +2,8 @@
 #define PARSER_PARSER
 
 #include <cassert>
+#include <optional>
+#include <llvm/ADT/DenseMap.h>
 #include "common/Token.hpp"
 #include "common/LocatedError.hpp"
 #include "common/AST.hpp"
@@ -51,6 +53,14 @@ class Parser {
   /// Set when an error occurs.
   const char* expectedTokens = nullptr;
 
+  /// If true, functionDecl() skips function bodies (see deferBodies()).
+  bool deferring = false;
+
+  /// Maps functions with deferred bodies to the first token of the body
+  /// (just after the `=` or at the `{`).
+  llvm::DenseMap<FunctionDecl*, std::vector<Token>::const_iterator>
+    deferredBodies;
+
 public:
   Parser(const std::vector<Token>& tokens)
     : tokens(tokens), p(tokens.begin()) {}
@@ -74,6 +84,37 @@ public:
   /// @brief Returns the first token that hasn't been parsed yet.
   Token getCurrentToken() const { return *p; }
 
+  /// @brief After this is called, function bodies are only scanned for their
+  /// closing `;` or `}`, and parsed later by parseBody(). Syntax errors in a
+  /// body are therefore not reported until it is parsed. The token vector
+  /// must outlive this parser.
+  void deferBodies() { deferring = true; }
+
+  /// @brief Parses the deferred body of @p f and attaches it to @p f.
+  /// @return False (with getError() set) iff the body does not parse.
+  bool parseBody(FunctionDecl* f) {
+    auto it = deferredBodies.find(f);
+    assert(it != deferredBodies.end() && "body of f was not deferred");
+    p = it->second;
+    deferredBodies.erase(it);
+    error = NOERROR;
+    Exp* body;
+    if (p->tag == Token::LBRACE) {
+      body = blockExp();
+    } else {
+      body = exp();
+      if (body != nullptr && !chomp(Token::SEMICOLON)) {
+        errTryingToParse = "function";
+        expectedTokens = ";";
+        error = ARRESTING_ERR;
+        body = nullptr;
+      }
+    }
+    if (body == nullptr) return false;
+    f->setBody(body);
+    return true;
+  }
+
   //==========================================================================//
   //=== Idents and QIdents
   //==========================================================================//
@@ -148,6 +189,15 @@ public:
     EPSILON
   }
 
+  /// @brief Parses an array literal `[e1, e2, ...]`.
+  ArrayLit* arrayLit() {
+    Token begin = *p;
+    if (!chomp(Token::LBRACKET)) EPSILON
+    ExpList* elements = expListWotc0(); ARREST_IF_ERROR
+    CHOMP_ELSE_ARREST(Token::RBRACKET, "]", "array literal")
+    return new ArrayLit(hereFrom(begin), elements);
+  }
+
   Exp* parensExp() {
     if (!chomp(Token::LPAREN)) EPSILON
     Exp* ret = exp(); ARREST_IF_ERROR
@@ -180,6 +230,7 @@ public:
     ret = intLit(); CONTINUE_ON_EPSILON(ret)
     ret = decimalLit(); CONTINUE_ON_EPSILON(ret)
     ret = stringLit(); CONTINUE_ON_EPSILON(ret)
+    ret = arrayLit(); CONTINUE_ON_EPSILON(ret)
     ret = parensExp(); CONTINUE_ON_EPSILON(ret)
     ret = blockExp(); CONTINUE_ON_EPSILON(ret)
     EPSILON
@@ -235,6 +286,9 @@ public:
     } else if (chomp(Token::KW_MOVE)) {
       Exp* e = expLv3(); ARREST_IF_ERROR
       return new MoveExp(hereFrom(begin), e);
+    } else if (chomp(Token::KW_AWAIT)) {
+      Exp* e = expLv3(); ARREST_IF_ERROR
+      return new AwaitExp(hereFrom(begin), e);
     } else {
       return expLv2();
     }
@@ -281,6 +335,49 @@ public:
   Exp* expLv7() {
     Token begin = *p;
     Exp* lhs = expLv6(); RETURN_IF_ERROR
+    while (p->tag == Token::OP_SHL || p->tag == Token::OP_SHR) {
+      auto op = (p->tag == Token::OP_SHL) ? BinopExp::SHL : BinopExp::SHR;
+      ++p;
+      Exp* rhs = expLv6(); ARREST_IF_ERROR
+      lhs = new BinopExp(hereFrom(begin), op, lhs, rhs);
+    }
+    return lhs;
+  }
+
+  Exp* expLv8() {
+    Token begin = *p;
+    Exp* lhs = expLv7(); RETURN_IF_ERROR
+    while (p->tag == Token::AMP && (p+1)->tag != Token::AMP) {
+      ++p;
+      Exp* rhs = expLv7(); ARREST_IF_ERROR
+      lhs = new BinopExp(hereFrom(begin), BinopExp::BITAND, lhs, rhs);
+    }
+    return lhs;
+  }
+
+  Exp* expLv9() {
+    Token begin = *p;
+    Exp* lhs = expLv8(); RETURN_IF_ERROR
+    while (chomp(Token::OP_BITXOR)) {
+      Exp* rhs = expLv8(); ARREST_IF_ERROR
+      lhs = new BinopExp(hereFrom(begin), BinopExp::BITXOR, lhs, rhs);
+    }
+    return lhs;
+  }
+
+  Exp* expLv10() {
+    Token begin = *p;
+    Exp* lhs = expLv9(); RETURN_IF_ERROR
+    while (chomp(Token::OP_BITOR)) {
+      Exp* rhs = expLv9(); ARREST_IF_ERROR
+      lhs = new BinopExp(hereFrom(begin), BinopExp::BITOR, lhs, rhs);
+    }
+    return lhs;
+  }
+
+  Exp* expLv11() {
+    Token begin = *p;
+    Exp* lhs = expLv10(); RETURN_IF_ERROR
     while (p->tag == Token::OP_EQ || p->tag == Token::OP_NE
     || p->tag == Token::OP_GE || p->tag == Token::OP_GT
     || p->tag == Token::OP_LE || p->tag == Token::OP_LT) {
@@ -291,38 +388,38 @@ public:
                 p->tag == Token::OP_LE ? BinopExp::LE :
                                          BinopExp::LT ;
       ++p;
-      Exp* rhs = expLv6(); ARREST_IF_ERROR
+      Exp* rhs = expLv10(); ARREST_IF_ERROR
       lhs = new BinopExp(hereFrom(begin), op, lhs, rhs);
     }
     return lhs;
   }
 
-  Exp* expLv8() {
+  Exp* expLv12() {
     Token begin = *p;
-    Exp* lhs = expLv7(); RETURN_IF_ERROR
+    Exp* lhs = expLv11(); RETURN_IF_ERROR
     while (p->tag == Token::AMP && (p+1)->tag == Token::AMP) {
       p += 2;
-      Exp* rhs = expLv7(); ARREST_IF_ERROR
+      Exp* rhs = expLv11(); ARREST_IF_ERROR
       lhs = new BinopExp(hereFrom(begin), BinopExp::AND, lhs, rhs);
     }
     return lhs;
   }
 
-  Exp* expLv9() {
+  Exp* expLv13() {
     Token begin = *p;
-    Exp* lhs = expLv8(); RETURN_IF_ERROR
+    Exp* lhs = expLv12(); RETURN_IF_ERROR
     while (chomp(Token::OP_OR)) {
-      Exp* rhs = expLv8(); ARREST_IF_ERROR
+      Exp* rhs = expLv12(); ARREST_IF_ERROR
       lhs = new BinopExp(hereFrom(begin), BinopExp::OR, lhs, rhs);
     }
     return lhs;
   }
 
-  Exp* expLv10() {
+  Exp* expLv14() {
     Token begin = *p;
-    Exp* lhs = expLv9(); RETURN_IF_ERROR
+    Exp* lhs = expLv13(); RETURN_IF_ERROR
     while (chomp(Token::EQUAL)) {
-      Exp* rhs = expLv9(); ARREST_IF_ERROR
+      Exp* rhs = expLv13(); ARREST_IF_ERROR
       lhs = new AssignExp(hereFrom(begin), lhs, rhs);
     }
     return lhs;
@@ -343,7 +440,7 @@ public:
   /// @brief Parses a non-statement expression.
   Exp* exp() {
     Exp* ret = ifExp(); CONTINUE_ON_EPSILON(ret)
-    return expLv10();
+    return expLv14();
   }
 
   /// @brief Zero or more comma-separated expressions with optional trailing
@@ -444,6 +541,10 @@ public:
       return new PrimitiveTypeExp((p++)->loc, PrimitiveTypeExp::i32);
     if (p->tag == Token::KW_i64)
       return new PrimitiveTypeExp((p++)->loc, PrimitiveTypeExp::i64);
+    if (p->tag == Token::KW_ISIZE)
+      return new PrimitiveTypeExp((p++)->loc, PrimitiveTypeExp::ISIZE);
+    if (p->tag == Token::KW_USIZE)
+      return new PrimitiveTypeExp((p++)->loc, PrimitiveTypeExp::USIZE);
     if (p->tag == Token::KW_BOOL)
       return new PrimitiveTypeExp((p++)->loc, PrimitiveTypeExp::BOOL);
     if (p->tag == Token::KW_UNIT)
@@ -517,8 +618,13 @@ public:
     Token begin = *p;
     bool hasBody = true;
     bool variadic = false;
+    bool async = false;
     if (chomp(Token::KW_EXTERN)) {
       hasBody = false;
+      async = chomp(Token::KW_ASYNC);
+      CHOMP_ELSE_ARREST(Token::KW_FUNC, "func", "function")
+    } else if (chomp(Token::KW_ASYNC)) {
+      async = true;
       CHOMP_ELSE_ARREST(Token::KW_FUNC, "func", "function")
     } else if (!chomp(Token::KW_FUNC)) EPSILON
     Name* name = ident(); ARREST_IF_ERROR
@@ -530,20 +636,48 @@ public:
     CHOMP_ELSE_ARREST(Token::RPAREN, ")", "function")
     CHOMP_ELSE_ARREST(Token::COLON, ":", "function")
     TypeExp* retType = typeExp(); ARREST_IF_ERROR
+    FunctionDecl* ret;
+    if (hasBody && deferring) {
+      bool exprBody = chomp(Token::EQUAL);
+      auto bodyBegin = p;
+      if (skipBody(exprBody)) {
+        ret = new FunctionDecl(hereFrom(begin), name, params, retType,
+          nullptr);
+        ret->deferBody();
+        deferredBodies[ret] = bodyBegin;
+        if (async) ret->markAsync();
+        return ret;
+      }
+      p = bodyBegin;
+    }
     if (hasBody) {
       if (chomp(Token::EQUAL)) {
         Exp* body = exp(); ARREST_IF_ERROR
         CHOMP_ELSE_ARREST(Token::SEMICOLON, ";", "function")
-        return new FunctionDecl(hereFrom(begin), name, params, retType, body);
+        ret = new FunctionDecl(hereFrom(begin), name, params, retType, body);
       } else {
         Exp* body = blockExp(); ARREST_IF_ERROR
-        return new FunctionDecl(hereFrom(begin), name, params, retType, body);
+        ret = new FunctionDecl(hereFrom(begin), name, params, retType, body);
       }
     } else {
       CHOMP_ELSE_ARREST(Token::SEMICOLON, ";", "function")
-      return new FunctionDecl(hereFrom(begin), name, params, retType, nullptr,
+      ret = new FunctionDecl(hereFrom(begin), name, params, retType, nullptr,
         variadic);
     }
+    if (async) ret->markAsync();
+    return ret;
+  }
+
+  ConstDecl* constDecl() {
+    Token begin = *p;
+    if (!chomp(Token::KW_CONST)) EPSILON
+    Name* name = ident(); ARREST_IF_ERROR
+    CHOMP_ELSE_ARREST(Token::COLON, ":", "constant")
+    TypeExp* type = typeExp(); ARREST_IF_ERROR
+    CHOMP_ELSE_ARREST(Token::EQUAL, "=", "constant")
+    Exp* init = exp(); ARREST_IF_ERROR
+    CHOMP_ELSE_ARREST(Token::SEMICOLON, ";", "constant")
+    return new ConstDecl(hereFrom(begin), name, type, init);
   }
 
   ModuleDecl* module_() {
@@ -556,11 +690,65 @@ public:
     return new ModuleDecl(hereFrom(begin), moduleName, n2);
   }
 
+  /// @brief Parses an attribute such as `#[soa]` or `#[name("arg", arg)]`.
+  /// Arguments may be string literals, integer literals, or identifiers.
+  std::optional<Attribute> attribute() {
+    Token begin = *p;
+    if (p->tag != Token::HASH || (p+1)->tag != Token::LBRACKET) {
+      error = EPSILON_ERR;
+      return std::nullopt;
+    }
+    p += 2;
+    auto arrest = [&](const char* expected) {
+      errTryingToParse = "attribute";
+      expectedTokens = expected;
+      error = ARRESTING_ERR;
+      return std::nullopt;
+    };
+    Name* attrName = ident();
+    if (error != NOERROR) return arrest("identifier");
+    std::string name = attrName->asStringRef().str();
+    delete attrName;
+    llvm::SmallVector<std::string, 2> args;
+    if (chomp(Token::LPAREN)) {
+      while (p->tag == Token::LIT_STRING || p->tag == Token::LIT_INT
+          || p->tag == Token::IDENT) {
+        llvm::StringRef arg = p->asStringRef();
+        if (p->tag == Token::LIT_STRING) arg = arg.drop_front().drop_back();
+        args.push_back(arg.str());
+        ++p;
+        if (!chomp(Token::COMMA)) break;
+      }
+      if (!chomp(Token::RPAREN)) return arrest(")");
+    }
+    if (!chomp(Token::RBRACKET)) return arrest("]");
+    return Attribute(hereFrom(begin), name, std::move(args));
+  }
+
+  /// @brief Parses a declaration preceded by zero or more attributes.
   Decl* decl() {
+    llvm::SmallVector<Attribute, 0> attrs;
+    while (std::optional<Attribute> attr = attribute())
+      attrs.push_back(std::move(*attr));
+    if (error == ARRESTING_ERR) return nullptr;
+    error = NOERROR;
+    Decl* ret = unattributedDecl();
+    if (ret != nullptr) {
+      ret->setAttributes(std::move(attrs));
+    } else if (error == EPSILON_ERR && !attrs.empty()) {
+      errTryingToParse = "attributed declaration";
+      expectedTokens = "const, func, extern, module, or struct";
+      error = ARRESTING_ERR;
+    }
+    return ret;
+  }
+
+  Decl* unattributedDecl() {
     Decl* ret;
     ret = functionDecl(); CONTINUE_ON_EPSILON(ret)
     ret = module_(); CONTINUE_ON_EPSILON(ret)
     ret = structDecl(); CONTINUE_ON_EPSILON(ret)
+    ret = constDecl(); CONTINUE_ON_EPSILON(ret)
     EPSILON
   }
 
@@ -592,6 +780,31 @@ private:
       { return false; }
   }
 
+  /// @brief Moves past a function body without building it. An expression
+  /// body (@p exprBody) ends at the first `;` outside of brackets, and a
+  /// block body at its matching `}`.
+  /// @return False iff the end of the body could not be found, in which case
+  /// the body should be parsed normally to get a good error message.
+  bool skipBody(bool exprBody) {
+    if (!exprBody && p->tag != Token::LBRACE) return false;
+    int depth = 0;
+    for (; p->tag != Token::END; ++p) {
+      switch (p->tag) {
+      case Token::LPAREN: case Token::LBRACE: case Token::LBRACKET:
+        ++depth; break;
+      case Token::RPAREN: case Token::RBRACE: case Token::RBRACKET:
+        if (--depth < 0) return false;
+        if (depth == 0 && !exprBody) { ++p; return true; }
+        break;
+      case Token::SEMICOLON:
+        if (depth == 0 && exprBody) { ++p; return true; }
+        break;
+      default: break;
+      }
+    }
+    return false;
+  }
+
   /// @brief Returns the location that spans from the beginning of @p first to
   /// the end of the token before the current one. Make sure there _is_ a
   /// previous token before calling this function.
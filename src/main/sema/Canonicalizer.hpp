@@ -5,13 +5,21 @@
 #include "common/AST.hpp"
 #include "common/LocatedError.hpp"
 #include "common/Ontology.hpp"
+#include "common/ScopeStack.hpp"
 
 /// @brief Second of five sema phases. Replaces all names in an AST with their
 /// fully qualified names.
+///
+/// A NameExp is a local variable if one is in scope, otherwise it names a
+/// global constant and is qualified like other decl names. Unbound names are
+/// left alone for the Unifier to report.
 class Canonicalizer {
   const Ontology& ont;
   std::vector<LocatedError>& errors;
 
+  /// @brief Names of the local variables in scope.
+  ScopeStack<bool> locals;
+
 public:
   Canonicalizer(const Ontology& ont, std::vector<LocatedError>& errors)
     : ont(ont), errors(errors) {}
@@ -28,12 +36,40 @@ public:
   /// @brief Recursively canonicalizes all the names in @p funcDecl.
   /// @param scope the scope in which @p decl appears
   void run(FunctionDecl* funcDecl, llvm::StringRef scope) {
+    runSignature(funcDecl, scope);
+    runBody(funcDecl, scope);
+  }
+
+  /// @brief Canonicalizes the name, parameter types, and return type of
+  /// @p funcDecl, but not its body.
+  /// @param scope the scope in which @p decl appears
+  void runSignature(FunctionDecl* funcDecl, llvm::StringRef scope) {
     llvm::Twine fqn = scope + "::" + funcDecl->getName()->asStringRef();
     funcDecl->getName()->set(fqn);
     canonicalizeNonDecl(scope, funcDecl->getParameters());
     canonicalizeNonDecl(scope, funcDecl->getReturnType());
+  }
+
+  /// @brief Recursively canonicalizes all the names in the body (if any) of
+  /// @p funcDecl. runSignature() must have been run on it.
+  /// @param scope the scope in which @p decl appears
+  void runBody(FunctionDecl* funcDecl, llvm::StringRef scope) {
     Exp* body = funcDecl->getBody();
-    if (body != nullptr) canonicalizeNonDecl(scope, body);
+    if (body == nullptr) return;
+    locals.push();
+    for (auto param : funcDecl->getParameters()->asArrayRef())
+      locals.add(param.first->asStringRef(), true);
+    canonicalizeNonDecl(scope, body);
+    locals.pop();
+  }
+
+  /// @brief Recursively canonicalizes all the names in @p constDecl.
+  /// @param scope the scope in which @p decl appears
+  void run(ConstDecl* constDecl, llvm::StringRef scope) {
+    llvm::Twine fqn = scope + "::" + constDecl->getName()->asStringRef();
+    constDecl->getName()->set(fqn);
+    canonicalizeNonDecl(scope, constDecl->getType());
+    canonicalizeNonDecl(scope, constDecl->getInit());
   }
 
   /// @brief Recursively canonicalizes all names in @p e.
@@ -50,7 +86,9 @@ private:
       canonicalize(scope, nameTExp->getName(), Ontology::Space::TYPE);
     }
     else if (auto callExp = CallExp::downcast(ast)) {
-      canonicalizeCallExpFunction(scope, callExp->getFunction());
+      canonicalizeCallExpFunction(scope, callExp);
+      if (callExp->getBuiltin() == CallExp::SORT_BY)
+        canonicalizeComparator(scope, callExp);
       for (auto arg : callExp->getArguments()->asArrayRef())
         canonicalizeNonDecl(scope, arg);
     }
@@ -59,15 +97,32 @@ private:
       for (auto arg : constrExp->getFields()->asArrayRef())
         canonicalizeNonDecl(scope, arg);
     }
+    else if (auto nameExp = NameExp::downcast(ast)) {
+      canonicalizeNameExp(scope, nameExp->getName());
+    }
+    else if (auto blockExp = BlockExp::downcast(ast)) {
+      locals.push();
+      for (Exp* stmt : blockExp->getStatements())
+        canonicalizeNonDecl(scope, stmt);
+      locals.pop();
+    }
+    else if (auto letExp = LetExp::downcast(ast)) {
+      if (TypeExp* ascrip = letExp->getAscrip())
+        canonicalizeNonDecl(scope, ascrip);
+      canonicalizeNonDecl(scope, letExp->getDefinition());
+      locals.add(letExp->getBoundIdent()->asStringRef(), true);
+    }
     else {
       for (AST* node : ast->getASTChildren()) canonicalizeNonDecl(scope, node);
     }
   }
 
-  /// @brief Canonicalizes the function name in a call expression.
+  /// @brief Canonicalizes the function name in a call expression, falling
+  /// back to a compiler builtin if no user function matches.
   /// @param scope fully-qualified name of the (lowest) module in which the
   /// call expression appears.
-  void canonicalizeCallExpFunction(llvm::StringRef scope, Name* functionName) {
+  void canonicalizeCallExpFunction(llvm::StringRef scope, CallExp* callExp) {
+    Name* functionName = callExp->getFunction();
     while (!scope.empty()) {
       std::string fqn = (scope + "::" + functionName->asStringRef()).str();
       if (auto d = ont.getFunction(fqn)) {
@@ -76,11 +131,50 @@ private:
       }
       scope = getQualifier(scope);
     }
+    auto builtin = CallExp::builtinFromName(functionName->asStringRef());
+    if (builtin != CallExp::NOT_BUILTIN) {
+      callExp->setBuiltin(builtin);
+      return;
+    }
     errors.push_back(LocatedError()
       << "Function not found.\n" << functionName->getLocation()
     );
   }
 
+  /// @brief Moves the function named by the last argument of a `sort_by`
+  /// call into the call's comparator and fully qualifies it. A last argument
+  /// that does not name a function is left for the Unifier to report.
+  void canonicalizeComparator(llvm::StringRef scope, CallExp* callExp) {
+    llvm::ArrayRef<Exp*> args = callExp->getArguments()->asArrayRef();
+    auto nameExp = args.empty() ? nullptr : NameExp::downcast(args.back());
+    if (nameExp == nullptr) return;
+    Name* name = nameExp->getName();
+    if (locals.getOrElse(name->asStringRef(), false)) return;
+    while (!scope.empty()) {
+      std::string fqn = (scope + "::" + name->asStringRef()).str();
+      if (ont.getFunction(fqn) != nullptr) {
+        callExp->setComparator(new Name(name->getLocation(), fqn));
+        callExp->getArguments()->popBack()->deleteRecursive();
+        return;
+      }
+      scope = getQualifier(scope);
+    }
+  }
+
+  /// @brief Qualifies @p name if it refers to a global constant rather than a
+  /// local variable.
+  void canonicalizeNameExp(llvm::StringRef scope, Name* name) {
+    if (locals.getOrElse(name->asStringRef(), false)) return;
+    while (!scope.empty()) {
+      std::string fqn = (scope + "::" + name->asStringRef()).str();
+      if (ont.getConst(fqn) != nullptr) {
+        name->set(fqn);
+        return;
+      }
+      scope = getQualifier(scope);
+    }
+  }
+
   /// @brief Canonicalizes the struct name in a constructor invocation.
   /// @param scope fully-qualified name of the (lowest) module in which the
   /// ConstrExp appears.
@@ -2,6 +2,7 @@
 #define SEMA_CATALOGER
 
 #include "common/AST.hpp"
+#include "common/CloneTargets.hpp"
 #include "common/LocatedError.hpp"
 #include "common/Ontology.hpp"
 
@@ -18,6 +19,7 @@ public:
 
   /// @brief Recursively catalogs a decl that appears in @p scope.
   void run(Decl* decl, llvm::StringRef scope) {
+    checkAttributes(decl);
     if (auto mod = ModuleDecl::downcast(decl)) {
       llvm::StringRef relName = mod->getName()->asStringRef();
       std::string fqn = (scope + "::" + relName).str();
@@ -46,6 +48,20 @@ public:
         ont.record(fqn, structDecl);
       }
     }
+    else if (auto constDecl = ConstDecl::downcast(decl)) {
+      llvm::StringRef relName = constDecl->getName()->asStringRef();
+      std::string fqn = (scope + "::" + relName).str();
+      if (auto prevDef = ont.getConst(fqn)) {
+        errors.push_back(LocatedError()
+          << "Constant is already defined.\n"
+          << decl->getName()->getLocation()
+          << "Previous definition was here:\n"
+          << prevDef->getName()->getLocation()
+        );
+      } else {
+        ont.record(fqn, constDecl);
+      }
+    }
     else if (auto func = FunctionDecl::downcast(decl)) {
       llvm::StringRef relName = func->getName()->asStringRef();
       std::string fqn = (scope + "::" + relName).str();
@@ -80,6 +96,86 @@ public:
   void run(DeclList* declList, llvm::StringRef scope)
     { for (auto decl : declList->asArrayRef()) run(decl, scope); }
 
+private:
+
+  /// @brief An attribute that may be applied to one kind of decl.
+  struct AttributeSpec {
+    AST::ID declKind;
+    const char* name;
+    unsigned minArgs;
+    unsigned maxArgs;
+  };
+
+  /// @brief All recognized attributes.
+  static constexpr AttributeSpec attributeSpecs[] = {
+    { AST::ID::FUNC, "cold", 0, 0 },
+    { AST::ID::STRUCT, "soa", 0, 0 },
+    { AST::ID::FUNC, "target_clones", 1, 8 },
+  };
+
+  /// @brief Pushes an error for each attribute of @p decl that is unknown,
+  /// not applicable to @p decl, or given the wrong number of arguments.
+  void checkAttributes(Decl* decl) {
+    for (const Attribute& attr : decl->getAttributes()) {
+      const AttributeSpec* spec = nullptr;
+      for (const AttributeSpec& s : attributeSpecs)
+        if (s.declKind == decl->id && attr.getName() == s.name) spec = &s;
+      if (spec == nullptr) {
+        errors.push_back(LocatedError()
+          << "Attribute " << attr.getName()
+          << " is not applicable to this declaration.\n" << attr.getLocation()
+        );
+      } else if (attr.getArgs().size() < spec->minArgs
+              || attr.getArgs().size() > spec->maxArgs) {
+        errors.push_back(LocatedError()
+          << "Wrong number of arguments for attribute " << attr.getName()
+          << ".\n" << attr.getLocation()
+        );
+      } else if (attr.getName() == "target_clones") {
+        checkTargetClones(FunctionDecl::downcast(decl), attr);
+      }
+    }
+  }
+
+  /// @brief Checks that the targets of `#[target_clones(...)]` are known and
+  /// distinct, include `default`, and annotate a non-async function with a
+  /// body.
+  void checkTargetClones(FunctionDecl* func, const Attribute& attr) {
+    if (func->isExtern()) {
+      errors.push_back(LocatedError()
+        << "Only functions with a body can have target clones.\n"
+        << attr.getLocation()
+      );
+    }
+    if (func->isAsync()) {
+      errors.push_back(LocatedError()
+        << "Async functions cannot have target clones.\n"
+        << attr.getLocation()
+      );
+    }
+    llvm::ArrayRef<std::string> targets = attr.getArgs();
+    for (size_t i = 0; i < targets.size(); ++i) {
+      if (targets[i] != "default" && !findCloneTarget(targets[i])) {
+        errors.push_back(LocatedError()
+          << "Unknown clone target " << targets[i] << ".\n"
+          << attr.getLocation()
+        );
+      }
+      if (llvm::is_contained(targets.take_front(i), targets[i])) {
+        errors.push_back(LocatedError()
+          << "Duplicate clone target " << targets[i] << ".\n"
+          << attr.getLocation()
+        );
+      }
+    }
+    if (!llvm::is_contained(targets, "default")) {
+      errors.push_back(LocatedError()
+        << "Target clones must include a default target.\n"
+        << attr.getLocation()
+      );
+    }
+  }
+
 };
 
 #endif
\ No newline at end of file
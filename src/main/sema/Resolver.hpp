@@ -56,6 +56,9 @@ public:
     if (auto refTy = RefType::downcast(ty)) {
       return tc.getRefType(resolveType(refTy->inner), refTy->unique);
     }
+    if (auto futTy = FutureType::downcast(ty)) {
+      return tc.getFutureType(resolveType(futTy->inner));
+    }
     if (Constraint::downcast(ty)) return ty;
     if (NameType::downcast(ty)) return ty;
     if (PrimitiveType::downcast(ty)) return ty;
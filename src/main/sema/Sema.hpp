@@ -1,6 +1,8 @@
 #ifndef SEMA_SEMA
 #define SEMA_SEMA
 
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/StringSet.h>
 #include "sema/Cataloger.hpp"
 #include "sema/Canonicalizer.hpp"
 #include "sema/Unifier.hpp"
@@ -16,8 +18,11 @@
 ///   4. LValueMarker  -- Distinguishes lvalues from rvalues
 ///   5. Resolver      -- Scrubs type variables from the AST
 ///
-/// Cataloguing is run over the entire parsed AST. Then the next four sub-tasks
-/// are run once per non-module decl and can run in parallel.
+/// declare() catalogs the entire parsed AST, canonicalizes every signature,
+/// and analyzes structs and constants, whose checks need all decls to have
+/// been canonicalized. Then the last four sub-tasks are run once per function
+/// body by analyzeBody(). Bodies only depend on signatures, so they can be
+/// analyzed in any order (and one at a time; see CompilerInstance::stream()).
 class Sema {
   Ontology ont;
   TypeContext tc;
@@ -47,16 +52,55 @@ public:
 
   /// @brief Runs all semantic analysis tasks on @p decls. 
   void run(DeclList* decls, llvm::StringRef scope) {
-    Cataloger(ont, errors).run(decls, scope);
+    declare(decls, scope);
     if (!errors.empty()) return;
-    analyzeDeclList(decls, scope);
+    forEachFunction(decls, scope, [&](FunctionDecl* f, llvm::StringRef scope)
+      { analyzeBody(f, scope); });
   }
 
   /// @brief Runs all semantic analysis tasks on @p decl in the global scope.
   void run(Decl* decl, llvm::StringRef scope) {
     Cataloger(ont, errors).run(decl, scope);
     if (!errors.empty()) return;
-    analyzeDecl(decl, scope);
+    runPhase(CANONICALIZE, decl, scope);
+    if (!errors.empty()) return;
+    runPhase(ANALYZE_DECLS, decl, scope);
+    if (!errors.empty()) return;
+    checkConsts();
+    if (!errors.empty()) return;
+    runPhase(ANALYZE_BODIES, decl, scope);
+  }
+
+  /// @brief Runs all sema tasks on @p decls except analyzing function
+  /// bodies, which is left to analyzeBody().
+  void declare(DeclList* decls, llvm::StringRef scope) {
+    Cataloger(ont, errors).run(decls, scope);
+    if (!errors.empty()) return;
+    for (Decl* decl : decls->asArrayRef()) runPhase(CANONICALIZE, decl, scope);
+    if (!errors.empty()) return;
+    for (Decl* decl : decls->asArrayRef())
+      runPhase(ANALYZE_DECLS, decl, scope);
+    if (!errors.empty()) return;
+    checkConsts();
+  }
+
+  /// @brief Runs all sema tasks except cataloging over the body of @p f,
+  /// which appears in @p scope. declare() must have been run.
+  void analyzeBody(FunctionDecl* f, llvm::StringRef scope) {
+    Canonicalizer(ont, errors).runBody(f, scope);
+    if (!errors.empty()) return;
+    Unifier(ont, tc, tvarEquiv, tvarBindings, errors).unifyFunc(f);
+    if (!errors.empty()) return;
+    LValueMarker(errors).run(f);
+    if (!errors.empty()) return;
+    Resolver(tvarEquiv, tvarBindings, tc).resolveAST(f);
+  }
+
+  /// @brief Forgets the type variables of the bodies analyzed so far, which
+  /// the Resolver has scrubbed from the AST.
+  void forgetTypeVars() {
+    tvarEquiv.clear();
+    tvarBindings.clear();
   }
 
   /// @brief Runs all sema tasks except cataloging over @p e.
@@ -70,37 +114,276 @@ public:
     Resolver(tvarEquiv, tvarBindings, tc).resolveAST(e);
   }
 
+  /// @brief Calls @p fn on each function in @p decls, including those in
+  /// nested modules, with the scope that it appears in.
+  static void forEachFunction(DeclList* decls, llvm::StringRef scope,
+      llvm::function_ref<void(FunctionDecl*, llvm::StringRef)> fn) {
+    for (Decl* decl : decls->asArrayRef()) {
+      if (auto funcDecl = FunctionDecl::downcast(decl))
+        fn(funcDecl, scope);
+      else if (auto modDecl = ModuleDecl::downcast(decl))
+        forEachFunction(modDecl->getDecls(),
+          (scope + "::" + modDecl->getName()->asStringRef()).str(), fn);
+    }
+  }
+
 private:
 
-  /// @brief Runs all sema tasks except cataloging over @p decls
-  void analyzeDeclList(DeclList* decls, llvm::StringRef scope)
-    { for (Decl* decl : decls->asArrayRef()) analyzeDecl(decl, scope); }
+  /// @brief The passes over decls: first all names in signatures, structs,
+  /// and constants are canonicalized, then structs and constants are
+  /// analyzed, and then function bodies.
+  enum Phase { CANONICALIZE, ANALYZE_DECLS, ANALYZE_BODIES };
 
-  /// @brief Runs all sema tasks except cataloging over @p decl.
-  void analyzeDecl(Decl* decl, llvm::StringRef scope) {
-    if (auto funcDecl = FunctionDecl::downcast(decl))
-      analyzeFuncDecl(funcDecl, scope);
-    else if (auto modDecl = ModuleDecl::downcast(decl))
-      analyzeDeclList(modDecl->getDecls(),
-        (scope + "::" + modDecl->getName()->asStringRef()).str());
-    else if (auto structDecl = StructDecl::downcast(decl))
-      analyzeStructDecl(structDecl, scope);
+  /// @brief Runs @p phase over @p decl, which appears in @p scope.
+  void runPhase(Phase phase, Decl* decl, llvm::StringRef scope) {
+    if (auto modDecl = ModuleDecl::downcast(decl)) {
+      std::string modScope =
+        (scope + "::" + modDecl->getName()->asStringRef()).str();
+      for (Decl* d : modDecl->getDecls()->asArrayRef())
+        runPhase(phase, d, modScope);
+    }
+    else if (auto funcDecl = FunctionDecl::downcast(decl)) {
+      if (phase == CANONICALIZE)
+        Canonicalizer(ont, errors).runSignature(funcDecl, scope);
+      else if (phase == ANALYZE_DECLS && funcDecl->isExtern())
+        analyzeExternDecl(funcDecl);
+      else if (phase == ANALYZE_BODIES)
+        analyzeBody(funcDecl, scope);
+    }
+    else if (auto structDecl = StructDecl::downcast(decl)) {
+      if (phase == CANONICALIZE)
+        Canonicalizer(ont, errors).run(structDecl, scope);
+      else if (phase == ANALYZE_DECLS)
+        analyzeStructDecl(structDecl);
+    }
+    else if (auto constDecl = ConstDecl::downcast(decl)) {
+      if (phase == CANONICALIZE)
+        Canonicalizer(ont, errors).run(constDecl, scope);
+      else if (phase == ANALYZE_DECLS)
+        analyzeConstDecl(constDecl);
+    }
   }
 
-  /// @brief Runs all sema tasks except cataloging over @p f.
-  void analyzeFuncDecl(FunctionDecl* f, llvm::StringRef scope) {
-    Canonicalizer(ont, errors).run(f, scope);
-    if (!errors.empty()) return;
-    Unifier(ont, tc, tvarEquiv, tvarBindings, errors).unifyFunc(f);
+  /// @brief Checks canonicalized struct @p s.
+  void analyzeStructDecl(StructDecl* s) {
+    if (!s->isSoa()) return;
+
+    // columns of a #[soa] struct must be plain arrays
+    for (auto field : s->getFields()->asArrayRef()) {
+      auto nameTExp = NameTypeExp::downcast(field.second);
+      if (nameTExp && ont.getType(nameTExp->getName()->asStringRef())->isSoa())
+        errors.push_back(LocatedError()
+          << "Fields of a #[soa] struct cannot have a #[soa] struct type.\n"
+          << field.second->getLocation()
+        );
+    }
+  }
+
+  /// @brief Checks the signature of canonicalized extern function @p f. A
+  /// reference to a #[soa] struct holds one pointer per field, which has no
+  /// C equivalent, so it cannot cross the extern boundary.
+  void analyzeExternDecl(FunctionDecl* f) {
+    std::vector<TypeExp*> texps{ f->getReturnType() };
+    for (auto param : f->getParameters()->asArrayRef())
+      texps.push_back(param.second);
+    for (TypeExp* texp : texps) {
+      auto refTExp = RefTypeExp::downcast(texp);
+      auto nameTExp = refTExp ?
+        NameTypeExp::downcast(refTExp->getPointeeType()) : nullptr;
+      if (nameTExp && ont.getType(nameTExp->getName()->asStringRef())->isSoa())
+        errors.push_back(LocatedError()
+          << "Extern functions cannot take or return references to #[soa] "
+          << "structs.\n" << texp->getLocation()
+        );
+    }
+  }
+
+  /// @brief Runs the remaining sema tasks over canonicalized constant @p c,
+  /// and checks that it can be evaluated at compile time.
+  void analyzeConstDecl(ConstDecl* c) {
+    if (tc.getTypeFromTypeExp(c->getType()) == tc.getUnit()) {
+      errors.push_back(LocatedError()
+        << "Constants cannot have type unit.\n" << c->getType()->getLocation()
+      );
+      return;
+    }
+    Unifier(ont, tc, tvarEquiv, tvarBindings, errors).unifyConst(c);
     if (!errors.empty()) return;
-    LValueMarker(errors).run(f);
+    Resolver(tvarEquiv, tvarBindings, tc).resolveAST(c);
+    checkConstInit(c->getInit());
+  }
+
+  /// @brief True iff a value of type @p texp contains a unique reference.
+  /// @param visited names of structs already being searched
+  bool hasUniqueRef(TypeExp* texp, llvm::StringSet<>& visited) {
+    if (auto refTExp = RefTypeExp::downcast(texp))
+      return refTExp->isUnique()
+          || hasUniqueRef(refTExp->getPointeeType(), visited);
+    if (auto nameTExp = NameTypeExp::downcast(texp)) {
+      llvm::StringRef structName = nameTExp->getName()->asStringRef();
+      if (!visited.insert(structName).second) return false;
+      for (auto field : ont.getType(structName)->getFields()->asArrayRef())
+        if (hasUniqueRef(field.second, visited)) return true;
+    }
+    return false;
+  }
+
+  /// @brief Pushes an error for each part of the initializer @p e of a
+  /// constant that cannot be evaluated at compile time.
+  void checkConstInit(Exp* e) {
+    if (BoolLit::downcast(e) || IntLit::downcast(e) || DecimalLit::downcast(e)
+        || StringLit::downcast(e) || NameExp::downcast(e))
+      return;
+    if (auto ascrip = AscripExp::downcast(e))
+      return checkConstInit(ascrip->getAscriptee());
+    if (auto unop = UnopExp::downcast(e))
+      return checkConstInit(unop->getInner());
+    if (auto binop = BinopExp::downcast(e)) {
+      checkConstInit(binop->getLHS());
+      return checkConstInit(binop->getRHS());
+    }
+    if (auto constr = ConstrExp::downcast(e)) {
+      for (Exp* field : constr->getFields()->asArrayRef())
+        checkConstInit(field);
+      return;
+    }
+    if (auto array = ArrayLit::downcast(e)) {
+      auto elemTy = NameType::downcast(RefType::downcast(e->getType())->inner);
+      if (elemTy && ont.getType(elemTy->asString)->isSoa())
+        errors.push_back(LocatedError()
+          << "Array literals of #[soa] structs are not supported.\n"
+          << e->getLocation()
+        );
+      for (Exp* element : array->getElements()->asArrayRef())
+        checkConstInit(element);
+      return;
+    }
+    errors.push_back(LocatedError()
+      << "Constant initializer must be a constant expression.\n"
+      << e->getLocation()
+    );
+  }
+
+  /// @brief Pushes an error for each constant that holds a unique reference,
+  /// whose initializer refers back to the constant itself, or whose
+  /// initializer is undefined.
+  void checkConsts() {
+    llvm::DenseMap<ConstDecl*, bool> finished;
+    for (auto& entry : ont.constSpace) {
+      ConstDecl* c = entry.second;
+      llvm::StringSet<> visited;
+      if (hasUniqueRef(c->getType(), visited))
+        errors.push_back(LocatedError()
+          << "Constants cannot hold unique references since nothing could "
+             "free them.\n" << c->getType()->getLocation()
+        );
+      checkConstCycles(c, finished);
+    }
     if (!errors.empty()) return;
-    Resolver(tvarEquiv, tvarBindings, tc).resolveAST(f);
+    llvm::DenseMap<ConstDecl*, std::optional<llvm::APInt>> values;
+    for (auto& entry : ont.constSpace)
+      if (!values.count(entry.second))
+        values[entry.second] = evalConstInit(entry.second->getInit(), values);
   }
 
-  /// @brief Runs all sema tasks except cataloging over @p s.
-  void analyzeStructDecl(StructDecl* s, llvm::StringRef scope)
-    { Canonicalizer(ont, errors).run(s, scope); }
+  /// @brief Evaluates the integer parts of the initializer (part) @p e of a
+  /// constant, and pushes an error for each division or remainder by zero
+  /// and each signed division that overflows, whose results are undefined.
+  /// Returns the value of @p e if it is a known integer.
+  /// @param values the values of the constants evaluated so far
+  std::optional<llvm::APInt> evalConstInit(Exp* e,
+      llvm::DenseMap<ConstDecl*, std::optional<llvm::APInt>>& values) {
+    if (auto lit = IntLit::downcast(e)) {
+      auto primTy = PrimitiveType::downcast(e->getType());
+      if (primTy == nullptr || !primTy->isInteger()) return std::nullopt;
+      unsigned width = primTy->kind == PrimitiveType::i8 ? 8
+        : primTy->kind == PrimitiveType::i16 ? 16
+        : primTy->kind == PrimitiveType::i32 ? 32 : 64;
+      return llvm::APInt(64, lit->asLong(), true).sextOrTrunc(width);
+    }
+    if (auto name = NameExp::downcast(e)) {
+      ConstDecl* c = ont.getConst(name->getName()->asStringRef());
+      if (!values.count(c)) values[c] = evalConstInit(c->getInit(), values);
+      return values[c];
+    }
+    if (auto ascrip = AscripExp::downcast(e))
+      return evalConstInit(ascrip->getAscriptee(), values);
+    if (auto unop = UnopExp::downcast(e)) {
+      std::optional<llvm::APInt> v = evalConstInit(unop->getInner(), values);
+      if (!v || unop->getUnop() != UnopExp::NEG) return std::nullopt;
+      return -*v;
+    }
+    if (auto binop = BinopExp::downcast(e)) {
+      std::optional<llvm::APInt> l = evalConstInit(binop->getLHS(), values);
+      std::optional<llvm::APInt> r = evalConstInit(binop->getRHS(), values);
+      if (!l || !r) return std::nullopt;
+      auto primTy = PrimitiveType::downcast(binop->getLHS()->getType());
+      bool isUnsigned = primTy && primTy->kind == PrimitiveType::USIZE;
+      unsigned shift = r->getZExtValue() & (l->getBitWidth() - 1);
+      switch (binop->getBinop()) {
+      case BinopExp::ADD: return *l + *r;
+      case BinopExp::SUB: return *l - *r;
+      case BinopExp::MUL: return *l * *r;
+      case BinopExp::BITAND: return *l & *r;
+      case BinopExp::BITOR: return *l | *r;
+      case BinopExp::BITXOR: return *l ^ *r;
+      case BinopExp::SHL: return l->shl(shift);
+      case BinopExp::SHR: return isUnsigned ? l->lshr(shift) : l->ashr(shift);
+      case BinopExp::DIV:
+      case BinopExp::MOD:
+        if (r->isZero())
+          errors.push_back(LocatedError()
+            << "Division by zero in constant initializer.\n"
+            << binop->getLocation()
+          );
+        else if (!isUnsigned && l->isMinSignedValue() && r->isAllOnes())
+          errors.push_back(LocatedError()
+            << "Signed division overflows in constant initializer.\n"
+            << binop->getLocation()
+          );
+        else if (binop->getBinop() == BinopExp::DIV)
+          return isUnsigned ? l->udiv(*r) : l->sdiv(*r);
+        else
+          return isUnsigned ? l->urem(*r) : l->srem(*r);
+        return std::nullopt;
+      default:
+        return std::nullopt;
+      }
+    }
+    if (auto constr = ConstrExp::downcast(e)) {
+      for (Exp* field : constr->getFields()->asArrayRef())
+        evalConstInit(field, values);
+    }
+    if (auto array = ArrayLit::downcast(e)) {
+      for (Exp* element : array->getElements()->asArrayRef())
+        evalConstInit(element, values);
+    }
+    return std::nullopt;
+  }
+
+  /// @param finished maps each constant visited so far to whether its
+  /// dependencies have all been checked
+  void checkConstCycles(ConstDecl* c,
+                        llvm::DenseMap<ConstDecl*, bool>& finished) {
+    auto inserted = finished.insert({ c, false });
+    if (!inserted.second) {
+      if (!inserted.first->second)
+        errors.push_back(LocatedError()
+          << "Constant depends on itself.\n" << c->getName()->getLocation()
+        );
+      return;
+    }
+    llvm::SmallVector<AST*, 8> worklist = { c->getInit() };
+    while (!worklist.empty()) {
+      AST* ast = worklist.pop_back_val();
+      if (auto nameExp = NameExp::downcast(ast)) {
+        if (ConstDecl* dep = ont.getConst(nameExp->getName()->asStringRef()))
+          checkConstCycles(dep, finished);
+      }
+      else worklist.append(ast->getASTChildren());
+    }
+    finished[c] = true;
+  }
 
 };
 
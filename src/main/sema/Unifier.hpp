@@ -42,6 +42,19 @@ class Unifier {
   /// @brief Maps names of local identifiers to their types.
   ScopeStack<Type*> localVarTypes;
 
+  /// @brief True while unifying the initializer of a constant, the only
+  /// place where array literals are allowed.
+  bool inConstInit = false;
+
+  /// @brief True while unifying the body of an `async` function, the only
+  /// place where `await` is allowed.
+  bool inAsyncFunc = false;
+
+  /// @brief Calls to `soa_alloc` and `soa_free` in the current function,
+  /// with the type they allocate or free. These must be `#[soa]` structs,
+  /// which is checked once the whole body has been unified.
+  std::vector<std::pair<CallExp*, TypeVar*>> soaCalls;
+
 public:
   Unifier(Ontology& ont, TypeContext& tc,
           llvm::DenseMap<TypeVar*, TypeVar*>& tvarEquiv,
@@ -57,10 +70,20 @@ public:
     localVarTypes.push();
     addParamsToLocalVarTypes(func->getParameters());
     Type* retTy = tc.getTypeFromTypeExp(func->getReturnType());
+    inAsyncFunc = func->isAsync();
     expectTypeToBe(func->getBody(), retTy);
+    inAsyncFunc = false;
+    checkSoaCalls();
     localVarTypes.pop();
   }
 
+  void unifyConst(ConstDecl* constDecl) {
+    inConstInit = true;
+    expectTypeToBe(constDecl->getInit(),
+      tc.getTypeFromTypeExp(constDecl->getType()));
+    inConstInit = false;
+  }
+
   /// @brief Unifies an expression or statement. Returns the type of @p _e. 
   /// Expressions or statements that bind local identifiers will cause
   /// `localVarTypes` to be updated.
@@ -72,6 +95,23 @@ public:
       e->setType(tc.getRefType(ofTy, false));
     }
 
+    else if (auto e = ArrayLit::downcast(_e)) {
+      llvm::ArrayRef<Exp*> elements = e->getElements()->asArrayRef();
+      if (!inConstInit)
+        errors.push_back(LocatedError()
+          << "Array literals are only allowed in constant initializers.\n"
+          << e->getLocation()
+        );
+      else if (elements.empty())
+        errors.push_back(LocatedError()
+          << "Array literal must have at least one element.\n"
+          << e->getLocation()
+        );
+      TypeVar* elemTy = tc.getFreshTypeVar();
+      for (Exp* element : elements) expectTypeToBe(element, elemTy);
+      e->setType(tc.getRefType(elemTy, false));
+    }
+
     else if (auto e = AscripExp::downcast(_e)) {
       Type* ty = tc.getTypeFromTypeExp(e->getAscripter());
       expectTypeToBe(e->getAscriptee(), ty);
@@ -84,6 +124,17 @@ public:
       e->setType(tc.getUnit());
     }
 
+    else if (auto e = AwaitExp::downcast(_e)) {
+      if (!inAsyncFunc)
+        errors.push_back(LocatedError()
+          << "Await is only allowed inside an async function.\n"
+          << e->getLocation()
+        );
+      TypeVar* retTy = tc.getFreshTypeVar();
+      expectTypeToBe(e->getInner(), tc.getFutureType(retTy));
+      e->setType(retTy);
+    }
+
     else if (auto e = BinopExp::downcast(_e)) {
       switch (e->getBinop()) {
       case BinopExp::ADD: case BinopExp::SUB: case BinopExp::MUL:
@@ -93,6 +144,13 @@ public:
         e->setType(lhsTy);
         break; 
       }
+      case BinopExp::BITAND: case BinopExp::BITOR: case BinopExp::BITXOR:
+      case BinopExp::SHL: case BinopExp::SHR: {
+        Type* lhsTy = expectTypeToBe(e->getLHS(), tc.getInteger());
+        expectTypeToBe(e->getRHS(), lhsTy);
+        e->setType(lhsTy);
+        break;
+      }
       case BinopExp::AND: case BinopExp::OR: {
         Type* boolType = tc.getBool();
         expectTypeToBe(e->getLHS(), boolType);
@@ -151,6 +209,8 @@ public:
       std::string s = e->getName()->asStringRef().str();
       if (Type* ty = localVarTypes.getOrElse(s, nullptr)) {
         e->setType(ty);
+      } else if (ConstDecl* constDecl = ont.getConst(s)) {
+        e->setType(tc.getTypeFromTypeExp(constDecl->getType()));
       } else {
         errors.push_back(LocatedError()
           << "Unbound identifier.\n" << e->getLocation()
@@ -174,7 +234,7 @@ public:
     else if (auto e = IndexExp::downcast(_e)) {
       Type* refTy = tc.getRefType(tc.getFreshTypeVar(), false);
       Type* baseTy = expectTypeToBe(e->getBase(), refTy);
-      expectTypeToBe(e->getIndex(), tc.getNumeric());
+      expectTypeToBe(e->getIndex(), tc.getIndex());
       e->setType(baseTy);
     }
 
@@ -239,6 +299,7 @@ public:
 
   /// @brief Unifies a function call expression.
   void unifyCallExp(CallExp* e) {
+    if (e->isBuiltin()) return unifyBuiltinCallExp(e);
     llvm::StringRef calleeName = e->getFunction()->asStringRef();
     llvm::ArrayRef<Exp*> args = e->getArguments()->asArrayRef();
     llvm::ArrayRef<std::pair<Name*, TypeExp*>> params;
@@ -248,7 +309,8 @@ public:
     FunctionDecl* calleeDecl = ont.getFunction(calleeName);
     params = calleeDecl->getParameters()->asArrayRef();
     variadic = calleeDecl->isVariadic();
-    e->setType(tc.getTypeFromTypeExp(calleeDecl->getReturnType()));
+    Type* retTy = tc.getTypeFromTypeExp(calleeDecl->getReturnType());
+    e->setType(calleeDecl->isAsync() ? tc.getFutureType(retTy) : retTy);
 
     // check for arity mismatch
     if (!variadic && args.size() != params.size())
@@ -271,6 +333,225 @@ public:
     }
   }
 
+  /// @brief Unifies a call to a compiler builtin.
+  void unifyBuiltinCallExp(CallExp* e) {
+    llvm::StringRef calleeName = e->getFunction()->asStringRef();
+    llvm::ArrayRef<Exp*> args = e->getArguments()->asArrayRef();
+    unsigned arity = builtinArity(e->getBuiltin());
+    unsigned numArgs = args.size() + (e->getComparator() ? 1 : 0);
+    if (numArgs != arity) {
+      errors.push_back(LocatedError()
+        << "Arity mismatch for builtin " << calleeName << ". Expected "
+        << std::to_string(arity) << " arguments but got "
+        << std::to_string(args.size()) << ".\n" << e->getLocation()
+      );
+      for (Exp* arg : args) unifyExp(arg);
+      e->setType(tc.getFreshTypeVar());
+      return;
+    }
+
+    switch (e->getBuiltin()) {
+    case CallExp::LIKELY:
+    case CallExp::UNLIKELY:
+      expectTypeToBe(args[0], tc.getBool());
+      e->setType(tc.getBool());
+      return;
+    case CallExp::BLOCK_ON: {
+      if (inAsyncFunc)
+        errors.push_back(LocatedError()
+          << "Cannot block inside an async function. Use await instead.\n"
+          << e->getLocation()
+        );
+      TypeVar* retTy = tc.getFreshTypeVar();
+      expectTypeToBe(args[0], tc.getFutureType(retTy));
+      e->setType(retTy);
+      return;
+    }
+    case CallExp::ALLOC:
+      expectTypeToBe(args[0], tc.getI64());
+      e->setType(tc.getRefType(tc.getI8(), true));
+      return;
+    case CallExp::REALLOC:
+      expectTypeToBe(args[0], tc.getRefType(tc.getI8(), true));
+      expectTypeToBe(args[1], tc.getI64());
+      e->setType(tc.getRefType(tc.getI8(), true));
+      return;
+    case CallExp::FREE:
+      expectTypeToBe(args[0], tc.getRefType(tc.getI8(), true));
+      e->setType(tc.getUnit());
+      return;
+    case CallExp::SOA_ALLOC: {
+      TypeVar* structTy = tc.getFreshTypeVar();
+      soaCalls.push_back({ e, structTy });
+      expectTypeToBe(args[0], tc.getUsize());
+      e->setType(tc.getRefType(structTy, true));
+      return;
+    }
+    case CallExp::SOA_FREE: {
+      TypeVar* structTy = tc.getFreshTypeVar();
+      soaCalls.push_back({ e, structTy });
+      expectTypeToBe(args[0], tc.getRefType(structTy, true));
+      e->setType(tc.getUnit());
+      return;
+    }
+    case CallExp::SORT:
+      expectElementsToBe(args[0], tc.getNumeric());
+      expectTypeToBe(args[1], tc.getUsize());
+      e->setType(tc.getUnit());
+      return;
+    case CallExp::RADIX_SORT:
+      expectElementsToBe(args[0], tc.getInteger());
+      expectTypeToBe(args[1], tc.getUsize());
+      e->setType(tc.getUnit());
+      return;
+    case CallExp::SORT_BY: {
+      TypeVar* elemTy = tc.getFreshTypeVar();
+      expectTypeToBe(args[0], tc.getRefType(elemTy, false));
+      expectTypeToBe(args[1], tc.getUsize());
+      expectComparator(e, elemTy);
+      e->setType(tc.getUnit());
+      return;
+    }
+    case CallExp::LOWER_BOUND: {
+      Type* elemTy = expectElementsToBe(args[0], tc.getNumeric());
+      expectTypeToBe(args[1], tc.getUsize());
+      expectTypeToBe(args[2], elemTy);
+      e->setType(tc.getUsize());
+      return;
+    }
+    case CallExp::PREFETCH:
+      expectTypeToBe(args[0], tc.getRefType(tc.getFreshTypeVar(), false));
+      expectPrefetchOperand(args[1], 1, "read/write flag");
+      expectPrefetchOperand(args[2], 3, "locality");
+      e->setType(tc.getUnit());
+      return;
+    case CallExp::BITREVERSE:
+    case CallExp::BSWAP:
+    case CallExp::CLZ:
+    case CallExp::CTZ:
+    case CallExp::POPCOUNT:
+      e->setType(expectTypeToBe(args[0], tc.getInteger()));
+      return;
+    case CallExp::ROTL:
+    case CallExp::ROTR: {
+      Type* ty = expectTypeToBe(args[0], tc.getInteger());
+      expectTypeToBe(args[1], ty);
+      e->setType(ty);
+      return;
+    }
+    case CallExp::ABS:
+    case CallExp::CEIL:
+    case CallExp::FLOOR:
+    case CallExp::FMA:
+    case CallExp::MAX:
+    case CallExp::MIN:
+    case CallExp::ROUND:
+    case CallExp::SQRT:
+    case CallExp::TRUNC: {
+      Type* ty = expectTypeToBe(args[0], tc.getDecimal());
+      for (Exp* arg : args.drop_front()) expectTypeToBe(arg, ty);
+      e->setType(ty);
+      return;
+    }
+    case CallExp::NOT_BUILTIN:
+      break;
+    }
+    llvm_unreachable("Unifier::unifyBuiltinCallExp() unexpected builtin");
+  }
+
+  /// @brief Returns the number of arguments that @p builtin takes.
+  static unsigned builtinArity(CallExp::Builtin builtin) {
+    switch (builtin) {
+    case CallExp::FMA:
+    case CallExp::LOWER_BOUND:
+    case CallExp::PREFETCH:
+    case CallExp::SORT_BY:     return 3;
+    case CallExp::MAX:
+    case CallExp::MIN:
+    case CallExp::RADIX_SORT:
+    case CallExp::REALLOC:
+    case CallExp::ROTL:
+    case CallExp::ROTR:
+    case CallExp::SORT:        return 2;
+    default:                   return 1;
+    }
+  }
+
+  /// @brief Checks that @p arg is a (borrowed) reference to elements that
+  /// satisfy @p constraint, and returns the element type.
+  Type* expectElementsToBe(Exp* arg, Constraint* constraint) {
+    TypeVar* elemTy = tc.getFreshTypeVar();
+    expectTypeToBe(arg, tc.getRefType(elemTy, false));
+    if (!unify(elemTy, constraint))
+      errors.push_back(LocatedError()
+        << "Expected a reference to " << constraint->asString()
+        << " elements but got " << softResolveType(arg->getType())->asString()
+        << ".\n" << arg->getLocation()
+      );
+    return elemTy;
+  }
+
+  /// @brief Checks that the comparator of `sort_by` call @p e is a function
+  /// `(&T, &T): bool`, where @p elemTy is `T`.
+  void expectComparator(CallExp* e, TypeVar* elemTy) {
+    Name* name = e->getComparator();
+    if (name == nullptr) {
+      errors.push_back(LocatedError()
+        << "The last argument of sort_by must name a comparison function.\n"
+        << e->getArguments()->asArrayRef().back()->getLocation()
+      );
+      return;
+    }
+    FunctionDecl* f = ont.getFunction(name->asStringRef());
+    auto params = f->getParameters()->asArrayRef();
+    bool ok = !f->isAsync() && !f->isVariadic() && params.size() == 2
+      && unify(tc.getTypeFromTypeExp(f->getReturnType()), tc.getBool());
+    for (auto param : params)
+      ok = ok && unify(tc.getTypeFromTypeExp(param.second),
+                       tc.getRefType(elemTy, false));
+    if (!ok) {
+      errors.push_back(LocatedError()
+        << "Comparator " << name->asStringRef() << " must have type "
+        << "(&T, &T): bool where T is the element type "
+        << softResolveType(elemTy)->asString() << ".\n" << name->getLocation()
+      );
+      return;
+    }
+    auto structTy = NameType::downcast(softResolveType(elemTy));
+    if (structTy && ont.getType(structTy->asString)->isSoa())
+      errors.push_back(LocatedError()
+        << "Cannot sort_by #[soa] struct " << structTy->asString << ".\n"
+        << e->getLocation()
+      );
+  }
+
+  /// @brief Checks that every `soa_alloc` and `soa_free` call of the
+  /// function just unified works on a `#[soa]` struct.
+  void checkSoaCalls() {
+    for (auto [e, structTy] : soaCalls) {
+      auto nameTy = NameType::downcast(softResolveType(structTy));
+      if (nameTy && ont.getType(nameTy->asString)->isSoa()) continue;
+      errors.push_back(LocatedError()
+        << e->getFunction()->asStringRef() << " needs a unique reference to "
+        << "a #[soa] struct, but got uniq &"
+        << softResolveType(structTy)->asString() << ".\n" << e->getLocation()
+      );
+    }
+    soaCalls.clear();
+  }
+
+  /// @brief Checks that @p arg is an integer literal between 0 and @p max,
+  /// as required for the constant operands of `prefetch`.
+  void expectPrefetchOperand(Exp* arg, long max, const char* what) {
+    expectTypeToBe(arg, tc.getNumeric());
+    auto lit = IntLit::downcast(arg);
+    if (lit == nullptr || lit->asLong() < 0 || lit->asLong() > max)
+      errors.push_back(LocatedError()
+        << "Prefetch " << what << " must be an integer literal from 0 to "
+        << std::to_string(max) << ".\n" << arg->getLocation()
+      );
+  }
+
   /// @brief Unifies a struct constructor expression.
   void unifyConstrExp(ConstrExp* e) {
     llvm::StringRef calleeName = e->getStruct()->asStringRef();
@@ -358,13 +639,23 @@ private:
   Type* unify(Type* ty1, Type* ty2) {
     if (auto t1 = Constraint::downcast(ty1)) {
       if (auto t2 = Constraint::downcast(ty2))      return unifyH(t1, t2);
+      if (auto t2 = FutureType::downcast(ty2))      return nullptr;
       if (auto t2 = NameType::downcast(ty2))        return nullptr;
       if (auto t2 = PrimitiveType::downcast(ty2))   return unifyH(t1, t2);
       if (auto t2 = RefType::downcast(ty2))         return nullptr;
       if (auto t2 = TypeVar::downcast(ty2))         return unifyH(t2, t1);
     }
+    if (auto t1 = FutureType::downcast(ty1)) {
+      if (auto t2 = Constraint::downcast(ty2))      return nullptr;
+      if (auto t2 = FutureType::downcast(ty2))      return unifyH(t1, t2);
+      if (auto t2 = NameType::downcast(ty2))        return nullptr;
+      if (auto t2 = PrimitiveType::downcast(ty2))   return nullptr;
+      if (auto t2 = RefType::downcast(ty2))         return nullptr;
+      if (auto t2 = TypeVar::downcast(ty2))         return unifyH(t2, t1);
+    }
     if (auto t1 = NameType::downcast(ty1)) {
       if (auto t2 = Constraint::downcast(ty2))      return nullptr;
+      if (auto t2 = FutureType::downcast(ty2))      return nullptr;
       if (auto t2 = NameType::downcast(ty2))        return unifyH(t1, t2);
       if (auto t2 = PrimitiveType::downcast(ty2))   return nullptr;
       if (auto t2 = RefType::downcast(ty2))         return nullptr;
@@ -372,6 +663,7 @@ private:
     }
     if (auto t1 = PrimitiveType::downcast(ty1)) {
       if (auto t2 = Constraint::downcast(ty2))      return unifyH(t2, t1);
+      if (auto t2 = FutureType::downcast(ty2))      return nullptr;
       if (auto t2 = NameType::downcast(ty2))        return nullptr;
       if (auto t2 = PrimitiveType::downcast(ty2))   return unifyH(t1, t2);
       if (auto t2 = RefType::downcast(ty2))         return nullptr;
@@ -379,6 +671,7 @@ private:
     }
     if (auto t1 = RefType::downcast(ty1)) {
       if (auto t2 = Constraint::downcast(ty2))      return nullptr;
+      if (auto t2 = FutureType::downcast(ty2))      return nullptr;
       if (auto t2 = NameType::downcast(ty2))        return nullptr;
       if (auto t2 = PrimitiveType::downcast(ty2))   return nullptr;
       if (auto t2 = RefType::downcast(ty2))         return unifyH(t1, t2);
@@ -392,9 +685,13 @@ private:
   }
 
   Type* unifyH(Constraint* c1, Constraint* c2) {
-    return c1->kind == Constraint::DECIMAL || c2->kind == Constraint::DECIMAL ?
-           tc.getDecimal() :
-           tc.getNumeric();
+    if (c1->kind == Constraint::NUMERIC) return c2;
+    if (c2->kind == Constraint::NUMERIC) return c1;
+    if (c1->kind == Constraint::INTEGER && c2->kind != Constraint::DECIMAL)
+      return c2;
+    if (c2->kind == Constraint::INTEGER && c1->kind != Constraint::DECIMAL)
+      return c1;
+    return c1 == c2 ? c1 : nullptr;
   }
 
   Type* unifyH(Constraint* c, PrimitiveType* p) {
@@ -405,6 +702,9 @@ private:
       default: return nullptr;
       }
     }
+    if (c->kind == Constraint::INDEX || c->kind == Constraint::INTEGER) {
+      return p->isInteger() ? p : nullptr;
+    }
     if (c->kind == Constraint::NUMERIC) {
       switch (p->kind) {
       case PrimitiveType::f32:
@@ -412,7 +712,9 @@ private:
       case PrimitiveType::i8:
       case PrimitiveType::i16:
       case PrimitiveType::i32:
-      case PrimitiveType::i64: return p;
+      case PrimitiveType::i64:
+      case PrimitiveType::ISIZE:
+      case PrimitiveType::USIZE: return p;
       default: return nullptr;
       }
     }
@@ -432,6 +734,12 @@ private:
     return tc.getRefType(unifiedInner, r1->unique);
   }
 
+  Type* unifyH(FutureType* f1, FutureType* f2) {
+    Type* unifiedInner = unify(f1->inner, f2->inner);
+    if (unifiedInner == nullptr) return nullptr;
+    return tc.getFutureType(unifiedInner);
+  }
+
   Type* unifyH(TypeVar* v1, TypeVar* v2) {
     TypeVar* w1 = find(v1);
     TypeVar* w2 = find(v2);
@@ -491,6 +799,9 @@ private:
     if (auto refTy = RefType::downcast(ty)) {
       return tc.getRefType(softResolveType(refTy->inner), refTy->unique);
     }
+    if (auto futTy = FutureType::downcast(ty)) {
+      return tc.getFutureType(softResolveType(futTy->inner));
+    }
     if (Constraint::downcast(ty)) return ty;
     if (NameType::downcast(ty)) return ty;
     if (PrimitiveType::downcast(ty)) return ty;
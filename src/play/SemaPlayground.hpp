@@ -2,30 +2,29 @@
 #define SEMAPLAYGROUND
 
 #include <iostream>
-#include "lexer/Lexer.hpp"
-#include "parser/Parser.hpp"
-#include "sema/Sema.hpp"
-
-AST* parse_function1(Parser& p, llvm::StringRef whatToParse) {
-  if (whatToParse == "decl") return p.decl();
-  if (whatToParse == "exp") return p.exp();
-  llvm::outs() << "I don't know how to parse a " << whatToParse << "\n";
-  exit(1);
+#include <llvm/LineEditor/LineEditor.h>
+#include "driver/CompilerInstance.hpp"
+
+/// @brief Prefix that turns an expression into a declaration, since
+/// CompilerInstance only parses declarations. Ends in a newline so the
+/// expression keeps its columns (its rows are one higher).
+const char expPrefix[] = "func playground(): unit = { let it =\n";
+const char expSuffix[] = "\n; };";
+
+/// @brief Returns the expression that @p decls wraps with expPrefix.
+Exp* unwrap_exp(DeclList* decls) {
+  auto func = FunctionDecl::downcast(decls->asArrayRef().front());
+  auto block = BlockExp::downcast(func->getBody());
+  return LetExp::downcast(block->getStatements().front())->getDefinition();
 }
 
-void type_function(Sema& sema, AST* _ast, const char* whatToType) {
-  if (!strcmp(whatToType, "decl")) {
-    sema.run(static_cast<Decl*>(_ast), "global");
-  }
-  else if (!strcmp(whatToType, "exp")) {
-    sema.analyzeExp(static_cast<Exp*>(_ast), "global");
-  } else {
-    llvm::outs() << "I don't know how to analyze a " << whatToType << "\n";
+int play_with_sema(char* grammarElement) {
+  bool isExp = !strcmp(grammarElement, "exp");
+  if (!isExp && strcmp(grammarElement, "decl")) {
+    llvm::outs() << "I don't know how to analyze a " << grammarElement << "\n";
     exit(1);
   }
-}
 
-int play_with_sema(char* grammarElement) {
   llvm::LineEditor lineEditor("");
 
   std::string usrInput;
@@ -44,29 +43,20 @@ next_line:
   usrInput += line; usrInput += "\n";
 
 check_input:
-  LocationTable LT(usrInput.c_str());
-  auto tokens = Lexer(usrInput.c_str(), &LT).run();
-  Parser parser(tokens);
-  AST* parsed = parse_function1(parser, grammarElement);
-  if (parsed != nullptr) {
-
-    Sema sema;
-    type_function(sema, parsed, grammarElement);
-    for (auto err : sema.getErrors()) {
-      std::cout << err.render(usrInput.c_str(), LT);
-    }
-    if (sema.getErrors().size() == 0) {
-      parsed->dump();
-    }
-
-    parsed->deleteRecursive();
-    goto next_input;
-  } else if (line.size() == 0) {
-    llvm::outs()
-      << parser.getError().render(usrInput.c_str(), LT)
-      << "\n";
+  CompilerInstance ci;
+  if (!ci.parse(isExp ? expPrefix + usrInput + expSuffix : usrInput)) {
+    if (line.size() != 0) goto next_line;
+    std::cout << ci.renderErrors() << "\n";
     goto next_input;
-  } else goto next_line;
+  }
+
+  if (!ci.analyze())
+    std::cout << ci.renderErrors();
+  else if (isExp)
+    unwrap_exp(ci.getDecls())->dump();
+  else
+    ci.getDecls()->dump();
+  goto next_input;
 }
 
-#endif
\ No newline at end of file
+#endif
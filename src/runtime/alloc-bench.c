@@ -0,0 +1,239 @@
+/*
+ * Benchmarks the MiSCR allocator (alloc.c) against glibc malloc.
+ *
+ * Each workload runs once per allocator, in a forked process of its own so
+ * that their memory use does not mix:
+ *
+ *   local   every thread allocates batches of small objects and frees them
+ *           in random order
+ *   remote  threads in pairs: one allocates objects, the other frees them
+ *   rss     every thread allocates many objects and frees 90% of them, then
+ *           the rest; reports how much memory stays resident
+ *
+ * Throughput is in million allocations plus frees per second. Build with
+ * `./build.sh alloc-bench` and run `./alloc-bench [THREADS]`.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+void* miscr_alloc(int64_t size);
+void miscr_free(void* p);
+
+typedef struct Allocator {
+  const char* name;
+  void* (*alloc)(size_t);
+  void (*free)(void*);
+} Allocator;
+
+static void* miscrAlloc(size_t n) { return miscr_alloc((int64_t)n); }
+
+static const Allocator allocators[] = {
+  { "glibc", malloc, free },
+  { "miscr", miscrAlloc, miscr_free },
+};
+
+static const Allocator* A;
+static unsigned numThreads;
+
+static uint64_t nextRandom(uint64_t* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/* Mostly small objects, as in programs built of small structs and strings:
+   16 to 128 bytes three times out of four, up to 1 KiB otherwise. */
+static size_t randomSize(uint64_t* state) {
+  uint64_t r = nextRandom(state);
+  return (r & 3) ? 16 + (r >> 8) % 113 : 16 + (r >> 8) % 1009;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double residentMiB(void) {
+  long pages = 0, resident = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+  }
+  return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+static void runThreads(void* (*body)(void*)) {
+  pthread_t threads[256];
+  for (uintptr_t i = 0; i < numThreads; ++i)
+    pthread_create(&threads[i], NULL, body, (void*)i);
+  for (unsigned i = 0; i < numThreads; ++i)
+    pthread_join(threads[i], NULL);
+}
+
+/*============================================================================*/
+/*=== Workloads                                                            ===*/
+/*============================================================================*/
+
+#define LOCAL_BATCH 1000
+#define LOCAL_ROUNDS 2000
+
+static void* localBody(void* arg) {
+  uint64_t rng = 88172645463325252ull + (uintptr_t)arg;
+  void* objs[LOCAL_BATCH];
+  for (unsigned round = 0; round < LOCAL_ROUNDS; ++round) {
+    for (unsigned i = 0; i < LOCAL_BATCH; ++i) {
+      objs[i] = A->alloc(randomSize(&rng));
+      *(char*)objs[i] = (char)i;
+    }
+    for (unsigned i = LOCAL_BATCH; i > 1; --i) {
+      unsigned j = nextRandom(&rng) % i;
+      void* tmp = objs[j];
+      objs[j] = objs[i - 1];
+      objs[i - 1] = tmp;
+    }
+    for (unsigned i = 0; i < LOCAL_BATCH; ++i) A->free(objs[i]);
+  }
+  return NULL;
+}
+
+static double local(void) {
+  runThreads(localBody);
+  return 2.0 * LOCAL_BATCH * LOCAL_ROUNDS * numThreads;
+}
+
+#define REMOTE_OBJECTS 2000000
+#define RING_SIZE 4096
+
+/* A single-producer single-consumer queue from a thread to its partner. */
+typedef struct Ring {
+  _Atomic size_t head, tail;
+  void* slots[RING_SIZE];
+} Ring;
+
+static Ring* rings;
+
+static void* remoteBody(void* arg) {
+  uintptr_t i = (uintptr_t)arg;
+  Ring* ring = &rings[i / 2];
+  uint64_t rng = 88172645463325252ull + i;
+  if (i % 2 == 0) {
+    for (size_t n = 0; n < REMOTE_OBJECTS; ++n) {
+      void* p = A->alloc(randomSize(&rng));
+      *(char*)p = (char)n;
+      size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+      while (tail - atomic_load_explicit(&ring->head, memory_order_acquire)
+             == RING_SIZE) sched_yield();
+      ring->slots[tail % RING_SIZE] = p;
+      atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+  } else {
+    for (size_t n = 0; n < REMOTE_OBJECTS; ++n) {
+      size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+      while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+        sched_yield();
+      A->free(ring->slots[head % RING_SIZE]);
+      atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+  }
+  return NULL;
+}
+
+static double remote(void) {
+  numThreads &= ~1u;
+  if (numThreads == 0) numThreads = 2;
+  rings = calloc(numThreads / 2, sizeof(Ring));
+  runThreads(remoteBody);
+  return 2.0 * REMOTE_OBJECTS * (numThreads / 2);
+}
+
+#define RSS_OBJECTS 500000
+
+static pthread_barrier_t rssBarrier;
+static double rssFragmented;
+
+static void* rssBody(void* arg) {
+  uint64_t rng = 88172645463325252ull + (uintptr_t)arg;
+  void** objs = malloc(RSS_OBJECTS * sizeof(void*));
+  for (unsigned i = 0; i < RSS_OBJECTS; ++i) {
+    size_t n = randomSize(&rng);
+    objs[i] = A->alloc(n);
+    memset(objs[i], 1, n);
+  }
+  for (unsigned i = 0; i < RSS_OBJECTS; ++i)
+    if (i % 10 != 0) A->free(objs[i]);
+  if (pthread_barrier_wait(&rssBarrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    rssFragmented = residentMiB();
+  pthread_barrier_wait(&rssBarrier);
+  for (unsigned i = 0; i < RSS_OBJECTS; i += 10) A->free(objs[i]);
+  free(objs);
+  return NULL;
+}
+
+static double rss(void) {
+  pthread_barrier_init(&rssBarrier, NULL, numThreads);
+  runThreads(rssBody);
+  return (2.0 * RSS_OBJECTS) * numThreads;
+}
+
+/*============================================================================*/
+
+typedef struct Workload {
+  const char* name;
+  double (*run)(void);  /* returns the number of operations */
+} Workload;
+
+static const Workload workloads[] = {
+  { "local", local }, { "remote", remote }, { "rss", rss },
+};
+
+int main(int argc, char** argv) {
+  unsigned threads = argc > 1 ? (unsigned)atoi(argv[1])
+    : (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads == 0 || threads > 256) {
+    fprintf(stderr, "usage: %s [THREADS (1 to 256)]\n", argv[0]);
+    return 1;
+  }
+  printf("%-8s %-6s %7s %8s %14s %14s %14s\n", "workload", "alloc",
+         "threads", "Mops/s", "peak RSS MiB", "90% freed MiB",
+         "all freed MiB");
+  fflush(stdout);
+  for (size_t w = 0; w < sizeof workloads / sizeof *workloads; ++w) {
+    for (size_t a = 0; a < sizeof allocators / sizeof *allocators; ++a) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        A = &allocators[a];
+        numThreads = threads;
+        rssFragmented = -1;
+        double start = now();
+        double ops = workloads[w].run();
+        double secs = now() - start;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%-8s %-6s %7u %8.1f %14.1f ", workloads[w].name, A->name,
+               numThreads, ops / secs / 1e6, usage.ru_maxrss / 1024.0);
+        if (rssFragmented >= 0) printf("%14.1f ", rssFragmented);
+        else printf("%14s ", "-");
+        printf("%14.1f\n", residentMiB());
+        fflush(stdout);
+        _exit(0);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * The MiSCR allocator: the runtime behind the `alloc`, `realloc`, and `free`
+ * builtins, built for many threads allocating many small objects.
+ *
+ * Objects of up to MAX_SMALL bytes are rounded up to one of NUM_CLASSES size
+ * classes and carved out of spans. A span is SPAN_SIZE bytes of memory,
+ * aligned to SPAN_SIZE, that starts with a header naming its size class and
+ * the heap that owns it, so the span of an object is found by masking its
+ * address. Every thread has its own heap and allocates from, and frees to,
+ * the spans it owns without locks or atomic instructions.
+ *
+ * An object freed by a thread other than the span's owner is a remote free.
+ * Remote frees are buffered per thread and handed over in batches, one atomic
+ * push per span per batch. The owner collects them when its spans run out.
+ * When a thread exits, its spans that are still in use are abandoned and later
+ * adopted by threads that need spans of the same size class.
+ *
+ * Empty spans go back to a global pool. The pool keeps RETAINED_SPANS of them
+ * ready for reuse, and returns the pages of the others to the kernel with
+ * madvise(MADV_DONTNEED). Larger objects are mapped individually and unmapped
+ * when freed.
+ *
+ * Build with `./build.sh runtime`. `miscrc` links the library into programs
+ * that use the allocation builtins, unless given `--libc-alloc`.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SPAN_SIZE ((size_t)64 << 10)
+#define PAGE_SIZE ((size_t)4096)   /* granularity of large mappings */
+#define HEADER_SIZE 64          /* multiple of 16, so objects are aligned */
+#define MAX_SMALL 8192
+#define NUM_CLASSES 32
+#define LARGE NUM_CLASSES       /* size class of a large object's mapping */
+#define ARENA_SPANS 64          /* spans mapped from the kernel at once */
+#define RETAINED_SPANS 64       /* empty spans whose pages are kept */
+#define REMOTE_BATCH 64         /* remote frees buffered per thread */
+
+typedef struct Block Block;
+struct Block { Block* next; };
+
+typedef struct Heap Heap;
+
+typedef struct Span Span;
+struct Span {
+  _Atomic(Heap*) owner;         /* NULL while abandoned or pooled */
+  Span* prev;                   /* in the owner's list for the size class, */
+  Span* next;                   /* or the pool or an abandoned list */
+  Block* free;                  /* objects freed by the owner */
+  _Atomic(Block*) remote;       /* objects freed by other threads */
+  union {
+    char* bump;                 /* start of the never-allocated part */
+    size_t mapped;              /* LARGE: bytes mapped */
+  };
+  uint32_t cls;
+  uint32_t size;                /* object size of the class */
+  uint32_t used;                /* objects not (known to be) freed */
+};
+_Static_assert(sizeof(Span) <= HEADER_SIZE, "span header too large");
+
+struct Heap {
+  /* The spans of each size class. Allocation uses the first one until it is
+     full, and then looks for a span with free objects. */
+  Span* spans[NUM_CLASSES];
+  void* remote[REMOTE_BATCH];   /* remote frees not yet handed over */
+  unsigned numRemote;
+  Heap* nextFree;               /* in freeHeaps */
+};
+
+static void fatal(const char* what) {
+  fprintf(stderr, "miscr allocator: %s\n", what);
+  abort();
+}
+
+/*============================================================================*/
+/*=== Size classes                                                         ===*/
+/*============================================================================*/
+
+/* Sizes up to 128 are rounded up to a multiple of 16; larger ones to one of
+   four steps per power of two (160, 192, 224, 256, 320, ...), which wastes at
+   most 20%. */
+static inline unsigned sizeClass(size_t n) {
+  if (n <= 128) return n == 0 ? 0 : (unsigned)((n - 1) >> 4);
+  unsigned log = 63 - __builtin_clzl(n - 1);
+  return 8 + (log - 7) * 4 + (unsigned)((n - 1) >> (log - 2)) - 4;
+}
+
+static size_t classSize(unsigned cls) {
+  if (cls < 8) return (cls + 1) * 16;
+  unsigned step = cls - 8, log = 7 + step / 4;
+  return (size_t)(5 + step % 4) << (log - 2);
+}
+
+static inline Span* spanOf(void* p) {
+  return (Span*)((uintptr_t)p & ~(uintptr_t)(SPAN_SIZE - 1));
+}
+
+/*============================================================================*/
+/*=== Span pool                                                            ===*/
+/*============================================================================*/
+
+/* Guards the pool, the arena, the abandoned spans, and freeHeaps. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Span* hotSpans;          /* empty, with their pages */
+static _Atomic size_t numHot;
+static Span** coldSpans;        /* empty, pages returned to the kernel */
+static size_t numCold, coldCap;
+static char* arenaNext;         /* spans never used */
+static char* arenaEnd;
+static Span* abandoned[NUM_CLASSES];
+static Heap* freeHeaps;         /* heaps of exited threads */
+
+/* Maps @p size bytes aligned to SPAN_SIZE, or returns NULL. */
+static void* mapAligned(size_t size) {
+  char* p = mmap(NULL, size + SPAN_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  char* aligned = (char*)(((uintptr_t)p + SPAN_SIZE - 1)
+                          & ~(uintptr_t)(SPAN_SIZE - 1));
+  if (aligned > p) munmap(p, aligned - p);
+  munmap(aligned + size, p + SPAN_SIZE - aligned);
+  return aligned;
+}
+
+/* Takes an empty span from the pool, or a new one from the arena. */
+static Span* takeSpan(void) {
+  pthread_mutex_lock(&lock);
+  Span* s = hotSpans;
+  if (s != NULL) {
+    hotSpans = s->next;
+    --numHot;
+  } else if (numCold > 0) {
+    s = coldSpans[--numCold];
+  } else {
+    if (arenaNext == arenaEnd) {
+      arenaNext = mapAligned(ARENA_SPANS * SPAN_SIZE);
+      if (arenaNext == NULL) {
+        arenaEnd = NULL;
+        pthread_mutex_unlock(&lock);
+        return NULL;
+      }
+      arenaEnd = arenaNext + ARENA_SPANS * SPAN_SIZE;
+    }
+    s = (Span*)arenaNext;
+    arenaNext += SPAN_SIZE;
+  }
+  pthread_mutex_unlock(&lock);
+  return s;
+}
+
+/* Returns empty span @p s to the pool. Beyond RETAINED_SPANS, its pages go
+   back to the kernel (they read as zeros if touched again), so the span is
+   recorded outside of itself. */
+static void releaseSpan(Span* s) {
+  atomic_store_explicit(&s->owner, NULL, memory_order_relaxed);
+  int keep = atomic_load_explicit(&numHot, memory_order_relaxed)
+    < RETAINED_SPANS;
+  if (!keep) madvise(s, SPAN_SIZE, MADV_DONTNEED);
+  pthread_mutex_lock(&lock);
+  if (keep) {
+    s->next = hotSpans;
+    hotSpans = s;
+    ++numHot;
+  } else {
+    if (numCold == coldCap) {
+      coldCap = coldCap ? 2 * coldCap : 1024;
+      coldSpans = realloc(coldSpans, coldCap * sizeof *coldSpans);
+      if (coldSpans == NULL) fatal("out of memory");
+    }
+    coldSpans[numCold++] = s;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/*============================================================================*/
+/*=== Heaps                                                                ===*/
+/*============================================================================*/
+
+static __thread Heap* heap;
+static pthread_key_t heapKey;
+static pthread_once_t heapKeyOnce = PTHREAD_ONCE_INIT;
+
+static void linkFront(Heap* h, Span* s) {
+  Span** list = &h->spans[s->cls];
+  s->prev = NULL;
+  s->next = *list;
+  if (*list != NULL) (*list)->prev = s;
+  *list = s;
+}
+
+static void unlinkSpan(Heap* h, Span* s) {
+  if (s->prev != NULL) s->prev->next = s->next;
+  else h->spans[s->cls] = s->next;
+  if (s->next != NULL) s->next->prev = s->prev;
+}
+
+/* Moves the objects that other threads freed to the owner's free list. */
+static void collect(Span* s) {
+  Block* b = atomic_exchange_explicit(&s->remote, NULL, memory_order_acquire);
+  while (b != NULL) {
+    Block* next = b->next;
+    b->next = s->free;
+    s->free = b;
+    --s->used;
+    b = next;
+  }
+}
+
+/* Hands over the buffered remote frees of @p h, with one push for each span
+   they belong to. */
+static void flushRemote(Heap* h) {
+  for (unsigned i = 0; i < h->numRemote; ++i) {
+    Block* head = h->remote[i];
+    if (head == NULL) continue;
+    Span* s = spanOf(head);
+    Block* tail = head;
+    for (unsigned j = i + 1; j < h->numRemote; ++j) {
+      if (h->remote[j] != NULL && spanOf(h->remote[j]) == s) {
+        tail->next = h->remote[j];
+        tail = tail->next;
+        h->remote[j] = NULL;
+      }
+    }
+    Block* old = atomic_load_explicit(&s->remote, memory_order_relaxed);
+    do tail->next = old;
+    while (!atomic_compare_exchange_weak_explicit(&s->remote, &old, head,
+             memory_order_release, memory_order_relaxed));
+  }
+  h->numRemote = 0;
+}
+
+/* Runs when a thread exits: releases its empty spans and abandons the
+   others. */
+static void heapExit(void* arg) {
+  Heap* h = arg;
+  flushRemote(h);
+  for (unsigned c = 0; c < NUM_CLASSES; ++c) {
+    Span* s = h->spans[c];
+    while (s != NULL) {
+      Span* next = s->next;
+      collect(s);
+      if (s->used == 0) {
+        releaseSpan(s);
+      } else {
+        atomic_store_explicit(&s->owner, NULL, memory_order_relaxed);
+        pthread_mutex_lock(&lock);
+        s->next = abandoned[c];
+        abandoned[c] = s;
+        pthread_mutex_unlock(&lock);
+      }
+      s = next;
+    }
+  }
+  heap = NULL;
+  pthread_mutex_lock(&lock);
+  h->nextFree = freeHeaps;
+  freeHeaps = h;
+  pthread_mutex_unlock(&lock);
+}
+
+static void makeHeapKey(void) {
+  if (pthread_key_create(&heapKey, heapExit) != 0)
+    fatal("cannot create thread-local key");
+}
+
+static Heap* newHeap(void) {
+  pthread_once(&heapKeyOnce, makeHeapKey);
+  pthread_mutex_lock(&lock);
+  Heap* h = freeHeaps;
+  if (h != NULL) freeHeaps = h->nextFree;
+  pthread_mutex_unlock(&lock);
+  if (h == NULL) {
+    h = mmap(NULL, sizeof(Heap), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (h == MAP_FAILED) fatal("out of memory");
+  }
+  memset(h, 0, sizeof *h);
+  pthread_setspecific(heapKey, h);
+  heap = h;
+  return h;
+}
+
+static inline Heap* getHeap(void) {
+  return heap != NULL ? heap : newHeap();
+}
+
+/*============================================================================*/
+/*=== Allocation                                                           ===*/
+/*============================================================================*/
+
+static inline void* allocFrom(Span* s) {
+  Block* b = s->free;
+  if (b != NULL) {
+    s->free = b->next;
+    ++s->used;
+    return b;
+  }
+  if (s->bump + s->size <= (char*)s + SPAN_SIZE) {
+    void* p = s->bump;
+    s->bump += s->size;
+    ++s->used;
+    return p;
+  }
+  return NULL;
+}
+
+/* Gives @p h a span of class @p cls: an abandoned one, or an empty one. */
+static Span* newSpan(Heap* h, unsigned cls) {
+  pthread_mutex_lock(&lock);
+  Span* s = abandoned[cls];
+  if (s != NULL) abandoned[cls] = s->next;
+  pthread_mutex_unlock(&lock);
+  if (s != NULL) {
+    atomic_store_explicit(&s->owner, h, memory_order_relaxed);
+    collect(s);
+  } else {
+    if ((s = takeSpan()) == NULL) return NULL;
+    s->free = NULL;
+    atomic_store_explicit(&s->remote, NULL, memory_order_relaxed);
+    s->bump = (char*)s + HEADER_SIZE;
+    s->cls = cls;
+    s->size = classSize(cls);
+    s->used = 0;
+    atomic_store_explicit(&s->owner, h, memory_order_relaxed);
+  }
+  linkFront(h, s);
+  return s;
+}
+
+static void* allocSlow(Heap* h, unsigned cls) {
+  flushRemote(h);
+  for (Span* s = h->spans[cls]; s != NULL; s = s->next) {
+    if (atomic_load_explicit(&s->remote, memory_order_relaxed) != NULL)
+      collect(s);
+    void* p = allocFrom(s);
+    if (p != NULL) {
+      unlinkSpan(h, s);
+      linkFront(h, s);
+      return p;
+    }
+  }
+  Span* s = newSpan(h, cls);
+  return s == NULL ? NULL : allocFrom(s);
+}
+
+static void* allocLarge(size_t n) {
+  if (n > PTRDIFF_MAX - SPAN_SIZE) return NULL;
+  size_t mapped = (HEADER_SIZE + n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  Span* s = mapAligned(mapped);
+  if (s == NULL) return NULL;
+  s->cls = LARGE;
+  s->mapped = mapped;
+  return (char*)s + HEADER_SIZE;
+}
+
+/* Allocates @p size bytes aligned to 16, or returns NULL. */
+void* miscr_alloc(int64_t size) {
+  size_t n = (size_t)size;
+  if (n > MAX_SMALL) return allocLarge(n);
+  Heap* h = getHeap();
+  unsigned cls = sizeClass(n);
+  Span* s = h->spans[cls];
+  void* p;
+  if (s != NULL && (p = allocFrom(s)) != NULL) return p;
+  return allocSlow(h, cls);
+}
+
+/* Frees @p p, which came from miscr_alloc or miscr_realloc, or is NULL. */
+void miscr_free(void* p) {
+  if (p == NULL) return;
+  Span* s = spanOf(p);
+  if (s->cls == LARGE) {
+    munmap(s, s->mapped);
+    return;
+  }
+  Heap* h = getHeap();
+  if (atomic_load_explicit(&s->owner, memory_order_relaxed) == h) {
+    Block* b = p;
+    b->next = s->free;
+    s->free = b;
+    if (--s->used == 0 && s != h->spans[s->cls]) {
+      unlinkSpan(h, s);
+      releaseSpan(s);
+    }
+    return;
+  }
+  if (h->numRemote == REMOTE_BATCH) flushRemote(h);
+  h->remote[h->numRemote++] = p;
+}
+
+/* Resizes @p p to @p size bytes, moving it if it does not fit. Returns the
+   new address, or NULL (leaving @p p alone) if out of memory. */
+void* miscr_realloc(void* p, int64_t size) {
+  if (p == NULL) return miscr_alloc(size);
+  Span* s = spanOf(p);
+  size_t have = s->cls == LARGE ? s->mapped - HEADER_SIZE : s->size;
+  size_t n = (size_t)size;
+  if (n <= have && (s->cls != LARGE || n > have / 2)) return p;
+  void* q = miscr_alloc(size);
+  if (q == NULL) return NULL;
+  memcpy(q, p, n < have ? n : have);
+  miscr_free(p);
+  return q;
+}
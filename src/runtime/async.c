@@ -0,0 +1,458 @@
+/*
+ * The MiSCR async runtime: a single-threaded event loop that runs the
+ * coroutines `async func`s compile to, and the I/O operations they await.
+ *
+ * I/O goes through io_uring if the kernel has it (Linux 5.7 or newer), and
+ * through epoll otherwise or if MISCR_ASYNC_EPOLL is set in the environment.
+ *
+ * A future is a coroutine handle. LLVM lays out a coroutine frame as the
+ * resume function, the destroy function, and then the promise, and sets the
+ * resume function to null when the coroutine finishes. Codegen's promise is
+ * `{ waiter, result }`, where the waiter is the coroutine that awaits this
+ * one. The operations below fake such frames with an i64 result.
+ *
+ * Build with `./build.sh runtime`. `miscrc` links the library into programs
+ * that use `async`.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct Frame Frame;
+struct Frame {
+  /* LLVM calls these with fastcc, which on x86-64 passes the handle just
+     like the C calling convention does */
+  void (*resume)(Frame*);
+  void (*destroy)(Frame*);
+  Frame* waiter;  /* promise: the coroutine awaiting this one, or NULL */
+};
+
+enum OpKind { OP_READ, OP_WRITE, OP_ACCEPT, OP_SLEEP };
+
+/* A pending or completed I/O operation, disguised as a coroutine frame. */
+typedef struct Op {
+  Frame frame;
+  int64_t result;               /* promise: the awaited value */
+  enum OpKind kind;
+  int fd;
+  void* buf;
+  uint64_t len;
+  int64_t deadline;             /* OP_SLEEP with epoll: CLOCK_MONOTONIC ns */
+  struct __kernel_timespec ts;  /* OP_SLEEP with io_uring: relative time */
+} Op;
+
+static void fatal(const char* what) {
+  fprintf(stderr, "miscr async runtime: %s\n", what);
+  abort();
+}
+
+/*============================================================================*/
+/*=== Ready queue                                                           ===*/
+/*============================================================================*/
+
+static Frame** ready;
+static size_t readyHead, readyLen, readyCap;
+
+/* Coroutines that have started an operation but not seen it complete. */
+static size_t pending;
+
+/* Queues @p f to be resumed by the event loop. Called by a coroutine that
+   finishes, with the coroutine that awaits it. */
+void miscr_async_wake(Frame* f) {
+  if (f == NULL) return;
+  if (readyLen == readyCap) {
+    size_t cap = readyCap ? 2 * readyCap : 64;
+    Frame** grown = malloc(cap * sizeof *grown);
+    if (grown == NULL) fatal("out of memory");
+    for (size_t i = 0; i < readyLen; ++i)
+      grown[i] = ready[(readyHead + i) % readyCap];
+    free(ready);
+    ready = grown;
+    readyHead = 0;
+    readyCap = cap;
+  }
+  ready[(readyHead + readyLen++) % readyCap] = f;
+}
+
+static void opPending(Frame* f) {
+  (void)f;
+  fatal("resumed an I/O operation that has not completed");
+}
+
+static void opDestroy(Frame* f) { free(f); }
+
+static void complete(Op* op, int64_t result) {
+  op->result = result;
+  op->frame.resume = NULL;
+  --pending;
+  miscr_async_wake(op->frame.waiter);
+}
+
+static int64_t performIo(Op* op) {
+  ssize_t n;
+  switch (op->kind) {
+  case OP_READ:   n = read(op->fd, op->buf, op->len); break;
+  case OP_WRITE:  n = write(op->fd, op->buf, op->len); break;
+  case OP_ACCEPT: n = accept4(op->fd, NULL, NULL, SOCK_CLOEXEC); break;
+  default:        n = 0; break;
+  }
+  return n < 0 ? -errno : n;
+}
+
+/*============================================================================*/
+/*=== io_uring backend                                                      ===*/
+/*============================================================================*/
+
+static struct {
+  int fd;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  unsigned sqEntries;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  unsigned toSubmit;
+} ring;
+
+/* Returns 0 if the kernel lacks io_uring or the features used here. */
+static int uringSetup(void) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof p);
+  int fd = syscall(__NR_io_uring_setup, 256, &p);
+  if (fd < 0) return 0;
+  unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+    | IORING_FEAT_RW_CUR_POS | IORING_FEAT_FAST_POLL;
+  if ((p.features & needed) != needed) {
+    close(fd);
+    return 0;
+  }
+  size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  char* rings = mmap(NULL, sqSize > cqSize ? sqSize : cqSize,
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED) {
+    close(fd);
+    return 0;
+  }
+  void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    close(fd);
+    return 0;
+  }
+  ring.fd = fd;
+  ring.sqHead = (unsigned*)(rings + p.sq_off.head);
+  ring.sqTail = (unsigned*)(rings + p.sq_off.tail);
+  ring.sqMask = (unsigned*)(rings + p.sq_off.ring_mask);
+  ring.sqArray = (unsigned*)(rings + p.sq_off.array);
+  ring.cqHead = (unsigned*)(rings + p.cq_off.head);
+  ring.cqTail = (unsigned*)(rings + p.cq_off.tail);
+  ring.cqMask = (unsigned*)(rings + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(rings + p.cq_off.cqes);
+  ring.sqEntries = p.sq_entries;
+  ring.sqes = sqes;
+  return 1;
+}
+
+/* Submits all queued entries and, if @p wait, blocks until at least one
+   operation has completed. */
+static void uringEnter(int wait) {
+  while (ring.toSubmit > 0 || wait) {
+    int n = syscall(__NR_io_uring_enter, ring.fd, ring.toSubmit, wait ? 1 : 0,
+      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fatal("io_uring_enter failed");
+    }
+    ring.toSubmit -= n;
+    wait = 0;
+  }
+}
+
+static void uringSubmit(Op* op) {
+  unsigned tail = *ring.sqTail;
+  if (tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) == ring.sqEntries) {
+    uringEnter(0);  /* the submission queue is full */
+  }
+  unsigned idx = tail & *ring.sqMask;
+  struct io_uring_sqe* sqe = &ring.sqes[idx];
+  memset(sqe, 0, sizeof *sqe);
+  sqe->fd = op->fd;
+  sqe->user_data = (uintptr_t)op;
+  switch (op->kind) {
+  case OP_READ:
+  case OP_WRITE:
+    sqe->opcode = op->kind == OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->addr = (uintptr_t)op->buf;
+    sqe->len = op->len > 0x7ffff000 ? 0x7ffff000 : op->len;
+    sqe->off = (uint64_t)-1;  /* at the current file position */
+    break;
+  case OP_ACCEPT:
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    break;
+  case OP_SLEEP:
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)&op->ts;
+    sqe->len = 1;
+    break;
+  }
+  ring.sqArray[idx] = idx;
+  __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++ring.toSubmit;
+}
+
+static void uringWait(void) {
+  uringEnter(1);
+  unsigned head = *ring.cqHead;
+  while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+    Op* op = (Op*)(uintptr_t)cqe->user_data;
+    int64_t result = cqe->res;
+    if (op->kind == OP_SLEEP && result == -ETIME) result = 0;
+    ++head;
+    complete(op, result);
+  }
+  __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+}
+
+/*============================================================================*/
+/*=== epoll backend                                                         ===*/
+/*============================================================================*/
+
+/* The operations waiting for a file descriptor to become ready. */
+typedef struct {
+  Op* reader;      /* OP_READ or OP_ACCEPT */
+  Op* writer;      /* OP_WRITE */
+  int registered;  /* the fd was added to the epoll set */
+} FdWaiters;
+
+static int epollFd;
+static FdWaiters* fds;
+static size_t fdsCap;
+
+/* OP_SLEEP operations, as a min-heap on their deadlines */
+static Op** timers;
+static size_t timersLen, timersCap;
+
+static int64_t now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void timerPush(Op* op) {
+  if (timersLen == timersCap) {
+    timersCap = timersCap ? 2 * timersCap : 16;
+    timers = realloc(timers, timersCap * sizeof *timers);
+    if (timers == NULL) fatal("out of memory");
+  }
+  size_t i = timersLen++;
+  while (i > 0 && timers[(i - 1) / 2]->deadline > op->deadline) {
+    timers[i] = timers[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  timers[i] = op;
+}
+
+static Op* timerPop(void) {
+  Op* ret = timers[0];
+  Op* last = timers[--timersLen];
+  size_t i = 0;
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= timersLen) break;
+    if (child + 1 < timersLen
+        && timers[child + 1]->deadline < timers[child]->deadline) ++child;
+    if (timers[child]->deadline >= last->deadline) break;
+    timers[i] = timers[child];
+    i = child;
+  }
+  if (timersLen > 0) timers[i] = last;
+  return ret;
+}
+
+static FdWaiters* waitersOf(int fd) {
+  if ((size_t)fd >= fdsCap) {
+    size_t cap = fdsCap ? fdsCap : 64;
+    while (cap <= (size_t)fd) cap *= 2;
+    fds = realloc(fds, cap * sizeof *fds);
+    if (fds == NULL) fatal("out of memory");
+    memset(fds + fdsCap, 0, (cap - fdsCap) * sizeof *fds);
+    fdsCap = cap;
+  }
+  return &fds[fd];
+}
+
+/* Asks for one notification when @p fd is ready for what its waiters want.
+   Returns 0 if @p fd cannot be polled. */
+static int epollArm(int fd) {
+  FdWaiters* w = waitersOf(fd);
+  struct epoll_event ev;
+  ev.events = EPOLLONESHOT | (w->reader ? EPOLLIN : 0)
+    | (w->writer ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  // the fd may have been closed and reused since it was registered
+  if (w->registered && epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0)
+    return 1;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) return 0;
+  w->registered = 1;
+  return 1;
+}
+
+/* Completes the operation in @p slot unless it would still block. */
+static void epollTry(Op** slot) {
+  int64_t result = performIo(*slot);
+  if (result == -EAGAIN || result == -EWOULDBLOCK) return;
+  Op* op = *slot;
+  *slot = NULL;
+  complete(op, result);
+}
+
+static void epollSubmit(Op* op) {
+  if (op->kind == OP_SLEEP) {
+    timerPush(op);
+    return;
+  }
+  // regular files are always ready
+  struct stat st;
+  if (fstat(op->fd, &st) != 0 || S_ISREG(st.st_mode)) {
+    complete(op, performIo(op));
+    return;
+  }
+  FdWaiters* w = waitersOf(op->fd);
+  Op** slot = op->kind == OP_WRITE ? &w->writer : &w->reader;
+  if (*slot != NULL) {
+    complete(op, -EBUSY);  /* one reader and one writer per fd at a time */
+    return;
+  }
+  *slot = op;
+  if (!epollArm(op->fd)) {
+    *slot = NULL;
+    complete(op, performIo(op));
+  }
+}
+
+static void epollWait(void) {
+  int timeout = -1;
+  if (timersLen > 0) {
+    int64_t left = timers[0]->deadline - now();
+    timeout = left <= 0 ? 0 : (int)((left + 999999) / 1000000);
+  }
+  struct epoll_event events[64];
+  int n = epoll_wait(epollFd, events, 64, timeout);
+  if (n < 0 && errno != EINTR) fatal("epoll_wait failed");
+  for (int i = 0; i < n; ++i) {
+    int fd = events[i].data.fd;
+    FdWaiters* w = waitersOf(fd);
+    uint32_t e = events[i].events;
+    if (w->reader && (e & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+      epollTry(&w->reader);
+    if (w->writer && (e & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+      epollTry(&w->writer);
+    if (w->reader || w->writer) epollArm(fd);
+  }
+  int64_t t = now();
+  while (timersLen > 0 && timers[0]->deadline <= t) complete(timerPop(), 0);
+}
+
+/*============================================================================*/
+/*=== Event loop and operations                                             ===*/
+/*============================================================================*/
+
+static enum { UNINITIALIZED, URING, EPOLL } backend;
+
+static void init(void) {
+  if (getenv("MISCR_ASYNC_EPOLL") == NULL && uringSetup()) {
+    backend = URING;
+    return;
+  }
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) fatal("epoll_create1 failed");
+  backend = EPOLL;
+}
+
+/* Runs the event loop until @p future has completed. This is `block_on`. */
+void miscr_async_run(Frame* future) {
+  if (backend == UNINITIALIZED) init();
+  for (;;) {
+    while (readyLen > 0) {
+      Frame* f = ready[readyHead];
+      readyHead = (readyHead + 1) % readyCap;
+      --readyLen;
+      f->resume(f);
+    }
+    if (future->resume == NULL) return;
+    if (pending == 0) fatal("deadlock: block_on waits for a future that can "
+                            "never complete");
+    if (backend == URING) uringWait();
+    else epollWait();
+  }
+}
+
+/* Starts @p op. Like a call to an `async func`, this runs eagerly up to the
+   point where it would block. */
+static Frame* start(Op* op) {
+  if (backend == UNINITIALIZED) init();
+  op->frame.resume = opPending;
+  op->frame.destroy = opDestroy;
+  ++pending;
+  if (backend == URING) uringSubmit(op);
+  else epollSubmit(op);
+  return &op->frame;
+}
+
+static Op* newOp(enum OpKind kind, int fd) {
+  Op* op = calloc(1, sizeof *op);
+  if (op == NULL) fatal("out of memory");
+  op->kind = kind;
+  op->fd = fd;
+  return op;
+}
+
+/* extern async func async_read(fd: i32, buf: &i8, n: i64): i64;
+   The number of bytes read, or a negated errno. */
+Frame* async_read(int32_t fd, void* buf, int64_t n) {
+  Op* op = newOp(OP_READ, fd);
+  op->buf = buf;
+  op->len = n < 0 ? 0 : n;
+  return start(op);
+}
+
+/* extern async func async_write(fd: i32, buf: &i8, n: i64): i64;
+   The number of bytes written, or a negated errno. */
+Frame* async_write(int32_t fd, void* buf, int64_t n) {
+  Op* op = newOp(OP_WRITE, fd);
+  op->buf = buf;
+  op->len = n < 0 ? 0 : n;
+  return start(op);
+}
+
+/* extern async func async_accept(fd: i32): i64;
+   The accepted connection, or a negated errno. */
+Frame* async_accept(int32_t fd) {
+  return start(newOp(OP_ACCEPT, fd));
+}
+
+/* extern async func async_sleep(ms: i64): i64;
+   Zero after at least @p ms milliseconds. */
+Frame* async_sleep(int64_t ms) {
+  Op* op = newOp(OP_SLEEP, -1);
+  if (ms < 0) ms = 0;
+  op->ts.tv_sec = ms / 1000;
+  op->ts.tv_nsec = (ms % 1000) * 1000000;
+  op->deadline = now() + ms * 1000000;
+  return start(op);
+}
@@ -1,7 +1,4 @@
-#include "lexer/Lexer.hpp"
-#include "parser/Parser.hpp"
-#include "sema/Sema.hpp"
-#include "borrowchecker/BorrowChecker.hpp"
+#include "driver/CompilerInstance.hpp"
 #include "test.hpp"
 
 namespace BorrowTests {
@@ -10,49 +7,16 @@ namespace BorrowTests {
   //==========================================================================//
 
   std::optional<std::string> declsShouldPass(const char* declsText) {
-    LocationTable LT(declsText);
-    auto tokens = Lexer(declsText, &LT).run();
-    Parser parser(tokens);
-    DeclList* parsed = parser.decls0();
-    if (parsed == nullptr) return "Parser error";
-    Sema sema;
-    sema.run(parsed, "global");
-    if (sema.hasErrors()) {
-      std::string errStr;
-      for (auto err : sema.getErrors())
-        errStr.append(err.render(declsText, LT));
-      return (errStr);
-    }
-    BorrowChecker bc(sema.getTypeContext(), sema.getOntology());
-    bc.checkDecls(parsed);
-    if (!bc.errors.empty()) {
-      std::string errStr;
-      for (auto err : bc.errors)
-        errStr.append(err.render(declsText, LT));
-      return (errStr);
-    }
+    CompilerInstance ci;
+    if (!ci.parse(declsText) || !ci.analyze() || !ci.borrowCheck())
+      return ci.renderErrors();
     SUCCESS
   }
 
   std::optional<std::string> declsShouldFail(const char* declsText) {
-    LocationTable LT(declsText);
-    auto tokens = Lexer(declsText, &LT).run();
-    Parser parser(tokens);
-    DeclList* parsed = parser.decls0();
-    if (parsed == nullptr) return "Parser error";
-    Sema sema;
-    sema.run(parsed, "global");
-    if (sema.hasErrors()) {
-      std::string errStr;
-      for (auto err : sema.getErrors())
-        errStr.append(err.render(declsText, LT));
-      return (errStr);
-    }
-    BorrowChecker bc(sema.getTypeContext(), sema.getOntology());
-    bc.checkDecls(parsed);
-    if (bc.errors.empty()) {
-      return "Expected borrow checking to fail.";
-    }
+    CompilerInstance ci;
+    if (!ci.parse(declsText) || !ci.analyze()) return ci.renderErrors();
+    if (ci.borrowCheck()) return "Expected borrow checking to fail.";
     SUCCESS
   }
 
@@ -91,6 +55,21 @@ namespace BorrowTests {
     );
   }
 
+  TEST(allocation_builtins) {
+    TRY(declsShouldPass(
+      "func foo(): unit = {\n"
+      "  let x = alloc(10);\n"
+      "  let y = realloc(x, 20);\n"
+      "  free(y);\n"
+      "};"
+    ))
+    TRY(declsShouldFail("func foo(): unit = { let x = alloc(10); };"))
+    TRY(declsShouldFail(
+      "func foo(): unit = { let x = alloc(10); free(x); free(x); };"
+    ))
+    SUCCESS
+  }
+
   TEST(immediately_borrowed_malloc) {
     return declsShouldFail(
       "extern func malloc(size: i64): uniq &i8;\n"
@@ -190,4 +169,181 @@ namespace BorrowTests {
     );
   }
 
-}
\ No newline at end of file
+  TEST(soa_columns_are_separate_paths) {
+    TRY(declsShouldPass(
+      "extern func alloc(): uniq &i8;\n"
+      "extern func free(ptr: uniq &i8): unit;\n"
+      "#[soa] struct Pair { a: uniq &i8, b: uniq &i8 }\n"
+      "func foo(ps: &Pair, i: i64): unit = {\n"
+      "  free(move ps[i]->a);\n"
+      "  free(move ps[i]->b);\n"
+      "  ps[i]->a = alloc();\n"
+      "  ps[i]->b = alloc();\n"
+      "};"
+    ))
+    TRY(declsShouldFail(
+      "extern func alloc(): uniq &i8;\n"
+      "extern func free(ptr: uniq &i8): unit;\n"
+      "#[soa] struct Pair { a: uniq &i8, b: uniq &i8 }\n"
+      "func foo(ps: &Pair, i: i64): unit = {\n"
+      "  free(move ps[i]->a);\n"
+      "  ps[i]->b = alloc();\n"
+      "};"
+    ))
+    SUCCESS
+  }
+
+  TEST(soa_allocations_must_be_freed) {
+    TRY(declsShouldPass(
+      "#[soa] struct P { x: i32, y: i32 }\n"
+      "func f(n: usize): unit = {\n"
+      "  let ps: uniq &P = soa_alloc(n);\n"
+      "  soa_free(ps);\n"
+      "};"
+    ))
+    TRY(declsShouldFail(
+      "#[soa] struct P { x: i32, y: i32 }\n"
+      "func f(n: usize): unit = { let ps: uniq &P = soa_alloc(n); };"
+    ))
+    SUCCESS
+  }
+
+  TEST(constants_are_read_only) {
+    TRY(declsShouldPass(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func get(i: i64): i32 = TABLE[i]!;"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func set(i: i64): unit = { TABLE[i]! = 0; };"
+    ))
+    TRY(declsShouldFail(
+      "const N: i32 = 1;\n"
+      "func set(): unit = { N = 2; };"
+    ))
+    SUCCESS
+  }
+
+  TEST(references_to_constants_cannot_escape) {
+    TRY(declsShouldPass(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func get(i: i64): i32 = { let t = TABLE; t[i]! };"
+    ))
+    TRY(declsShouldPass(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func at(t: &i32, i: i64): i32 = t[i]!;\n"
+      "func sum(t: &i32): i32 = { let i = 0; at(t, i) + at(t, i) };\n"
+      "func f(): i32 = sum(TABLE);"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "extern func puts(s: &i32): i32;\n"
+      "func f(): i32 = puts(TABLE);"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func id(t: &i32): &i32 = t;\n"
+      "func f(): i32 = { let t = id(TABLE); t! };"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func w(t: &i32): unit = { t! = 0; };\n"
+      "func f(): unit = w(TABLE);"
+    ))
+    TRY(declsShouldFail(
+      "const N: i32 = 1;\n"
+      "func w(t: &i32): unit = { t! = 0; };\n"
+      "func f(): unit = w(&N);"
+    ))
+    TRY(declsShouldFail(
+      "struct S { p: &i32 }\n"
+      "const N: i32 = 1;\n"
+      "func w(s: S): unit = { s.p! = 0; };\n"
+      "func f(): unit = w(S{ &N });"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func f(): &i32 = TABLE;"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [1, 2, 3];\n"
+      "func f(p: &&i32): unit = { p! = TABLE; };"
+    ))
+    SUCCESS
+  }
+
+  TEST(sorting_constants_is_rejected) {
+    TRY(declsShouldPass(
+      "const TABLE: &i32 = [3, 1, 2];\n"
+      "func find(x: i32): usize = lower_bound(TABLE, 3, x);"
+    ))
+    TRY(declsShouldFail(
+      "const TABLE: &i32 = [3, 1, 2];\n"
+      "func f(): unit = sort(TABLE, 3);"
+    ))
+    SUCCESS
+  }
+
+  TEST(futures_and_await) {
+    TRY(declsShouldPass(
+      "async func f(): i32 = 1;\n"
+      "async func g(): i32 = { let x = f(); await x };"
+    ))
+    TRY(declsShouldFail(
+      "async func f(): i32 = 1;\n"
+      "async func g(): unit = { let x = f(); };"
+    ))
+    TRY(declsShouldFail(
+      "async func f(): i32 = 1;\n"
+      "async func g(): i32 = { let x = f(); await x + await x };"
+    ))
+    TRY(declsShouldFail(
+      "extern func alloc(): uniq &i8;\n"
+      "extern func free(ptr: uniq &i8): unit;\n"
+      "async func f(): unit = {};\n"
+      "async func g(p: &uniq &i8): unit = {\n"
+      "  free(move p!);\n"
+      "  await f();\n"
+      "  p! = alloc();\n"
+      "};"
+    ))
+    SUCCESS
+  }
+
+  TEST(futures_keep_borrows_across_await) {
+    TRY(declsShouldPass(
+      "async func f(): unit = {};\n"
+      "async func read(p: &i8): unit = {};\n"
+      "async func g(): unit = {\n"
+      "  let x = alloc(8);\n"
+      "  let r = read(borrow x);\n"
+      "  await f();\n"
+      "  await r;\n"
+      "  free(x);\n"
+      "};"
+    ))
+    TRY(declsShouldFail(
+      "async func f(): unit = {};\n"
+      "async func read(p: &i8): unit = {};\n"
+      "async func g(): unit = {\n"
+      "  let x = alloc(8);\n"
+      "  let r = read(borrow x);\n"
+      "  await f();\n"
+      "  free(x);\n"
+      "  await r;\n"
+      "};"
+    ))
+    TRY(declsShouldFail(
+      "async func f(): unit = {};\n"
+      "async func swap(p: &uniq &i8): unit = {};\n"
+      "async func g(): unit = {\n"
+      "  let x = alloc(8);\n"
+      "  let s = swap(&x);\n"
+      "  await f();\n"
+      "  free(x);\n"
+      "  await s;\n"
+      "};"
+    ))
+    SUCCESS
+  }
+}
@@ -0,0 +1,434 @@
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Verifier.h>
+#include "lexer/Lexer.hpp"
+#include "parser/Parser.hpp"
+#include "sema/Sema.hpp"
+#include "codegen/Codegen.hpp"
+#include "driver/CompilerInstance.hpp"
+#include "test.hpp"
+
+namespace CodegenTests {
+  TESTGROUP("Codegen Tests")
+
+  //==========================================================================//
+
+  /// Generates code for @p declsText into @p mod and verifies it.
+  std::optional<std::string> generate(const char* declsText,
+      llvm::Module& mod, bool trackLocations = false) {
+    LocationTable LT(declsText);
+    auto tokens = Lexer(declsText, &LT).run();
+    Parser parser(tokens);
+    DeclList* parsed = parser.decls0();
+    if (parsed == nullptr) return "Parser error";
+    Sema sema;
+    sema.run(parsed, "global");
+    if (sema.hasErrors()) {
+      std::string errStr;
+      for (auto err : sema.getErrors())
+        errStr.append(err.render(declsText, LT));
+      return errStr;
+    }
+    Codegen codegen(sema.getOntology(), mod);
+    if (trackLocations) codegen.trackSourceLocations("test.miscr");
+    codegen.genDeclList(parsed);
+    std::string verifierOutput;
+    llvm::raw_string_ostream os(verifierOutput);
+    if (llvm::verifyModule(mod, &os)) return os.str();
+    SUCCESS
+  }
+
+  /// Counts the instructions with opcode @p opcode in global function
+  /// @p funcName.
+  unsigned countInstructions(llvm::Module& mod, const char* funcName,
+      unsigned opcode) {
+    unsigned n = 0;
+    llvm::Function* f = mod.getFunction(std::string("global::") + funcName);
+    for (llvm::BasicBlock& bb : *f)
+      for (llvm::Instruction& inst : bb)
+        if (inst.getOpcode() == opcode) ++n;
+    return n;
+  }
+
+  /// Counts the calls to @p callee in global function @p funcName.
+  unsigned countCalls(llvm::Module& mod, const char* funcName,
+      const char* callee) {
+    unsigned n = 0;
+    llvm::Function* f = mod.getFunction(std::string("global::") + funcName);
+    for (llvm::Instruction& inst : llvm::instructions(f))
+      if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst))
+        if (call->getCalledFunction()
+            && call->getCalledFunction()->getName() == callee) ++n;
+    return n;
+  }
+
+  //==========================================================================//
+
+  TEST(loop_variables_become_phis) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func sum(n: i32): i32 = {\n"
+      "  let s = 0; let i = 0;\n"
+      "  while (i < n) { s = s + i; i = i + 1; }\n"
+      "  s\n"
+      "};", mod))
+    ASSERT(countInstructions(mod, "sum", llvm::Instruction::Alloca) == 0,
+      "Expected no stack slots")
+    ASSERT(countInstructions(mod, "sum", llvm::Instruction::PHI) == 2,
+      "Expected a PHI for s and one for i")
+    SUCCESS
+  }
+
+  TEST(if_join_has_one_phi) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func f(c: bool, x: i32): i32 = {\n"
+      "  let y = x;\n"
+      "  if (c) { y = x + 1; }\n"
+      "  y + x\n"
+      "};", mod))
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Alloca) == 0,
+      "Expected no stack slots")
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::PHI) == 1,
+      "Expected a PHI for y only")
+    SUCCESS
+  }
+
+  TEST(address_taken_variable_keeps_slot) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func f(x: i32): i32 = {\n"
+      "  let y = x;\n"
+      "  let r = &y;\n"
+      "  r! = 3;\n"
+      "  y\n"
+      "};", mod))
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Alloca) == 1,
+      "Expected a stack slot for y only")
+    SUCCESS
+  }
+
+  TEST(identical_string_literals_share_a_global) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "extern func puts(s: &i8): i32;\n"
+      "func f(): i32 = { puts(\"a\\n\"); puts(\"b\"); puts(\"a\\n\") };",
+      mod))
+    ASSERT(mod.global_size() == 2, "Expected one global per distinct literal")
+    for (llvm::GlobalVariable& g : mod.globals()) {
+      ASSERT(g.isConstant() && g.hasGlobalUnnamedAddr(),
+        "Expected an unnamed_addr constant")
+    }
+    SUCCESS
+  }
+
+  TEST(constructor_is_built_in_place) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "struct P { a: i32, b: i32 }\n"
+      "func f(x: i32): i32 = {\n"
+      "  let p = P{ x, x + 1 };\n"
+      "  let r = &p;\n"
+      "  p = P{ p.b, p.a };\n"
+      "  r->a\n"
+      "};", mod))
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Alloca) == 1,
+      "Expected the slot of p as the only temporary")
+    SUCCESS
+  }
+
+  TEST(large_struct_copies_use_memcpy) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "struct Big { a: i64, b: i64, c: i64, d: i64, e: i64 }\n"
+      "func f(r: &Big, s: &Big): unit = {\n"
+      "  r! = s!;\n"
+      "  s! = Big{ 1, 2, 3, 4, 5 };\n"
+      "};", mod))
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Call) == 2,
+      "Expected two memcpy calls")
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Load) == 0,
+      "Expected no aggregate loads")
+    SUCCESS
+  }
+
+  TEST(block_local_slots_have_lifetimes) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "struct Big { a: i64, b: i64, c: i64, d: i64, e: i64 }\n"
+      "extern func use(b: &Big): unit;\n"
+      "extern func useInt(i: &i32): unit;\n"
+      "func f(c: bool): unit = {\n"
+      "  if (c) { let x = Big{ 1, 2, 3, 4, 5 }; use(&x); }\n"
+      "  else { let y = Big{ 5, 4, 3, 2, 1 }; use(&y); }\n"
+      "  let i = 0;\n"
+      "  while (i < 3) { let z = i; useInt(&z); i = i + 1; }\n"
+      "};", mod))
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Alloca) == 3,
+      "Expected slots for x, y, and z")
+    for (const char* name :
+         { "llvm.lifetime.start.p0", "llvm.lifetime.end.p0" })
+      ASSERT(countCalls(mod, "f", name) == 3,
+        std::string("Expected one ") + name + " per slot")
+    SUCCESS
+  }
+
+  TEST(allocation_builtins_call_the_allocator) {
+    const char* decls =
+      "func f(): unit = { let p = alloc(16); free(realloc(p, 32)); };";
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(decls, mod))
+    for (const char* name : { "miscr_alloc", "miscr_realloc", "miscr_free" })
+      ASSERT(countCalls(mod, "f", name) == 1, std::string("Expected ") + name)
+    ASSERT(mod.getFunction("miscr_alloc")->hasRetAttribute(
+      llvm::Attribute::NoAlias), "Expected miscr_alloc to return noalias")
+    CompilerInstance::Options opts;
+    opts.libcAllocator = true;
+    CompilerInstance ci(opts);
+    if (!ci.compile(decls)) return ci.renderErrors();
+    ASSERT(!ci.getCodegen()->usesRuntimeAllocator()
+      && ci.getModule()->getFunction("malloc")
+      && ci.getModule()->getFunction("realloc")
+      && ci.getModule()->getFunction("free"), "Expected calls to libc")
+    SUCCESS
+  }
+
+  TEST(soa_alloc_allocates_all_columns_at_once) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "#[soa] struct P { x: i8, y: i64 }\n"
+      "func set(ps: &P): unit = { ps[0]->y = 1; };\n"
+      "func f(n: usize): unit = {\n"
+      "  let ps: uniq &P = soa_alloc(n);\n"
+      "  set(borrow ps);\n"
+      "  soa_free(ps);\n"
+      "};", mod))
+    ASSERT(countCalls(mod, "f", "miscr_alloc") == 1, "Expected one alloc")
+    ASSERT(countCalls(mod, "f", "miscr_free") == 1, "Expected one free")
+    SUCCESS
+  }
+
+  TEST(target_clones_are_dispatched_by_an_ifunc) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "#[target_clones(\"avx2\", \"default\")]\n"
+      "func f(x: i32): i32 = x * 2;\n"
+      "func g(): i32 = f(1);", mod))
+    llvm::GlobalIFunc* ifunc = mod.getNamedIFunc("global::f");
+    ASSERT(ifunc != nullptr, "Expected an ifunc for f")
+    llvm::Function* avx2 = mod.getFunction("global::f.avx2");
+    ASSERT(avx2 && avx2->getFnAttribute("target-features").getValueAsString()
+      == "+avx2", "Expected an avx2 clone")
+    ASSERT(mod.getFunction("global::f.default"), "Expected a default clone")
+    ASSERT(countInstructions(mod, "g", llvm::Instruction::Call) == 1,
+      "Expected g to call f")
+    SUCCESS
+  }
+
+  TEST(instructions_have_source_locations) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func f(x: i32): i32 = x;\n"
+      "func g(): i32 =\n"
+      "  f(1) + 2;", mod, true))
+    ASSERT(countInstructions(mod, "g", llvm::Instruction::Call) == 1,
+      "Expected a call to f")
+    for (llvm::Instruction& inst : mod.getFunction("global::g")->front()) {
+      if (!llvm::isa<llvm::CallInst>(inst)) continue;
+      llvm::DebugLoc loc = inst.getDebugLoc();
+      ASSERT(loc && loc.getLine() == 3 && loc.getCol() == 3,
+        "Expected the call to be located at 3:3")
+    }
+    SUCCESS
+  }
+
+  TEST(constants_become_read_only_globals) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "const N: i32 = 2 * 3;\n"
+      "const TABLE: &i32 = [N, N + 1];\n"
+      "func f(i: i64): i32 = TABLE[i]! + N;", mod))
+    llvm::GlobalVariable* n = mod.getGlobalVariable("global::N", true);
+    ASSERT(n && n->isConstant(), "Expected a constant global for N")
+    auto value = llvm::dyn_cast<llvm::ConstantInt>(n->getInitializer());
+    ASSERT(value && value->getSExtValue() == 6, "Expected N to be folded")
+    ASSERT(countInstructions(mod, "f", llvm::Instruction::Load) == 1,
+      "Expected N to be used without a load")
+    SUCCESS
+  }
+
+  TEST(index_variables_are_pointer_width) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func sum(a: &i32): i32 = {\n"
+      "  let s = 0; let i = 0;\n"
+      "  while (i < 100) { s = s + a[i]!; i = i + 1; }\n"
+      "  s\n"
+      "};\n"
+      "func half(x: usize): usize = x / 2;", mod))
+    for (llvm::Instruction& inst : llvm::instructions(
+           mod.getFunction("global::sum")))
+      if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst))
+        ASSERT(gep->getOperand(1)->getType()->isIntegerTy(64),
+          "Expected i to be an isize")
+    ASSERT(countInstructions(mod, "half", llvm::Instruction::UDiv) == 1,
+      "Expected usize division to be unsigned")
+    SUCCESS
+  }
+
+  TEST(bit_builtins_become_intrinsics) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func mix(x: i32, n: i32): i32 =\n"
+      "  rotl(x, n) ^ popcount(x) | clz(x) & ctz(x) >> 1;\n"
+      "func swap(x: i64): i64 = bswap(bitreverse(x)) << 1;", mod))
+    for (const char* name : { "llvm.fshl.i32", "llvm.ctpop.i32",
+        "llvm.ctlz.i32", "llvm.cttz.i32", "llvm.bswap.i64",
+        "llvm.bitreverse.i64" })
+      ASSERT(mod.getFunction(name), std::string("Expected ") + name)
+    ASSERT(countInstructions(mod, "mix", llvm::Instruction::AShr) == 1,
+      "Expected an arithmetic right shift")
+    ASSERT(countInstructions(mod, "mix", llvm::Instruction::Call) == 4,
+      "Expected one call per builtin")
+    SUCCESS
+  }
+
+  TEST(shift_amounts_wrap_around) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "const S: i32 = 1 << 33;\n"
+      "func shl(x: i64, n: i64): i64 = x << n;", mod))
+    auto s = llvm::dyn_cast<llvm::ConstantInt>(
+      mod.getGlobalVariable("global::S", true)->getInitializer());
+    ASSERT(s && s->getSExtValue() == 2, "Expected 1 << 33 to be 2")
+    ASSERT(countInstructions(mod, "shl", llvm::Instruction::And) == 1,
+      "Expected the shift amount to be masked")
+    SUCCESS
+  }
+
+  TEST(math_builtins_become_intrinsics) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "func norm(x: f64, y: f64): f64 = sqrt(fma(x, x, y * y));\n"
+      "func clamp(x: f32): f32 = max(min(abs(x), 1.0), floor(x));", mod))
+    for (const char* name : { "llvm.sqrt.f64", "llvm.fma.f64",
+        "llvm.fabs.f32", "llvm.minnum.f32", "llvm.maxnum.f32",
+        "llvm.floor.f32" })
+      ASSERT(mod.getFunction(name), std::string("Expected ") + name)
+    ASSERT(countInstructions(mod, "norm", llvm::Instruction::FMul) == 1,
+      "Expected a floating-point multiply")
+    SUCCESS
+  }
+
+  TEST(nan_is_not_equal_to_itself) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "const NAN: f64 = 0.0 / 0.0;\n"
+      "const NAN_NE_NAN: bool = NAN /= NAN;\n"
+      "func isNaN(x: f64): bool = x /= x;", mod))
+    auto ne = llvm::dyn_cast<llvm::ConstantInt>(
+      mod.getGlobalVariable("global::NAN_NE_NAN", true)->getInitializer());
+    ASSERT(ne && ne->isOne(), "Expected NAN /= NAN to be true")
+    ASSERT(countInstructions(mod, "isNaN", llvm::Instruction::FCmp) == 1,
+      "Expected a floating-point comparison")
+    for (llvm::Instruction& inst : llvm::instructions(
+           mod.getFunction("global::isNaN")))
+      if (auto cmp = llvm::dyn_cast<llvm::FCmpInst>(&inst))
+        ASSERT(cmp->getPredicate() == llvm::CmpInst::FCMP_UNE,
+          "Expected an unordered comparison")
+    SUCCESS
+  }
+
+  TEST(sorting_builtins_are_specialized) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "struct P { k: i64, v: i64 }\n"
+      "extern func ints(n: usize): &usize;\n"
+      "extern func ps(n: usize): &P;\n"
+      "func byKey(a: &P, b: &P): bool = a->k < b->k;\n"
+      "func f(n: usize): usize = {\n"
+      "  let a = ints(n); sort(a, n); radix_sort(a, n);\n"
+      "  sort_by(ps(n), n, byKey);\n"
+      "  lower_bound(a, n, 7)\n"
+      "};", mod))
+    for (const char* name : { "miscr.sort.usize", "miscr.radix_sort.usize",
+        "miscr.lower_bound.usize", "miscr.sort.by.global::byKey" })
+      ASSERT(mod.getFunction(name), std::string("Expected ") + name)
+    ASSERT(countCalls(mod, "f", "miscr.sort.usize") == 1,
+      "Expected f to call the usize sort")
+    bool comparatorCalled = false;
+    for (llvm::Function& fn : mod)
+      if (fn.getName().endswith("by.global::byKey"))
+        for (llvm::Instruction& inst : llvm::instructions(fn))
+          if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst))
+            if (call->getCalledFunction()
+                && call->getCalledFunction()->getName() == "global::byKey")
+              comparatorCalled = true;
+    ASSERT(comparatorCalled, "Expected sort_by to call the comparator")
+    unsigned selects = 0;
+    for (llvm::Instruction& inst :
+        llvm::instructions(mod.getFunction("miscr.lower_bound.usize")))
+      if (llvm::isa<llvm::SelectInst>(inst)) ++selects;
+    ASSERT(selects > 0, "Expected lower_bound to be branchless")
+    SUCCESS
+  }
+
+  TEST(async_functions_become_coroutines) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("test", ctx);
+    TRY(generate(
+      "struct P { x: i32, y: i32 }\n"
+      "async func one(): i32 = 1;\n"
+      "async func two(): i32 = { let p = P{ 1, 2 }; await one() + p.y };\n"
+      "func main(): i32 = block_on(two());", mod))
+    for (const char* name : { "llvm.coro.id", "llvm.coro.begin",
+        "llvm.coro.suspend", "llvm.coro.end", "llvm.coro.done",
+        "miscr_async_wake", "miscr_async_run" })
+      ASSERT(mod.getFunction(name), std::string("Expected ") + name)
+    ASSERT(mod.getFunction("global::two")->getReturnType()->isPointerTy(),
+      "Expected an async function to return its coroutine handle")
+    // one final suspend, plus one per await
+    ASSERT(countCalls(mod, "two", "llvm.coro.suspend") == 2,
+      "Expected two suspend points")
+    SUCCESS
+  }
+
+  TEST(unit_async_functions) {
+    CompilerInstance ci;
+    if (!ci.parse(
+        "async func tick(): unit = {};\n"
+        "async func run(): unit = { await tick(); };\n"
+        "func main(): unit = block_on(run());")
+        || !ci.analyze() || !ci.generate())
+      return ci.renderErrors();
+    bool found = false;
+    for (llvm::Instruction& inst :
+        llvm::instructions(ci.getModule()->getFunction("global::tick"))) {
+      auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+      if (alloca == nullptr || alloca->getName() != "promise") continue;
+      auto st = llvm::cast<llvm::StructType>(alloca->getAllocatedType());
+      ASSERT(st->getNumElements() == 1 && st->getElementType(0)->isPointerTy(),
+        "Expected the promise of a unit future to hold only the waiter")
+      found = true;
+    }
+    ASSERT(found, "Expected a promise")
+    SUCCESS
+  }
+}
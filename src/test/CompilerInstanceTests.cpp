@@ -0,0 +1,349 @@
+#include <thread>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DiagnosticPrinter.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include "driver/CompilerInstance.hpp"
+#include "driver/MachineCodeReport.hpp"
+#include "test.hpp"
+
+namespace CompilerInstanceTests {
+  TESTGROUP("Compiler Instance Tests")
+
+  //==========================================================================//
+
+  /// A program whose IR depends on @p n.
+  std::string program(unsigned n) {
+    return "extern func puts(s: &i8): i32;\n"
+      "func f(x: i32): i32 = x * " + std::to_string(n) + ";\n"
+      "func main(): i32 = { puts(\"hi\"); f(" + std::to_string(n) + ") };";
+  }
+
+  /// Writes a bitcode file that defines `i32 square(i32)` and `i32 unused()`
+  /// (as clang would for C) to a temporary file and returns its path.
+  std::string writeSquareBitcode() {
+    llvm::LLVMContext ctx;
+    llvm::Module lib("square.c", ctx);
+    lib.setTargetTriple("x86_64-unknown-linux-gnu");
+    llvm::IRBuilder<> B(ctx);
+    auto square = llvm::Function::Create(llvm::FunctionType::get(
+      B.getInt32Ty(), { B.getInt32Ty() }, false),
+      llvm::GlobalValue::ExternalLinkage, "square", lib);
+    B.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", square));
+    B.CreateRet(B.CreateMul(square->getArg(0), square->getArg(0)));
+    auto unused = llvm::Function::Create(llvm::FunctionType::get(
+      B.getInt32Ty(), false), llvm::GlobalValue::ExternalLinkage, "unused",
+      lib);
+    B.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", unused));
+    B.CreateRet(B.getInt32(0));
+    llvm::SmallString<128> path;
+    int fd;
+    llvm::sys::fs::createTemporaryFile("square", "bc", fd, path);
+    llvm::raw_fd_ostream os(fd, true);
+    llvm::WriteBitcodeToFile(lib, os);
+    return path.str().str();
+  }
+
+  /// Writes a bitcode file that defines `i32 next_id()`, which increments and
+  /// returns `static i32 counter`, and `i32 square(i32)`, laid out with a
+  /// different data layout string than miscrc's, to a temporary file and
+  /// returns its path.
+  std::string writeCounterBitcode() {
+    llvm::LLVMContext ctx;
+    llvm::Module lib("counter.c", ctx);
+    lib.setTargetTriple("x86_64-unknown-linux-gnu");
+    lib.setDataLayout("e-m:e-i64:64-f80:128-S128");
+    llvm::IRBuilder<> B(ctx);
+    auto counter = new llvm::GlobalVariable(lib, B.getInt32Ty(), false,
+      llvm::GlobalValue::InternalLinkage, B.getInt32(0), "counter");
+    auto nextId = llvm::Function::Create(llvm::FunctionType::get(
+      B.getInt32Ty(), false), llvm::GlobalValue::ExternalLinkage, "next_id",
+      lib);
+    B.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", nextId));
+    llvm::Value* id = B.CreateAdd(B.CreateLoad(B.getInt32Ty(), counter),
+      B.getInt32(1));
+    B.CreateStore(id, counter);
+    B.CreateRet(id);
+    auto square = llvm::Function::Create(llvm::FunctionType::get(
+      B.getInt32Ty(), { B.getInt32Ty() }, false),
+      llvm::GlobalValue::ExternalLinkage, "square", lib);
+    B.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", square));
+    B.CreateRet(B.CreateMul(square->getArg(0), square->getArg(0)));
+    llvm::SmallString<128> path;
+    int fd;
+    llvm::sys::fs::createTemporaryFile("counter", "bc", fd, path);
+    llvm::raw_fd_ostream os(fd, true);
+    llvm::WriteBitcodeToFile(lib, os);
+    return path.str().str();
+  }
+
+  //==========================================================================//
+
+  TEST(compiles_to_an_in_memory_module) {
+    CompilerInstance ci;
+    if (!ci.compile(program(7))) return ci.renderErrors();
+    ASSERT(ci.getModule()->getFunction("global::f"), "Expected f")
+    ASSERT(ci.getIR().find("mul i32 %x, 7") != std::string::npos,
+      "Expected f to multiply by 7")
+    llvm::SmallString<0> obj;
+    if (!ci.emitObject(obj)) return ci.renderErrors();
+    ASSERT(obj.size() > 4 && obj.str().startswith("\x7f" "ELF"),
+      "Expected an ELF object")
+    SUCCESS
+  }
+
+  TEST(structs_use_the_target_data_layout) {
+    CompilerInstance ci;
+    if (!ci.parse(
+        "struct Big { a: i32, b: i64, c: i64, d: i64 }\n"
+        "func f(r: &Big, s: &Big): unit = { r! = s!; };")
+        || !ci.analyze() || !ci.generate())
+      return ci.renderErrors();
+    std::string ir = ci.getIR();
+    ASSERT(ir.find("align 8 %s, i64 32, i1 false)") != std::string::npos,
+      "Expected a 32-byte copy aligned to 8 bytes, got:\n" + ir)
+    SUCCESS
+  }
+
+  /// A module with a function that keeps a 64-byte struct on its stack, and
+  /// target clones, which need the generated `miscr.cpu_features`.
+  const char* reportedProgram =
+    "struct Big { a: i64, b: i64, c: i64, d: i64,\n"
+    "             e: i64, f: i64, g: i64, h: i64 }\n"
+    "extern func use(b: &Big): unit;\n"
+    "func big(): unit = { let b = Big{ 1, 2, 3, 4, 5, 6, 7, 8 }; use(&b); };\n"
+    "#[target_clones(\"avx2\", \"default\")]\n"
+    "func g(x: i32): i32 = x + 1;";
+
+  /// Compiles reportedProgram and reads the sizes back into @p report.
+  std::optional<std::string> readReport(MachineCodeReport& report) {
+    CompilerInstance ci;
+    llvm::SmallString<0> obj;
+    if (!ci.compile(reportedProgram) || !ci.emitObject(obj, true))
+      return ci.renderErrors();
+    ASSERT(report.read(obj, ci.getOntology()), "Could not read the object")
+    SUCCESS
+  }
+
+  TEST(stack_usage_report) {
+    MachineCodeReport report;
+    TRY(readReport(report))
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    report.printStackUsage(os, MachineCodeReport::TEXT, "t.miscr");
+    const MachineCodeReport::Function& first = report.functions.front();
+    ASSERT(first.name == "global::big" && !first.dynamicFrame
+      && first.frameBytes >= 64, "Expected big to have the largest frame, "
+      "of at least 64 bytes, got:\n" + os.str())
+    ASSERT(os.str().find("  global::big  t.miscr:4:1\n") != std::string::npos,
+      "Expected the location of big, got:\n" + os.str())
+    SUCCESS
+  }
+
+  TEST(size_report) {
+    MachineCodeReport report;
+    TRY(readReport(report))
+    uint64_t total = 0;
+    bool cpuFeatures = false;
+    for (const MachineCodeReport::Function& f : report.functions) {
+      ASSERT(f.codeBytes > 0, "Expected " + f.name + " to have code")
+      total += f.codeBytes;
+      cpuFeatures |= f.name == "miscr.cpu_features" && f.generated;
+    }
+    ASSERT(cpuFeatures, "Expected miscr.cpu_features to be reported")
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    report.printSizeReport(os, MachineCodeReport::TEXT);
+    ASSERT(os.str().find("  (generated)\n") != std::string::npos,
+      "Expected a module for generated code, got:\n" + os.str())
+    ASSERT(os.str().find(llvm::formatv("{0,9}  total\n", total).str())
+      != std::string::npos,
+      "Expected the total to count every function, got:\n" + os.str())
+    SUCCESS
+  }
+
+  TEST(errors_are_collected_per_stage) {
+    CompilerInstance parseErr;
+    ASSERT(!parseErr.compile("func f(: i32 = 1;") && parseErr.hasErrors(),
+      "Expected a parser error")
+    CompilerInstance semaErr;
+    ASSERT(!semaErr.compile("func f(): i32 = true;"), "Expected a type error")
+    ASSERT(semaErr.renderErrors().find("func f(): i32 = ")
+      != std::string::npos, "Expected the error to show the source")
+    ASSERT(!semaErr.generate(), "Expected later stages to refuse to run")
+    CompilerInstance::Options opts;
+    opts.skipBorrowChecking = true;
+    CompilerInstance unchecked(opts);
+    ASSERT(unchecked.compile(
+      "extern func malloc(n: i64): uniq &i8;\n"
+      "func leak(): unit = { let x = malloc(1); };"),
+      "Expected the borrow checker to be skipped")
+    SUCCESS
+  }
+
+  TEST(streams_functions_into_partitions) {
+    const char* text =
+      "struct P { x: i32, y: i32 }\n"
+      "func f(a: i32): i32 = g(a).x + 1;\n"
+      "func g(a: i32): P = P{ a, 2 * a };\n"
+      "module M { func h(): i32 = f(3) * 2; }\n"
+      "func main(): i32 = M::h() - 9;";
+    CompilerInstance whole;
+    if (!whole.compile(text)) return whole.renderErrors();
+    CompilerInstance::Options opts;
+    opts.stream = true;
+    opts.partitionBudget = 1;
+    CompilerInstance ci(opts);
+    if (!ci.parse(text)) return ci.renderErrors();
+    std::vector<std::string> defined;
+    unsigned partitions = 0;
+    bool ok = ci.stream([&](llvm::Module& part) {
+      ++partitions;
+      for (llvm::Function& f : part)
+        if (!f.isDeclaration()) defined.push_back(f.getName().str());
+      return true;
+    });
+    if (!ok) return ci.renderErrors();
+    ASSERT(partitions == 5, "Expected one partition per function and a "
+      "final one, got " + std::to_string(partitions))
+    std::vector<std::string> expected;
+    for (llvm::Function& f : *whole.getModule())
+      if (!f.isDeclaration()) expected.push_back(f.getName().str());
+    std::sort(defined.begin(), defined.end());
+    std::sort(expected.begin(), expected.end());
+    ASSERT(defined == expected, "Expected the partitions to define the "
+      "functions of the whole module")
+    for (auto& entry : ci.getOntology().functionSpace)
+      ASSERT(!entry.second->hasBody(), "Expected the AST of "
+        + entry.first().str() + " to be released")
+    SUCCESS
+  }
+
+  TEST(stream_reports_errors_in_bodies) {
+    CompilerInstance::Options opts;
+    opts.stream = true;
+    CompilerInstance parseErr(opts);
+    ASSERT(parseErr.parse("func f(): i32 = 1 + ;\nfunc g(): i32 = 2;"),
+      "Expected bodies to be skipped by the parser")
+    ASSERT(!parseErr.stream([](llvm::Module&) { return true; })
+      && parseErr.renderErrors().find("I got stuck")
+      != std::string::npos, "Expected a parser error in f")
+    CompilerInstance semaErr(opts);
+    unsigned partitions = 0;
+    ASSERT(semaErr.parse("func f(): i32 = 1;\nfunc g(): i32 = true;"),
+      "Expected the program to parse")
+    ASSERT(!semaErr.stream([&](llvm::Module&) { ++partitions; return true; }),
+      "Expected a type error in g")
+    ASSERT(partitions == 0, "Expected nothing to be emitted")
+    SUCCESS
+  }
+
+  TEST(instances_run_in_parallel) {
+    const unsigned numThreads = 8, perThread = 4;
+    std::vector<std::string> expected(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i) {
+      CompilerInstance ci;
+      if (!ci.compile(program(i))) return ci.renderErrors();
+      expected[i] = ci.getIR();
+    }
+    std::vector<std::string> failures(numThreads);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < numThreads; ++i) {
+      threads.emplace_back([&, i]() {
+        for (unsigned j = 0; j < perThread; ++j) {
+          CompilerInstance::Options opts;
+          opts.optLevel = j % 2 == 0 ? 0 : 2;
+          CompilerInstance ci(opts);
+          if (!ci.compile(program(i))) failures[i] = ci.renderErrors();
+          else if (opts.optLevel == 0 && ci.getIR() != expected[i])
+            failures[i] = "IR differs from a sequential compile";
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+    for (const std::string& failure : failures)
+      if (!failure.empty()) return failure;
+    SUCCESS
+  }
+
+  TEST(links_extern_functions_from_bitcode) {
+    const char* program =
+      "module C { extern func square(x: i32): i32; }\n"
+      "func f(y: i32): i32 = C::square(y) + 1;";
+    CompilerInstance::Options opts;
+    opts.bitcodeFiles = { writeSquareBitcode() };
+    CompilerInstance ci(opts);
+    if (!ci.parse(program) || !ci.analyze() || !ci.generate())
+      return ci.renderErrors();
+    std::string ir = ci.getIR();
+    ASSERT(ir.find("define internal i32 @square(") != std::string::npos
+      && ir.find("@unused") == std::string::npos,
+      "Expected only square to be linked\n" + ir)
+    opts.optLevel = 2;
+    CompilerInstance optimized(opts);
+    if (!optimized.compile(program)) return optimized.renderErrors();
+    ir = optimized.getIR();
+    ASSERT(ir.find("@square") == std::string::npos
+      && ir.find("mul i32 %y, %y") != std::string::npos,
+      "Expected square to be inlined into f\n" + ir)
+    llvm::sys::fs::remove(opts.bitcodeFiles[0]);
+
+    opts.bitcodeFiles = { "does-not-exist.bc" };
+    CompilerInstance missing(opts);
+    ASSERT(!missing.compile(program)
+      && missing.renderErrors().find("does-not-exist.bc") != std::string::npos,
+      "Expected a missing bitcode file to be reported")
+    SUCCESS
+  }
+
+  TEST(streams_stateful_bitcode_into_one_partition) {
+    const char* program =
+      "module C {\n"
+      "  extern func next_id(): i32;\n"
+      "  extern func square(x: i32): i32;\n"
+      "}\n"
+      "func f(): i32 = C::next_id() + C::square(2);\n"
+      "func g(): i32 = C::next_id() * C::square(3);\n"
+      "func main(): i32 = f() + g();";
+    CompilerInstance::Options opts;
+    opts.stream = true;
+    opts.partitionBudget = 1;
+    opts.bitcodeFiles = { writeCounterBitcode() };
+    CompilerInstance ci(opts);
+    std::string warnings;
+    ci.getLLVMContext().setDiagnosticHandlerCallBack(
+      [](const llvm::DiagnosticInfo& diag, void* context) {
+        llvm::raw_string_ostream os(*static_cast<std::string*>(context));
+        llvm::DiagnosticPrinterRawOStream printer(os);
+        diag.print(printer);
+        os << "\n";
+      }, &warnings);
+    if (!ci.parse(program)) return ci.renderErrors();
+    std::vector<std::string> parts;
+    bool ok = ci.stream([&](llvm::Module& part) {
+      std::string ir;
+      llvm::raw_string_ostream os(ir);
+      part.print(os, nullptr);
+      parts.push_back(os.str());
+      return true;
+    });
+    llvm::sys::fs::remove(opts.bitcodeFiles[0]);
+    if (!ok) return ci.renderErrors();
+    ASSERT(warnings.empty(), "Expected the data layouts to match\n"
+      + warnings)
+    ASSERT(parts.size() == 4, "Expected one partition per function and a "
+      "final one, got " + std::to_string(parts.size()))
+    for (unsigned i = 0; i < parts.size(); ++i) {
+      bool last = i + 1 == parts.size();
+      const std::string& ir = parts[i];
+      ASSERT((ir.find("@counter") != std::string::npos) == last
+        && (ir.find("define i32 @next_id()") != std::string::npos) == last,
+        "Expected only the last partition to define next_id and counter\n"
+        + ir)
+      ASSERT(last || ir.find("define internal i32 @square(")
+        != std::string::npos, "Expected square to be copied\n" + ir)
+    }
+    SUCCESS
+  }
+}
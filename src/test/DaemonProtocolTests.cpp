@@ -0,0 +1,42 @@
+#include "daemon/Protocol.hpp"
+#include "test.hpp"
+
+namespace DaemonProtocolTests {
+  TESTGROUP("Daemon Protocol Tests")
+
+  //==========================================================================//
+
+  TEST(strings_round_trip) {
+    int fds[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "No socketpair")
+    std::string got;
+    bool ok = DaemonProtocol::sendString(fds[0], "hello")
+           && DaemonProtocol::recvString(fds[1], got);
+    close(fds[0]);
+    close(fds[1]);
+    ASSERT(ok && got == "hello", "Expected to receive hello")
+    SUCCESS
+  }
+
+  TEST(oversized_strings_are_rejected) {
+    int fds[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "No socketpair")
+    std::string got;
+    bool ok = DaemonProtocol::sendU32(fds[0], UINT32_MAX)
+           && DaemonProtocol::recvString(fds[1], got);
+    close(fds[0]);
+    close(fds[1]);
+    ASSERT(!ok && got.empty(), "Expected the length to be refused")
+    SUCCESS
+  }
+
+  TEST(peers_of_the_same_user_are_accepted) {
+    int fds[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "No socketpair")
+    bool same = DaemonProtocol::peerIsSameUser(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    ASSERT(same, "Expected the peer to run as this user")
+    SUCCESS
+  }
+}
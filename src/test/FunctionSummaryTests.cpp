@@ -0,0 +1,166 @@
+#include "lexer/Lexer.hpp"
+#include "parser/Parser.hpp"
+#include "sema/Sema.hpp"
+#include "analysis/FunctionSummaries.hpp"
+#include "test.hpp"
+
+namespace FunctionSummaryTests {
+  TESTGROUP("Function Summary Tests")
+
+  //==========================================================================//
+
+  /// Summarizes @p declsText with @p numThreads threads and copies the
+  /// summary of global function @p funcName into @p out.
+  std::optional<std::string> summarize(const char* declsText,
+      const char* funcName, FunctionSummary& out, unsigned numThreads = 1) {
+    LocationTable LT(declsText);
+    auto tokens = Lexer(declsText, &LT).run();
+    Parser parser(tokens);
+    DeclList* parsed = parser.decls0();
+    if (parsed == nullptr) return "Parser error";
+    Sema sema;
+    sema.run(parsed, "global");
+    if (sema.hasErrors()) {
+      std::string errStr;
+      for (auto err : sema.getErrors())
+        errStr.append(err.render(declsText, LT));
+      return errStr;
+    }
+    FunctionSummaries summaries(sema.getOntology(), numThreads);
+    summaries.run();
+    std::string fqn = std::string("global::") + funcName;
+    out = summaries.lookup(sema.getOntology().getFunction(fqn));
+    SUCCESS
+  }
+
+  //==========================================================================//
+
+  TEST(pure_function) {
+    FunctionSummary s;
+    TRY(summarize("func add(a: i32, b: i32): i32 = a + b;", "add", s))
+    ASSERT(s.isPure(), "Expected add to be pure")
+    SUCCESS
+  }
+
+  TEST(readonly_nocapture_param) {
+    FunctionSummary s;
+    TRY(summarize(
+      "struct S { len: i64 }\n"
+      "func len(s: &S): i64 = s->len;", "len", s))
+    ASSERT(s.memory == FunctionSummary::READ, "Expected len to only read")
+    ASSERT(s.isReadOnly(0), "Expected s to be readonly")
+    ASSERT(s.isNoCapture(0), "Expected s to be nocapture")
+    SUCCESS
+  }
+
+  TEST(written_param) {
+    FunctionSummary s;
+    TRY(summarize("func set(p: &i32): unit = { p! = 1; };", "set", s))
+    ASSERT(s.memory == FunctionSummary::READWRITE, "Expected a write")
+    ASSERT(!s.isReadOnly(0), "Expected p to be written")
+    ASSERT(s.isNoCapture(0), "Expected p to be nocapture")
+    SUCCESS
+  }
+
+  TEST(written_through_local_alias) {
+    FunctionSummary s;
+    TRY(summarize(
+      "func set(p: &i32): unit = {\n"
+      "  let q = p;\n"
+      "  let r = &q;\n"
+      "  (r!)! = 1;\n"
+      "};", "set", s))
+    ASSERT(!s.isReadOnly(0), "Expected p to be written")
+    SUCCESS
+  }
+
+  TEST(written_through_overwritten_address_taken_local) {
+    FunctionSummary s;
+    TRY(summarize(
+      "func f(p: &i32, q: &i32): unit = {\n"
+      "  let x = q;\n"
+      "  let r = &x;\n"
+      "  r! = p;\n"
+      "  x! = 42;\n"
+      "};", "f", s))
+    ASSERT(!s.isReadOnly(0), "Expected p to be written")
+    SUCCESS
+  }
+
+  TEST(returned_and_captured_params) {
+    FunctionSummary s;
+    TRY(summarize("func id(p: &i32): &i32 = p;", "id", s))
+    ASSERT(s.isPure(), "Expected id to be pure")
+    ASSERT(!s.isNoCapture(0), "Expected p to be returned")
+    ASSERT(!s.returnsFresh(), "Expected id to return its argument")
+    TRY(summarize("func stash(dst: &&i32, p: &i32): unit = { dst! = p; };",
+      "stash", s))
+    ASSERT(!s.isReadOnly(0), "Expected dst to be written")
+    ASSERT(s.isReadOnly(1), "Expected p to be readonly")
+    ASSERT(!s.isNoCapture(1), "Expected p to be captured")
+    SUCCESS
+  }
+
+  TEST(summaries_flow_through_calls) {
+    const char* decls =
+      "extern func free(ptr: uniq &i8): unit;\n"
+      "func set(p: &i32): unit = { p! = 1; };\n"
+      "func viaSet(p: &i32, q: &i32): unit = set(p);\n"
+      "func even(p: &i32, n: i32): bool =\n"
+      "  if (n == 0) true else odd(p, n - 1);\n"
+      "func odd(p: &i32, n: i32): bool =\n"
+      "  if (n == 0) false else even(p, n - 1);\n"
+      "func callsExtern(x: uniq &i8): unit = free(x);\n";
+    FunctionSummary s;
+    TRY(summarize(decls, "viaSet", s))
+    ASSERT(!s.isReadOnly(0), "Expected p to be written through set")
+    ASSERT(s.isReadOnly(1), "Expected q to be readonly")
+    TRY(summarize(decls, "odd", s))
+    ASSERT(s.isPure(), "Expected mutually recursive odd to be pure")
+    ASSERT(s.isNoCapture(0), "Expected p to be nocapture")
+    TRY(summarize(decls, "callsExtern", s))
+    ASSERT(s.memory == FunctionSummary::READWRITE, "Extern calls are unknown")
+    ASSERT(!s.isNoCapture(0), "Extern calls may capture")
+    SUCCESS
+  }
+
+  TEST(allocation_builtins_have_effects) {
+    FunctionSummary s;
+    TRY(summarize("func make(): uniq &i8 = alloc(16);", "make", s))
+    ASSERT(s.memory == FunctionSummary::READWRITE, "Expected alloc to write")
+    ASSERT(s.returnsExternal, "Expected alloc to return new memory")
+    TRY(summarize("func drop(x: uniq &i8): unit = free(x);", "drop", s))
+    ASSERT(!s.isReadOnly(0), "Expected free to write x")
+    SUCCESS
+  }
+
+  TEST(sorting_builtins_write_their_array) {
+    FunctionSummary s;
+    TRY(summarize("func f(a: &i32, n: usize): unit = sort(a, n);", "f", s))
+    ASSERT(!s.isReadOnly(0), "Expected sort to write a")
+    ASSERT(s.isNoCapture(0), "Expected sort not to capture a")
+    TRY(summarize(
+      "func f(a: &i32, n: usize): usize = lower_bound(a, n, 0);", "f", s))
+    ASSERT(s.isReadOnly(0), "Expected lower_bound to only read a")
+    SUCCESS
+  }
+
+  TEST(parallel_matches_sequential) {
+    std::string decls = "func leaf(p: &i32): unit = { p! = 1; };\n";
+    for (int i = 0; i < 40; ++i) {
+      std::string n = std::to_string(i);
+      decls += "func g" + n + "(p: &i32, q: &i32): i32 = {"
+               " leaf(p); q! };\n";
+    }
+    decls += "func top(p: &i32): i32 = g0(p, p) + g39(p, p);\n";
+    FunctionSummary seq, par;
+    for (const char* f : { "g7", "top" }) {
+      TRY(summarize(decls.c_str(), f, seq, 1))
+      TRY(summarize(decls.c_str(), f, par, 4))
+      ASSERT(seq == par, "Parallel summary differs from sequential one")
+    }
+    ASSERT(!par.isReadOnly(0), "Expected top's p to be written")
+    SUCCESS
+  }
+
+}
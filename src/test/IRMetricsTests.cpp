@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include "driver/CompilerInstance.hpp"
+#include "test.hpp"
+
+/// Golden metrics of the IR generated for the examples and for the kernels in
+/// src/test/metrics, at -O0 (what Codegen emits) and at -O2 (what LLVM makes
+/// of it). A metric regresses if it grows more than 5% over its baseline in
+/// src/test/metrics/baseline.txt, or if fewer loops vectorize. After an
+/// intended change, regenerate the baselines with `make ir-metrics-baseline`
+/// (which runs `MISCR_UPDATE_IR_METRICS=1 ./tests`) and commit the diff.
+/// What LLVM makes of the IR depends on its version, so the test fails under
+/// an LLVM major version other than the one that recorded the baselines. Only
+/// the optimization levels that have rows in the baseline are compared; the
+/// update records all of them.
+namespace IRMetricsTests {
+  TESTGROUP("IR Metrics Tests")
+
+  //==========================================================================//
+
+  enum Metric { INSTRUCTIONS, ALLOCAS, CALLS, LOADS, STORES, VECTORIZED_LOOPS,
+                NUM_METRICS };
+  const char* metricNames[NUM_METRICS] =
+    { "instructions", "allocas", "calls", "loads", "stores",
+      "vectorized_loops" };
+
+  /// Values of the metrics, indexed by Metric.
+  typedef std::array<unsigned, NUM_METRICS> Metrics;
+
+  /// The repository root, found relative to this source file.
+  std::string repoPath(llvm::StringRef relPath) {
+    llvm::SmallString<128> path(llvm::sys::path::parent_path(
+      llvm::sys::path::parent_path(llvm::sys::path::parent_path(__FILE__))));
+    llvm::sys::path::append(path, relPath);
+    return std::string(path.str());
+  }
+
+  /// The measured programs, relative to the repository root.
+  std::vector<std::string> programs() {
+    std::vector<std::string> progs;
+    for (const char* dir : { "examples", "src/test/metrics" }) {
+      std::error_code ec;
+      for (llvm::sys::fs::directory_iterator it(repoPath(dir), ec), end;
+           it != end && !ec; it.increment(ec))
+        if (llvm::sys::path::extension(it->path()) == ".miscr")
+          progs.push_back(std::string(dir) + "/"
+            + llvm::sys::path::filename(it->path()).str());
+    }
+    std::sort(progs.begin(), progs.end());
+    return progs;
+  }
+
+  Metrics measure(const llvm::Module& mod) {
+    Metrics m{};
+    for (const llvm::Function& f : mod) {
+      for (const llvm::BasicBlock& bb : f) {
+        bool hasVectors = false;
+        for (const llvm::Instruction& inst : bb) {
+          ++m[INSTRUCTIONS];
+          if (llvm::isa<llvm::AllocaInst>(inst)) ++m[ALLOCAS];
+          else if (llvm::isa<llvm::CallBase>(inst)
+                   && !llvm::isa<llvm::IntrinsicInst>(inst)) ++m[CALLS];
+          else if (llvm::isa<llvm::LoadInst>(inst)) ++m[LOADS];
+          else if (llvm::isa<llvm::StoreInst>(inst)) ++m[STORES];
+          if (inst.getType()->isVectorTy()) hasVectors = true;
+        }
+        // The vector body, but not the scalar remainder, of a vectorized loop.
+        llvm::MDNode* loop =
+          bb.getTerminator()->getMetadata(llvm::LLVMContext::MD_loop);
+        if (hasVectors && loop != nullptr
+            && llvm::findOptionMDForLoopID(loop, "llvm.loop.isvectorized"))
+          ++m[VECTORIZED_LOOPS];
+      }
+    }
+    return m;
+  }
+
+  /// Compiles @p program at @p optLevel and measures the result into @p m.
+  std::optional<std::string> compileAndMeasure(const std::string& program,
+      unsigned optLevel, Metrics& m) {
+    auto buf = llvm::MemoryBuffer::getFile(repoPath(program));
+    if (!buf) return "Cannot read " + program;
+    CompilerInstance::Options opts;
+    opts.name = program;
+    opts.optLevel = optLevel;
+    CompilerInstance ci(opts);
+    if (!ci.compile(buf.get()->getBuffer()))
+      return program + " does not compile:\n" + ci.renderErrors();
+    m = measure(*ci.getModule());
+    SUCCESS
+  }
+
+  /// Identifies a row of baseline.txt, e.g. "examples/X.miscr -O2".
+  std::string rowKey(const std::string& program, unsigned optLevel)
+    { return program + " -O" + std::to_string(optLevel); }
+
+  //==========================================================================//
+
+  TEST(metrics_within_budget) {
+    std::string baselinePath = repoPath("src/test/metrics/baseline.txt");
+    bool update = std::getenv("MISCR_UPDATE_IR_METRICS") != nullptr;
+
+    // Read the baselines.
+    unsigned baselineLLVM = 0;
+    std::map<std::string, Metrics> baseline;
+    std::set<std::string> baselineLevels;
+    std::ifstream in(baselinePath);
+    for (std::string line; std::getline(in, line);) {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream fields(line);
+      std::string program, level;
+      fields >> program >> level;
+      if (program == "llvm") { baselineLLVM = std::stoi(level); continue; }
+      baselineLevels.insert(level);
+      Metrics& m = baseline[program + " " + level];
+      for (unsigned i = 0; i < NUM_METRICS; ++i) {
+        std::string field;
+        fields >> field;
+        m[i] = std::stoi(field.substr(field.find('=') + 1));
+      }
+    }
+
+    ASSERT(update || baselineLLVM == LLVM_VERSION_MAJOR, baselinePath
+      + " was recorded with LLVM " + std::to_string(baselineLLVM)
+      + ", but the tests use LLVM " + std::to_string(LLVM_VERSION_MAJOR)
+      + ". Rerecord it with `make ir-metrics-baseline`.")
+
+    std::string regressions;
+    std::ostringstream out;
+    out << "# Golden IR metrics checked by IRMetricsTests.cpp. Regenerate\n"
+           "# with: MISCR_UPDATE_IR_METRICS=1 ./tests\n"
+           "llvm " << LLVM_VERSION_MAJOR << "\n";
+    for (const std::string& program : programs()) {
+      for (unsigned optLevel : { 0, 2 }) {
+        if (!update && !baselineLevels.count("-O" + std::to_string(optLevel)))
+          continue;
+        Metrics m;
+        TRY(compileAndMeasure(program, optLevel, m))
+        std::string key = rowKey(program, optLevel);
+        out << key;
+        for (unsigned i = 0; i < NUM_METRICS; ++i)
+          out << " " << metricNames[i] << "=" << m[i];
+        out << "\n";
+        if (update) continue;
+        auto it = baseline.find(key);
+        if (it == baseline.end()) {
+          regressions += key + ": no baseline\n";
+          continue;
+        }
+        for (unsigned i = 0; i < NUM_METRICS; ++i) {
+          unsigned base = it->second[i];
+          bool regressed = i == VECTORIZED_LOOPS ? m[i] < base
+            : m[i] > base + base / 20;
+          if (regressed)
+            regressions += key + ": " + metricNames[i] + " "
+              + std::to_string(base) + " -> " + std::to_string(m[i]) + "\n";
+        }
+      }
+    }
+
+    if (update) {
+      std::ofstream(baselinePath) << out.str();
+      SUCCESS
+    }
+    ASSERT(regressions.empty(), regressions + "If this is intended, rerun "
+      "with MISCR_UPDATE_IR_METRICS=1 to update " + baselinePath)
+    SUCCESS
+  }
+}
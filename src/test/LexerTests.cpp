@@ -43,6 +43,13 @@ namespace LexerTests {
     });
   }
 
+  TEST(bitwise_operators) {
+    return tokensShouldBe("<< >> <<= | || ^", {
+      Token::OP_SHL, Token::OP_SHR, Token::OP_SHL, Token::EQUAL,
+      Token::OP_BITOR, Token::OP_OR, Token::OP_BITXOR, Token::END
+    });
+  }
+
   TEST(ampersands_should_all_be_separate) {
     return tokensShouldBe("&   &&   &&&", {
       Token::AMP, Token::AMP, Token::AMP, Token::AMP, Token::AMP, Token::AMP,
@@ -0,0 +1,264 @@
+#include "lexer/Lexer.hpp"
+#include "parser/Parser.hpp"
+#include "sema/Sema.hpp"
+#include "analysis/FunctionSummaries.hpp"
+#include "driver/CompilerInstance.hpp"
+#include "mir/MIRBuilder.hpp"
+#include "mir/MIROptimizer.hpp"
+#include "test.hpp"
+
+namespace MIRTests {
+  TESTGROUP("MIR Tests")
+
+  //==========================================================================//
+
+  /// Builds the MIR of global function @p funcName in @p declsText, optimizes
+  /// it, and prints it into @p out (or "unsupported"). The stats of the
+  /// optimizer are copied into @p stats.
+  std::optional<std::string> optimize(const char* declsText,
+      const char* funcName, std::string& out, MIROptimizer::Stats& stats) {
+    LocationTable LT(declsText);
+    auto tokens = Lexer(declsText, &LT).run();
+    Parser parser(tokens);
+    DeclList* parsed = parser.decls0();
+    if (parsed == nullptr) return "Parser error";
+    Sema sema;
+    sema.run(parsed, "global");
+    if (sema.hasErrors()) {
+      std::string errStr;
+      for (auto err : sema.getErrors())
+        errStr.append(err.render(declsText, LT));
+      return errStr;
+    }
+    FunctionSummaries summaries(sema.getOntology());
+    summaries.run();
+    std::string fqn = std::string("global::") + funcName;
+    std::unique_ptr<mir::Function> fn =
+      MIRBuilder(sema.getOntology(), sema.getTypeContext())
+        .build(sema.getOntology().getFunction(fqn));
+    out.clear();
+    llvm::raw_string_ostream os(out);
+    if (fn == nullptr) {
+      os << "unsupported";
+      SUCCESS
+    }
+    MIROptimizer optimizer(sema.getOntology(), sema.getTypeContext(),
+                           &summaries);
+    optimizer.run(*fn);
+    stats = optimizer.getStats();
+    fn->print(os);
+    SUCCESS
+  }
+
+  bool contains(const std::string& s, const char* part)
+    { return s.find(part) != std::string::npos; }
+
+  /// Compiles @p declsText, through the MIR if @p mir, and copies the
+  /// constant that global function `g` folds to into @p out. The attributes
+  /// of the functions are replaced by `alwaysinline`, so the result does not
+  /// depend on the summaries, only on the code generated for the bodies.
+  std::optional<std::string> foldG(const char* declsText, bool mir,
+      int64_t& out) {
+    CompilerInstance::Options opts;
+    opts.mir = mir;
+    opts.optLevel = 2;
+    CompilerInstance ci(opts);
+    if (!ci.parse(declsText) || !ci.analyze() || !ci.borrowCheck()
+        || !ci.generate())
+      return ci.renderErrors();
+    for (llvm::Function& f : *ci.getModule())
+      if (!f.isDeclaration()) {
+        f.setAttributes(llvm::AttributeList());
+        f.addFnAttr(llvm::Attribute::AlwaysInline);
+      }
+    if (!ci.optimize()) return ci.renderErrors();
+    llvm::Function* g = ci.getModule()->getFunction("global::g");
+    for (llvm::BasicBlock& bb : *g)
+      if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(bb.getTerminator()))
+        if (auto c = llvm::dyn_cast_or_null<llvm::ConstantInt>(
+              ret->getReturnValue())) {
+          out = c->getSExtValue();
+          SUCCESS
+        }
+    return "Expected g to fold to a constant\n" + ci.getIR();
+  }
+
+  //==========================================================================//
+
+  TEST(loop_variables_become_phis) {
+    std::string mir;
+    MIROptimizer::Stats stats;
+    TRY(optimize(
+      "func sum(n: i32): i32 {\n"
+      "  let s = 0;\n"
+      "  let i = 0;\n"
+      "  while (i < n) { s = s + i; i = i + 1; }\n"
+      "  s\n"
+      "}", "sum", mir, stats))
+    ASSERT(contains(mir, "bb1:  ; preds bb0 bb2"), mir)
+    ASSERT(contains(mir, "= phi %1, %8 : i32"), mir)
+    ASSERT(!contains(mir, "slot") && !contains(mir, "load"), mir)
+    SUCCESS
+  }
+
+  TEST(moves_and_borrows_are_propagated) {
+    std::string mir;
+    MIROptimizer::Stats stats;
+    TRY(optimize(
+      "module M {\n"
+      "  extern func strlen(s: &i8): i64;\n"
+      "  func len(p: uniq &i8): i64 {\n"
+      "    let q = move p;\n"
+      "    let n = strlen(borrow q);\n"
+      "    free(q);\n"
+      "    n\n"
+      "  }\n"
+      "}", "M::len", mir, stats))
+    ASSERT(stats.movesPropagated == 1 && stats.borrowsRemoved == 1, mir)
+    ASSERT(contains(mir, "call global::M::strlen %0 : i64"), mir)
+    ASSERT(contains(mir, "builtin free %0\n"), mir)
+    SUCCESS
+  }
+
+  TEST(address_taken_struct_is_scalar_replaced) {
+    std::string mir;
+    MIROptimizer::Stats stats;
+    TRY(optimize(
+      "module M {\n"
+      "  struct Point { x: i32, y: i32 }\n"
+      "  func f(a: i32, b: i32): i32 {\n"
+      "    let p = Point{ a, b };\n"
+      "    let q = &p;\n"
+      "    q->x = q->x + 1;\n"
+      "    p.x + p.y\n"
+      "  }\n"
+      "}", "M::f", mir, stats))
+    ASSERT(stats.slotsPromoted == 2, mir)
+    ASSERT(!contains(mir, "slot") && !contains(mir, "construct"), mir)
+    ASSERT(contains(mir, "%3 = binop + %0, %2 : i32\n"
+                         "  %4 = binop + %3, %1 : i32\n"), mir)
+    SUCCESS
+  }
+
+  TEST(loads_are_forwarded_past_read_only_calls) {
+    std::string mir;
+    MIROptimizer::Stats stats;
+    TRY(optimize(
+      "module M {\n"
+      "  func peek(a: &i8): i8 = a!;\n"
+      "  func f(n: i64): i8 {\n"
+      "    let buf = alloc(n);\n"
+      "    let p = borrow buf;\n"
+      "    p[0]! = 7;\n"
+      "    p[1]! = 8;\n"
+      "    let k = peek(p[1]);\n"
+      "    let r = p[0]! + k;\n"
+      "    free(buf);\n"
+      "    r\n"
+      "  }\n"
+      "}", "M::f", mir, stats))
+    ASSERT(stats.loadsForwarded == 1 && !contains(mir, "load"), mir)
+    ASSERT(contains(mir, "call global::M::peek %7 : i8\n"
+                         "  %11 = binop + %4, %10 : i8\n"), mir)
+    SUCCESS
+  }
+
+  TEST(loads_are_not_forwarded_after_an_escape) {
+    std::string mir;
+    MIROptimizer::Stats stats;
+    TRY(optimize(
+      "module M {\n"
+      "  extern func keep(p: &i8): unit;\n"
+      "  func f(n: i64): i8 {\n"
+      "    let buf = alloc(n);\n"
+      "    let p = borrow buf;\n"
+      "    p[0]! = 7;\n"
+      "    keep(p);\n"
+      "    let r = p[0]!;\n"
+      "    free(buf);\n"
+      "    r\n"
+      "  }\n"
+      "}", "M::f", mir, stats))
+    ASSERT(stats.loadsForwarded == 0, mir)
+    ASSERT(contains(mir, "%7 = load %3 : i8"), mir)
+    SUCCESS
+  }
+
+  TEST(async_functions_are_unsupported) {
+    std::string mir;
+    MIROptimizer::Stats stats;
+    TRY(optimize(
+      "module M {\n"
+      "  extern async func async_sleep(ms: i64): i64;\n"
+      "  async func slow(x: i32): i32 = { await async_sleep(100); x };\n"
+      "}", "M::slow", mir, stats))
+    ASSERT(mir == "unsupported", mir)
+    SUCCESS
+  }
+
+  TEST(compiler_instance_lowers_through_mir) {
+    const char* program =
+      "struct Vec3 { x: f64, y: f64, z: f64 }\n"
+      "extern func consume(v: &Vec3): unit;\n"
+      "func f(c: bool, n: i32): f64 {\n"
+      "  let acc: f64 = 0.0;\n"
+      "  if (c) {\n"
+      "    let u = Vec3{ 1.0, 2.0, 3.0 };\n"
+      "    consume(&u);\n"
+      "    acc = u.x + u.z;\n"
+      "  }\n"
+      "  let i = 0;\n"
+      "  while (i < n) { let w = Vec3{ acc, acc, acc }; consume(&w); "
+      "i = i + 1; }\n"
+      "  acc\n"
+      "}\n"
+      "#[soa] struct P { x: i32, y: i32 }\n"
+      "func g(ps: &P, i: i64): i32 = ps[i]->x;";
+    CompilerInstance::Options opts;
+    opts.mir = true;
+    CompilerInstance ci(opts);
+    if (!ci.compile(program)) return ci.renderErrors();
+    std::string ir = ci.getIR();
+    const Codegen::Stats& stats = ci.getCodegen()->getStats();
+    ASSERT(stats.mirFunctions == 1 && stats.mirFallbacks == 1, ir)
+    ASSERT(contains(ir, "whileCond:") && contains(ir, "%u = alloca"), ir)
+    ASSERT(contains(ir, "@llvm.memcpy"), "Expected u to be copied from a "
+      "constant\n" + ir)
+    SUCCESS
+  }
+
+  TEST(mir_agrees_with_direct_codegen) {
+    const char* programs[] = {
+      // a store through the address of x retargets it from q to p
+      "func f(p: &i32, q: &i32): unit = {\n"
+      "  let x = q;\n"
+      "  let r = &x;\n"
+      "  r! = p;\n"
+      "  x! = 42;\n"
+      "};\n"
+      "func g(): i32 = { let v = 5; let w = 7; f(&v, &w); v };",
+
+      "func peek(a: &i32): i32 = a!;\n"
+      "func bump(a: &i32): unit = { a! = a! + 1; };\n"
+      "func g(): i32 = {\n"
+      "  let v = 1;\n"
+      "  let k = peek(&v);\n"
+      "  bump(&v);\n"
+      "  v * 10 + k\n"
+      "};",
+
+      "struct P { x: i32, y: i32 }\n"
+      "func swap(p: &P): unit = { let t = p->x; p->x = p->y; p->y = t; };\n"
+      "func g(): i32 = { let p = P{ 3, 4 }; swap(&p); p.x * 10 + p.y };",
+    };
+    for (const char* program : programs) {
+      int64_t direct, viaMIR;
+      TRY(foldG(program, false, direct))
+      TRY(foldG(program, true, viaMIR))
+      ASSERT(direct == viaMIR, std::string("Expected ") + program
+        + "\nto give " + std::to_string(direct) + " through the MIR, not "
+        + std::to_string(viaMIR))
+    }
+    SUCCESS
+  }
+}
@@ -108,6 +108,20 @@ namespace ParserTests {
     });
   }
 
+  TEST(bitwise_binops_bind_tighter_than_comparisons) {
+    return expParseTreeShouldBe("1 | 2 & 3 << 4 == 5", {
+      "BINOP_EXP",
+      "    BINOP_EXP",
+      "        INT_LIT",
+      "        BINOP_EXP",
+      "            INT_LIT",
+      "            BINOP_EXP",
+      "                INT_LIT",
+      "                INT_LIT",
+      "    INT_LIT",
+    });
+  }
+
   TEST(block_expression) {
     return expParseTreeShouldBe("{ let x = 10; x; }", {
       "BLOCK",
@@ -194,4 +208,22 @@ namespace ParserTests {
     });
   }
 
+  TEST(attributes) {
+    const char* text = "#[soa] #[align(16)] struct S { x: i32 }";
+    LocationTable LT(text);
+    auto tokens = Lexer(text, &LT).run();
+    Parser parser(tokens);
+    Decl* parsed = parser.decl();
+    if (parsed == nullptr) return parser.getError().render(text, LT);
+    if (!StructDecl::downcast(parsed)) return "Expected a struct";
+    auto attrs = parsed->getAttributes();
+    if (attrs.size() != 2) return "Expected two attributes";
+    if (!parsed->hasAttribute("soa")) return "Missing soa attribute";
+    auto align = parsed->findAttribute("align");
+    if (align == nullptr || align->getArgs().size() != 1
+        || align->getArgs()[0] != "16")
+      return "Wrong align attribute";
+    SUCCESS
+  }
+
 }
\ No newline at end of file
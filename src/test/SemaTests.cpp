@@ -143,10 +143,105 @@ namespace SemaTests {
     );
   }
 
+  TEST(calls_to_later_functions_returning_structs) {
+    return declShouldPass(
+      "module Testing {"
+      "  struct P { x: i32 }"
+      "  func f(): i32 = g().x;"
+      "  func g(): P = P{1};"
+      "}"
+    );
+  }
+
   TEST(indexing) {
     return expShouldHaveType("(\"hello\")[0]", "&i8");
   }
 
+  TEST(bit_manipulation) {
+    TRY(expShouldHaveType("(1: i64) << 3 ^ 5", "i64"))
+    TRY(expShouldHaveType("popcount(7) & 1", "integer"))
+    TRY(expShouldHaveType("rotl(1: usize, 3)", "usize"))
+    TRY(expShouldFailSema("1.5 | 2"))
+    TRY(expShouldFailSema("clz(true)"))
+    TRY(expShouldFailSema("rotr(1)"))
+    SUCCESS
+  }
+
+  TEST(math_builtins) {
+    TRY(expShouldHaveType("sqrt(2.0)", "decimal"))
+    TRY(expShouldHaveType("fma(1.0, 2.0, 3.0: f32)", "f32"))
+    TRY(expShouldHaveType("min(abs(-1.5), floor(2.5: f64))", "f64"))
+    TRY(expShouldFailSema("sqrt(2: i32)"))
+    TRY(expShouldFailSema("max(1.0: f32, 2.0: f64)"))
+    TRY(expShouldFailSema("fma(1.0, 2.0)"))
+    SUCCESS
+  }
+
+  TEST(allocation_builtins) {
+    TRY(expShouldHaveType("alloc(16)", "uniq &i8"))
+    TRY(expShouldHaveType("realloc(alloc(16), 32)", "uniq &i8"))
+    TRY(expShouldHaveType("free(alloc(16))", "unit"))
+    TRY(expShouldFailSema("alloc(1.5)"))
+    TRY(expShouldFailSema("free(16)"))
+    TRY(declShouldPass(
+      "extern func free(ptr: uniq &i8, size: i64): unit;\n"
+      "func f(): unit = free(alloc(16), 16);"))
+    SUCCESS
+  }
+
+  TEST(sorting_builtins) {
+    TRY(declShouldPass(
+      "module M {\n"
+      "  extern func ints(n: usize): &i32;\n"
+      "  extern func floats(n: usize): &f64;\n"
+      "  func f(n: usize): usize = {\n"
+      "    let a = ints(n); sort(a, n); radix_sort(a, n);\n"
+      "    sort(floats(n), n);\n"
+      "    lower_bound(a, n, 7)\n"
+      "  };\n"
+      "}"))
+    TRY(declShouldPass(
+      "module M {\n"
+      "  struct P { k: i64, v: i64 }\n"
+      "  extern func ps(n: usize): &P;\n"
+      "  func byKey(a: &P, b: &P): bool = a->k < b->k;\n"
+      "  func f(n: usize): unit = sort_by(ps(n), n, byKey);\n"
+      "}"))
+    TRY(expShouldFailSema("sort(\"hi\", true)"))
+    TRY(declShouldFail(
+      "module M {\n"
+      "  extern func ints(n: i64): &i32;\n"
+      "  func f(n: i64): unit = sort(ints(n), n);\n"
+      "}"))
+    TRY(declShouldFail(
+      "module M {\n"
+      "  extern func floats(n: usize): &f64;\n"
+      "  func f(n: usize): unit = radix_sort(floats(n), n);\n"
+      "}"))
+    TRY(declShouldFail(
+      "module M {\n"
+      "  extern func ints(n: usize): &i32;\n"
+      "  func less(a: &i64, b: &i64): bool = a! < b!;\n"
+      "  func f(n: usize): unit = sort_by(ints(n), n, less);\n"
+      "}"))
+    TRY(declShouldFail(
+      "module M {\n"
+      "  extern func ints(n: usize): &i32;\n"
+      "  func f(n: usize): unit = { let c = 0; sort_by(ints(n), n, c); };\n"
+      "}"))
+    SUCCESS
+  }
+
+  TEST(pointer_width_indices) {
+    TRY(expShouldHaveType("1: isize", "isize"))
+    TRY(expShouldHaveType("(1: usize) / 2", "usize"))
+    TRY(expShouldHaveType("{ let i = 0; (\"hi\")[i]; i; }", "index"))
+    TRY(expShouldHaveType("{ let i = 0; (\"hi\")[i]; i + 1: i32; }", "i32"))
+    TRY(expShouldFailSema("(\"hi\")[1.5]"))
+    TRY(expShouldFailSema("(1: isize) + (1: usize)"))
+    SUCCESS
+  }
+
   TEST(structs_and_field_access) {
     return declShouldPass(
       "module Testing {"
@@ -169,4 +264,154 @@ namespace SemaTests {
     );
   }
 
-}
\ No newline at end of file
+  TEST(soa_attribute) {
+    TRY(declShouldPass(
+      "module Testing {"
+      "  #[soa] struct Particle { x: i32, y: i32 }"
+      "  func f(ps: &Particle): i32 = ps[0]->x;"
+      "}"
+    ))
+    TRY(declShouldFail("#[soa] func f(): unit = {};"))
+    TRY(declShouldFail("#[soa(1)] struct S { x: i32 }"))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  #[soa] struct A { x: i32 }"
+      "  #[soa] struct B { a: A }"
+      "}"
+    ))
+    SUCCESS
+  }
+
+  TEST(soa_allocation_builtins) {
+    TRY(declShouldPass(
+      "module Testing {"
+      "  #[soa] struct P { x: i32, y: i32 }"
+      "  func f(n: usize): unit = {"
+      "    let ps: uniq &P = soa_alloc(n);"
+      "    soa_free(ps);"
+      "  };"
+      "}"
+    ))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  struct P { x: i32, y: i32 }"
+      "  func f(n: usize): uniq &P = soa_alloc(n);"
+      "}"
+    ))
+    TRY(declShouldFail("func f(n: usize): unit = soa_free(soa_alloc(n));"))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  #[soa] struct P { x: i32 }"
+      "  extern func g(ps: &P): unit;"
+      "}"
+    ))
+    SUCCESS
+  }
+
+  TEST(hint_builtins) {
+    TRY(expShouldHaveType("likely(1 < 2)", "bool"))
+    TRY(expShouldHaveType("unlikely(false)", "bool"))
+    TRY(expShouldHaveType("{ let x = 0; prefetch(&x, 0, 3) }", "unit"))
+    TRY(expShouldFailSema("likely(1)"))
+    TRY(expShouldFailSema("likely(true, false)"))
+    TRY(expShouldFailSema("{ let x = 0; prefetch(&x, 2, 3) }"))
+    TRY(expShouldFailSema("{ let x = 0; let r = 1; prefetch(&x, 0, r) }"))
+    TRY(declShouldPass("#[cold] func f(): unit = {};"))
+    SUCCESS
+  }
+
+  TEST(target_clones_attribute) {
+    TRY(declShouldPass(
+      "#[target_clones(\"avx2\", \"sse4.2\", \"default\")]"
+      "func f(x: i32): i32 = x;"))
+    TRY(declShouldFail("#[target_clones(\"avx2\")] func f(): unit = {};"))
+    TRY(declShouldFail(
+      "#[target_clones(\"neon\", \"default\")] func f(): unit = {};"))
+    TRY(declShouldFail(
+      "#[target_clones(\"avx2\", \"avx2\", \"default\")]"
+      "func f(): unit = {};"))
+    TRY(declShouldFail(
+      "#[target_clones(\"avx2\", \"default\")] extern func f(): unit;"))
+    SUCCESS
+  }
+
+  TEST(async_functions) {
+    TRY(declShouldPass(
+      "module Testing {"
+      "  extern async func async_sleep(ms: i64): i64;"
+      "  async func twice(ms: i64): i64 = {"
+      "    let a = await async_sleep(ms);"
+      "    a + await async_sleep(ms);"
+      "  };"
+      "  func main(): i64 = block_on(twice(10));"
+      "}"
+    ))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  async func f(): i32 = 1;"
+      "  func g(): i32 = await f();"
+      "}"
+    ))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  async func f(): i32 = 1;"
+      "  async func g(): i32 = block_on(f());"
+      "}"
+    ))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  async func f(): i32 = 1;"
+      "  func g(): i32 = f();"
+      "}"
+    ))
+    SUCCESS
+  }
+
+  TEST(constants) {
+    TRY(declShouldPass(
+      "module Testing {"
+      "  struct Pt { x: i32, y: i32 }"
+      "  const N: i32 = 4 * 4;"
+      "  const ORIGIN: Pt = Pt{ N - 16, 0 };"
+      "  const TABLE: &i64 = [1, 2, 4];"
+      "  func f(N: i32): i32 = N + ORIGIN.x;"
+      "  func g(i: i64): i64 = TABLE[i]!;"
+      "}"
+    ))
+    TRY(declShouldFail("const U: uniq &i8 = \"x\";"))
+    TRY(declShouldFail("func f(): &i32 = [1, 2];"))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  extern func g(): i32;"
+      "  const C: i32 = g();"
+      "}"
+    ))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  const A: i32 = B;"
+      "  const B: i32 = A + 1;"
+      "}"
+    ))
+    TRY(declShouldPass(
+      "module Testing {"
+      "  const M: i32 = -2147483647 - 1;"
+      "  const Q: i32 = M / (1 << 33);"
+      "  const R: usize = 7 % 3;"
+      "}"
+    ))
+    TRY(declShouldFail("const X: i32 = 1 / 0;"))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  const Z: i64 = 3 - 3;"
+      "  const TABLE: &i64 = [1, 2 % Z];"
+      "}"
+    ))
+    TRY(declShouldFail(
+      "module Testing {"
+      "  const M: i32 = -2147483647 - 1;"
+      "  const X: i32 = M / -1;"
+      "}"
+    ))
+    SUCCESS
+  }
+}
@@ -0,0 +1,145 @@
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include "driver/IndexJob.hpp"
+#include "test.hpp"
+
+namespace SymbolIndexTests {
+  TESTGROUP("Symbol Index Tests")
+
+  //==========================================================================//
+
+  /// Creates a new directory in the system's temporary directory.
+  std::string makeTempDir() {
+    llvm::SmallString<128> model, dir;
+    llvm::sys::path::system_temp_directory(true, model);
+    llvm::sys::path::append(model, "miscr-index");
+    llvm::sys::fs::createUniqueDirectory(model, dir);
+    return dir.str().str();
+  }
+
+  /// Writes @p text to file @p name in directory @p dir and returns its path.
+  std::string writeFile(llvm::StringRef dir, llvm::StringRef name,
+                        llvm::StringRef text) {
+    llvm::SmallString<128> path(dir);
+    llvm::sys::path::append(path, name);
+    std::error_code EC;
+    llvm::raw_fd_ostream os(path, EC);
+    os << text;
+    return path.str().str();
+  }
+
+  /// Updates the index in @p dir with @p files and, if @p query is nonempty,
+  /// prints the query results into @p out.
+  std::optional<std::string> runIndex(llvm::StringRef dir,
+      std::vector<std::string> files, const char* query, std::string& out) {
+    IndexJob job;
+    job.indexFile = (dir + "/test.idx").str();
+    job.inFiles = std::move(files);
+    job.query = query;
+    out.clear();
+    std::string errs;
+    llvm::raw_string_ostream outStream(out), errStream(errs);
+    if (job.run(outStream, errStream) != 0) return errStream.str();
+    outStream.flush();
+    SUCCESS
+  }
+
+  bool contains(const std::string& s, const std::string& part)
+    { return s.find(part) != std::string::npos; }
+
+  const char* libText =
+    "module M {\n"
+    "  struct P { x: i32, y: i32 }\n"
+    "  func get(p: &P): i32 = p->x;\n"
+    "}";
+
+  const char* mainText =
+    "module M {\n"
+    "  struct P { x: i32, y: i32 }\n"
+    "  extern func get(p: &P): i32;\n"
+    "}\n"
+    "func main(): i32 = { let p = M::P{ 1, 2 }; M::get(&p) + p.x };";
+
+  //==========================================================================//
+
+  TEST(finds_declarations_and_references_across_files) {
+    std::string dir = makeTempDir();
+    std::string lib = writeFile(dir, "lib.miscr", libText);
+    std::string main = writeFile(dir, "main.miscr", mainText);
+    std::string out;
+    TRY(runIndex(dir, { lib, main }, "M::get", out))
+    ASSERT(out == lib + ":3:8: func global::M::get\n"
+                + main + ":3:15: extern func global::M::get\n"
+                + main + ":5:44: call global::M::get\n", out)
+    TRY(runIndex(dir, {}, "global::M::P.x", out))
+    ASSERT(out == lib + ":2:14: field global::M::P.x\n"
+                + main + ":2:14: field global::M::P.x\n"
+                + lib + ":3:29: field access global::M::P.x\n"
+                + main + ":5:59: field access global::M::P.x\n", out)
+    TRY(runIndex(dir, {}, "M::P*", out))
+    ASSERT(contains(out, main + ":5:30: constructor global::M::P\n")
+      && contains(out, lib + ":3:16: type global::M::P\n")
+      && contains(out, "global::M::P.y\n"), out)
+    SUCCESS
+  }
+
+  TEST(updates_changed_and_deleted_files) {
+    std::string dir = makeTempDir();
+    std::string lib = writeFile(dir, "lib.miscr", libText);
+    std::string main = writeFile(dir, "main.miscr", mainText);
+    std::string out;
+    TRY(runIndex(dir, { lib, main }, "", out))
+
+    // an index that failed to update keeps the old entries of the file
+    writeFile(dir, "main.miscr", "func main(): i32 = M::get(;");
+    ASSERT(runIndex(dir, { main }, "", out).has_value(),
+      "Expected a parse error")
+    TRY(runIndex(dir, {}, "M::get", out))
+    ASSERT(contains(out, main + ":5:44: call"), out)
+
+    writeFile(dir, "main.miscr", "func main(): i32 = 0;");
+    TRY(runIndex(dir, { main }, "M::get", out))
+    ASSERT(out == lib + ":3:8: func global::M::get\n", out)
+    llvm::sys::fs::remove(lib);
+    TRY(runIndex(dir, {}, "*", out))
+    ASSERT(out == main + ":1:6: func global::main\n", out)
+    SUCCESS
+  }
+
+  TEST(skips_files_that_are_up_to_date) {
+    std::string dir = makeTempDir();
+    std::string lib = writeFile(dir, "lib.miscr", libText);
+    std::string out;
+    TRY(runIndex(dir, { lib }, "", out))
+    std::string err;
+    auto index = SymbolIndex::open(dir + "/test.idx", err);
+    if (index == nullptr) return err;
+    SymbolIndex::Builder builder;
+    builder.load(*index);
+    auto stamp = index->getFileStamp(0);
+    ASSERT(index->getFilePath(0) == lib
+      && builder.isUpToDate(lib, stamp.first, stamp.second)
+      && !builder.isUpToDate(lib, stamp.first, stamp.second + 1),
+      "Expected the stamp of lib.miscr")
+    ASSERT(index->find("global::M::get") && !index->find("global::M::g")
+      && index->findPrefix("global::M::P").second
+         - index->findPrefix("global::M::P").first == 3,
+      "Expected P, P.x, and P.y")
+    SUCCESS
+  }
+
+  TEST(rejects_malformed_indexes) {
+    std::string dir = makeTempDir();
+    std::string err;
+    ASSERT(!SymbolIndex::open(writeFile(dir, "a.idx", "MiSCRIdx"), err),
+      "Expected a truncated index to be rejected")
+    ASSERT(contains(err, "not a MiSCR symbol index"), err)
+    std::string lib = writeFile(dir, "lib.miscr", libText);
+    writeFile(dir, "test.idx", std::string(64, '\0'));
+    std::string out;
+    TRY(runIndex(dir, { lib }, "M::get", out))
+    ASSERT(out == lib + ":3:8: func global::M::get\n",
+      "Expected the index to be rebuilt\n" + out)
+    SUCCESS
+  }
+}
@@ -5,6 +5,9 @@
 #include <functional>
 #include <optional>
 #include <vector>
+// All test files are compiled as one translation unit, so headers that
+// define identifiers clashing with the macros below must come first.
+#include <llvm/Support/Threading.h>  // enumerator SUCCESS
 
 #define TESTGROUP(name) UnitTestGroup testGroup(name);
 #define TEST(name) std::optional<std::string> name();\